@@ -0,0 +1,115 @@
+#!/bin/bash
+# Runs every scene in a list file (same format as autorun_list.sh) at the same
+# time as far as the machine allows. Every job is pinned to its own disjoint
+# set of cores, sized by the face count of its mesh, and writes its own
+# performance log; all logs are merged into one CSV at the end.
+#
+# Usage: ./autorun_parallel.sh <list.txt> [total cores] [output.csv]
+
+list=$1
+dir=`dirname $1`
+totalCores=${2:-`nproc`}
+combined=${3:-"${dir}/performance_all.csv"}
+logDir="${dir}/batch_logs"
+
+# One thread per this many faces, capped so that a single huge scene does not
+# take the whole machine; small scenes run single-threaded, which is the most
+# efficient use of a core
+facesPerThread=4000
+maxThreadsPerJob=16
+
+mkdir -p "${logDir}"
+echo "Using base directory ${dir}, ${totalCores} cores"
+
+# Scenes whose mesh is not a file (e.g. repel_implicit, which meshes an implicit
+# surface at startup) cannot be sized up front; they get the largest job size
+unknownFaces=$(( facesPerThread * maxThreadsPerJob ))
+
+meshFaces() {
+	local scene=$1
+	local sceneDir=`dirname ${scene}`
+	local mesh=`awk '$1 == "repel_mesh" { print $2; exit }' ${scene}`
+	local path="${sceneDir}/${mesh}"
+	if [[ -z ${mesh} || ! -f ${path} ]]; then
+		echo "No mesh file for ${scene}; sizing it as ${unknownFaces} faces" >&2
+		echo ${unknownFaces}
+	elif [[ ${path} == *.rsm ]]; then
+		# nFaces is the uint64 at byte offset 24 of the binary mesh header
+		od -A n -t u8 -j 24 -N 8 ${path} | tr -d ' '
+	else
+		grep -c '^f ' ${path}
+	fi
+}
+
+# Size every job, then sort by decreasing size, so that the big jobs start
+# first and the small ones fill in the gaps
+jobs=()
+for i in `cat ${list}`
+do
+	fname="${dir}/${i}"
+	faces=`meshFaces ${fname}`
+	threads=$(( (faces + facesPerThread - 1) / facesPerThread ))
+	(( threads < 1 )) && threads=1
+	(( threads > maxThreadsPerJob )) && threads=${maxThreadsPerJob}
+	(( threads > totalCores )) && threads=${totalCores}
+	jobs+=("${faces} ${threads} ${fname}")
+done
+IFS=$'\n' jobs=(`printf '%s\n' "${jobs[@]}" | sort -k1,1 -n -r`)
+unset IFS
+
+declare -A freeCore
+for (( c = 0; c < totalCores; c++ )); do freeCore[$c]=1; done
+declare -A jobCores
+
+# Takes the lowest-numbered free cores, so that jobs stay on neighbouring cores
+allocateCores() {
+	local n=$1
+	local taken=()
+	for (( c = 0; c < totalCores && ${#taken[@]} < n; c++ )); do
+		if [[ ${freeCore[$c]} == 1 ]]; then
+			taken+=($c)
+		fi
+	done
+	if (( ${#taken[@]} < n )); then
+		return 1
+	fi
+	for c in ${taken[@]}; do freeCore[$c]=0; done
+	allocated=`IFS=,; echo "${taken[*]}"`
+	return 0
+}
+
+releaseFinished() {
+	for pid in ${!jobCores[@]}; do
+		if ! kill -0 ${pid} 2> /dev/null; then
+			for c in ${jobCores[$pid]//,/ }; do freeCore[$c]=1; done
+			unset jobCores[$pid]
+		fi
+	done
+}
+
+for job in "${jobs[@]}"
+do
+	read faces threads fname <<< "${job}"
+	until allocateCores ${threads}; do
+		wait -n
+		releaseFinished
+	done
+
+	name=`echo ${fname#${dir}/} | tr '/' '_'`
+	log="${logDir}/${name%.txt}.csv"
+	echo "Running ${fname} (${faces} faces) on cores ${allocated}..."
+	OMP_PROC_BIND=close OMP_PLACES=cores taskset -c ${allocated} \
+		./build/bin/rsurfaces ${fname} --autolog --threads ${threads} --log ${log} > "${log%.csv}.out" 2>&1 &
+	jobCores[$!]=${allocated}
+done
+wait
+
+echo "scene, threads, iteration, time, energy, faces" > ${combined}
+for job in "${jobs[@]}"
+do
+	read faces threads fname <<< "${job}"
+	name=`echo ${fname#${dir}/} | tr '/' '_'`
+	log="${logDir}/${name%.txt}.csv"
+	sed "s|^|${fname#${dir}/}, ${threads}, |" ${log} >> ${combined}
+done
+echo "Wrote combined performance log to ${combined}"
@@ -16,12 +16,18 @@
 #include "optimized_bct.h"
 //#include "optimized_cluster_tree.h"
 #include "sobolev/hs_operators.h"
+#include "geometry_cache.h"
+
+#include <numeric>
 
 namespace rsurfaces
 {
 
+    // If previous is given, its clustering is repaired instead of clustering from scratch;
+    // previous_primitive then maps each face to its index in previous, or to -1 for new faces.
     template <typename MeshPtrT>
-    inline OptimizedClusterTree * CreateOptimizedBVH_Hybrid(MeshPtrT &mesh, GeomPtr &geom, BVHSettings settings = BVHDefaultSettings)
+    inline OptimizedClusterTree * CreateOptimizedBVH_Hybrid(MeshPtrT &mesh, GeomPtr &geom, BVHSettings settings = BVHDefaultSettings,
+                                                           const OptimizedClusterTree *previous = nullptr, const mint *previous_primitive = nullptr)
     {
         geom->requireFaceAreas();
         geom->requireFaceNormals();
@@ -120,6 +126,26 @@ namespace rsurfaces
         
         MKLSparseMatrix DiffOp = MKLSparseMatrix( DiffOp0.rows(), DiffOp0.cols(), DiffOp0.outerIndexPtr(), DiffOp0.innerIndexPtr(), DiffOp0.valuePtr() ); // This is a sparse matrix in CSR format.
 
+        if (previous)
+        {
+            return new OptimizedClusterTree(
+                *previous,
+                previous_primitive,
+                &P_coords[0],
+                primitive_count,
+                dim,
+                &P_hull_coords[0],
+                primitive_length,
+                &P_near[0],
+                near_dim,
+                &P_far[0],
+                far_dim,
+                DiffOp,
+                AvOp,
+                settings
+            );
+        }
+
         // create a cluster tree
         return new OptimizedClusterTree(
             &P_coords[0],      // coordinates used for clustering
@@ -373,8 +399,49 @@ namespace rsurfaces
         }
     } // UpdateOptimizedBVH
 
+    // Same as above, but reads the face data from a cache that has been updated to the current
+    // positions; the cache must require FaceAreas, FaceNormals and FaceBarycenters.
+    inline void UpdateOptimizedBVH(OptimizedClusterTree * bvh, const GeometryCache &cache)
+    {
+        mint nFaces = cache.FaceCount();
+        mint near_dim = bvh->near_dim;
+        mint far_dim = bvh->far_dim;
+
+        mreal const *restrict const A = cache.FaceArea();
+        mreal const *restrict const X = cache.FaceBarycenterX();
+        mreal const *restrict const Y = cache.FaceBarycenterY();
+        mreal const *restrict const Z = cache.FaceBarycenterZ();
+        mreal const *restrict const N1 = cache.FaceNormalX();
+        mreal const *restrict const N2 = cache.FaceNormalY();
+        mreal const *restrict const N3 = cache.FaceNormalZ();
+
+        std::vector<mreal> P_near_(near_dim * nFaces);
+        std::vector<mreal> P_far_(far_dim * nFaces);
+
+        // Both arrays hold area and barycenter first, then either the normal (dim 7) or the
+        // upper triangle of the projector n n^T (dim 10).
+        #pragma omp parallel for
+        for (mint i = 0; i < nFaces; ++i)
+        {
+            mreal n1 = N1[i];
+            mreal n2 = N2[i];
+            mreal n3 = N3[i];
+            mreal data7[7] = {A[i], X[i], Y[i], Z[i], n1, n2, n3};
+            mreal data10[10] = {A[i], X[i], Y[i], Z[i], n1 * n1, n1 * n2, n1 * n3, n2 * n2, n2 * n3, n3 * n3};
+
+            mreal const *near_src = (near_dim == 7) ? data7 : data10;
+            mreal const *far_src = (far_dim == 7) ? data7 : data10;
+            std::copy(near_src, near_src + near_dim, &P_near_[near_dim * i]);
+            std::copy(far_src, far_src + far_dim, &P_far_[far_dim * i]);
+        }
+
+        bvh->SemiStaticUpdate( &P_near_[0], &P_far_[0] );
+    } // UpdateOptimizedBVH
+
+    // Same repair arguments as CreateOptimizedBVH_Hybrid.
     template <typename MeshPtrT>
-    inline OptimizedClusterTree * CreateOptimizedBVH_Projectors(MeshPtrT &mesh, GeomPtr &geom, BVHSettings settings = BVHDefaultSettings)
+    inline OptimizedClusterTree * CreateOptimizedBVH_Projectors(MeshPtrT &mesh, GeomPtr &geom, BVHSettings settings = BVHDefaultSettings,
+                                                                const OptimizedClusterTree *previous = nullptr, const mint *previous_primitive = nullptr)
     {
         geom->requireFaceAreas();
         geom->requireFaceNormals();
@@ -469,6 +536,26 @@ namespace rsurfaces
         
         MKLSparseMatrix DiffOp = MKLSparseMatrix( DiffOp0.rows(), DiffOp0.cols(), DiffOp0.outerIndexPtr(), DiffOp0.innerIndexPtr(), DiffOp0.valuePtr() ); // This is a sparse matrix in CSR format.
 
+        if (previous)
+        {
+            return new OptimizedClusterTree(
+                *previous,
+                previous_primitive,
+                &P_coords[0],
+                primitive_count,
+                dim,
+                &P_hull_coords[0],
+                primitive_length,
+                &P_near[0],
+                near_dim,
+                &P_far[0],
+                far_dim,
+                DiffOp,
+                AvOp,
+                settings
+            );
+        }
+
         // create a cluster tree
         return new OptimizedClusterTree(
             &P_coords[0],      // coordinates used for clustering
@@ -498,6 +585,181 @@ namespace rsurfaces
         return CreateOptimizedBVH_Hybrid(mesh, geom, settings);
 #endif
     }
+
+    // Builds the tree for a mesh that differs from the one of previous only by local remeshing;
+    // previous_primitive maps each face to its index in the previous mesh, or to -1 for new faces.
+    template <typename MeshPtrT>
+    inline OptimizedClusterTree * RepairOptimizedBVH(MeshPtrT &mesh, GeomPtr &geom, const OptimizedClusterTree *previous, const mint *previous_primitive, BVHSettings settings = BVHDefaultSettings)
+    {
+#ifdef USE_NORMALS_ONLY
+        return CreateOptimizedBVH_Normals(mesh, geom, settings);
+#else
+        return CreateOptimizedBVH_Hybrid(mesh, geom, settings, previous, previous_primitive);
+#endif
+    }
+
+    template <typename MeshPtrT>
+    inline OptimizedClusterTree * RepairOptimizedBVH_Projectors(MeshPtrT &mesh, GeomPtr &geom, const OptimizedClusterTree *previous, const mint *previous_primitive, BVHSettings settings = BVHDefaultSettings)
+    {
+        return CreateOptimizedBVH_Projectors(mesh, geom, settings, previous, previous_primitive);
+    }
+
+    // Tracks how the faces of a mesh relate to those of the tree an energy built in its last
+    // Update, so that the next Update can repair that tree instead of clustering from scratch.
+    // Without a remeshing in between, the connectivity is unchanged and faces map one to one.
+    class FaceOriginTracker
+    {
+    public:
+        // Kept faces never change their leaf, so the clustering degrades while the surface moves;
+        // after this many consecutive repairs, the tree is clustered from scratch again.
+        static const int max_repairs = 16;
+
+        // Takes the face origins of a remeshing; several remeshings between two Updates compose.
+        void Remeshed(const std::vector<mint> &origins)
+        {
+            if (remeshed)
+            {
+                std::vector<mint> composed(origins.size());
+                for (size_t i = 0; i < origins.size(); ++i)
+                {
+                    mint j = origins[i];
+                    composed[i] = (j >= 0 && j < static_cast<mint>(map.size())) ? map[j] : -1;
+                }
+                map.swap(composed);
+            }
+            else
+            {
+                map = origins;
+            }
+            remeshed = true;
+        }
+
+        // Returns for each of the face_count current faces its index in previous (or -1 for new
+        // faces), or nullptr if previous should not be repaired. Must be followed by Built.
+        const mint *Match(const OptimizedClusterTree *previous, mint face_count)
+        {
+            if (!previous || face_count == 0 || repairs >= max_repairs)
+            {
+                return nullptr;
+            }
+            if (remeshed)
+            {
+                return (static_cast<mint>(map.size()) == face_count) ? &map[0] : nullptr;
+            }
+            if (previous->primitive_count != face_count)
+            {
+                return nullptr;
+            }
+            map.resize(face_count);
+            std::iota(map.begin(), map.end(), 0);
+            return &map[0];
+        }
+
+        // Records whether the tree built in the current Update was repaired.
+        void Built(bool repaired)
+        {
+            repairs = repaired ? repairs + 1 : 0;
+            remeshed = false;
+        }
+
+    private:
+        std::vector<mint> map;
+        bool remeshed = false;
+        int repairs = 0;
+    };
+    
+    // Writes (charge, position) of every vertex, with unit charges, in the layout of a vertex point cloud tree.
+    template <typename MeshPtrT>
+    inline void GetVertexChargeData(MeshPtrT &mesh, GeomPtr &geom, mreal * P_data, mreal * P_coords = nullptr)
+    {
+        geom->requireVertexPositions();
+        
+        mint vertex_count = mesh->nVertices();
+        
+        #pragma omp parallel for
+        for( mint i = 0; i < vertex_count; ++i )
+        {
+            Vector3 p = geom->inputVertexPositions[i];
+            P_data[4 * i + 0] = 1.;
+            P_data[4 * i + 1] = p.x;
+            P_data[4 * i + 2] = p.y;
+            P_data[4 * i + 3] = p.z;
+            if( P_coords )
+            {
+                P_coords[3 * i + 0] = p.x;
+                P_coords[3 * i + 1] = p.y;
+                P_coords[3 * i + 2] = p.z;
+            }
+        }
+    } // GetVertexChargeData
+
+    // Creates a cluster tree whose primitives are the vertices of the mesh, each carrying a unit charge.
+    // Near and far field data are (charge, position), so that clusters carry their total charge and center of charge.
+    template <typename MeshPtrT>
+    inline OptimizedClusterTree * CreateOptimizedBVH_Vertices(MeshPtrT &mesh, GeomPtr &geom, BVHSettings settings = BVHDefaultSettings)
+    {
+        mint primitive_count = mesh->nVertices();
+        mint dim = 3;
+        mint data_dim = 1 + dim;
+        
+        std::vector<mreal> P_coords(dim * primitive_count);
+        std::vector<mreal> P_data(data_dim * primitive_count);
+        
+        GetVertexChargeData(mesh, geom, &P_data[0], &P_coords[0]);
+        
+        mint * idx = nullptr;
+        mint * idxdim = nullptr;
+        mreal * ones = nullptr;
+        mreal * zeroes = nullptr;
+        
+        safe_iota( idx, dim * primitive_count + 1);
+        safe_alloc( idxdim, dim * primitive_count);
+        safe_alloc( ones, primitive_count + 1, 1.);
+        safe_alloc( zeroes, dim * primitive_count, 0.);
+        
+        #pragma omp parallel for
+        for( mint i = 0; i < primitive_count; ++i)
+        {
+            for( mint k = 0; k < dim; ++k )
+            {
+                idxdim[ dim * i + k] = i;
+            }
+        }
+        
+        MKLSparseMatrix AvOp = MKLSparseMatrix( primitive_count, primitive_count, idx, idx, ones ); // identity matrix
+        MKLSparseMatrix DiffOp = MKLSparseMatrix( dim * primitive_count, primitive_count, idx, idxdim, zeroes ); // zero matrix
+        
+        OptimizedClusterTree * bvh = new OptimizedClusterTree(
+            &P_coords[0],      // coordinates used for clustering
+            primitive_count,   // number of primitives
+            dim,               // dimension of ambient space
+            &P_coords[0],      // a vertex is its own convex hull
+            1,                 // number of points in the convex hull of each primitive
+            &P_data[0],        // charge and position of the vertex
+            data_dim,          // number of dofs of P_near per vertex
+            &P_data[0],        // charge and position of the vertex
+            data_dim,          // number of dofs of P_far per vertex
+            idx,               // some ordering of vertices
+            DiffOp,            // the first-order differential operator belonging to the hi order term of the metric
+            AvOp,              // the zeroth-order differential operator belonging to the lo order term of the metric
+            settings
+        );
+        
+        safe_free(idx);
+        safe_free(idxdim);
+        safe_free(ones);
+        safe_free(zeroes);
+        
+        return bvh;
+    } // CreateOptimizedBVH_Vertices
+    
+    template <typename MeshPtrT>
+    inline void UpdateOptimizedBVH_Vertices(OptimizedClusterTree * bvh, MeshPtrT &mesh, GeomPtr &geom)
+    {
+        std::vector<mreal> P_data(4 * mesh->nVertices());
+        GetVertexChargeData(mesh, geom, &P_data[0]);
+        bvh->SemiStaticUpdate( &P_data[0], &P_data[0] );
+    } // UpdateOptimizedBVH_Vertices
     
     inline BCTPtr CreateOptimizedBCTFromBVH(OptimizedClusterTree* bvh, double alpha, double beta, double chi, double weight = 1., BCTSettings settings = BCTDefaultSettings)
     {
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "rsurface_types.h"
+
+#include <cstdint>
+#include <ostream>
+
+namespace rsurfaces
+{
+    // Compact binary triangle mesh format (".rsm"). The file is laid out so
+    // that it can be memory-mapped and used without any parsing:
+    //
+    //   BinaryMeshHeader
+    //   double   positions[3 * nVertices]          (x, y, z per vertex)
+    //   uint32_t faces[3 * nFaces]                 (0-indexed triangles)
+    //   double   faceData[faceDataDim * nFaces]    (optional per-face data)
+    //
+    // Every section starts at an 8-byte aligned offset recorded in the header.
+    struct BinaryMeshHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t faceDataDim;
+        uint64_t nVertices;
+        uint64_t nFaces;
+        uint64_t positionsOffset;
+        uint64_t facesOffset;
+        uint64_t faceDataOffset;
+    };
+
+    static const char BINARY_MESH_MAGIC[8] = {'R', 'S', 'U', 'R', 'F', 'M', 'S', 'H'};
+    static const uint32_t BINARY_MESH_VERSION = 1;
+
+    // Returns true if the filename has the binary mesh extension.
+    bool isBinaryMeshFile(std::string const &filename);
+
+    // Read-only memory mapping of a binary mesh file. The arrays returned by
+    // the accessors point directly into the mapped pages, and stay valid for
+    // as long as this object is alive.
+    class MappedBinaryMesh
+    {
+    public:
+        MappedBinaryMesh(std::string filename);
+        ~MappedBinaryMesh();
+
+        MappedBinaryMesh(const MappedBinaryMesh &) = delete;
+        MappedBinaryMesh &operator=(const MappedBinaryMesh &) = delete;
+
+        inline size_t nVertices() const { return header->nVertices; }
+        inline size_t nFaces() const { return header->nFaces; }
+        inline size_t faceDataDim() const { return header->faceDataDim; }
+
+        inline const double *positions() const
+        {
+            return reinterpret_cast<const double *>(bytes + header->positionsOffset);
+        }
+
+        inline const uint32_t *faces() const
+        {
+            return reinterpret_cast<const uint32_t *>(bytes + header->facesOffset);
+        }
+
+        // Returns 0 if the file has no per-face data.
+        inline const double *faceData() const
+        {
+            if (header->faceDataDim == 0)
+            {
+                return 0;
+            }
+            return reinterpret_cast<const double *>(bytes + header->faceDataOffset);
+        }
+
+        // Tells the kernel that the positions of vertices [begin, end) will not be
+        // needed again, so that their pages can be dropped from memory.
+        void ReleasePositions(size_t begin, size_t end) const;
+
+        // Builds the polygon list needed to construct a geometry-central mesh.
+        std::vector<std::vector<size_t>> FaceVertexList() const;
+
+        // Signed volume enclosed by the triangles, computed straight from the mapped arrays.
+        double TotalVolume() const;
+
+    private:
+        std::string filename;
+        int fd;
+        size_t fileSize;
+        const char *bytes;
+        const BinaryMeshHeader *header;
+    };
+
+    std::tuple<MeshUPtr, GeomUPtr> readBinaryMesh(std::string filename);
+    std::tuple<std::unique_ptr<surface::SurfaceMesh>, GeomUPtr> readBinaryNonManifoldMesh(std::string filename);
+
+    // Writes a triangle mesh, given as raw arrays, in the binary format to the given stream.
+    // positions holds 3 doubles per vertex, faces holds 3 vertex indices per face.
+    void writeBinaryMesh(std::ostream &out, const double *positions, size_t nVertices, const uint32_t *faces, size_t nFaces,
+                         const double *faceData = 0, size_t faceDataDim = 0);
+
+    // Writes a triangle mesh in the binary format. If faceData is given, it must
+    // hold faceDataDim values per face, in face order. Throws if the file could
+    // not be written completely.
+    void writeMeshToBinary(surface::SurfaceMesh &mesh, surface::VertexPositionGeometry &geom, std::string output,
+                           const std::vector<double> *faceData = 0, size_t faceDataDim = 0);
+
+    // Converts any mesh format readable by geometry-central into the binary format.
+    void convertMeshToBinary(std::string input, std::string output);
+} // namespace rsurfaces
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "binary_mesh.h"
+
+#include <iostream>
+#include <list>
+
+namespace rsurfaces
+{
+    // Helpers for writing the optimizer state of a flow into a binary
+    // checkpoint stream, and reading it back in the same order.
+    namespace checkpoint
+    {
+        static const char STATE_MAGIC[8] = {'R', 'S', 'U', 'R', 'F', 'C', 'H', 'K'};
+        static const uint32_t STATE_VERSION = 3;
+
+        template <typename T>
+        inline void writeValue(std::ostream &out, const T &value)
+        {
+            out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        inline T readValue(std::istream &in)
+        {
+            T value;
+            in.read(reinterpret_cast<char *>(&value), sizeof(T));
+            if (!in)
+            {
+                throw std::runtime_error("Checkpoint file ended unexpectedly.");
+            }
+            return value;
+        }
+
+        // Number of bytes between the read position and the end of the stream, or -1
+        // if the stream cannot tell.
+        inline int64_t bytesLeft(std::istream &in)
+        {
+            std::streampos pos = in.tellg();
+            if (pos < 0)
+            {
+                return -1;
+            }
+            in.seekg(0, std::ios::end);
+            std::streampos end = in.tellg();
+            in.seekg(pos);
+            return (end < 0) ? -1 : int64_t(end - pos);
+        }
+
+        // Sizes come from the file, so they are checked before anything is allocated for them.
+        inline void checkMatrixSize(std::istream &in, int64_t rows, int64_t cols)
+        {
+            if (rows < 0 || cols < 0)
+            {
+                throw std::runtime_error("Checkpoint file holds a negative matrix size.");
+            }
+            int64_t left = bytesLeft(in);
+            if (left >= 0 && rows > 0 && cols > left / int64_t(sizeof(double)) / rows)
+            {
+                throw std::runtime_error("Checkpoint file holds a matrix larger than the rest of the file.");
+            }
+        }
+
+        // Identifies the arrays of a binary mesh, so that a state file can be checked to
+        // belong to the mesh file next to it.
+        inline uint64_t meshFingerprint(const MappedBinaryMesh &mesh)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            auto mix = [&hash](const char *bytes, size_t size)
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    hash = (hash ^ uint8_t(bytes[i])) * 1099511628211ull;
+                }
+            };
+            uint64_t counts[2] = {mesh.nVertices(), mesh.nFaces()};
+            mix(reinterpret_cast<const char *>(counts), sizeof(counts));
+            mix(reinterpret_cast<const char *>(mesh.positions()), 3 * sizeof(double) * mesh.nVertices());
+            mix(reinterpret_cast<const char *>(mesh.faces()), 3 * sizeof(uint32_t) * mesh.nFaces());
+            return hash;
+        }
+
+        inline void writeMatrix(std::ostream &out, const Eigen::MatrixXd &M)
+        {
+            writeValue<int64_t>(out, M.rows());
+            writeValue<int64_t>(out, M.cols());
+            out.write(reinterpret_cast<const char *>(M.data()), sizeof(double) * M.size());
+        }
+
+        inline void readMatrix(std::istream &in, Eigen::MatrixXd &M)
+        {
+            int64_t rows = readValue<int64_t>(in);
+            int64_t cols = readValue<int64_t>(in);
+            checkMatrixSize(in, rows, cols);
+            M.resize(rows, cols);
+            in.read(reinterpret_cast<char *>(M.data()), sizeof(double) * M.size());
+            if (!in)
+            {
+                throw std::runtime_error("Checkpoint file ended unexpectedly.");
+            }
+        }
+
+        inline void writeVector(std::ostream &out, const Eigen::VectorXd &v)
+        {
+            writeValue<int64_t>(out, v.rows());
+            out.write(reinterpret_cast<const char *>(v.data()), sizeof(double) * v.size());
+        }
+
+        inline void readVector(std::istream &in, Eigen::VectorXd &v)
+        {
+            int64_t rows = readValue<int64_t>(in);
+            checkMatrixSize(in, rows, 1);
+            v.resize(rows);
+            in.read(reinterpret_cast<char *>(v.data()), sizeof(double) * v.size());
+            if (!in)
+            {
+                throw std::runtime_error("Checkpoint file ended unexpectedly.");
+            }
+        }
+
+        inline void writeVectorList(std::ostream &out, const std::list<Eigen::VectorXd> &list)
+        {
+            writeValue<uint64_t>(out, list.size());
+            for (const Eigen::VectorXd &v : list)
+            {
+                writeVector(out, v);
+            }
+        }
+
+        inline void readVectorList(std::istream &in, std::list<Eigen::VectorXd> &list)
+        {
+            uint64_t size = readValue<uint64_t>(in);
+            // Every vector takes at least the bytes of its size
+            int64_t left = bytesLeft(in);
+            if (left >= 0 && size > uint64_t(left) / sizeof(int64_t))
+            {
+                throw std::runtime_error("Checkpoint file holds more vectors than fit in the rest of the file.");
+            }
+            list.clear();
+            for (uint64_t i = 0; i < size; i++)
+            {
+                list.push_back(Eigen::VectorXd());
+                readVector(in, list.back());
+            }
+        }
+
+        inline void writePositions(std::ostream &out, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            Eigen::MatrixXd positions(mesh->nVertices(), 3);
+            for (size_t i = 0; i < mesh->nVertices(); i++)
+            {
+                Vector3 p = geom->inputVertexPositions[i];
+                positions(i, 0) = p.x;
+                positions(i, 1) = p.y;
+                positions(i, 2) = p.z;
+            }
+            writeMatrix(out, positions);
+        }
+
+        inline void readPositions(std::istream &in, const MeshPtr &mesh, const GeomPtr &geom)
+        {
+            Eigen::MatrixXd positions;
+            readMatrix(in, positions);
+            if ((size_t)positions.rows() != mesh->nVertices())
+            {
+                throw std::runtime_error("Checkpoint positions do not match the number of mesh vertices.");
+            }
+            for (size_t i = 0; i < mesh->nVertices(); i++)
+            {
+                geom->inputVertexPositions[i] = Vector3{positions(i, 0), positions(i, 1), positions(i, 2)};
+            }
+            geom->refreshQuantities();
+        }
+    } // namespace checkpoint
+} // namespace rsurfaces
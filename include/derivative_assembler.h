@@ -2,16 +2,22 @@
 
 #include "rsurface_types.h"
 #include "optimized_bct_types.h"
+#include "vertex_positions.h"
 #include <Eigen/Sparse>
 #include <Eigen/Dense>
 
 
 namespace rsurfaces
 {
+    // Copy of the vertex positions; use mapVertexPositions to work on them in place.
     Eigen::Matrix<mreal, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> getVertexPositions( MeshPtr mesh, GeomPtr geom );
     
     Eigen::Matrix<mint,  Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> getPrimitiveIndices( MeshPtr mesh, GeomPtr geom );
     
+    // Adds weight * buffer.row(3 * i + j) to the row of output that belongs to vertex j of triangle i,
+    // where triangles holds F x 3 vertex indices; no sparse matrix is formed.
+    void AssembleDerivative( mint const * triangles, mint primitive_count, Eigen::MatrixXd const & buffer, Eigen::MatrixXd & output, mreal weight = 1. );
+    
     void AssembleDerivative( Eigen::Matrix<mint, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> const & primitives, Eigen::MatrixXd const & buffer, Eigen::MatrixXd & output, mreal weight = 1. );
     
     void AssembleDerivativeFromACNData( MeshPtr mesh, GeomPtr geom, EigenMatrixRM const & P_D_data, Eigen::MatrixXd & output, mreal weight = 1.);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+#include "drag_region.h"
+
+namespace rsurfaces
+{
+    // Interactive dragging of a geodesic neighborhood of a vertex. The neighborhood and its
+    // falloff weights are found once per drag by a bounded Dijkstra search on flat adjacency
+    // arrays; every frame then only rewrites the positions of the region and updates the
+    // whole-mesh quantities of the DragRegion from the faces around it.
+    class DragEditor
+    {
+    public:
+        // Starts a drag at vertex, moving everything within the given geodesic radius.
+        // step is the number of flow steps taken so far. Returns false if the region is empty.
+        bool Begin(MeshPtr const &mesh, GeomPtr const &geom, mint vertex, mreal radius, long step);
+
+        // Moves each vertex of the region by its weight times displacement, relative to
+        // its position when the drag began. If the flow took a step since the last call,
+        // it has moved the whole mesh, so the whole-mesh sums are taken again first.
+        void Apply(GeomPtr const &geom, Vector3 displacement, long step);
+
+        void End();
+
+        // Must be called whenever the connectivity of the mesh changed.
+        void Invalidate();
+
+        inline bool Active() const
+        {
+            return active;
+        }
+
+        inline const DragRegion &Region() const
+        {
+            return region;
+        }
+
+    private:
+        void BuildAdjacency(MeshPtr const &mesh, GeomPtr const &geom);
+        // Sums area, volume and area-weighted centroids over the given F x 3 triangles.
+        void FaceSums(GeomPtr const &geom, const mint *tris, mint count, mreal *sums) const;
+
+        bool active = false;
+        bool adjacency_valid = false;
+        mint vertex_count = 0;
+        mint face_count = 0;
+
+        // F x 3 vertex indices of all faces, vertex-face incidences, and vertex neighbors
+        std::vector<mint> triangles;
+        std::vector<mint> vf_outer;
+        std::vector<mint> vf_inner;
+        std::vector<mint> adj_outer;
+        std::vector<mint> adj_inner;
+
+        // Dijkstra distances; only the entries of the last region are ever not infinite.
+        std::vector<mreal> distances;
+
+        DragRegion region;
+        std::vector<mint> region_triangles;
+        std::vector<mreal> base_positions;
+        // Area, volume and area-weighted centroid sums over the whole mesh and over the
+        // region faces, both taken when the drag began or after the flow step sums_step
+        mreal base_total[5];
+        mreal base_region[5];
+        long sums_step = 0;
+    }; // DragEditor
+
+} // namespace rsurfaces
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+#include <algorithm>
+
+namespace rsurfaces
+{
+    // The part of the mesh that moves during an interactive drag, together with whole-mesh
+    // quantities that are kept up to date incrementally from it. Constraints and potentials
+    // use it to re-target themselves without touching the rest of the mesh.
+    struct DragRegion
+    {
+        // Dragged vertices, sorted, and their falloff weights
+        std::vector<mint> vertices;
+        std::vector<mreal> weights;
+        // Faces incident to a dragged vertex, and all vertices of those faces (sorted);
+        // these are the only elements whose geometry changes during the drag
+        std::vector<mint> faces;
+        std::vector<mint> touchedVertices;
+
+        // Current total area, enclosed volume, and area-weighted barycenter of the mesh
+        mreal totalArea = 0.;
+        mreal totalVolume = 0.;
+        Vector3 barycenter{0, 0, 0};
+
+        inline bool Contains(mint v) const
+        {
+            return std::binary_search(vertices.begin(), vertices.end(), v);
+        }
+
+        inline bool Touches(mint v) const
+        {
+            return std::binary_search(touchedVertices.begin(), touchedVertices.end(), v);
+        }
+    };
+} // namespace rsurfaces
@@ -2,10 +2,14 @@
 
 #include "rsurface_types.h"
 #include "energy/tpe_kernel.h"
-#include "spatial/bvh_6d.h"
+#include "bct_constructors.h"
+#include "optimized_bct.h"
 
 namespace rsurfaces
 {
+    // Coulomb energy of unit charges placed at the vertices, summed over all ordered pairs of distinct vertices.
+    // The interactions are split into near and far field by a block cluster tree on the vertices; the far field
+    // is a monopole approximation using the total charge and center of charge of each cluster.
     class CoulombEnergy : public SurfaceEnergy
     {
     public:
@@ -13,18 +17,34 @@ namespace rsurfaces
         ~CoulombEnergy();
         virtual double Value();
         virtual void Differential(Eigen::MatrixXd &output);
+        // Computes the value and the differential in a single pass.
+        virtual double ValueAndDifferential(Eigen::MatrixXd &output);
         virtual void Update();
+        // The next Update repairs the face tree for the remeshed faces; the vertex tree is always rebuilt.
+        virtual void NotifyRemeshed(const std::vector<mint> &faceOrigins);
         virtual MeshPtr GetMesh();
         virtual GeomPtr GetGeom();
         virtual Vector2 GetExponents();
+        // Returns the face tree of the mesh, which the Hs metric is built on.
         virtual OptimizedClusterTree *GetBVH();
         virtual double GetTheta();
 
     private:
         TPEKernel *kernel;
-        OptimizedClusterTree *root;
         double theta;
-        double energyAtVertex(OptimizedClusterTree *node, GCVertex v);
-        Vector3 gradientAtVertex(OptimizedClusterTree *node, GCVertex v);
+        OptimizedClusterTree *root = nullptr;
+        OptimizedClusterTree *vertex_bvh = nullptr;
+        OptimizedBlockClusterTree *vertex_bct = nullptr;
+        FaceOriginTracker faceOrigins;
+
+        void ClearTrees();
+        // Reloads the vertex positions into the vertex tree; the clustering is kept until the next Update.
+        void RefreshCharges();
+
+        template <bool derivatives>
+        mreal NearField();
+
+        template <bool derivatives>
+        mreal FarField();
     };
-} // namespace rsurfaces
\ No newline at end of file
+} // namespace rsurfaces
@@ -21,6 +21,13 @@ namespace rsurfaces
         UVDataPtr uvs;
         std::unique_ptr<ImplicitSurface> surface;
 
+        // Flat buffers for batched evaluation, reused across steps
+        std::vector<double> positions;
+        std::vector<double> distances;
+        std::vector<double> gradients;
+        std::vector<char> attracted;
+        void evaluateSurface(bool withGradients);
+
         inline bool shouldAttract(GCVertex v)
         {
             // If no UVs are defined, then everything gets attracted
@@ -19,5 +19,11 @@ namespace rsurfaces
         private:
         double power;
         std::unique_ptr<ImplicitSurface> surface;
+
+        // Flat buffers for batched evaluation, reused across steps
+        std::vector<double> positions;
+        std::vector<double> distances;
+        std::vector<double> gradients;
+        void evaluateSurface(bool withGradients);
     };
 }
\ No newline at end of file
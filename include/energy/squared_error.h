@@ -33,6 +33,9 @@ namespace rsurfaces {
 
         void ChangeVertexTarget(GCVertex v, Vector3 newPos);
 
+        // Moves the targets of the region vertices to their current positions.
+        virtual void ResetTargetsInRegion(const DragRegion &region);
+
         // In some cases, we might require positions to be modified externally
         VertexDataWrapper originalPositions;
     };
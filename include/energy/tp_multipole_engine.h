@@ -0,0 +1,942 @@
+#pragma once
+
+#include "optimized_bct_types.h"
+#include "optimized_bct.h"
+
+namespace rsurfaces
+{
+    // Traversal engine for the 0-th order multipole tangent-point energies.
+    //
+    // The near field runs over pairs of primitives in neighbouring leaf
+    // clusters, the far field over admissible pairs of clusters. Both reduce
+    // to the same operation: one source element i against a set of target
+    // elements j, which is what the data policies below implement as a single
+    // vectorized row kernel. The engine is parametrized by
+    //
+    //  - the data used in the near field and in the far field, which is either
+    //    TPNormalData (weight, center, normal; near/far dim 7) or
+    //    TPProjectorData (weight, center, tangent projector; near/far dim 10);
+    //  - whether the interaction is mutual (self-repulsion, where S == T and
+    //    every unordered pair is visited once with derivatives written to both
+    //    sides) or one-sided (obstacles, where only S receives derivatives).
+    //
+    // Everything that does not apply to a variant (derivative terms, target
+    // side accumulation, symmetry filters) is removed at compile time.
+    //
+    // The Barnes-Hut energies further below walk the cluster tree of the
+    // targets once per leaf of the sources instead of the block cluster
+    // tree lists, and use TPBarnesHutEngine with the one-sided kernels.
+
+    // Index sets for the row kernels: a contiguous range of primitives in the
+    // near field, a row of the sparse admissibility matrix in the far field.
+    struct TPContiguousTargets
+    {
+        inline mint operator()(mint k) const
+        {
+            return k;
+        }
+    };
+
+    struct TPIndexedTargets
+    {
+        mint const *restrict const inner;
+        inline mint operator()(mint k) const
+        {
+            return inner[k];
+        }
+    };
+
+    // Kernel (|<v,n>|^alpha + |<v,m>|^alpha) / |v|^beta, with the exponent
+    // passed as alpha.
+    struct TPNormalData
+    {
+        static const mint dim = 7;
+
+        static inline mreal Exponent(mreal alpha)
+        {
+            return alpha;
+        }
+
+        // Returns a * sum_j b_j K(x_i, y_j) over the targets js(k) for k in [k_begin, k_end).
+        // With derivatives, adds the derivatives with respect to the data of i to
+        // U[dim * i + ...] and, if mutual, those with respect to the data of j to V[dim * j + ...].
+        // If filtered, only targets j >= i are taken into account.
+        template <bool derivatives, bool mutual, bool filtered, typename Targets, typename T1, typename T2>
+        static inline mreal Row(mint i, const Targets &js, mint k_begin, mint k_end,
+                                mreal const *const *X, mreal const *const *Y,
+                                mreal *restrict U, mreal *restrict V, T1 alpha, T2 betahalf)
+        {
+            T1 alpha_minus_2 = alpha - 2;
+            T2 minus_betahalf = -betahalf;
+            T2 minus_betahalf_minus_1 = -betahalf - 1;
+            mreal beta = 2. * betahalf;
+
+            mreal const *restrict const B = Y[0];
+            mreal const *restrict const Y1 = Y[1];
+            mreal const *restrict const Y2 = Y[2];
+            mreal const *restrict const Y3 = Y[3];
+            mreal const *restrict const M1 = Y[4];
+            mreal const *restrict const M2 = Y[5];
+            mreal const *restrict const M3 = Y[6];
+
+            mreal a = X[0][i];
+            mreal x1 = X[1][i];
+            mreal x2 = X[2][i];
+            mreal x3 = X[3][i];
+            mreal n1 = X[4][i];
+            mreal n2 = X[5][i];
+            mreal n3 = X[6][i];
+
+            mreal sum = 0.;
+            mreal da = 0.;
+            mreal dx1 = 0.;
+            mreal dx2 = 0.;
+            mreal dx3 = 0.;
+            mreal dn1 = 0.;
+            mreal dn2 = 0.;
+            mreal dn3 = 0.;
+
+            #pragma omp simd reduction( + : sum, da, dx1, dx2, dx3, dn1, dn2, dn3 )
+            for( mint k = k_begin; k < k_end; ++k )
+            {
+                mint j = js(k);
+                if( !filtered || i <= j )
+                {
+                    mreal b = B[j];
+                    mreal y1 = Y1[j];
+                    mreal y2 = Y2[j];
+                    mreal y3 = Y3[j];
+                    mreal m1 = M1[j];
+                    mreal m2 = M2[j];
+                    mreal m3 = M3[j];
+
+                    mreal v1 = y1 - x1;
+                    mreal v2 = y2 - x2;
+                    mreal v3 = y3 - x3;
+
+                    mreal rCosPhi = v1 * n1 + v2 * n2 + v3 * n3;
+                    mreal rCosPsi = v1 * m1 + v2 * m2 + v3 * m3;
+                    mreal r2 = v1 * v1 + v2 * v2 + v3 * v3;
+
+                    if( !derivatives )
+                    {
+                        sum += ( mypow( fabs(rCosPhi), alpha ) + mypow( fabs(rCosPsi), alpha ) ) * mypow( r2, minus_betahalf ) * b;
+                    }
+                    else
+                    {
+                        mreal rBetaMinus2 = mypow( r2, minus_betahalf_minus_1 );
+                        mreal rBeta = rBetaMinus2 * r2;
+
+                        mreal rCosPhiAlphaMinus1 = mypow( fabs(rCosPhi), alpha_minus_2 ) * rCosPhi;
+                        mreal rCosPhiAlpha = rCosPhiAlphaMinus1 * rCosPhi;
+
+                        mreal rCosPsiAlphaMinus1 = mypow( fabs(rCosPsi), alpha_minus_2 ) * rCosPsi;
+                        mreal rCosPsiAlpha = rCosPsiAlphaMinus1 * rCosPsi;
+
+                        mreal Num = rCosPhiAlpha + rCosPsiAlpha;
+                        mreal factor0 = rBeta * alpha;
+                        mreal density = rBeta * Num;
+                        sum += density * b;
+
+                        mreal F = factor0 * rCosPhiAlphaMinus1;
+                        mreal G = factor0 * rCosPsiAlphaMinus1;
+                        mreal H = beta * rBetaMinus2 * Num;
+
+                        mreal bF = b * F;
+
+                        mreal Z1 = ( - n1 * F - m1 * G + v1 * H );
+                        mreal Z2 = ( - n2 * F - m2 * G + v2 * H );
+                        mreal Z3 = ( - n3 * F - m3 * G + v3 * H );
+
+                        da += b * (
+                                   density
+                                   +
+                                   F * ( n1 * (x1 - v1) + n2 * (x2 - v2) + n3 * (x3 - v3) )
+                                   +
+                                   G * ( m1 * x1 + m2 * x2 + m3 * x3 )
+                                   -
+                                   H * ( v1 * x1 + v2 * x2 + v3 * x3 )
+                                   );
+                        dx1 += b * Z1;
+                        dx2 += b * Z2;
+                        dx3 += b * Z3;
+                        dn1 += bF * v1;
+                        dn2 += bF * v2;
+                        dn3 += bF * v3;
+
+                        if( mutual )
+                        {
+                            mreal aG = a * G;
+                            V[ 7 * j + 0 ] += a * (
+                                                   density
+                                                   -
+                                                   F * ( n1 * y1 + n2 * y2 + n3 * y3 )
+                                                   -
+                                                   G * ( m1 * (y1 + v1) + m2 * (y2 + v2) + m3 * (y3 + v3) )
+                                                   +
+                                                   H * ( v1 * y1 + v2 * y2 + v3 * y3 )
+                                                   );
+                            V[ 7 * j + 1 ] -= a * Z1;
+                            V[ 7 * j + 2 ] -= a * Z2;
+                            V[ 7 * j + 3 ] -= a * Z3;
+                            V[ 7 * j + 4 ] += aG * v1;
+                            V[ 7 * j + 5 ] += aG * v2;
+                            V[ 7 * j + 6 ] += aG * v3;
+                        }
+                    }
+                }
+            }
+
+            if( derivatives )
+            {
+                U[ 7 * i + 0 ] += da;
+                U[ 7 * i + 1 ] += dx1;
+                U[ 7 * i + 2 ] += dx2;
+                U[ 7 * i + 3 ] += dx3;
+                U[ 7 * i + 4 ] += dn1;
+                U[ 7 * i + 5 ] += dn2;
+                U[ 7 * i + 6 ] += dn3;
+            }
+
+            return a * sum;
+        }
+    };
+
+    // Kernel (|<v,Pv>|^(alpha/2) + |<v,Qv>|^(alpha/2)) / |v|^beta, with the
+    // exponent passed as alpha/2.
+    struct TPProjectorData
+    {
+        static const mint dim = 10;
+
+        static inline mreal Exponent(mreal alpha)
+        {
+            return alpha / 2;
+        }
+
+        // Same contract as TPNormalData::Row.
+        template <bool derivatives, bool mutual, bool filtered, typename Targets, typename T1, typename T2>
+        static inline mreal Row(mint i, const Targets &js, mint k_begin, mint k_end,
+                                mreal const *const *X, mreal const *const *Y,
+                                mreal *restrict U, mreal *restrict V, T1 alphahalf, T2 betahalf)
+        {
+            T1 alphahalf_minus_1 = alphahalf - 1;
+            T2 minus_betahalf = -betahalf;
+            T2 minus_betahalf_minus_1 = -betahalf - 1;
+            mreal beta = 2. * betahalf;
+
+            mreal const *restrict const B = Y[0];
+            mreal const *restrict const Y1 = Y[1];
+            mreal const *restrict const Y2 = Y[2];
+            mreal const *restrict const Y3 = Y[3];
+            mreal const *restrict const Q11 = Y[4];
+            mreal const *restrict const Q12 = Y[5];
+            mreal const *restrict const Q13 = Y[6];
+            mreal const *restrict const Q22 = Y[7];
+            mreal const *restrict const Q23 = Y[8];
+            mreal const *restrict const Q33 = Y[9];
+
+            mreal a = X[0][i];
+            mreal x1 = X[1][i];
+            mreal x2 = X[2][i];
+            mreal x3 = X[3][i];
+            mreal p11 = X[4][i];
+            mreal p12 = X[5][i];
+            mreal p13 = X[6][i];
+            mreal p22 = X[7][i];
+            mreal p23 = X[8][i];
+            mreal p33 = X[9][i];
+
+            mreal sum = 0.;
+            mreal da = 0.;
+            mreal dx1 = 0.;
+            mreal dx2 = 0.;
+            mreal dx3 = 0.;
+            mreal dp11 = 0.;
+            mreal dp12 = 0.;
+            mreal dp13 = 0.;
+            mreal dp22 = 0.;
+            mreal dp23 = 0.;
+            mreal dp33 = 0.;
+
+            #pragma omp simd reduction( + : sum, da, dx1, dx2, dx3, dp11, dp12, dp13, dp22, dp23, dp33 )
+            for( mint k = k_begin; k < k_end; ++k )
+            {
+                mint j = js(k);
+                if( !filtered || i <= j )
+                {
+                    mreal b = B[j];
+                    mreal y1 = Y1[j];
+                    mreal y2 = Y2[j];
+                    mreal y3 = Y3[j];
+                    mreal q11 = Q11[j];
+                    mreal q12 = Q12[j];
+                    mreal q13 = Q13[j];
+                    mreal q22 = Q22[j];
+                    mreal q23 = Q23[j];
+                    mreal q33 = Q33[j];
+
+                    mreal v1 = y1 - x1;
+                    mreal v2 = y2 - x2;
+                    mreal v3 = y3 - x3;
+
+                    mreal v11 = v1 * v1;
+                    mreal v22 = v2 * v2;
+                    mreal v33 = v3 * v3;
+                    mreal r2 = v11 + v22 + v33;
+
+                    mreal Pv1 = p11*v1 + p12*v2 + p13*v3;
+                    mreal Pv2 = p12*v1 + p22*v2 + p23*v3;
+                    mreal Pv3 = p13*v1 + p23*v2 + p33*v3;
+                    mreal rCosPhi2 = v1*Pv1 + v2*Pv2 + v3*Pv3;
+
+                    mreal Qv1 = q11*v1 + q12*v2 + q13*v3;
+                    mreal Qv2 = q12*v1 + q22*v2 + q23*v3;
+                    mreal Qv3 = q13*v1 + q23*v2 + q33*v3;
+                    mreal rCosPsi2 = v1*Qv1 + v2*Qv2 + v3*Qv3;
+
+                    if( !derivatives )
+                    {
+                        sum += ( mypow( fabs(rCosPhi2), alphahalf ) + mypow( fabs(rCosPsi2), alphahalf ) ) * mypow( r2, minus_betahalf ) * b;
+                    }
+                    else
+                    {
+                        mreal v12 = 2. * v1 * v2;
+                        mreal v13 = 2. * v1 * v3;
+                        mreal v23 = 2. * v2 * v3;
+
+                        mreal rCosPhiAlphaMinus2 = mypow( fabs(rCosPhi2), alphahalf_minus_1 );
+                        mreal rCosPsiAlphaMinus2 = mypow( fabs(rCosPsi2), alphahalf_minus_1 );
+                        mreal rMinusBetaMinus2 = mypow( r2, minus_betahalf_minus_1 );
+
+                        mreal rMinusBeta = rMinusBetaMinus2 * r2;
+                        mreal rCosPhiAlpha = rCosPhiAlphaMinus2 * rCosPhi2;
+                        mreal rCosPsiAlpha = rCosPsiAlphaMinus2 * rCosPsi2;
+                        mreal Num = ( rCosPhiAlpha + rCosPsiAlpha );
+
+                        mreal E = Num * rMinusBeta;
+                        sum += E * b;
+
+                        mreal factor = alphahalf * rMinusBeta;
+                        mreal F = factor * rCosPhiAlphaMinus2;
+                        mreal G = factor * rCosPsiAlphaMinus2;
+                        mreal H = - beta * rMinusBetaMinus2 * Num;
+
+                        mreal bF = b * F;
+
+                        mreal dEdv1 = 2. * (F * Pv1 + G * Qv1) + H * v1;
+                        mreal dEdv2 = 2. * (F * Pv2 + G * Qv2) + H * v2;
+                        mreal dEdv3 = 2. * (F * Pv3 + G * Qv3) + H * v3;
+
+                        da += b * ( E + dEdv1 * x1 + dEdv2 * x2 + dEdv3 * x3 - factor * rCosPhiAlpha );
+                        dx1 -= b * dEdv1;
+                        dx2 -= b * dEdv2;
+                        dx3 -= b * dEdv3;
+                        dp11 += bF * v11;
+                        dp12 += bF * v12;
+                        dp13 += bF * v13;
+                        dp22 += bF * v22;
+                        dp23 += bF * v23;
+                        dp33 += bF * v33;
+
+                        if( mutual )
+                        {
+                            mreal aG = a * G;
+                            V[ 10 * j + 0 ] += a * ( E - dEdv1 * y1 - dEdv2 * y2 - dEdv3 * y3 - factor * rCosPsiAlpha );
+                            V[ 10 * j + 1 ] += a * dEdv1;
+                            V[ 10 * j + 2 ] += a * dEdv2;
+                            V[ 10 * j + 3 ] += a * dEdv3;
+                            V[ 10 * j + 4 ] += aG * v11;
+                            V[ 10 * j + 5 ] += aG * v12;
+                            V[ 10 * j + 6 ] += aG * v13;
+                            V[ 10 * j + 7 ] += aG * v22;
+                            V[ 10 * j + 8 ] += aG * v23;
+                            V[ 10 * j + 9 ] += aG * v33;
+                        }
+                    }
+                }
+            }
+
+            if( derivatives )
+            {
+                U[ 10 * i + 0 ] += da;
+                U[ 10 * i + 1 ] += dx1;
+                U[ 10 * i + 2 ] += dx2;
+                U[ 10 * i + 3 ] += dx3;
+                U[ 10 * i + 4 ] += dp11;
+                U[ 10 * i + 5 ] += dp12;
+                U[ 10 * i + 6 ] += dp13;
+                U[ 10 * i + 7 ] += dp22;
+                U[ 10 * i + 8 ] += dp23;
+                U[ 10 * i + 9 ] += dp33;
+            }
+
+            return a * sum;
+        }
+    };
+
+    template <typename NearData, typename FarData, bool mutual>
+    class TPMultipoleEngine
+    {
+    public:
+        // Returns the unweighted energy.
+        static mreal Energy(OptimizedBlockClusterTree *bct, mreal alpha, mreal beta, bool use_int)
+        {
+            return Dispatch<false>(bct, alpha, beta, use_int);
+        }
+
+        // Returns the unweighted energy, and adds its derivatives to the
+        // thread-local P_D_near / C_D_far buffers of bct->S (and bct->T, for
+        // mutual interactions). The buffers must have been cleansed before.
+        static mreal DEnergy(OptimizedBlockClusterTree *bct, mreal alpha, mreal beta, bool use_int)
+        {
+            return Dispatch<true>(bct, alpha, beta, use_int);
+        }
+
+    private:
+        // Integer exponents let mypow use repeated multiplication instead of pow.
+        template <bool derivatives>
+        static mreal Dispatch(OptimizedBlockClusterTree *bct, mreal alpha, mreal beta, bool use_int)
+        {
+            mreal intpart;
+            bool betahalfint = (std::modf( beta/2, &intpart) == 0.0);
+            mreal near_exponent = NearData::Exponent(alpha);
+            mreal far_exponent = FarData::Exponent(alpha);
+
+            mreal value = 0.;
+
+            if( use_int && betahalfint && std::modf( near_exponent, &intpart) == 0.0 )
+            {
+                value += NearField<derivatives>( bct, (mint) std::round(near_exponent), (mint) std::round(beta/2) );
+            }
+            else
+            {
+                value += NearField<derivatives>( bct, near_exponent, beta/2 );
+            }
+
+            if( use_int && betahalfint && std::modf( far_exponent, &intpart) == 0.0 )
+            {
+                value += FarField<derivatives>( bct, (mint) std::round(far_exponent), (mint) std::round(beta/2) );
+            }
+            else
+            {
+                value += FarField<derivatives>( bct, far_exponent, beta/2 );
+            }
+
+            return value;
+        }
+
+        template <bool derivatives, typename T1, typename T2>
+        static mreal NearField(OptimizedBlockClusterTree *bct, T1 alpha, T2 betahalf)
+        {
+            ptic("TPMultipoleEngine::NearField");
+
+            auto S = bct->S;
+            auto T = bct->T;
+            mint b_m = bct->near->b_m;
+            mint nthreads = std::min( S->thread_count, T->thread_count);
+
+            mint const *restrict const b_row_ptr = S->leaf_cluster_ptr;
+            mint const *restrict const b_col_ptr = T->leaf_cluster_ptr;
+            mint const *restrict const b_outer = bct->near->b_outer;
+            mint const *restrict const b_inner = bct->near->b_inner;
+
+            mreal const *const *X = &S->P_near[0];
+            mreal const *const *Y = &T->P_near[0];
+
+            TPContiguousTargets js;
+            mreal sum = 0.;
+
+            #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
+            for( mint b_i = 0; b_i < b_m; ++b_i )
+            {
+                mint thread = omp_get_thread_num();
+                mreal *restrict U = derivatives ? &S->P_D_near[thread][0] : nullptr;
+                mreal *restrict V = (derivatives && mutual) ? &T->P_D_near[thread][0] : nullptr;
+
+                mint i_begin = b_row_ptr[b_i];
+                mint i_end = b_row_ptr[b_i+1];
+
+                for( mint k = b_outer[b_i]; k < b_outer[b_i+1]; ++k )
+                {
+                    mint b_j = b_inner[k];
+                    // Mutual interactions visit each pair of leaves once, and each
+                    // pair of primitives in a diagonal block once (diagonal excluded)
+                    if( !mutual || b_i <= b_j )
+                    {
+                        mint j_begin = b_col_ptr[b_j];
+                        mint j_end = b_col_ptr[b_j+1];
+
+                        for( mint i = i_begin; i < i_end; ++i )
+                        {
+                            mint begin = ( mutual && b_i == b_j ) ? i + 1 : j_begin;
+                            sum += NearData::template Row<derivatives, mutual, false>( i, js, begin, j_end, X, Y, U, V, alpha, betahalf );
+                        }
+                    }
+                }
+            }
+
+            ptoc("TPMultipoleEngine::NearField");
+
+            return sum;
+        }
+
+        template <bool derivatives, typename T1, typename T2>
+        static mreal FarField(OptimizedBlockClusterTree *bct, T1 alpha, T2 betahalf)
+        {
+            ptic("TPMultipoleEngine::FarField");
+
+            auto S = bct->S;
+            auto T = bct->T;
+            mint b_m = bct->far->b_m;
+            mint nthreads = std::min( S->thread_count, T->thread_count);
+
+            mint const *restrict const b_outer = bct->far->b_outer;
+            TPIndexedTargets js{ bct->far->b_inner };
+
+            mreal const *const *X = &S->C_far[0];
+            mreal const *const *Y = &T->C_far[0];
+
+            mreal sum = 0.;
+
+            #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
+            for( mint i = 0; i < b_m; ++i )
+            {
+                mint thread = omp_get_thread_num();
+                mreal *restrict U = derivatives ? &S->C_D_far[thread][0] : nullptr;
+                mreal *restrict V = (derivatives && mutual) ? &T->C_D_far[thread][0] : nullptr;
+
+                // The admissible pairs of a mutual interaction come in both orders
+                sum += FarData::template Row<derivatives, mutual, mutual>( i, js, b_outer[i], b_outer[i+1], X, Y, U, V, alpha, betahalf );
+            }
+
+            ptoc("TPMultipoleEngine::FarField");
+
+            return sum;
+        }
+    };
+
+    // One-sided kernel |<v,n>|^alpha / |v|^beta of the Barnes-Hut energies, in
+    // which only the source carries a normal and the target is a weighted point.
+    struct TPBarnesHutNormalData
+    {
+        static const mint dim = 7;
+
+        static inline mreal Exponent(mreal alpha)
+        {
+            return alpha;
+        }
+
+        // Returns K(x_i, y). With derivatives, also writes the derivatives of
+        // a_i b K(x_i, y) with respect to the data of i, divided by b, to dX and
+        // those with respect to (b, y), divided by a_i, to dY.
+        template <bool derivatives, typename T1, typename T2>
+        static inline mreal Pair(mint i, mreal const *const *X, mreal y1, mreal y2, mreal y3,
+                                 mreal *restrict dX, mreal *restrict dY, T1 alpha, T2 betahalf)
+        {
+            mreal x1 = X[1][i];
+            mreal x2 = X[2][i];
+            mreal x3 = X[3][i];
+            mreal n1 = X[4][i];
+            mreal n2 = X[5][i];
+            mreal n3 = X[6][i];
+
+            mreal v1 = y1 - x1;
+            mreal v2 = y2 - x2;
+            mreal v3 = y3 - x3;
+
+            mreal rCosPhi = v1 * n1 + v2 * n2 + v3 * n3;
+            mreal r2 = v1 * v1 + v2 * v2 + v3 * v3;
+
+            if( !derivatives )
+            {
+                T2 minus_betahalf = -betahalf;
+                return mypow( fabs(rCosPhi), alpha ) * mypow( r2, minus_betahalf );
+            }
+
+            T1 alpha_minus_2 = alpha - 2;
+            T2 minus_betahalf_minus_1 = -betahalf - 1;
+            mreal beta = 2. * betahalf;
+
+            mreal rBetaMinus2 = mypow( r2, minus_betahalf_minus_1 );
+            mreal rBeta = rBetaMinus2 * r2;
+
+            mreal rCosPhiAlphaMinus1 = mypow( fabs(rCosPhi), alpha_minus_2 ) * rCosPhi;
+            mreal rCosPhiAlpha = rCosPhiAlphaMinus1 * rCosPhi;
+
+            mreal density = rBeta * rCosPhiAlpha;
+            mreal F = rBeta * alpha * rCosPhiAlphaMinus1;
+            mreal H = beta * rBetaMinus2 * rCosPhiAlpha;
+
+            mreal Z1 = ( - n1 * F + v1 * H );
+            mreal Z2 = ( - n2 * F + v2 * H );
+            mreal Z3 = ( - n3 * F + v3 * H );
+
+            dX[0] = density + F * ( n1 * (x1 - v1) + n2 * (x2 - v2) + n3 * (x3 - v3) ) - H * ( v1 * x1 + v2 * x2 + v3 * x3 );
+            dX[1] = Z1;
+            dX[2] = Z2;
+            dX[3] = Z3;
+            dX[4] = F * v1;
+            dX[5] = F * v2;
+            dX[6] = F * v3;
+
+            dY[0] = density - F * ( n1 * y1 + n2 * y2 + n3 * y3 ) + H * ( v1 * y1 + v2 * y2 + v3 * y3 );
+            dY[1] = - Z1;
+            dY[2] = - Z2;
+            dY[3] = - Z3;
+
+            return density;
+        }
+    };
+
+    // One-sided kernel |<v,Pv>|^(alpha/2) / |v|^beta of the Barnes-Hut energies,
+    // with the exponent passed as alpha/2.
+    struct TPBarnesHutProjectorData
+    {
+        static const mint dim = 10;
+
+        static inline mreal Exponent(mreal alpha)
+        {
+            return alpha / 2;
+        }
+
+        // Same contract as TPBarnesHutNormalData::Pair.
+        template <bool derivatives, typename T1, typename T2>
+        static inline mreal Pair(mint i, mreal const *const *X, mreal y1, mreal y2, mreal y3,
+                                 mreal *restrict dX, mreal *restrict dY, T1 alphahalf, T2 betahalf)
+        {
+            mreal x1 = X[1][i];
+            mreal x2 = X[2][i];
+            mreal x3 = X[3][i];
+            mreal p11 = X[4][i];
+            mreal p12 = X[5][i];
+            mreal p13 = X[6][i];
+            mreal p22 = X[7][i];
+            mreal p23 = X[8][i];
+            mreal p33 = X[9][i];
+
+            mreal v1 = y1 - x1;
+            mreal v2 = y2 - x2;
+            mreal v3 = y3 - x3;
+
+            mreal v11 = v1 * v1;
+            mreal v22 = v2 * v2;
+            mreal v33 = v3 * v3;
+            mreal r2 = v11 + v22 + v33;
+
+            mreal Pv1 = p11*v1 + p12*v2 + p13*v3;
+            mreal Pv2 = p12*v1 + p22*v2 + p23*v3;
+            mreal Pv3 = p13*v1 + p23*v2 + p33*v3;
+            mreal rCosPhi2 = v1*Pv1 + v2*Pv2 + v3*Pv3;
+
+            if( !derivatives )
+            {
+                T2 minus_betahalf = -betahalf;
+                return mypow( fabs(rCosPhi2), alphahalf ) * mypow( r2, minus_betahalf );
+            }
+
+            T1 alphahalf_minus_1 = alphahalf - 1;
+            T2 minus_betahalf_minus_1 = -betahalf - 1;
+            mreal beta = 2. * betahalf;
+
+            mreal rCosPhiAlphaMinus2 = mypow( fabs(rCosPhi2), alphahalf_minus_1 );
+            mreal rMinusBetaMinus2 = mypow( r2, minus_betahalf_minus_1 );
+
+            mreal rMinusBeta = rMinusBetaMinus2 * r2;
+            mreal rCosPhiAlpha = rCosPhiAlphaMinus2 * rCosPhi2;
+
+            mreal E = rCosPhiAlpha * rMinusBeta;
+            mreal factor = alphahalf * rMinusBeta;
+            mreal F = factor * rCosPhiAlphaMinus2;
+            mreal H = - beta * rMinusBetaMinus2 * rCosPhiAlpha;
+
+            mreal dEdv1 = 2. * F * Pv1 + H * v1;
+            mreal dEdv2 = 2. * F * Pv2 + H * v2;
+            mreal dEdv3 = 2. * F * Pv3 + H * v3;
+
+            dX[0] = E + dEdv1 * x1 + dEdv2 * x2 + dEdv3 * x3 - factor * rCosPhiAlpha;
+            dX[1] = - dEdv1;
+            dX[2] = - dEdv2;
+            dX[3] = - dEdv3;
+            dX[4] = F * v11;
+            dX[5] = F * 2. * v1 * v2;
+            dX[6] = F * 2. * v1 * v3;
+            dX[7] = F * v22;
+            dX[8] = F * 2. * v2 * v3;
+            dX[9] = F * v33;
+
+            dY[0] = E - dEdv1 * y1 - dEdv2 * y2 - dEdv3 * y3;
+            dY[1] = dEdv1;
+            dY[2] = dEdv2;
+            dY[3] = dEdv3;
+
+            return E;
+        }
+    };
+
+    // Barnes-Hut traversal: every leaf cluster of the sources S walks the cluster
+    // tree of the targets T from the root, and takes a target cluster as a single
+    // weighted point as soon as it is well separated from the leaf. For S == T,
+    // the pairs of a primitive with itself are left out.
+    template <typename Data>
+    class TPBarnesHutEngine
+    {
+    public:
+        // Returns the unweighted energy.
+        static mreal Energy(OptimizedClusterTree *S, OptimizedClusterTree *T, mreal theta, mreal alpha, mreal beta, bool use_int)
+        {
+            return Dispatch<false, false, false>(S, T, theta, alpha, beta, use_int);
+        }
+
+        // Returns the unweighted energy, and adds its derivatives with respect to
+        // the sources to the thread-local P_D_near buffers of S (if source_d), and
+        // those with respect to the targets to the thread-local P_D_near / C_D_far
+        // buffers of T (if target_d). The buffers must have been cleansed before.
+        template <bool source_d, bool target_d>
+        static mreal DEnergy(OptimizedClusterTree *S, OptimizedClusterTree *T, mreal theta, mreal alpha, mreal beta, bool use_int)
+        {
+            return Dispatch<true, source_d, target_d>(S, T, theta, alpha, beta, use_int);
+        }
+
+    private:
+        template <bool derivatives, bool source_d, bool target_d>
+        static mreal Dispatch(OptimizedClusterTree *S, OptimizedClusterTree *T, mreal theta, mreal alpha, mreal beta, bool use_int)
+        {
+            mreal intpart;
+            mreal exponent = Data::Exponent(alpha);
+
+            if( use_int && std::modf( beta/2, &intpart) == 0.0 && std::modf( exponent, &intpart) == 0.0 )
+            {
+                return Traverse<derivatives, source_d, target_d>( S, T, theta, (mint) std::round(exponent), (mint) std::round(beta/2) );
+            }
+            else
+            {
+                return Traverse<derivatives, source_d, target_d>( S, T, theta, exponent, beta/2 );
+            }
+        }
+
+        template <bool derivatives, bool source_d, bool target_d, typename T1, typename T2>
+        static mreal Traverse(OptimizedClusterTree *S, OptimizedClusterTree *T, mreal theta, T1 alpha, T2 betahalf)
+        {
+            ptic("TPBarnesHutEngine::Traverse");
+
+            const mint dim = Data::dim;
+            const bool self = (S == T);
+            mreal theta2 = theta * theta;
+            mint nthreads = std::min( S->thread_count, T->thread_count );
+            mint far_dim = T->far_dim;
+
+            mreal const *const *X = &S->P_near[0];
+
+            mreal const * restrict const C_xmin1 = S->C_min[0];
+            mreal const * restrict const C_xmin2 = S->C_min[1];
+            mreal const * restrict const C_xmin3 = S->C_min[2];
+            mreal const * restrict const C_xmax1 = S->C_max[0];
+            mreal const * restrict const C_xmax2 = S->C_max[1];
+            mreal const * restrict const C_xmax3 = S->C_max[2];
+            mreal const * restrict const C_xr2 = S->C_squared_radius;
+            mint  const * restrict const C_xbegin = S->C_begin;
+            mint  const * restrict const C_xend = S->C_end;
+            mint  const * restrict const leaf = S->leaf_clusters;
+
+            mreal const * restrict const C_ymin1 = T->C_min[0];
+            mreal const * restrict const C_ymin2 = T->C_min[1];
+            mreal const * restrict const C_ymin3 = T->C_min[2];
+            mreal const * restrict const C_ymax1 = T->C_max[0];
+            mreal const * restrict const C_ymax2 = T->C_max[1];
+            mreal const * restrict const C_ymax3 = T->C_max[2];
+            mreal const * restrict const C_yr2 = T->C_squared_radius;
+            mint  const * restrict const C_ybegin = T->C_begin;
+            mint  const * restrict const C_yend = T->C_end;
+            mint  const * restrict const C_left = T->C_left;
+            mint  const * restrict const C_right = T->C_right;
+
+            mreal const * restrict const P_B = T->P_near[0];
+            mreal const * restrict const P_Y1 = T->P_near[1];
+            mreal const * restrict const P_Y2 = T->P_near[2];
+            mreal const * restrict const P_Y3 = T->P_near[3];
+
+            mreal const * restrict const C_B = T->C_far[0];
+            mreal const * restrict const C_Y1 = T->C_far[1];
+            mreal const * restrict const C_Y2 = T->C_far[2];
+            mreal const * restrict const C_Y3 = T->C_far[3];
+
+            A_Vector<A_Vector<mint>> thread_stack( nthreads );
+
+            mreal sum = 0.;
+
+            #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
+            for( mint k = 0; k < S->leaf_cluster_count; ++k )
+            {
+                mint thread = omp_get_thread_num();
+
+                A_Vector<mint> * stack = &thread_stack[thread];
+
+                // For S == T, the source and target buffers are the same.
+                mreal * const P_U = source_d ? &S->P_D_near[thread][0] : nullptr;
+                mreal * const P_V = target_d ? &T->P_D_near[thread][0] : nullptr;
+                mreal * const C_V = target_d ? &T->C_D_far[thread][0] : nullptr;
+
+                mreal dX [dim];
+                mreal dY [4];
+
+                stack->clear();
+                stack->push_back(0);
+
+                mint l = leaf[k];
+                mint i_begin = C_xbegin[l];
+                mint i_end   = C_xend[l];
+
+                mreal xmin1 = C_xmin1[l];
+                mreal xmin2 = C_xmin2[l];
+                mreal xmin3 = C_xmin3[l];
+
+                mreal xmax1 = C_xmax1[l];
+                mreal xmax2 = C_xmax2[l];
+                mreal xmax3 = C_xmax3[l];
+
+                mreal r2l = C_xr2[l];
+
+                mreal local_sum = 0.;
+
+                while( !stack->empty() )
+                {
+                    mint C = stack->back();
+                    stack->pop_back();
+
+                    mreal h2 = std::max(r2l, C_yr2[C]);
+
+                    // Compute squared distance between bounding boxes.
+                    // Inpired by https://gamedev.stackexchange.com/questions/154036/efficient-minimum-distance-between-two-axis-aligned-squares
+                    mreal d1 = mymax( 0., mymax(xmin1, C_ymin1[C]) - mymin(xmax1, C_ymax1[C]) );
+                    mreal d2 = mymax( 0., mymax(xmin2, C_ymin2[C]) - mymin(xmax2, C_ymax2[C]) );
+                    mreal d3 = mymax( 0., mymax(xmin3, C_ymin3[C]) - mymin(xmax3, C_ymax3[C]) );
+
+                    mreal R2 = d1 * d1 + d2 * d2 + d3 * d3;
+
+                    if( h2 < theta2 * R2 )
+                    {
+                        // far field: the whole cluster C acts as a single weighted point
+                        mreal b  = C_B [C];
+                        mreal y1 = C_Y1[C];
+                        mreal y2 = C_Y2[C];
+                        mreal y3 = C_Y3[C];
+
+                        mreal row_sum = 0.;
+
+                        if( !derivatives )
+                        {
+                            #pragma omp simd reduction( + : row_sum )
+                            for( mint i = i_begin; i < i_end; ++i )
+                            {
+                                row_sum += X[0][i] * Data::template Pair<false>( i, X, y1, y2, y3, dX, dY, alpha, betahalf );
+                            }
+                        }
+                        else
+                        {
+                            mreal db [4] = { 0., 0., 0., 0. };
+
+                            for( mint i = i_begin; i < i_end; ++i )
+                            {
+                                mreal a = X[0][i];
+                                row_sum += a * Data::template Pair<true>( i, X, y1, y2, y3, dX, dY, alpha, betahalf );
+
+                                if( source_d )
+                                {
+                                    for( mint m = 0; m < dim; ++m )
+                                    {
+                                        P_U[ dim * i + m ] += b * dX[m];
+                                    }
+                                }
+                                if( target_d )
+                                {
+                                    for( mint m = 0; m < 4; ++m )
+                                    {
+                                        db[m] += a * dY[m];
+                                    }
+                                }
+                            }
+
+                            if( target_d )
+                            {
+                                for( mint m = 0; m < 4; ++m )
+                                {
+                                    C_V[ far_dim * C + m ] += db[m];
+                                }
+                            }
+                        }
+
+                        local_sum += b * row_sum;
+                    }
+                    else
+                    {
+                        mint left  = C_left[C];
+                        mint right = C_right[C];
+                        if( left >= 0 && right >= 0 )
+                        {
+                            stack->push_back( right );
+                            stack->push_back( left  );
+                        }
+                        else
+                        {
+                            // near field loop
+                            mint j_begin = C_ybegin[C];
+                            mint j_end   = C_yend[C];
+
+                            for( mint i = i_begin; i < i_end; ++i )
+                            {
+                                mreal a = X[0][i];
+                                mreal row_sum = 0.;
+
+                                if( !derivatives )
+                                {
+                                    #pragma omp simd reduction( + : row_sum )
+                                    for( mint j = j_begin; j < j_end; ++j )
+                                    {
+                                        if( !self || i != j )
+                                        {
+                                            row_sum += P_B[j] * Data::template Pair<false>( i, X, P_Y1[j], P_Y2[j], P_Y3[j], dX, dY, alpha, betahalf );
+                                        }
+                                    }
+                                }
+                                else
+                                {
+                                    for( mint j = j_begin; j < j_end; ++j )
+                                    {
+                                        if( !self || i != j )
+                                        {
+                                            mreal b = P_B[j];
+                                            row_sum += b * Data::template Pair<true>( i, X, P_Y1[j], P_Y2[j], P_Y3[j], dX, dY, alpha, betahalf );
+
+                                            if( source_d )
+                                            {
+                                                for( mint m = 0; m < dim; ++m )
+                                                {
+                                                    P_U[ dim * i + m ] += b * dX[m];
+                                                }
+                                            }
+                                            if( target_d )
+                                            {
+                                                for( mint m = 0; m < 4; ++m )
+                                                {
+                                                    P_V[ dim * j + m ] += a * dY[m];
+                                                }
+                                            }
+                                        }
+                                    }
+                                }
+
+                                local_sum += a * row_sum;
+                            }
+                        }
+                    }
+                }
+
+                sum += local_sum;
+            }
+
+            ptoc("TPBarnesHutEngine::Traverse");
+
+            return sum;
+        }
+    };
+} // namespace rsurfaces
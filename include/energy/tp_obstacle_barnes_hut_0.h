@@ -35,6 +35,26 @@ namespace rsurfaces
             Update();
         }
 
+        // Takes ownership of an already built obstacle tree, e.g. one merged from several obstacles.
+        TPObstacleBarnesHut0(MeshPtr mesh_, GeomPtr geom_, SurfaceEnergy *bvhSharedFrom_, OptimizedClusterTree *o_bvh_,
+                             mreal alpha_, mreal beta_, mreal theta_, mreal weight_ = 1.)
+        {
+            mesh = mesh_;
+            geom = geom_;
+            bvh = 0;
+            bvhSharedFrom = bvhSharedFrom_;
+            o_bvh = o_bvh_;
+            alpha = alpha_;
+            beta = beta_;
+            theta = theta_;
+            weight = weight_;
+
+            mreal intpart;
+            use_int = (std::modf(alpha, &intpart) == 0.0) && (std::modf(beta / 2, &intpart) == 0.0);
+
+            Update();
+        }
+
         ~TPObstacleBarnesHut0()
         {
             if (o_bvh)
@@ -50,6 +70,9 @@ namespace rsurfaces
         // V x 3 matrix, where each row holds the differential (a 3-vector) with
         // respect to the corresponding vertex.
         virtual void Differential(Eigen::MatrixXd &output);
+        // Computes the value and the differential in a single pass, since the
+        // derivative kernels evaluate all the terms of the energy anyway.
+        virtual double ValueAndDifferential(Eigen::MatrixXd &output);
 
         // Update the energy to reflect the current state of the mesh. This could
         // involve building a new BVH for Barnes-Hut energies, for instance.
@@ -77,12 +100,6 @@ namespace rsurfaces
         OptimizedClusterTree * bvh = nullptr;
         OptimizedClusterTree * o_bvh = nullptr;
 
-        template <typename T1, typename T2>
-        mreal Energy(T1 alpha, T2 betahalf);
-
-        template <typename T1, typename T2>
-        mreal DEnergy(T1 alpha, T2 betahalf);
-
     }; // TPEnergyBarnesHut0
 
 } // namespace rsurfaces
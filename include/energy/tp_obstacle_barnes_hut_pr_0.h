@@ -49,6 +49,9 @@ namespace rsurfaces
         // V x 3 matrix, where each row holds the differential (a 3-vector) with
         // respect to the corresponding vertex.
         virtual void Differential(Eigen::MatrixXd &output);
+        // Computes the value and the differential in a single pass, since the
+        // derivative kernels evaluate all the terms of the energy anyway.
+        virtual double ValueAndDifferential(Eigen::MatrixXd &output);
 
         // Update the energy to reflect the current state of the mesh. This could
         // involve building a new BVH for Barnes-Hut energies, for instance.
@@ -84,12 +87,6 @@ namespace rsurfaces
         OptimizedClusterTree * bvh = nullptr;
         OptimizedClusterTree * o_bvh = nullptr;
 
-        template <typename T1, typename T2>
-        mreal Energy(T1 alpha, T2 betahalf);
-
-        template <typename T1, typename T2>
-        mreal DEnergy(T1 alpha, T2 betahalf);
-
     }; // TPEnergyBarnesHut0
 
 } // namespace rsurfaces
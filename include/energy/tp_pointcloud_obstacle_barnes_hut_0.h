@@ -30,7 +30,113 @@ namespace rsurfaces
                 return;
             }
 
-            mint primitive_count = pt_positions.rows();
+            // Eigen::MatrixXd is column major.
+            BuildObstacleTree( pt_weights.data(), pt_positions.data(), pt_positions.rows(), 1, pt_positions.rows() );
+            SetParameters( alpha_, beta_, theta_, weight_ );
+        }
+
+        // Builds the obstacle directly from raw arrays, e.g. memory-mapped from a binary file, without
+        // going through Eigen. pt_positions is an array of size pt_count x 3 stored in row major order.
+        // If pt_weights is nullptr, all points get unit weight.
+        TPPointCloudObstacleBarnesHut0(MeshPtr mesh_, GeomPtr geom_, SurfaceEnergy *bvhSharedFrom_,
+                                       const mreal * pt_weights, const mreal * pt_positions, mint pt_count,
+                                       mreal alpha_, mreal beta_, mreal theta_, mreal weight_ = 1.)
+        {
+            mesh = mesh_;
+            geom = geom_;
+            bvh = 0;
+            bvhSharedFrom = bvhSharedFrom_;
+
+            BuildObstacleTree( pt_weights, pt_positions, pt_count, 3, 1 );
+            SetParameters( alpha_, beta_, theta_, weight_ );
+        }
+
+        // Takes ownership of an already built point tree, e.g. one merged from several point clouds.
+        // Its primitives must hold (weight, position) in the first four slots of the near and far data.
+        TPPointCloudObstacleBarnesHut0(MeshPtr mesh_, GeomPtr geom_, SurfaceEnergy *bvhSharedFrom_, OptimizedClusterTree *o_bvh_,
+                                       mreal alpha_, mreal beta_, mreal theta_, mreal weight_ = 1.)
+        {
+            mesh = mesh_;
+            geom = geom_;
+            bvh = 0;
+            bvhSharedFrom = bvhSharedFrom_;
+            o_bvh = o_bvh_;
+
+            SetParameters( alpha_, beta_, theta_, weight_ );
+        }
+
+        ~TPPointCloudObstacleBarnesHut0()
+        {
+            if (o_bvh)
+            {
+                delete o_bvh;
+            }
+        }
+
+        // Returns the current value of the energy.
+        virtual double Value();
+
+        // Returns the current differential of the energy, stored in the given
+        // V x 3 matrix, where each row holds the differential (a 3-vector) with
+        // respect to the corresponding vertex.
+        virtual void Differential(Eigen::MatrixXd &output);
+
+        // Update the energy to reflect the current state of the mesh. This could
+        // involve building a new BVH for Barnes-Hut energies, for instance.
+        virtual void Update();
+
+        // Get the mesh associated with this energy.
+        virtual MeshPtr GetMesh();
+
+        // Get the geometry associated with this geometry.
+        virtual GeomPtr GetGeom();
+
+        // Get the exponents of this energy; only applies to tangent-point energies.
+        virtual Vector2 GetExponents();
+
+        // Get a pointer to the current BVH for this energy.
+        // Return 0 if the energy doesn't use a BVH.
+        virtual OptimizedClusterTree *GetBVH();
+
+        // Return the separation parameter for this energy.
+        // Return 0 if this energy doesn't do hierarchical approximation.
+        virtual double GetTheta();
+
+        bool use_int = false;
+
+    private:
+        MeshPtr mesh = nullptr;
+        GeomPtr geom = nullptr;
+        mreal alpha = 6.;
+        mreal beta = 12.;
+        mreal theta = 0.5;
+
+        SurfaceEnergy * bvhSharedFrom;
+        OptimizedClusterTree * bvh = nullptr;
+        OptimizedClusterTree * o_bvh = nullptr;
+
+        template <typename T1, typename T2>
+        mreal Energy(T1 alpha, T2 betahalf);
+
+        template <typename T1, typename T2>
+        mreal DEnergy(T1 alpha, T2 betahalf);
+
+        void SetParameters( mreal alpha_, mreal beta_, mreal theta_, mreal weight_ )
+        {
+            alpha = alpha_;
+            beta = beta_;
+            theta = theta_;
+            weight = weight_;
+
+            mreal intpart;
+            use_int = (std::modf(alpha, &intpart) == 0.0) && (std::modf(beta / 2, &intpart) == 0.0);
+            
+            Update();
+        }
+
+        // Position k of point i is read from pt_positions[ row_stride * i + col_stride * k ].
+        void BuildObstacleTree( const mreal * pt_weights, const mreal * pt_positions, mint primitive_count, mint row_stride, mint col_stride )
+        {
             mint dim = 3;
             mint primitive_length = 1;
 
@@ -38,12 +144,12 @@ namespace rsurfaces
             mint far_dim = bvhSharedFrom->GetBVH()->far_dim;
             safe_alloc( P_far, primitive_count * far_dim, 0.);
             #pragma omp parallel for
-            for( mint i = 0; i < pt_positions.rows(); ++i )
+            for( mint i = 0; i < primitive_count; ++i )
             {
-                P_far[ far_dim * i + 0] = pt_weights(i);
-                P_far[ far_dim * i + 1] = pt_positions(i,0);
-                P_far[ far_dim * i + 2] = pt_positions(i,1);
-                P_far[ far_dim * i + 3] = pt_positions(i,2);
+                P_far[ far_dim * i + 0] = pt_weights ? pt_weights[i] : 1.;
+                P_far[ far_dim * i + 1] = pt_positions[ row_stride * i ];
+                P_far[ far_dim * i + 2] = pt_positions[ row_stride * i + col_stride ];
+                P_far[ far_dim * i + 3] = pt_positions[ row_stride * i + 2 * col_stride ];
             }
 
             mreal * P_near = nullptr;
@@ -52,12 +158,12 @@ namespace rsurfaces
             safe_alloc( P_near, primitive_count * near_dim, 0.);
             safe_alloc( P_coords, primitive_count * dim, 0.);
             #pragma omp parallel for
-            for( mint i = 0; i < pt_positions.rows(); ++i )
+            for( mint i = 0; i < primitive_count; ++i )
             {
-                P_near[ near_dim * i + 0] = pt_weights(i);
-                P_near[ near_dim * i + 1] = P_coords[ dim * i + 0] = pt_positions(i,0);
-                P_near[ near_dim * i + 2] = P_coords[ dim * i + 1] = pt_positions(i,1);
-                P_near[ near_dim * i + 3] = P_coords[ dim * i + 2] = pt_positions(i,2);
+                P_near[ near_dim * i + 0] = pt_weights ? pt_weights[i] : 1.;
+                P_near[ near_dim * i + 1] = P_coords[ dim * i + 0] = pt_positions[ row_stride * i ];
+                P_near[ near_dim * i + 2] = P_coords[ dim * i + 1] = pt_positions[ row_stride * i + col_stride ];
+                P_near[ near_dim * i + 3] = P_coords[ dim * i + 2] = pt_positions[ row_stride * i + 2 * col_stride ];
             }
 
             mint * idx = nullptr;
@@ -106,74 +212,8 @@ namespace rsurfaces
             safe_free(idxdim);
             safe_free(ones);
             safe_free(zeroes);
-
-            alpha = alpha_;
-            beta = beta_;
-            theta = theta_;
-            weight = weight_;
-
-            mreal intpart;
-            use_int = (std::modf(alpha, &intpart) == 0.0) && (std::modf(beta / 2, &intpart) == 0.0);
-            
-            Update();
-        }
-
-        ~TPPointCloudObstacleBarnesHut0()
-        {
-            if (o_bvh)
-            {
-                delete o_bvh;
-            }
         }
 
-        // Returns the current value of the energy.
-        virtual double Value();
-
-        // Returns the current differential of the energy, stored in the given
-        // V x 3 matrix, where each row holds the differential (a 3-vector) with
-        // respect to the corresponding vertex.
-        virtual void Differential(Eigen::MatrixXd &output);
-
-        // Update the energy to reflect the current state of the mesh. This could
-        // involve building a new BVH for Barnes-Hut energies, for instance.
-        virtual void Update();
-
-        // Get the mesh associated with this energy.
-        virtual MeshPtr GetMesh();
-
-        // Get the geometry associated with this geometry.
-        virtual GeomPtr GetGeom();
-
-        // Get the exponents of this energy; only applies to tangent-point energies.
-        virtual Vector2 GetExponents();
-
-        // Get a pointer to the current BVH for this energy.
-        // Return 0 if the energy doesn't use a BVH.
-        virtual OptimizedClusterTree *GetBVH();
-
-        // Return the separation parameter for this energy.
-        // Return 0 if this energy doesn't do hierarchical approximation.
-        virtual double GetTheta();
-
-        bool use_int = false;
-
-    private:
-        MeshPtr mesh = nullptr;
-        GeomPtr geom = nullptr;
-        mreal alpha = 6.;
-        mreal beta = 12.;
-        mreal theta = 0.5;
-
-        SurfaceEnergy * bvhSharedFrom;
-        OptimizedClusterTree * bvh = nullptr;
-        OptimizedClusterTree * o_bvh = nullptr;
-
-        template <typename T1, typename T2>
-        mreal Energy(T1 alpha, T2 betahalf);
-
-        template <typename T1, typename T2>
-        mreal DEnergy(T1 alpha, T2 betahalf);
-
     }; // TPEnergyBarnesHut0
 
 } // namespace rsurfaces
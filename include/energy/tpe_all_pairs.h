@@ -6,6 +6,7 @@
 #include "optimized_bct_types.h"
 #include "optimized_bct.h"
 #include "derivative_assembler.h"
+#include "bct_constructors.h"
 
 
 namespace rsurfaces
@@ -45,6 +46,9 @@ namespace rsurfaces
         // Update the energy to reflect the current state of the mesh. This could
         // involve building a new BVH for Barnes-Hut energies, for instance.
         virtual void Update();
+
+        // The next Update repairs the current BVH for the remeshed faces.
+        virtual void NotifyRemeshed(const std::vector<mint> &faceOrigins);
         
         // Get the exponents of this energy; only applies to tangent-point energies.
         virtual Vector2 GetExponents();
@@ -63,6 +67,7 @@ namespace rsurfaces
         
     private:
         OptimizedClusterTree* bvh = nullptr;
+        FaceOriginTracker faceOrigins;
         
         mreal alpha = 6.;
         mreal beta  = 12.;
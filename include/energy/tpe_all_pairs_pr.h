@@ -6,6 +6,7 @@
 #include "optimized_bct_types.h"
 #include "optimized_bct.h"
 #include "derivative_assembler.h"
+#include "bct_constructors.h"
 
 
 namespace rsurfaces
@@ -48,6 +49,9 @@ namespace rsurfaces
         // involve building a new BVH for Barnes-Hut energies, for instance.
         virtual void Update();
 
+        // The next Update repairs the current BVH for the remeshed faces.
+        virtual void NotifyRemeshed(const std::vector<mint> &faceOrigins);
+
         // Get the mesh associated with this energy.
         virtual MeshPtr GetMesh();
 
@@ -73,6 +77,7 @@ namespace rsurfaces
         MeshPtr mesh = nullptr;
         GeomPtr geom = nullptr;
         OptimizedClusterTree * bvh = nullptr;
+        FaceOriginTracker faceOrigins;
         
         mreal alpha = 6.;
         mreal beta  = 12.;
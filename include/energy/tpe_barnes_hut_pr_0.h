@@ -6,6 +6,7 @@
 #include "optimized_bct_types.h"
 #include "optimized_bct.h"
 #include "derivative_assembler.h"
+#include "bct_constructors.h"
 
 namespace rsurfaces
 {
@@ -44,11 +45,17 @@ namespace rsurfaces
         // V x 3 matrix, where each row holds the differential (a 3-vector) with
         // respect to the corresponding vertex.
         virtual void Differential(Eigen::MatrixXd &output);
+        // Computes the value and the differential in a single pass, since the
+        // derivative kernels evaluate all the terms of the energy anyway.
+        virtual double ValueAndDifferential(Eigen::MatrixXd &output);
 
         // Update the energy to reflect the current state of the mesh. This could
         // involve building a new BVH for Barnes-Hut energies, for instance.
         virtual void Update();
 
+        // The next Update repairs the current BVH for the remeshed faces.
+        virtual void NotifyRemeshed(const std::vector<mint> &faceOrigins);
+
         // Get the mesh associated with this energy.
         virtual MeshPtr GetMesh();
 
@@ -77,12 +84,7 @@ namespace rsurfaces
         mreal theta = 0.5;
         
         OptimizedClusterTree* bvh;
-        
-        template<typename T1, typename T2>
-        mreal Energy(T1 alpha, T2 betahalf);
-        
-        template<typename T1, typename T2>
-        mreal DEnergy(T1 alpha, T2 betahalf);
+        FaceOriginTracker faceOrigins;
         
     }; // TPEnergyBarnesHut0
 
@@ -37,6 +37,9 @@ namespace rsurfaces
         // V x 3 matrix, where each row holds the differential (a 3-vector) with
         // respect to the corresponding vertex.
         virtual void Differential(Eigen::MatrixXd &output);
+        // Computes the value and the differential in a single pass, since the
+        // derivative kernels evaluate all the terms of the energy anyway.
+        virtual double ValueAndDifferential(Eigen::MatrixXd &output);
 
         // Get the exponents of this energy; only applies to tangent-point energies.
         virtual Vector2 GetExponents();
@@ -58,20 +61,6 @@ namespace rsurfaces
         
         mreal alpha = 6.;
         mreal beta  = 12.;
-        
-        template<typename T1, typename T2>
-        mreal FarField( T1 alpha, T2 betahalf);
-        
-        template<typename T1, typename T2>
-        mreal NearField(T1 alpha, T2 betahalf);
-        
-        template<typename T1, typename T2>
-        mreal DFarField(T1 alpha, T2 betahalf);
-        
-        template<typename T1, typename T2>
-        mreal DNearField(T1 alpha, T2 betahalf);
-        
-        
     }; // TPEnergyMultipole0
 
 } // namespace rsurfaces
@@ -5,6 +5,7 @@
 #include "helpers.h"
 #include "optimized_bct_types.h"
 #include "derivative_assembler.h"
+#include "sobolev/flat_bilaplacian.h"
 
 namespace rsurfaces
 {
@@ -34,11 +35,16 @@ namespace rsurfaces
         // Willmore energy should add a bi-Laplacian term.
         virtual void AddMetricTerm(std::vector<MetricTerm*> &terms);
 
+        // Refreshes the flat operators and the mean curvature vectors
+        // H = -1/(2 A) L x, which vanish on the boundary.
         void requireMeanCurvatureVectors();
         
     private:
-        Eigen::MatrixXd H;
-        Eigen::VectorXd H_squared;
+        // Shared with the bi-Laplacian metric term, so that both reuse the same
+        // sparsity patterns across steps.
+        std::shared_ptr<FlatBiLaplacian> operators = std::make_shared<FlatBiLaplacian>();
+        std::vector<mreal> H;
+        std::vector<mreal> H_squared;
         
     }; // WillmoreEnergy
 } // namespace rsurfaces
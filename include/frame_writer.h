@@ -0,0 +1,92 @@
+#pragma once
+
+#include "rsurface_types.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace rsurfaces
+{
+    enum class FrameFormat
+    {
+        OBJ,
+        Binary,
+        Trajectory
+    };
+
+    class TrajectoryWriter;
+
+    // Everything needed to write one frame, copied out of the mesh so that
+    // the flow can keep mutating it while the frame is being written.
+    struct FrameSnapshot
+    {
+        std::string filename;
+        FrameFormat format;
+        bool compress;
+        // V x 3, row major, so that the data is x/y/z per vertex like in the binary format
+        Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor> positions;
+        // Shared between all frames until the connectivity changes
+        std::shared_ptr<const std::vector<uint32_t>> faces;
+        // Empty if area ratios are not written. The binary format stores them as per-face
+        // data with the ratio of each of the three corners; trajectories cannot hold them.
+        Eigen::VectorXd areaRatios;
+    };
+
+    // Writes mesh frames on a background thread. Enqueue only copies the vertex
+    // positions; all formatting, compression and disk access happen off the
+    // flow's critical path. At most maxQueued frames are held in memory; if the
+    // disk falls behind, Enqueue blocks until a slot frees up.
+    class AsyncFrameWriter
+    {
+    public:
+        AsyncFrameWriter(size_t maxQueued_ = 4);
+        ~AsyncFrameWriter();
+
+        // Snapshots the current positions and queues a frame to be written to output.
+        // The file extension is adjusted to the chosen format / compression. In the
+        // Trajectory format, all frames are appended to trajectoryFile instead, without
+        // area ratios. The face list is copied again whenever connectivityEpoch differs
+        // from the one of the previous frame.
+        void Enqueue(MeshPtr mesh, GeomPtr geom, GeomPtr geomOrig, bool writeAreaRatios, std::string output,
+                     size_t connectivityEpoch);
+
+        // Makes the next frame take a new copy of the face list, for changes of the
+        // mesh that the connectivity epoch does not count, e.g. a compress.
+        void InvalidateConnectivity();
+
+        // Blocks until all queued frames have been written.
+        void Flush();
+
+        FrameFormat format;
+        bool compress;
+        std::string trajectoryFile;
+        double trajectoryQuantum;
+        // If not negative, an existing trajectory file is continued after this many
+        // frames instead of being started over; set when resuming from a checkpoint.
+        long trajectoryKeepFrames;
+
+    private:
+        void run();
+        void writeFrame(FrameSnapshot &frame);
+
+        size_t maxQueued;
+        bool stopping;
+        bool busy;
+        std::deque<FrameSnapshot> queue;
+        std::shared_ptr<const std::vector<uint32_t>> currentFaces;
+        size_t currentFacesEpoch;
+        bool warnedTrajectoryAreaRatios;
+        // Only touched by the worker thread; opened with the first trajectory frame
+        std::unique_ptr<TrajectoryWriter> trajectory;
+
+        std::mutex queueMutex;
+        std::condition_variable queueNotEmpty;
+        std::condition_variable queueNotFull;
+        std::thread worker;
+    };
+
+    // Returns true if frames can be gzip-compressed in this build.
+    bool frameCompressionAvailable();
+} // namespace rsurfaces
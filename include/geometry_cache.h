@@ -0,0 +1,80 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+namespace rsurfaces
+{
+    // Flat copies of the per-face / per-vertex quantities that are read while positions change
+    // quickly, e.g. during line search trials; positions are read in place from the geometry.
+    // Unlike geom->refreshQuantities(), Update only recomputes the quantities that have been
+    // required, and only for the faces and vertices around vertices that are marked as moving.
+    class GeometryCache
+    {
+    public:
+        enum Quantity
+        {
+            FaceAreas = 1,
+            FaceNormals = 2,
+            FaceBarycenters = 4,
+            VertexDualAreas = 8
+        };
+
+        // quantities is a combination of Quantity flags.
+        void Require(int quantities);
+        inline bool Requires(int quantities) const { return (required & quantities) == quantities; }
+
+        // Rebuilds the connectivity arrays and recomputes every required quantity; must be
+        // called after any change of connectivity. All vertices are marked as moving.
+        void Rebuild(MeshPtr const &mesh, GeomPtr const &geom);
+
+        // Marks the vertices with a nonzero row in the V x 3 matrix direction as the only
+        // ones that move from now on.
+        void SetMoving(const Eigen::MatrixXd &direction);
+        // Recomputes the required quantities around the moving vertices.
+        void Update();
+
+        inline mint VertexCount() const { return vertexCount; }
+        inline mint FaceCount() const { return faceCount; }
+        // F x 3 vertex indices, in the order of the face's halfedges.
+        inline const mint *Triangles() const { return triangles.data(); }
+
+        // V x 3 row-major positions, owned by the geometry.
+        inline const mreal *Positions() const { return positions; }
+
+        inline const mreal *FaceArea() const { return faceArea.data(); }
+        inline const mreal *FaceNormalX() const { return nx.data(); }
+        inline const mreal *FaceNormalY() const { return ny.data(); }
+        inline const mreal *FaceNormalZ() const { return nz.data(); }
+        inline const mreal *FaceBarycenterX() const { return bx.data(); }
+        inline const mreal *FaceBarycenterY() const { return by.data(); }
+        inline const mreal *FaceBarycenterZ() const { return bz.data(); }
+        // Barycentric dual area of each vertex.
+        inline const mreal *VertexDualArea() const { return dualArea.data(); }
+
+    private:
+        void Resize();
+
+        int required = 0;
+        // Quantities that have been required but not computed yet
+        int missing = 0;
+
+        mint vertexCount = 0;
+        mint faceCount = 0;
+        const mreal *positions = nullptr;
+        std::vector<mint> triangles;
+
+        // Faces around each vertex
+        std::vector<mint> vf_outer;
+        std::vector<mint> vf_inner;
+
+        std::vector<char> vertexMoving;
+        std::vector<char> faceChanged;
+
+        std::vector<mreal> faceArea;
+        std::vector<mreal> nx, ny, nz;
+        std::vector<mreal> bx, by, bz;
+        std::vector<mreal> dualArea;
+    }; // GeometryCache
+
+} // namespace rsurfaces
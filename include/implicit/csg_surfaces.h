@@ -0,0 +1,39 @@
+#pragma once
+
+#include "implicit/implicit_surface.h"
+
+namespace rsurfaces
+{
+    enum class CSGOperation
+    {
+        Union,
+        Intersection,
+        Difference
+    };
+
+    // Boolean combination of two implicit surfaces, using min / max of the
+    // signed distances. The result is exact outside the combined shape for
+    // unions and a (conservative) bound elsewhere, which is all a barrier
+    // energy needs. Difference removes the second surface from the first.
+    class ImplicitCSG : public ImplicitSurface {
+        public:
+        ImplicitCSG(CSGOperation op, std::unique_ptr<ImplicitSurface> first_, std::unique_ptr<ImplicitSurface> second_);
+        virtual double SignedDistance(Vector3 point);
+        virtual Vector3 GradientOfDistance(Vector3 point);
+        virtual double BoundingDiameter();
+        virtual Vector3 BoundingCenter();
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
+
+        private:
+        CSGOperation operation;
+        std::unique_ptr<ImplicitSurface> first;
+        std::unique_ptr<ImplicitSurface> second;
+
+        // Whether the second operand determines the value, given both distances
+        // (with the second one already negated for differences)
+        inline bool takeSecond(double d1, double d2) const
+        {
+            return (operation == CSGOperation::Union) ? (d2 < d1) : (d2 > d1);
+        }
+    };
+}
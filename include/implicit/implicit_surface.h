@@ -11,5 +11,11 @@ namespace rsurfaces
         virtual Vector3 GradientOfDistance(Vector3 point) = 0;
         virtual double BoundingDiameter() = 0;
         virtual Vector3 BoundingCenter() = 0;
+
+        // Evaluates the signed distance (and, if gradients is nonzero, its
+        // gradient) at n points at once. points and gradients hold 3 doubles
+        // per point. The default falls back on the per-point virtual calls;
+        // surfaces with closed forms override it with a vectorized loop.
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "implicit/implicit_surface.h"
+
+#include <unordered_map>
+
+namespace rsurfaces
+{
+    // Signed distance to a triangle mesh, sampled on a sparse grid. Only the
+    // blocks of grid nodes within a narrow band around the mesh are stored;
+    // inside the band, the distance and its gradient come from trilinear
+    // interpolation, at a constant cost per query no matter how large the mesh
+    // is. Outside the band, the distance is reported as plus or minus the band
+    // width (negative inside) with a zero gradient, i.e. the surface exerts no
+    // force there.
+    //
+    // Signs come from angle-weighted pseudonormals, so the mesh should be
+    // closed and consistently oriented for the inside to be negative.
+    class MeshSDF : public ImplicitSurface
+    {
+    public:
+        MeshSDF(surface::SurfaceMesh &mesh, surface::VertexPositionGeometry &geom, double cellSize_, int bandCells_ = 4);
+
+        virtual double SignedDistance(Vector3 point);
+        virtual Vector3 GradientOfDistance(Vector3 point);
+        virtual double BoundingDiameter();
+        virtual Vector3 BoundingCenter();
+
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
+
+        inline size_t BlockCount() const { return blockKeys.size(); }
+
+    private:
+        // Cells per block along each axis; a block stores (B + 1)^3 nodes, so
+        // that every cell can be interpolated from a single block.
+        static const int B = 8;
+        static const int NODES = B + 1;
+
+        double cellSize;
+        double bandWidth;
+        Vector3 origin;
+        Vector3 boxMin;
+        Vector3 boxMax;
+
+        std::vector<uint64_t> blockKeys;
+        std::vector<float> blockValues;
+        std::unordered_map<uint64_t, size_t> blockIndex;
+        // Over the box of blocks around the stored ones: whether a block that is
+        // not stored lies inside the mesh.
+        int64_t blockLo[3];
+        int64_t blockHi[3];
+        std::vector<char> blockInside;
+
+        // Whether the block (i, j, k), which must not be stored, lies inside the mesh.
+        bool missingBlockInside(int64_t i, int64_t j, int64_t k) const;
+        double evaluate(const double *p, double *gradient) const;
+    };
+} // namespace rsurfaces
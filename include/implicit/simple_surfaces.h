@@ -11,6 +11,7 @@ namespace rsurfaces
         virtual Vector3 GradientOfDistance(Vector3 point);
         virtual double BoundingDiameter();
         virtual Vector3 BoundingCenter();
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
 
         private:
         double radius;
@@ -25,6 +26,7 @@ namespace rsurfaces
         virtual Vector3 GradientOfDistance(Vector3 point);
         virtual double BoundingDiameter();
         virtual Vector3 BoundingCenter();
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
 
         private:
         double radius;
@@ -39,6 +41,7 @@ namespace rsurfaces
         virtual Vector3 GradientOfDistance(Vector3 point);
         virtual double BoundingDiameter();
         virtual Vector3 BoundingCenter();
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
 
         private:
         double majorRadius;
@@ -53,6 +56,7 @@ namespace rsurfaces
         virtual Vector3 GradientOfDistance(Vector3 point2);
         virtual double BoundingDiameter();
         virtual Vector3 BoundingCenter();
+        virtual void Evaluate(const double *points, size_t n, double *distances, double *gradients);
 
         private:
         Vector3 point;
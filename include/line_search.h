@@ -2,6 +2,10 @@
 
 #include "rsurface_types.h"
 #include "surface_energy.h"
+#include "geometry_cache.h"
+#include "vertex_positions.h"
+
+#include <cmath>
 
 namespace rsurfaces
 {
@@ -17,30 +21,41 @@ namespace rsurfaces
         return sum;
     }
 
-    inline void AddGradientsToMatrix(std::vector<SurfaceEnergy*> &energies, Eigen::MatrixXd &gradient)
+    // Adds the differentials of all energies to gradient, and returns the
+    // total energy, which comes out of the same passes.
+    inline double AddGradientsToMatrix(std::vector<SurfaceEnergy*> &energies, Eigen::MatrixXd &gradient)
     {
+        double sum = 0;
         for (SurfaceEnergy *energy : energies)
         {
-            energy->Differential(gradient);
+            sum += energy->ValueAndDifferential(gradient);
         }
+        return sum;
     }
 
     class LineSearch
     {
         public:
-        LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_=-1.);
+        // If the total energy at the current configuration is already known, it
+        // can be passed as initialEnergy_ to save evaluating it again. With a
+        // cache, trial steps only update the cache and the BVH instead of all
+        // quantities of the geometry, which is refreshed once at the end.
+        LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_=-1., double initialEnergy_=NAN, GeometryCache *cache_=nullptr);
         double BacktrackingLineSearch(Eigen::MatrixXd &gradient, double initGuess, double gradDot, bool negativeIsForward = true);
         
         private:
         MeshPtr mesh;
         GeomPtr geom;
         std::vector<SurfaceEnergy*> energies;
-        Eigen::MatrixXd origPositions;
+        EigenMatrixRM origPositions;
         double maxStep;
+        double knownInitialEnergy;
+        GeometryCache *cache;
 
         void SaveCurrentPositions();
         void RestorePositions();
         void SetGradientStep(Eigen::MatrixXd &gradient, double delta);
+        void RefreshGeometry();
     };
 }
 
@@ -17,19 +17,17 @@
 #include "energy/tpe_multipole_0.h"
 #include "energy/tpe_barnes_hut_0.h"
 #include "implicit/simple_surfaces.h"
-#include "marchingcubes/CIsoSurface.h"
+#include "implicit/mesh_sdf.h"
+#include "implicit/csg_surfaces.h"
+#include "marchingcubes/parallel_marching_cubes.h"
+#include "frame_writer.h"
+#include "merged_obstacle_tree.h"
+#include "drag_editor.h"
 
 #define EIGEN_NO_DEBUG
 
 namespace rsurfaces
 {
-    struct PriorityVertex
-    {
-        GCVertex vertex;
-        double priority;
-        Vector3 position;
-    };
-
     class MainApp
     {
     public:
@@ -37,6 +35,8 @@ namespace rsurfaces
         static int defaultNumThreads;
         static MainApp *instance;
         MainApp(MeshPtr mesh_, GeomPtr geom_, SurfaceFlow *flow_, polyscope::SurfaceMesh *psMesh_, std::string meshName_);
+        // Waits for the frames still queued in the frame writer to reach the disk.
+        ~MainApp();
 
         void CreateAndDestroyBVH();
         void TestWillmore();
@@ -49,14 +49,22 @@ namespace rsurfaces
         void TestNormalDeriv();
         void MeshImplicitSurface(ImplicitSurface *surface);
 
-        void GetFalloffWindow(GCVertex v, double radius, std::vector<PriorityVertex> &verts);
         void HandlePicking();
 
         void TakeOptimizationStep(bool remeshAfter, bool showAreaRatios);
         void AddObstacle(std::string filename, double weight, bool recenter, bool asPointCloud);
+        void AddMappedPointCloudObstacle(std::string filename, double weight);
+        void AddStreamedPointCloudObstacle(std::string filename, double weight, double cellSize);
+        // Builds one energy for all obstacles added so far; call after the last AddObstacle.
+        void FinishObstacles();
         void AddPotential(scene::PotentialType pType, double weight, double targetValue);
+        static ImplicitSurface *CreateImplicitSurface(scene::ImplicitBarrierData &implicitBarrier);
         void AddImplicitBarrier(scene::ImplicitBarrierData &implicitBarrier);
 
+        // Checkpoints are written as <prefix>.rsm (mesh) and <prefix>.state (everything else).
+        void SaveCheckpoint(std::string prefix);
+        void LoadCheckpoint(std::string prefix);
+
         MeshPtr mesh;
         GeomPtr geom;
         GeomPtr geomOrig;
@@ -89,11 +97,20 @@ namespace rsurfaces
         scene::SceneData sceneData;
         bool exitWhenDone;
         double totalObstacleVolume;
+        MergedObstacleTreeBuilder obstacleTree;
+        // If set, the primitives of loaded obstacles are cached here, keyed by a hash of the obstacle file
+        std::string obstacleCacheDir;
+        AsyncFrameWriter frameWriter;
+        int checkpointInterval;
+        std::string checkpointPrefix;
+        // Number of the next frame to be written; part of the checkpoint, so that a
+        // resumed run continues the frame sequence instead of overwriting it
+        size_t frameIndex = 0;
+        DragEditor dragEditor;
 
     private:
         int implicitCount = 0;
         GCVertex pickedVertex;
-        std::vector<PriorityVertex> dragVertices;
 
         double pickDepth;
         void logPerformanceLine();
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+#include "implicit/implicit_surface.h"
+
+namespace rsurfaces
+{
+    // Regular grid of (nx + 1) x (ny + 1) x (nz + 1) sample points, starting at origin;
+    // samples are stored with x running fastest, as CIsoSurface expects them.
+    struct SampleGrid
+    {
+        Vector3 origin;
+        Vector3 cellLengths;
+        mint nx, ny, nz;
+
+        inline mint PointCount() const { return (nx + 1) * (ny + 1) * (nz + 1); }
+    };
+
+    // Samples the signed distance of the surface at all points of the grid, one z-plane
+    // at a time through the batched ImplicitSurface::Evaluate.
+    void SampleImplicitSurface(ImplicitSurface *surface, const SampleGrid &grid, std::vector<double> &field);
+
+    // Marching cubes over slabs of constant z, processed in parallel. Vertices on grid edges
+    // are numbered through one edge-index array per z-plane of grid points, so no map or lock
+    // is needed to share them between cells. Triangles use the tables of CIsoSurface and
+    // positions are absolute. positions is V x 3, triangles F x 3, both row-major.
+    void ExtractIsoSurface(const double *field, double isoLevel, const SampleGrid &grid,
+                           std::vector<double> &positions, std::vector<mint> &triangles);
+
+    // Builds a mesh directly from the output of ExtractIsoSurface, oriented so that it
+    // encloses positive volume. Throws if the triangles do not form a manifold.
+    std::tuple<MeshUPtr, GeomUPtr> IsoSurfaceToMesh(const std::vector<double> &positions, const std::vector<mint> &triangles);
+
+    // Samples the surface on a cubic grid with the given cell size that covers its bounding
+    // region plus one cell on every side, and meshes its zero level set. Throws if the grid
+    // would need more than 2^28 sample points.
+    std::tuple<MeshUPtr, GeomUPtr> ImplicitSurfaceToMesh(ImplicitSurface *surface, double cellSize);
+} // namespace rsurfaces
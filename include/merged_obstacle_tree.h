@@ -0,0 +1,76 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_cluster_tree.h"
+
+namespace rsurfaces
+{
+    // Collects the primitives of several static obstacles (triangle meshes and
+    // point clouds) and builds one OptimizedClusterTree over all triangles and
+    // one over all points, so that every energy evaluation needs at most two
+    // traversals against the flowing mesh, no matter how many obstacles the
+    // scene has. Points stay points (hulls of length 1), so that large clouds
+    // cost no more than a point cloud tree of their own.
+    //
+    // The obstacle side of the tangent-point energy and of the metric is linear
+    // in the areas of the obstacle primitives, so each obstacle's weight is
+    // folded into the areas of its primitives. The resulting trees are then used
+    // with a total weight of 1.
+    class MergedObstacleTreeBuilder
+    {
+    public:
+        void AddMesh(surface::SurfaceMesh &mesh, surface::VertexPositionGeometry &geom, mreal weight);
+
+        // pt_positions is an array of size pt_count x 3 stored in row major order.
+        // If pt_weights is nullptr, all points get unit weight.
+        void AddPointCloud(const mreal *pt_positions, const mreal *pt_weights, mint pt_count, mreal weight);
+
+        // Builds the tree over all triangles, or over all points, with the same
+        // per-primitive data layout as the tree of the flowing mesh; the caller
+        // takes ownership. Returns 0 if there are no primitives of that kind.
+        OptimizedClusterTree *Build(mint near_dim, mint far_dim, bool pointClouds) const;
+
+        void Clear();
+
+        inline mint PrimitiveCount() const { return triangles.areas.size() + points.areas.size(); }
+        inline mint ObstacleCount() const { return obstacleBegin.size(); }
+
+        // Writes the primitives of the most recently added obstacle, without its
+        // weight, to a cache file, so that later runs can skip loading the obstacle.
+        void SaveLastObstacle(std::string cacheFile, double volume) const;
+
+        // Adds an obstacle from a cache file written by SaveLastObstacle. Returns
+        // false if the file does not exist or is not a valid cache file.
+        bool LoadObstacle(std::string cacheFile, mreal weight, double &volume);
+
+        // Triangles (corners of the primitive hulls) or points of the most recently
+        // added obstacle, for display.
+        void LastObstacleGeometry(std::vector<Vector3> &points, std::vector<std::vector<size_t>> &triangles) const;
+
+    private:
+        // Per primitive: weighted area and barycenter; triangles also keep their
+        // normal and the three corners of their hull. Points have neither.
+        struct PrimitivePool
+        {
+            std::vector<mreal> areas;
+            std::vector<mreal> centers;
+            std::vector<mreal> normals;
+            std::vector<mreal> hulls;
+
+            void resize(mint count, bool isPointCloud);
+        };
+        PrimitivePool triangles;
+        PrimitivePool points;
+
+        // First primitive (in its pool), weight and kind of every obstacle added so far
+        std::vector<mint> obstacleBegin;
+        std::vector<mreal> obstacleWeights;
+        std::vector<bool> obstacleIsPointCloud;
+
+        void beginObstacle(mreal weight, bool isPointCloud);
+    };
+
+    // Name of the cache file for an obstacle, derived from a hash of the
+    // file's contents and of the options that change its primitives.
+    std::string obstacleCacheFile(std::string cacheDir, std::string filename, bool recenter, bool asPointCloud);
+} // namespace rsurfaces
@@ -2,6 +2,7 @@
 
 #include "rsurface_types.h"
 #include "optimized_bct.h"
+#include "sobolev/flat_bilaplacian.h"
 
 namespace rsurfaces
 {
@@ -35,11 +36,12 @@ namespace rsurfaces
     {
         public:
         BiLaplacianMetricTerm(MeshPtr &mesh, GeomPtr &geom);
+        // Reuses the sparsity patterns cached in the given operators.
+        BiLaplacianMetricTerm(MeshPtr &mesh, GeomPtr &geom, std::shared_ptr<FlatBiLaplacian> operators_);
         virtual void MultiplyAdd(Eigen::VectorXd &vec, Eigen::VectorXd &result) const;
 
         private:
-        size_t nMultiplyRows;
-        Eigen::SparseMatrix<double> biLaplacian;
+        std::shared_ptr<FlatBiLaplacian> operators;
     };
 }
 
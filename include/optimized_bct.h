@@ -30,6 +30,10 @@ namespace rsurfaces
         mreal near_lo_modifier = 1.;
         mreal near_hi_modifier = 1.;
         
+        // If false, the constructor only builds the near and far block cluster lists and skips the
+        // tangent-point metric matrices. Useful for energies that evaluate their own kernels on the lists.
+        bool require_metrics = true;
+        
 //        BCTSettings();
 //        ~BCTSettings();
     };
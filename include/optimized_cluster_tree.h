@@ -65,6 +65,29 @@ namespace rsurfaces
             MKLSparseMatrix &AvOp,
             BVHSettings settings_ = BVHDefaultSettings
         );
+
+        // Repairs the clustering of a previous tree for a locally changed primitive set, instead of
+        // clustering from scratch. previous_primitive[i] is the index that primitive i had in
+        // previous, or -1 for primitives that did not exist there. Kept primitives stay in their
+        // previous leaf and new ones go to the leaf whose bounding box is closest; leaves that
+        // now exceed split_threshold are split, and clusters that fell below it become leaves.
+        // All primitive and cluster data and the pre/post operators are computed as usual.
+        OptimizedClusterTree(
+            const OptimizedClusterTree &previous,
+            const mint * restrict const previous_primitive,
+            const mreal * restrict const P_coords_,
+            const mint primitive_count_,
+            const mint dim_,
+            const mreal * restrict const P_hull_coords_,
+            const mint hull_count_,
+            const mreal * restrict const P_near_,
+            const mint near_dim_,
+            const mreal * restrict const P_far_,
+            const mint far_dim_,
+            MKLSparseMatrix &DiffOp,
+            MKLSparseMatrix &AvOp,
+            BVHSettings settings_ = BVHDefaultSettings
+        );
         mint dim = 3;
         mint near_dim = 7; // = 1 + 3 + 3 for weight, center, normal, stored consecutively
         mint far_dim = 10; // = 1 + 3 + 3 * (3 + 1)/2 for weight, center, projector, stored consecutively
@@ -143,6 +166,13 @@ namespace rsurfaces
         A_Vector<A_Vector<mint>> chunk_roots;
         mint tree_max_depth = 0;
         bool chunks_prepared = false;
+
+        // Obstacle trees never change after construction. For a frozen tree, the
+        // primitive weights and their percolated cluster sums are computed once
+        // by Freeze() and reused by every block cluster tree built against it.
+        bool frozen = false;
+        mreal *restrict P_frozen_weights = nullptr;
+        mreal *restrict C_frozen_weights = nullptr;
         
         ~OptimizedClusterTree()
         {;
@@ -318,6 +348,12 @@ namespace rsurfaces
                         safe_free(C_is_chunk_root);
                     }
 
+                    #pragma omp task
+                    {
+                        safe_free(P_frozen_weights);
+                        safe_free(C_frozen_weights);
+                    }
+
                 }
             }
             ptoc("~OptimizedClusterTree");
@@ -391,9 +427,32 @@ namespace rsurfaces
         void SemiStaticUpdate( const mreal * restrict const P_near_, const mreal * restrict const P_far_ );
         
         void PrintToFile(std::string filename = "./OptimizedClusterTree.tsv");
+
+        // Marks the tree as static and precomputes the data that OptimizedBlockClusterTree
+        // would otherwise recompute from it on every construction.
+        void Freeze();
         
     private:
         
+        // Copies settings and sizes, and the clustering coordinates in the given ordering.
+        void Initialize( const mreal * restrict const P_coords_, const mint primitive_count_, const mint dim_, const mint hull_count_,
+                         const mint near_dim_, const mint far_dim_, const mint * restrict const ordering_, BVHSettings settings_ );
+
+        // Serializes the cluster tree below root (and deletes it), then computes all data from it.
+        void Finish( Cluster2 * root, const mreal * restrict const P_hull_coords_, const mreal * restrict const P_near_,
+                     const mreal * restrict const P_far_, MKLSparseMatrix &DiffOp, MKLSparseMatrix &AvOp );
+
+        // Finds the leaf (as index into leaf_clusters) that each primitive of a new primitive set belongs to.
+        void FindLeaves( const mreal * restrict const P_coords_, const mint count, const mint * restrict const previous_primitive, mint * restrict const leaf ) const;
+
+        // Rebuilds the subtree of cluster C of previous on the primitives sorted into its leaves;
+        // returns nullptr if the subtree lost all of its primitives.
+        Cluster2 * RepairCluster( const OptimizedClusterTree &previous, const mint C, const mint * restrict const leaf_ptr, const mint free_thread_count );
+
+        void CountDescendants( Cluster2 * const C, const mint depth );
+
+        void DeleteCluster( Cluster2 * const C );
+
         void computeClusterData(const mint C, const mint free_thread_count); // helper function for ComputeClusterData
 
         bool requireChunks( mint C, mint last, mint thread);
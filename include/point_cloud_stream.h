@@ -0,0 +1,69 @@
+#pragma once
+
+#include "rsurface_types.h"
+
+#include <unordered_map>
+
+namespace rsurfaces
+{
+    // Reduces a point cloud that is too large to hold in memory (several copies
+    // of it are needed to build a cluster tree) to a weighted point cloud of
+    // manageable size. Points are streamed in chunks and binned into a uniform
+    // grid; every occupied cell becomes one point at the centroid of its points,
+    // weighted by their count. To the Barnes-Hut traversal, such a point looks
+    // like a leaf cluster seen from afar, so the energy is approximated at the
+    // resolution of the grid: the error is small while the cell size is small
+    // compared to the distance of the flowing surface, and grows as the surface
+    // comes closer. Memory use only depends on the number of occupied cells.
+    class StreamingPointCloudReducer
+    {
+    public:
+        StreamingPointCloudReducer(double cellSize_);
+
+        // Adds count points, given as 3 doubles per point.
+        void AddChunk(const double *positions, size_t count);
+
+        // Streams the vertex positions of a binary mesh file in chunks of the
+        // given number of points, releasing each chunk's pages once it is binned.
+        void AddBinaryFile(std::string filename, size_t chunkSize = size_t(1) << 22);
+
+        // Writes the reduced cloud as 3 doubles per point and one weight per point.
+        void Extract(std::vector<double> &positions, std::vector<double> &weights) const;
+
+        inline size_t InputCount() const { return inputCount; }
+        inline size_t PointCount() const { return cells.size(); }
+
+    private:
+        struct CellKey
+        {
+            int64_t i, j, k;
+            inline bool operator==(const CellKey &other) const
+            {
+                return i == other.i && j == other.j && k == other.k;
+            }
+        };
+
+        struct CellKeyHash
+        {
+            inline size_t operator()(const CellKey &key) const
+            {
+                uint64_t h = uint64_t(key.i) * 73856093ull;
+                h ^= uint64_t(key.j) * 19349663ull;
+                h ^= uint64_t(key.k) * 83492791ull;
+                return h;
+            }
+        };
+
+        struct CellSum
+        {
+            double count = 0;
+            double x = 0;
+            double y = 0;
+            double z = 0;
+        };
+
+        double cellSize;
+        size_t inputCount;
+        std::unordered_map<CellKey, CellSum, CellKeyHash> cells;
+    };
+} // namespace rsurfaces
@@ -2,6 +2,8 @@
 
 #include "rsurface_types.h"
 #include "remeshing/remeshing.h"
+#include "remeshing/flat_smoother.h"
+#include "remeshing/vertex_transfer.h"
 #include "vertex_data_wrapper.h"
 
 #include "sobolev/all_constraints.h"
@@ -38,7 +40,28 @@ namespace rsurfaces
             DynamicRemesher(MeshPtr mesh_, GeomPtr geom_, GeomPtr geomOrig_);
             void SetModes(RemeshingMode rMode, SmoothingMode sMode, FlippingMode fMode);
             bool Remesh(int numIters, bool changeTopology);
+            // Registered data is interpolated through splits and collapses like the positions.
             void KeepVertexDataUpdated(VertexDataWrapper *data);
+            // How the vertices after the last split/collapse step were made from the ones
+            // before it, so that per-vertex state can be carried over.
+            inline const VertexTransfer &LastTransfer() const
+            {
+                return transfer;
+            }
+            // For each face after the last Remesh, the index it had before, or -1 if it is new.
+            inline const std::vector<mint> &FaceOrigins() const
+            {
+                return faceOrigins;
+            }
+            // Incremented by every flip, split or collapse, so that anything caching the
+            // connectivity can tell whether it is still current.
+            inline size_t ConnectivityEpoch() const
+            {
+                return connectivityEpoch;
+            }
+            // Target lengths are measured on the initial mesh, so a resumed run has to restore them
+            void SaveState(std::ostream &out);
+            void LoadState(std::istream &in);
             bool curvatureAdaptive;
 
             SmoothingMode smoothingMode;
@@ -56,6 +79,15 @@ namespace rsurfaces
             double initialHWeightedLength;
             double epsilon;
             std::vector<VertexDataWrapper *> vectorData;
+            std::vector<mint> faceOrigins;
+            VertexTransfer transfer;
+
+            // Smoothing works on flat copies of the connectivity and positions; the former are
+            // only rebuilt after splits, collapses or flips, the latter once per Remesh.
+            FlatSmoother smoother;
+            bool topologyChanged = true;
+            bool positionsLoaded = false;
+            size_t connectivityEpoch = 0;
         };
     } // namespace remeshing
 } // namespace rsurfaces
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+namespace rsurfaces
+{
+    namespace remeshing
+    {
+        // Tangential vertex smoothing on flat arrays. Connectivity is copied into CSR arrays
+        // once and reused until the topology changes; positions are held as separate x, y, z
+        // arrays and every pass writes into a second set of arrays that is then swapped in.
+        // Results match smoothByCircumcenter and smoothByLaplacian.
+        class FlatSmoother
+        {
+        public:
+            // Rebuilds the connectivity arrays; must be called after any split, collapse or flip.
+            void Rebuild(MeshPtr const &mesh);
+            // True if Rebuild has been called for a mesh with these element counts.
+            bool Matches(MeshPtr const &mesh) const;
+
+            // Copies the vertex positions from / to the geometry.
+            void Load(GeomPtr const &geom);
+            void Store(GeomPtr const &geom) const;
+
+            void SmoothByCircumcenter();
+            void SmoothByLaplacian();
+
+        private:
+            // Computes unit normals and areas of all faces and the angle at each corner, and
+            // optionally the circumcenters (barycenters for faces at the boundary).
+            void ComputeFaceData(bool centers);
+            // Writes the position of vertex i moved by stepSize * u, with u projected to the
+            // tangent plane of the angle-weighted vertex normal.
+            void TangentialStep(mint i, mreal u0, mreal u1, mreal u2, mreal stepSize);
+
+            mint vertexCount = 0;
+            mint faceCount = 0;
+            std::vector<GCVertex> vertices;
+
+            // F x 3 vertex indices; faces with a boundary edge are flagged
+            std::vector<mint> triangles;
+            std::vector<char> faceOnBoundary;
+            std::vector<char> vertexOnBoundary;
+
+            // Faces around each vertex, with the corner of the face the vertex sits at
+            std::vector<mint> vf_outer;
+            std::vector<mint> vf_face;
+            std::vector<mint> vf_corner;
+            // Neighbors of each vertex
+            std::vector<mint> vv_outer;
+            std::vector<mint> vv_inner;
+
+            std::vector<mreal> x, y, z;
+            std::vector<mreal> x_new, y_new, z_new;
+
+            std::vector<mreal> faceArea;
+            std::vector<mreal> nx, ny, nz;
+            std::vector<mreal> cx, cy, cz;
+            std::vector<mreal> cornerAngle;
+        }; // FlatSmoother
+    } // namespace remeshing
+} // namespace rsurfaces
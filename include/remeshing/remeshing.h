@@ -8,6 +8,7 @@
 #include <queue>
 
 #include "rsurface_types.h"
+#include "remeshing/vertex_transfer.h"
 
 namespace rsurfaces
 {
@@ -32,6 +33,11 @@ namespace rsurfaces
 
         void fixDelaunay(MeshPtr const &mesh, GeomPtr const &geometry);
 
+        // Same result as fixDelaunay, but works in rounds: the Delaunay test runs in parallel
+        // over all edges that may have changed, and each round flips a set of non-Delaunay
+        // edges no two of which share a face. Returns the number of flips.
+        size_t fixDelaunayParallel(MeshPtr const &mesh, GeomPtr const &geometry);
+
         void smoothByLaplacian(MeshPtr const &mesh, GeomPtr const &geometry);
 
         Vector3 findCircumcenter(Vector3 p1, Vector3 p2, Vector3 p3);
@@ -40,7 +46,9 @@ namespace rsurfaces
 
         void smoothByCircumcenter(MeshPtr const &mesh, GeomPtr const &geometry);
         
-        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive = true);
+        // Splits long and collapses short edges. If a transfer is given, it records how the
+        // new vertices are made from the old ones; the caller calls Begin and End around this.
+        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive = true, VertexTransfer *transfer = nullptr);
         
         Vector3 findBarycenter(Vector3 p1, Vector3 p2, Vector3 p3);
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+namespace rsurfaces
+{
+    namespace remeshing
+    {
+        // Records how the vertices of a mesh are created from the vertices it had before a
+        // round of splits and collapses, so that per-vertex data can be carried over: a split
+        // vertex takes the average of its edge's endpoints and a collapsed vertex the average
+        // of the two it replaced, just like their positions. After End, each vertex of the
+        // new mesh is a weighted sum of old vertices, stored in CSR form.
+        class VertexTransfer
+        {
+        public:
+            // Starts recording; vertex i of the (compressed) mesh is old vertex i.
+            void Begin(MeshPtr const &mesh);
+            void RecordSplit(GCVertex newVertex, GCVertex a, GCVertex b);
+            // Collapses have to be announced before they happen, since one endpoint disappears.
+            void StageCollapse(GCVertex a, GCVertex b);
+            // survivor is the vertex returned by the collapse; averaged is false if it kept its
+            // position (as boundary vertices do).
+            void CommitCollapse(GCVertex survivor, bool averaged);
+            // Finishes recording; call after the mesh has been compressed.
+            void End(MeshPtr const &mesh);
+
+            inline mint OldCount() const { return oldCount; }
+            inline mint NewCount() const { return (mint)outer.size() - 1; }
+
+            // new_data = T * old_data for per-vertex blocks of blockSize values.
+            void Apply(const mreal *oldData, mreal *newData, mint blockSize) const;
+            // Transfers a matrix with one row per vertex.
+            void Apply(Eigen::MatrixXd &data) const;
+            // Transfers a vector with blockSize consecutive entries per vertex.
+            void Apply(Eigen::VectorXd &data, mint blockSize) const;
+
+        private:
+            typedef std::vector<std::pair<mint, mreal>> Stencil;
+            Stencil GetStencil(GCVertex v) const;
+            void SetStencil(GCVertex v, Stencil s);
+            static Stencil Average(const Stencil &s1, const Stencil &s2);
+
+            mint oldCount = 0;
+            // Old index of each vertex (-1 for new ones), and the stencil of vertices
+            // that are not simply a copy of their old vertex (-1 otherwise)
+            surface::VertexData<mint> origin;
+            surface::VertexData<mint> stencilIndex;
+            std::vector<Stencil> stencils;
+            Stencil staged_a, staged_b;
+            GCVertex staged_va, staged_vb;
+
+            std::vector<mint> outer;
+            std::vector<mint> inner;
+            std::vector<mreal> weights;
+        }; // VertexTransfer
+    } // namespace remeshing
+} // namespace rsurfaces
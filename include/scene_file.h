@@ -56,6 +56,8 @@ namespace rsurfaces
             double weight;
             bool recenter = false;
             bool asPointCloud = false;
+            // If positive, the point cloud is streamed and reduced to cells of this size
+            double cellSize = 0;
         };
 
         enum class ImplicitType
@@ -63,7 +65,11 @@ namespace rsurfaces
             Sphere,
             Cylinder,
             Torus,
-            Plane
+            Plane,
+            Mesh,
+            Union,
+            Intersection,
+            Difference
         };
 
         struct ImplicitBarrierData
@@ -73,11 +79,18 @@ namespace rsurfaces
             bool repel = true;
             double power = 2;
             double weight = 1;
+            std::string meshFile;
+            // The two operands of Union, Intersection and Difference
+            std::vector<ImplicitBarrierData> operands;
         };
 
         struct SceneData
         {
             std::string meshName;
+            // If set, the starting mesh is generated from this implicit surface instead of read from meshName
+            bool meshFromImplicit = false;
+            ImplicitBarrierData meshImplicit;
+            double meshEdgeLength = 0;
             double alpha;
             double beta;
             bool allowBarycenterShift = false;
@@ -90,6 +103,11 @@ namespace rsurfaces
             int iterationLimit = 0;
             long realTimeLimit = 0;
             std::string performanceLogFile = "performance.csv";
+            int checkpointInterval = 0;
+            std::string checkpointPrefix = "checkpoint";
+            std::string trajectoryFile = "";
+            double trajectoryQuantum = 1e-6;
+            std::string obstacleCacheDir = "";
             GradientMethod defaultMethod = GradientMethod::HsProjectedIterative;
             bool disableNearField = false;
             bool autoComputeVolumeTarget = false;
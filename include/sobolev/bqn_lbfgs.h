@@ -13,6 +13,8 @@ namespace rsurfaces
         public:
         BQN_LBFGS(size_t memSize_, std::vector<Constraints::SimpleProjectorConstraint *> simpleConstraints_, double bqn_B_);
         virtual void UpdateHistory(Eigen::VectorXd &currentPosition, Eigen::VectorXd &currentGradient);
+        virtual void SaveState(std::ostream &out);
+        virtual void LoadState(std::istream &in);
 
         private:
         double bqn_B;
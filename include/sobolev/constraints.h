@@ -2,6 +2,7 @@
 
 #include "rsurface_types.h"
 #include "matrix_utils.h"
+#include "drag_region.h"
 
 namespace rsurfaces
 {
@@ -12,6 +13,12 @@ namespace rsurfaces
         public:
             virtual ~ConstraintBase() {}
             virtual void ResetFunction(const MeshPtr &mesh, const GeomPtr &geom) = 0;
+            // Like ResetFunction, after only the vertices of the given region have moved.
+            // Constraints that can re-target from the region alone override this.
+            virtual void ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region)
+            {
+                ResetFunction(mesh, geom);
+            }
             virtual void addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow) = 0;
             virtual void addEntries(Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow) = 0;
             virtual void addErrorValues(Eigen::VectorXd &V, const MeshPtr &mesh, const GeomPtr &geom, int baseRow) = 0;
@@ -11,6 +11,7 @@ namespace rsurfaces
         public:
             VertexNormalConstraint(const MeshPtr &mesh, const GeomPtr &geom);
             virtual void ResetFunction(const MeshPtr &mesh, const GeomPtr &geom);
+            virtual void ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region);
             virtual void addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow);
             virtual void addEntries(Eigen::MatrixXd &M, const MeshPtr &mesh, const GeomPtr &geom, int baseRow);
             virtual void addErrorValues(Eigen::VectorXd &V, const MeshPtr &mesh, const GeomPtr &geom, int baseRow);
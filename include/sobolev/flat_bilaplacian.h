@@ -0,0 +1,78 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+namespace rsurfaces
+{
+    // Cotan Laplacian L and bi-Laplacian L M^{-1} L of a triangle mesh, stored as
+    // flat CSR arrays. The sparsity patterns (and the index lists used to fill them)
+    // only depend on the triangle list, so they are built once and reused for as
+    // long as the connectivity does not change; each Update only recomputes values.
+    class FlatBiLaplacian
+    {
+    public:
+        // Re-reads positions and triangles from the mesh and recomputes cotan
+        // weights, dual areas and the Laplacian values.
+        void Update(MeshPtr const &mesh, GeomPtr const &geom);
+
+        // Recomputes the bi-Laplacian values from the current Laplacian values,
+        // adding epsilon to the diagonal.
+        void AssembleBiLaplacian(mreal epsilon);
+
+        // y += L * x, where x and y are V x 3 row-major arrays.
+        void MultiplyAddLaplacian(const mreal *x, mreal *y) const;
+        // y += (L M^{-1} L + epsilon I) * x, where x and y are V x 3 row-major arrays.
+        void MultiplyAddBiLaplacian(const mreal *x, mreal *y) const;
+
+        inline mint VertexCount() const { return vertex_count; }
+        inline mint TriangleCount() const { return triangle_count; }
+        // V x 3 row-major vertex positions.
+        inline const mreal *Positions() const { return positions.data(); }
+        // F x 3 row-major vertex indices.
+        inline const mint *Triangles() const { return triangles.data(); }
+        // Barycentric dual area of each vertex.
+        inline const mreal *DualAreas() const { return dual_areas.data(); }
+        // Nonzero for vertices that lie on the boundary.
+        inline const char *Boundary() const { return boundary.data(); }
+
+    private:
+        void BuildPatterns();
+
+        mint vertex_count = 0;
+        mint triangle_count = 0;
+
+        std::vector<mreal> positions;
+        std::vector<mint> triangles;
+        std::vector<mreal> dual_areas;
+        std::vector<mreal> inv_dual_areas;
+        std::vector<char> boundary;
+
+        // Half the cotangent of each triangle corner, and each triangle's area.
+        std::vector<mreal> corner_cotans;
+        std::vector<mreal> triangle_areas;
+
+        // Triangles incident to each vertex.
+        std::vector<mint> vt_outer;
+        std::vector<mint> vt_inner;
+
+        // Laplacian pattern (diagonal included); each off-diagonal slot lists
+        // the triangle corners that lie opposite of its edge.
+        std::vector<mint> L_outer;
+        std::vector<mint> L_inner;
+        std::vector<mint> L_diag;
+        std::vector<mreal> L_values;
+        std::vector<mint> corner_outer;
+        std::vector<mint> corner_inner;
+
+        // Bi-Laplacian pattern; B_targets holds, for every product L_ik * L_kj in
+        // the order in which AssembleBiLaplacian enumerates them, the slot of B_ij.
+        std::vector<mint> B_outer;
+        std::vector<mint> B_inner;
+        std::vector<mint> B_diag;
+        std::vector<mreal> B_values;
+        std::vector<mint> B_term_ptr;
+        std::vector<mint> B_targets;
+    }; // FlatBiLaplacian
+
+} // namespace rsurfaces
@@ -44,7 +44,7 @@ namespace rsurfaces
         class HsMetric
         {
         public:
-            HsMetric(std::vector<SurfaceEnergy*> energies, SurfaceEnergy *obstacleEnergy_,
+            HsMetric(std::vector<SurfaceEnergy*> energies, std::vector<SurfaceEnergy*> obstacleEnergies_,
                      std::vector<Constraints::SimpleProjectorConstraint *> &spcs,
                      std::vector<ConstraintPack> &schurs);
             ~HsMetric();
@@ -207,7 +207,8 @@ namespace rsurfaces
                     optBCT = CreateOptimizedBCTFromBVH(bvh, exps.x, exps.y, bh_theta, energy->GetWeight(), settings);
 
 
-                    if (obstacleEnergy)
+                    // Every obstacle adds its interaction with the mesh to the diagonal
+                    for (SurfaceEnergy *obstacleEnergy : obstacleEnergies)
                     {
                         std::cout << "    * Building obstacle BCT" << std::endl;
                         OptimizedClusterTree* obstacleBVH = obstacleEnergy->GetBVH();
@@ -221,7 +222,8 @@ namespace rsurfaces
                         }
                         // Now this tells the BCT to multiply the metrics by the obstacleEnergy's weight.
                         // Should be useful for regularization/penalty scenarios in which one wants to apply extremely large weights.
-                        obstacleBCT = std::make_shared<OptimizedBlockClusterTree>(bvh, obstacleBVH, exps.x, exps.y, bh_theta, obstacleEnergy->GetWeight(), settings);
+                        BCTPtr obstacleBCT = std::make_shared<OptimizedBlockClusterTree>(bvh, obstacleBVH, exps.x, exps.y, bh_theta, obstacleEnergy->GetWeight(), settings);
+                        obstacleBCTs.push_back(obstacleBCT);
                         std::cout << "    * Built obstacle BCT" << std::endl;
                         optBCT->AddObstacleCorrection(obstacleBCT);
                         std::cout << "    * Added obstacle correction" << std::endl;
@@ -254,12 +256,12 @@ namespace rsurfaces
             SurfaceEnergy *energy;
             std::vector<SurfaceEnergy*> extraEnergies;
 
-            SurfaceEnergy *obstacleEnergy;
+            std::vector<SurfaceEnergy*> obstacleEnergies;
             bool usedDefaultConstraint;
 
             mutable SparseFactorization factorizedLaplacian;
             mutable BCTPtr optBCT;
-            mutable BCTPtr obstacleBCT;
+            mutable std::vector<BCTPtr> obstacleBCTs;
             mutable bool schurComplementComputed;
             mutable SchurComplement schurComplement;
         };
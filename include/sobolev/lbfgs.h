@@ -1,7 +1,9 @@
 #pragma once
 
 #include "rsurface_types.h"
+#include "remeshing/vertex_transfer.h"
 #include <list>
+#include <iostream>
 
 namespace rsurfaces
 {
@@ -17,6 +19,14 @@ namespace rsurfaces
         virtual void UpdateHistory(Eigen::VectorXd &currentPosition, Eigen::VectorXd &currentGradient);
         void UpdateDirection(Eigen::VectorXd &currentPosition, Eigen::VectorXd &currentGradient);
         void ResetMemory();
+        // Carries the history over to a remeshed surface. Returns false (and resets the
+        // memory) if the history does not belong to the mesh the transfer started from.
+        bool TransferHistory(const remeshing::VertexTransfer &transfer);
+
+        // Write / read the full history, so that a resumed run continues
+        // with the same quasi-Newton memory.
+        virtual void SaveState(std::ostream &out);
+        virtual void LoadState(std::istream &in);
 
         inline Eigen::VectorXd& y_current()
         {
@@ -37,6 +47,8 @@ namespace rsurfaces
         protected:
         size_t memSize;
         bool firstStep;
+        // Set after a transfer: the next position is not one step away from the last one
+        bool historyTransferred;
         std::list<Eigen::VectorXd> s_list;
         std::list<Eigen::VectorXd> y_list;
         std::vector<double> rhos;
@@ -3,6 +3,7 @@
 #include "rsurface_types.h"
 #include "optimized_cluster_tree.h"
 #include "metric_term.h"
+#include "drag_region.h"
 
 namespace rsurfaces
 {
@@ -15,6 +16,17 @@ namespace rsurfaces
         // the current mesh configuration.
         virtual void ResetTargets() {}
 
+        // Like ResetTargets, after only the vertices of the given region have moved.
+        virtual void ResetTargetsInRegion(const DragRegion &region)
+        {
+            ResetTargets();
+        }
+
+        // Called after splits or collapses with the index each face had before (or -1 for
+        // new faces), so that the next Update can repair its data structures instead of
+        // rebuilding them.
+        virtual void NotifyRemeshed(const std::vector<mint> &faceOrigins) {}
+
         // Returns the current value of the energy.
         virtual double Value() = 0;
         
@@ -22,6 +34,16 @@ namespace rsurfaces
         // V x 3 matrix, where each row holds the differential (a 3-vector) with
         // respect to the corresponding vertex.
         virtual void Differential(Eigen::MatrixXd &output) = 0;
+
+        // Adds the differential to output like Differential, and returns the
+        // value of the energy at the same configuration. Energies whose
+        // derivative passes already evaluate every term of the energy override
+        // this to get both for the price of one.
+        virtual double ValueAndDifferential(Eigen::MatrixXd &output)
+        {
+            Differential(output);
+            return Value();
+        }
         
         // Update the energy to reflect the current state of the mesh. This could
         // involve building a new BVH for Barnes-Hut energies, for instance.
@@ -8,6 +8,7 @@
 #include "sobolev/all_constraints.h"
 #include "surface_energy.h"
 #include "line_search.h"
+#include "geometry_cache.h"
 #include "sobolev/hs_ncg.h"
 #include "sobolev/lbfgs.h"
 #include "profiler.h"
@@ -37,6 +38,13 @@ namespace rsurfaces
         void RecenterMesh();
         void ResetAllConstraints();
         void ResetAllPotentials();
+        // Passes the face origins of a remeshing step on to the energies.
+        void NotifyRemeshed(const std::vector<mint> &faceOrigins);
+        // Carries the Nesterov and L-BFGS memory over to a remeshed surface. Returns
+        // false if some of it could not be transferred and has to be reset instead.
+        bool TransferVertexData(const remeshing::VertexTransfer &transfer);
+        // Resets constraints and potentials after only the vertices of region have moved.
+        void ResetRegion(const DragRegion &region);
 
         void AssembleGradients(Eigen::MatrixXd &dest);
         std::unique_ptr<Hs::HsMetric> GetHsMetric();
@@ -44,6 +52,13 @@ namespace rsurfaces
         void UpdateEnergies();
         double evaluateEnergy();
 
+        // Write / read all optimizer state that is carried from one step to the
+        // next (step count, Nesterov memory, constraint targets, L-BFGS history).
+        // LoadState expects the flow to be set up with the same constraints, in
+        // the same order, as the one that was saved.
+        void SaveState(std::ostream &out);
+        void LoadState(std::istream &in);
+
         template <typename Constraint>
         Constraint *addSchurConstraint(MeshPtr &mesh, GeomPtr &geom, double multiplier, long iterations, double add = 0)
         {
@@ -110,12 +125,17 @@ namespace rsurfaces
         Eigen::MatrixXd prevPositions1;
         Eigen::MatrixXd prevPositions2;
         unsigned int stepCount;
+        // Total energy at the configuration of the last AssembleGradients call
+        double assembledEnergy;
         std::vector<ConstraintPack> schurConstraints;
         std::vector<Constraints::SimpleProjectorConstraint *> simpleConstraints;
         Vector3 origBarycenter;
         Constraints::BarycenterComponentsConstraint *secretBarycenter;
         LBFGSOptimizer* lbfgs;
-        SurfaceEnergy* obstacleEnergy;
+        // Used by line searches for their trial steps
+        GeometryCache geometryCache;
+        // All obstacle energies, which the Hs metric adds to its diagonal
+        std::vector<SurfaceEnergy*> obstacleEnergies;
 
         size_t addConstraintTriplets(std::vector<Triplet> &triplets, bool includeSchur);
         
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "rsurface_types.h"
+
+#include <cstdint>
+#include <fstream>
+
+namespace rsurfaces
+{
+    // Trajectory stream format (".rst"): all frames of a run in a single file.
+    //
+    //   TrajectoryHeader
+    //   record*
+    //
+    // Every record is a TrajectoryRecordHeader followed by its payload. A
+    // Connectivity record (nVertices, nFaces, uint32_t faces[3 * nFaces]) starts
+    // a new epoch, and is written only when remeshing has changed the mesh. The
+    // first frame of an epoch is a Keyframe holding the quantized positions; all
+    // further frames are Delta records holding the difference of the quantized
+    // positions to the previous frame. Quantized values are zigzag/varint coded,
+    // so the small per-frame deltas mostly take one or two bytes per coordinate.
+    // If the file is compressed, every payload is additionally deflated with zlib.
+    struct TrajectoryHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t compressed;
+        // Positions are stored as integer multiples of this step
+        double quantum;
+    };
+
+    enum class TrajectoryRecord : uint32_t
+    {
+        Connectivity = 0,
+        Keyframe = 1,
+        Delta = 2
+    };
+
+    struct TrajectoryRecordHeader
+    {
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t rawSize;
+        uint64_t storedSize;
+    };
+
+    static const char TRAJECTORY_MAGIC[8] = {'R', 'S', 'U', 'R', 'F', 'T', 'R', 'J'};
+    static const uint32_t TRAJECTORY_VERSION = 1;
+
+    // Returns true if the filename has the trajectory extension.
+    bool isTrajectoryFile(std::string const &filename);
+
+    class TrajectoryWriter
+    {
+    public:
+        // If keepFrames is negative, the file is started over. Otherwise an existing
+        // trajectory is cut back to its first keepFrames frames (or to its last
+        // complete record) and continued, so that a resumed run picks up where
+        // its checkpoint was written.
+        TrajectoryWriter(std::string filename_, double quantum_, bool compress_, long keepFrames = -1);
+
+        // Appends one frame. positions holds 3 doubles per vertex; faces holds
+        // 3 vertex indices per face. A new epoch is started whenever faces
+        // points to a different face list than the previous frame.
+        void WriteFrame(const double *positions, size_t nVertices, const std::shared_ptr<const std::vector<uint32_t>> &faces);
+
+        inline size_t NumFrames() const { return nFrames; }
+        inline std::string Filename() const { return filename; }
+
+    private:
+        void writeRecord(TrajectoryRecord type, const std::string &payload);
+        // Returns false if there is no trajectory to continue.
+        bool truncateForResume(long keepFrames);
+
+        std::string filename;
+        std::ofstream out;
+        double quantum;
+        bool compress;
+        size_t nFrames;
+        std::shared_ptr<const std::vector<uint32_t>> epochFaces;
+        std::vector<int64_t> lastQuantized;
+    };
+
+    class TrajectoryReader
+    {
+    public:
+        TrajectoryReader(std::string filename_);
+
+        // Decodes the next frame into positions (3 doubles per vertex) and faces
+        // (3 indices per face). Returns false at the end of the stream; a record
+        // cut off by a killed run is treated as the end of the stream.
+        bool NextFrame(std::vector<double> &positions, std::vector<uint32_t> &faces);
+
+        // Number of the frame that the next call to NextFrame returns.
+        inline size_t FrameIndex() const { return nFrames; }
+
+    private:
+        bool readRecord(TrajectoryRecord &type, std::string &payload);
+
+        std::string filename;
+        std::ifstream in;
+        double quantum;
+        bool compressed;
+        size_t nFrames;
+        std::vector<uint32_t> epochFaces;
+        std::vector<int64_t> lastQuantized;
+        // Whether a connectivity record has been read, and whether its keyframe is still to come
+        bool epochStarted;
+        bool keyframePending;
+    };
+
+    // Writes every frame of a trajectory as <outputDir>/frameNNNN.obj, the
+    // layout the rendering scripts expect.
+    void extractTrajectory(std::string input, std::string outputDir);
+} // namespace rsurfaces
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "rsurface_types.h"
+#include "optimized_bct_types.h"
+
+namespace rsurfaces
+{
+    typedef Eigen::Map<EigenMatrixRM> VertexPositionMap;
+
+    // V x 3 row-major view of the vertex positions of the geometry, without copying: geometry-central
+    // stores them as one contiguous array of Vector3, in the order of the vertex indices as long as
+    // the mesh is compressed. The view stays valid until vertices are added or removed.
+    inline VertexPositionMap mapVertexPositions(MeshPtr const &mesh, GeomPtr const &geom)
+    {
+        static_assert(sizeof(Vector3) == 3 * sizeof(mreal), "Vector3 has to consist of three packed mreals.");
+        if (!mesh->isCompressed())
+        {
+            throw std::runtime_error("mapVertexPositions: the mesh has to be compressed.");
+        }
+        return VertexPositionMap(reinterpret_cast<mreal *>(geom->inputVertexPositions.raw().data()), mesh->nVertices(), 3);
+    }
+} // namespace rsurfaces
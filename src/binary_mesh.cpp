@@ -0,0 +1,274 @@
+#include "binary_mesh.h"
+#include "scene_file.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rsurfaces
+{
+    inline uint64_t alignTo8(uint64_t offset)
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    bool isBinaryMeshFile(std::string const &filename)
+    {
+        return endsWith(filename, ".rsm");
+    }
+
+    MappedBinaryMesh::MappedBinaryMesh(std::string filename_)
+    {
+        filename = filename_;
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Could not open binary mesh " + filename + ".");
+        }
+
+        struct stat st;
+        fstat(fd, &st);
+        fileSize = st.st_size;
+
+        if (fileSize < sizeof(BinaryMeshHeader))
+        {
+            close(fd);
+            throw std::runtime_error("Binary mesh " + filename + " is too small to contain a header.");
+        }
+
+        void *mapped = mmap(0, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Could not memory-map binary mesh " + filename + ".");
+        }
+        // Everything gets read exactly once while building the mesh or the tree
+        madvise(mapped, fileSize, MADV_WILLNEED);
+
+        bytes = static_cast<const char *>(mapped);
+        header = reinterpret_cast<const BinaryMeshHeader *>(bytes);
+
+        if (std::memcmp(header->magic, BINARY_MESH_MAGIC, sizeof(BINARY_MESH_MAGIC)) != 0)
+        {
+            munmap(mapped, fileSize);
+            close(fd);
+            throw std::runtime_error(filename + " is not a binary mesh file.");
+        }
+        if (header->version != BINARY_MESH_VERSION)
+        {
+            munmap(mapped, fileSize);
+            close(fd);
+            throw std::runtime_error("Unsupported binary mesh version " + std::to_string(header->version) + " in " + filename + ".");
+        }
+
+        uint64_t end = header->faceDataOffset + sizeof(double) * header->faceDataDim * header->nFaces;
+        if (header->positionsOffset + 3 * sizeof(double) * header->nVertices > fileSize ||
+            header->facesOffset + 3 * sizeof(uint32_t) * header->nFaces > fileSize || end > fileSize)
+        {
+            munmap(mapped, fileSize);
+            close(fd);
+            throw std::runtime_error("Binary mesh " + filename + " is truncated.");
+        }
+
+        // Everything downstream indexes the mapped positions with these without further checks
+        const uint32_t *faceIndices = faces();
+        int64_t nIndices = 3 * header->nFaces;
+        uint32_t maxIndex = 0;
+        #pragma omp parallel for reduction(max : maxIndex)
+        for (int64_t i = 0; i < nIndices; i++)
+        {
+            maxIndex = std::max(maxIndex, faceIndices[i]);
+        }
+        if (nIndices > 0 && maxIndex >= header->nVertices)
+        {
+            munmap(mapped, fileSize);
+            close(fd);
+            throw std::runtime_error("Binary mesh " + filename + " has a face referring to vertex " + std::to_string(maxIndex) +
+                                     ", but only " + std::to_string(header->nVertices) + " vertices.");
+        }
+    }
+
+    MappedBinaryMesh::~MappedBinaryMesh()
+    {
+        munmap(const_cast<char *>(bytes), fileSize);
+        close(fd);
+    }
+
+    void MappedBinaryMesh::ReleasePositions(size_t begin, size_t end) const
+    {
+        // Only whole pages inside the range can be released
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t first = header->positionsOffset + 3 * sizeof(double) * begin;
+        size_t last = header->positionsOffset + 3 * sizeof(double) * end;
+        first = (first + pageSize - 1) / pageSize * pageSize;
+        last = last / pageSize * pageSize;
+        if (first < last)
+        {
+            madvise(const_cast<char *>(bytes) + first, last - first, MADV_DONTNEED);
+        }
+    }
+
+    std::vector<std::vector<size_t>> MappedBinaryMesh::FaceVertexList() const
+    {
+        size_t nF = nFaces();
+        const uint32_t *f = faces();
+        std::vector<std::vector<size_t>> polygons(nF);
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < nF; i++)
+        {
+            polygons[i] = {f[3 * i], f[3 * i + 1], f[3 * i + 2]};
+        }
+        return polygons;
+    }
+
+    double MappedBinaryMesh::TotalVolume() const
+    {
+        size_t nF = nFaces();
+        const uint32_t *f = faces();
+        const double *p = positions();
+        double volume = 0;
+
+        #pragma omp parallel for reduction(+ : volume)
+        for (size_t i = 0; i < nF; i++)
+        {
+            const double *a = p + 3 * f[3 * i];
+            const double *b = p + 3 * f[3 * i + 1];
+            const double *c = p + 3 * f[3 * i + 2];
+            Vector3 v1{a[0], a[1], a[2]};
+            Vector3 v2{b[0], b[1], b[2]};
+            Vector3 v3{c[0], c[1], c[2]};
+            volume += dot(cross(v1, v2), v3) / 6;
+        }
+        return volume;
+    }
+
+    template <typename Mesh>
+    std::tuple<std::unique_ptr<Mesh>, GeomUPtr> readBinaryMeshAs(std::string filename)
+    {
+        MappedBinaryMesh mapped(filename);
+
+        std::unique_ptr<Mesh> mesh(new Mesh(mapped.FaceVertexList()));
+        GeomUPtr geom(new surface::VertexPositionGeometry(*mesh));
+
+        size_t nV = mapped.nVertices();
+        const double *pos = mapped.positions();
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < nV; i++)
+        {
+            geom->inputVertexPositions[i] = Vector3{pos[3 * i], pos[3 * i + 1], pos[3 * i + 2]};
+        }
+
+        std::cout << "Read binary mesh " << filename << " (" << nV << " vertices, " << mapped.nFaces() << " faces)" << std::endl;
+
+        return std::make_tuple(std::move(mesh), std::move(geom));
+    }
+
+    std::tuple<MeshUPtr, GeomUPtr> readBinaryMesh(std::string filename)
+    {
+        return readBinaryMeshAs<surface::HalfedgeMesh>(filename);
+    }
+
+    std::tuple<std::unique_ptr<surface::SurfaceMesh>, GeomUPtr> readBinaryNonManifoldMesh(std::string filename)
+    {
+        return readBinaryMeshAs<surface::SurfaceMesh>(filename);
+    }
+
+    void writeBinaryMesh(std::ostream &out, const double *positions, size_t nV, const uint32_t *faces, size_t nF,
+                         const double *faceData, size_t faceDataDim)
+    {
+        if (!faceData)
+        {
+            faceDataDim = 0;
+        }
+
+        BinaryMeshHeader header;
+        std::memcpy(header.magic, BINARY_MESH_MAGIC, sizeof(BINARY_MESH_MAGIC));
+        header.version = BINARY_MESH_VERSION;
+        header.faceDataDim = faceDataDim;
+        header.nVertices = nV;
+        header.nFaces = nF;
+        header.positionsOffset = alignTo8(sizeof(BinaryMeshHeader));
+        header.facesOffset = alignTo8(header.positionsOffset + 3 * sizeof(double) * nV);
+        header.faceDataOffset = alignTo8(header.facesOffset + 3 * sizeof(uint32_t) * nF);
+
+        uint64_t positionsEnd = header.positionsOffset + 3 * sizeof(double) * nV;
+        uint64_t facesEnd = header.facesOffset + 3 * sizeof(uint32_t) * nF;
+
+        const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(BinaryMeshHeader));
+        out.write(zeros, header.positionsOffset - sizeof(BinaryMeshHeader));
+        out.write(reinterpret_cast<const char *>(positions), 3 * sizeof(double) * nV);
+        out.write(zeros, header.facesOffset - positionsEnd);
+        out.write(reinterpret_cast<const char *>(faces), 3 * sizeof(uint32_t) * nF);
+        if (faceDataDim > 0)
+        {
+            out.write(zeros, header.faceDataOffset - facesEnd);
+            out.write(reinterpret_cast<const char *>(faceData), sizeof(double) * faceDataDim * nF);
+        }
+    }
+
+    void writeMeshToBinary(surface::SurfaceMesh &mesh, surface::VertexPositionGeometry &geom, std::string output,
+                           const std::vector<double> *faceData, size_t faceDataDim)
+    {
+        size_t nV = mesh.nVertices();
+        size_t nF = mesh.nFaces();
+
+        if (faceData && faceData->size() != faceDataDim * nF)
+        {
+            throw std::runtime_error("Per-face data for " + output + " does not have " + std::to_string(faceDataDim) + " entries per face.");
+        }
+
+        std::vector<double> positions(3 * nV);
+        for (size_t i = 0; i < nV; i++)
+        {
+            Vector3 p = geom.inputVertexPositions[i];
+            positions[3 * i] = p.x;
+            positions[3 * i + 1] = p.y;
+            positions[3 * i + 2] = p.z;
+        }
+
+        std::vector<uint32_t> faces(3 * nF);
+        surface::VertexData<size_t> inds = mesh.getVertexIndices();
+        size_t i = 0;
+        for (surface::Face f : mesh.faces())
+        {
+            if (f.degree() != 3)
+            {
+                throw std::runtime_error("Binary mesh format only supports triangle meshes.");
+            }
+            for (surface::Vertex v : f.adjacentVertices())
+            {
+                faces[i++] = inds[v];
+            }
+        }
+
+        std::ofstream outfile(output, std::ios::binary);
+        if (!outfile)
+        {
+            throw std::runtime_error("Could not open " + output + " for writing.");
+        }
+        writeBinaryMesh(outfile, positions.data(), nV, faces.data(), nF, faceData ? faceData->data() : 0, faceDataDim);
+        outfile.close();
+        if (!outfile)
+        {
+            throw std::runtime_error("Failed to write " + output + ".");
+        }
+    }
+
+    void convertMeshToBinary(std::string input, std::string output)
+    {
+        std::unique_ptr<surface::SurfaceMesh> mesh;
+        GeomUPtr geom;
+        std::tie(mesh, geom) = readNonManifoldMesh(input);
+
+        writeMeshToBinary(*mesh, *geom, output);
+        std::cout << "Converted " << input << " (" << mesh->nVertices() << " vertices, " << mesh->nFaces()
+                  << " faces) to binary mesh " << output << std::endl;
+    }
+} // namespace rsurfaces
@@ -5,32 +5,34 @@ namespace rsurfaces
 {
     Eigen::Matrix<mreal, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> getVertexPositions( MeshPtr mesh, GeomPtr geom )
     {
-        ptic("getVertexPositions");
-        geom->requireVertexPositions();
-        mint n = mesh->nVertices();
-        Eigen::Matrix<mreal, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> result ( n, 3 );
-        #pragma omp parallel for
-        for( mint i = 0; i < n; ++i )
-        {
-            auto x = geom->inputVertexPositions[i];
-            result( i, 0 ) = x[0];
-            result( i, 1 ) = x[1];
-            result( i, 2 ) = x[2];
-            
-        }
-        ptoc("getVertexPositions");
-        return result;
+        return mapVertexPositions( mesh, geom );
     }
     
     Eigen::Matrix<mint, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>  getPrimitiveIndices( MeshPtr mesh, GeomPtr geom )
     {
         ptic("getPrimitiveIndices");
         mint n = mesh->nFaces();
+        Eigen::Matrix<mint, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> result ( n, 3 );
+        
+        if( mesh->isCompressed() )
+        {
+            // Element indices are dense, so faces can be visited in parallel and no index containers are needed.
+            #pragma omp parallel for
+            for( mint i = 0; i < n; ++i )
+            {
+                GCHalfedge he = mesh->face(i).halfedge();
+                
+                result( i, 0 ) = he.vertex().getIndex();
+                result( i, 1 ) = he.next().vertex().getIndex();
+                result( i, 2 ) = he.next().next().vertex().getIndex();
+            }
+            ptoc("getPrimitiveIndices");
+            return result;
+        }
+        
         VertexIndices vInds = mesh->getVertexIndices();
         FaceIndices fInds = mesh->getFaceIndices();
-        Eigen::Matrix<mint, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> result ( n, 3 );
         
-//        #pragma omp parallel for
         for( auto face : mesh->faces() )
         {
             mint i = fInds[face];
@@ -79,51 +81,45 @@ namespace rsurfaces
         return Eigen::Map<Eigen::SparseMatrix<mreal>> ( vertex_count, primitive_count * primitive_length, primitive_count * primitive_length, &outer[0], &inner[0], &values[0] );
     }
 
-    void AssembleDerivative( Eigen::Matrix<mint, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> const & primitives, Eigen::MatrixXd const & buffer, Eigen::MatrixXd & output, mreal weight )
+    void AssembleDerivative( mint const * restrict const triangles, mint primitive_count, Eigen::MatrixXd const & buffer, Eigen::MatrixXd & output, mreal weight )
     {
         ptic("AssembleDerivative");
-        mint vertex_count = output.rows();
-        mint primitive_count = primitives.rows();
-        mint primitive_length = primitives.cols();
-
-        mint * outer = nullptr;
-        mint * inner = nullptr;
-        mreal * values = nullptr;
-
+        mint corner_count = 3 * primitive_count;
+        mint dim = output.cols();
         
-        safe_iota( outer, primitive_count * primitive_length + 1 );
-        
-        safe_alloc( inner, primitive_count * primitive_length );
-        
-        safe_alloc( values, primitive_count * primitive_length, weight );
-        
-        
-        #pragma omp parallel for simd aligned( outer, inner, values : ALIGN)
-        for( mint i = 0; i < primitive_count; ++i )
+        // Scatter the rows of buffer to the vertices of their corners. Each thread takes one
+        // coordinate, i.e. one contiguous column of buffer and output, so that no writes collide.
+        #pragma omp parallel for num_threads( dim )
+        for( mint k = 0; k < dim; ++k )
         {
-            for( mint j = 0; j < primitive_length; ++j )
+            mreal const * restrict const b = buffer.col(k).data();
+            mreal * restrict const o = output.col(k).data();
+            
+            for( mint c = 0; c < corner_count; ++c )
             {
-                inner[ primitive_length * i + j ] = primitives(i,j);
+                o[ triangles[c] ] += weight * b[c];
             }
         }
-
-        // It's crucial here that primitives is row major.
-        Eigen::Map<Eigen::SparseMatrix<mreal>> A ( vertex_count, primitive_count * primitive_length, primitive_count * primitive_length, outer, inner, values );
-
-        output += A * buffer;
-
-        safe_free(outer);
-        safe_free(inner);
-        safe_free(values);
         
         ptoc("AssembleDerivative");
     }
     
+    void AssembleDerivative( Eigen::Matrix<mint, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> const & primitives, Eigen::MatrixXd const & buffer, Eigen::MatrixXd & output, mreal weight )
+    {
+        // It's crucial here that primitives is row major.
+        // The scatter above assumes triangles, i.e. three corners per primitive.
+        if( primitives.cols() != 3 )
+        {
+            throw std::runtime_error("AssembleDerivative expects triangles, but got primitives with " + std::to_string(primitives.cols()) + " corners.");
+        }
+        AssembleDerivative( primitives.data(), primitives.rows(), buffer, output, weight );
+    }
+    
     void AssembleDerivativeFromACNData( MeshPtr mesh, GeomPtr geom, EigenMatrixRM const & P_D_data, Eigen::MatrixXd & output, mreal weight )
     {
         ptic("AssembleDerivativeFromACNData");
         
-        auto V_coords = getVertexPositions( mesh, geom );
+        VertexPositionMap V_coords = mapVertexPositions( mesh, geom );
         auto primitives = getPrimitiveIndices( mesh, geom );
         
         mint vertex_count = V_coords.rows();
@@ -138,6 +134,7 @@ namespace rsurfaces
         
         Eigen::MatrixXd buffer ( primitive_count * primitive_length, dim );
         
+        #pragma omp parallel for
         for( mint i = 0;  i < primitive_count; ++i )
         {
             
@@ -268,7 +265,7 @@ namespace rsurfaces
     {
         ptic("AssembleDerivativeFromACPData");
         
-        auto V_coords = getVertexPositions( mesh, geom );
+        VertexPositionMap V_coords = mapVertexPositions( mesh, geom );
         auto primitives = getPrimitiveIndices( mesh, geom );
         
         mint vertex_count = V_coords.rows();
@@ -0,0 +1,303 @@
+#include "drag_editor.h"
+#include "derivative_assembler.h"
+
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+namespace rsurfaces
+{
+    void DragEditor::BuildAdjacency(MeshPtr const &mesh, GeomPtr const &geom)
+    {
+        ptic("DragEditor::BuildAdjacency");
+
+        auto prims = getPrimitiveIndices(mesh, geom);
+        vertex_count = mesh->nVertices();
+        face_count = prims.rows();
+        triangles.assign(prims.data(), prims.data() + 3 * face_count);
+
+        // Vertex-face incidences
+        vf_outer.assign(vertex_count + 1, 0);
+        for (mint k = 0; k < 3 * face_count; ++k)
+        {
+            ++vf_outer[triangles[k] + 1];
+        }
+        for (mint i = 0; i < vertex_count; ++i)
+        {
+            vf_outer[i + 1] += vf_outer[i];
+        }
+        vf_inner.resize(3 * face_count);
+        std::vector<mint> fill(vf_outer.begin(), vf_outer.end() - 1);
+        for (mint f = 0; f < face_count; ++f)
+        {
+            for (mint c = 0; c < 3; ++c)
+            {
+                vf_inner[fill[triangles[3 * f + c]]++] = f;
+            }
+        }
+
+        // Vertex neighbors, gathered from the incident faces
+        adj_outer.assign(vertex_count + 1, 0);
+        adj_inner.clear();
+        adj_inner.reserve(6 * face_count);
+        std::vector<mint> row;
+        for (mint i = 0; i < vertex_count; ++i)
+        {
+            row.clear();
+            for (mint k = vf_outer[i]; k < vf_outer[i + 1]; ++k)
+            {
+                mint f = vf_inner[k];
+                for (mint c = 0; c < 3; ++c)
+                {
+                    mint j = triangles[3 * f + c];
+                    if (j != i)
+                    {
+                        row.push_back(j);
+                    }
+                }
+            }
+            std::sort(row.begin(), row.end());
+            row.erase(std::unique(row.begin(), row.end()), row.end());
+            adj_inner.insert(adj_inner.end(), row.begin(), row.end());
+            adj_outer[i + 1] = adj_inner.size();
+        }
+
+        distances.assign(vertex_count, std::numeric_limits<mreal>::infinity());
+        adjacency_valid = true;
+
+        ptoc("DragEditor::BuildAdjacency");
+    }
+
+    void DragEditor::Invalidate()
+    {
+        adjacency_valid = false;
+        End();
+    }
+
+    void DragEditor::FaceSums(GeomPtr const &geom, const mint *tris, mint count, mreal *sums) const
+    {
+        mreal area = 0.;
+        mreal volume = 0.;
+        mreal m0 = 0.;
+        mreal m1 = 0.;
+        mreal m2 = 0.;
+
+        #pragma omp parallel for reduction( + : area, volume, m0, m1, m2 )
+        for (mint f = 0; f < count; ++f)
+        {
+            Vector3 p0 = geom->inputVertexPositions[tris[3 * f + 0]];
+            Vector3 p1 = geom->inputVertexPositions[tris[3 * f + 1]];
+            Vector3 p2 = geom->inputVertexPositions[tris[3 * f + 2]];
+
+            mreal a = norm(cross(p1 - p0, p2 - p0)) / 2;
+            Vector3 centroid = (p0 + p1 + p2) / 3;
+
+            area += a;
+            volume += dot(cross(p0, p1), p2) / 6;
+            m0 += a * centroid.x;
+            m1 += a * centroid.y;
+            m2 += a * centroid.z;
+        }
+
+        sums[0] = area;
+        sums[1] = volume;
+        sums[2] = m0;
+        sums[3] = m1;
+        sums[4] = m2;
+    }
+
+    bool DragEditor::Begin(MeshPtr const &mesh, GeomPtr const &geom, mint vertex, mreal radius, long step)
+    {
+        ptic("DragEditor::Begin");
+
+        if (!adjacency_valid || vertex_count != (mint)mesh->nVertices() || face_count != (mint)mesh->nFaces())
+        {
+            BuildAdjacency(mesh, geom);
+        }
+
+        region = DragRegion();
+        mreal sigma = radius / 3;
+
+        // Bounded Dijkstra search on edges; every vertex whose distance gets set is
+        // remembered so that only those entries need to be reset afterwards.
+        typedef std::pair<mreal, mint> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        std::vector<mint> reached;
+        std::vector<mreal> reached_dist;
+
+        distances[vertex] = 0.;
+        reached.push_back(vertex);
+        queue.push(Entry(0., vertex));
+
+        while (!queue.empty())
+        {
+            Entry next = queue.top();
+            queue.pop();
+
+            mreal d = next.first;
+            mint i = next.second;
+
+            if (d > radius)
+            {
+                break;
+            }
+            if (d > distances[i])
+            {
+                // Stale entry
+                continue;
+            }
+
+            region.vertices.push_back(i);
+            reached_dist.push_back(d);
+
+            Vector3 p_i = geom->inputVertexPositions[i];
+            for (mint k = adj_outer[i]; k < adj_outer[i + 1]; ++k)
+            {
+                mint j = adj_inner[k];
+                mreal d_j = d + norm(geom->inputVertexPositions[j] - p_i);
+                if (d_j < distances[j])
+                {
+                    if (distances[j] == std::numeric_limits<mreal>::infinity())
+                    {
+                        reached.push_back(j);
+                    }
+                    distances[j] = d_j;
+                    queue.push(Entry(d_j, j));
+                }
+            }
+
+            // Settled vertices are never improved again; marking them with -1 keeps
+            // later duplicates of them in the queue stale.
+            distances[i] = -1.;
+        }
+
+        for (mint j : reached)
+        {
+            distances[j] = std::numeric_limits<mreal>::infinity();
+        }
+
+        mint n = region.vertices.size();
+        if (n == 0)
+        {
+            ptoc("DragEditor::Begin");
+            return false;
+        }
+
+        // Sort the region by vertex index, carrying the distances along
+        std::vector<mint> order(n);
+        for (mint k = 0; k < n; ++k)
+        {
+            order[k] = k;
+        }
+        std::sort(order.begin(), order.end(), [&](mint a, mint b) { return region.vertices[a] < region.vertices[b]; });
+
+        std::vector<mint> sorted(n);
+        region.weights.resize(n);
+        base_positions.resize(3 * n);
+        for (mint k = 0; k < n; ++k)
+        {
+            mint i = region.vertices[order[k]];
+            mreal r = reached_dist[order[k]] / sigma;
+            sorted[k] = i;
+            region.weights[k] = exp(-0.5 * r * r);
+
+            Vector3 p = geom->inputVertexPositions[i];
+            base_positions[3 * k + 0] = p.x;
+            base_positions[3 * k + 1] = p.y;
+            base_positions[3 * k + 2] = p.z;
+        }
+        region.vertices.swap(sorted);
+
+        // Faces whose geometry changes, and their vertices
+        for (mint i : region.vertices)
+        {
+            region.faces.insert(region.faces.end(), vf_inner.begin() + vf_outer[i], vf_inner.begin() + vf_outer[i + 1]);
+        }
+        std::sort(region.faces.begin(), region.faces.end());
+        region.faces.erase(std::unique(region.faces.begin(), region.faces.end()), region.faces.end());
+
+        region_triangles.resize(3 * region.faces.size());
+        for (size_t k = 0; k < region.faces.size(); ++k)
+        {
+            for (mint c = 0; c < 3; ++c)
+            {
+                region_triangles[3 * k + c] = triangles[3 * region.faces[k] + c];
+            }
+        }
+        region.touchedVertices = region_triangles;
+        std::sort(region.touchedVertices.begin(), region.touchedVertices.end());
+        region.touchedVertices.erase(std::unique(region.touchedVertices.begin(), region.touchedVertices.end()), region.touchedVertices.end());
+
+        FaceSums(geom, triangles.data(), face_count, base_total);
+        FaceSums(geom, region_triangles.data(), region.faces.size(), base_region);
+        sums_step = step;
+
+        region.totalArea = base_total[0];
+        region.totalVolume = base_total[1];
+        region.barycenter = Vector3{base_total[2], base_total[3], base_total[4]} / base_total[0];
+
+        active = true;
+
+        std::cout << "Dragging " << n << " vertices (" << region.faces.size() << " faces)" << std::endl;
+
+        ptoc("DragEditor::Begin");
+        return true;
+    }
+
+    void DragEditor::Apply(GeomPtr const &geom, Vector3 displacement, long step)
+    {
+        if (!active)
+        {
+            return;
+        }
+
+        ptic("DragEditor::Apply");
+
+        if (step != sums_step)
+        {
+            // The flow moved the vertices outside the region (and may have recentered the
+            // mesh), so the sums from the last Apply are stale
+            FaceSums(geom, triangles.data(), face_count, base_total);
+            FaceSums(geom, region_triangles.data(), region.faces.size(), base_region);
+            sums_step = step;
+        }
+
+        mint n = region.vertices.size();
+        mint const *restrict const verts = region.vertices.data();
+        mreal const *restrict const w = region.weights.data();
+        mreal const *restrict const x = base_positions.data();
+
+        #pragma omp parallel for simd
+        for (mint k = 0; k < n; ++k)
+        {
+            geom->inputVertexPositions[verts[k]] = Vector3{x[3 * k + 0] + w[k] * displacement.x,
+                                                           x[3 * k + 1] + w[k] * displacement.y,
+                                                           x[3 * k + 2] + w[k] * displacement.z};
+        }
+
+        // Only the region faces changed, so the whole-mesh sums follow from their difference.
+        mreal current[5];
+        FaceSums(geom, region_triangles.data(), region.faces.size(), current);
+
+        mreal sums[5];
+        for (mint c = 0; c < 5; ++c)
+        {
+            sums[c] = base_total[c] - base_region[c] + current[c];
+        }
+
+        region.totalArea = sums[0];
+        region.totalVolume = sums[1];
+        region.barycenter = Vector3{sums[2], sums[3], sums[4]} / sums[0];
+
+        ptoc("DragEditor::Apply");
+    }
+
+    void DragEditor::End()
+    {
+        active = false;
+        region = DragRegion();
+        region_triangles.clear();
+        base_positions.clear();
+    }
+
+} // namespace rsurfaces
@@ -1,28 +1,139 @@
 #include "energy/coulomb.h"
+#include "energy/tp_multipole_engine.h"
 
 namespace rsurfaces
 {
+    // Returns a * sum_j b_j / |y_j - x_i| over the targets js(k) for k in [k_begin, k_end).
+    // With derivatives, adds the derivatives with respect to the charge moments of i to U[4 * i + ...].
+    template <bool derivatives, typename Targets>
+    static inline mreal CoulombRow(mint i, const Targets &js, mint k_begin, mint k_end,
+                                   mreal const *const *X, mreal const *const *Y, mreal *restrict U)
+    {
+        mreal const *restrict const B = Y[0];
+        mreal const *restrict const Y1 = Y[1];
+        mreal const *restrict const Y2 = Y[2];
+        mreal const *restrict const Y3 = Y[3];
+
+        mreal a = X[0][i];
+        mreal x1 = X[1][i];
+        mreal x2 = X[2][i];
+        mreal x3 = X[3][i];
+
+        mreal sum = 0.;
+        mreal dx1 = 0.;
+        mreal dx2 = 0.;
+        mreal dx3 = 0.;
+
+        #pragma omp simd reduction( + : sum, dx1, dx2, dx3 )
+        for( mint k = k_begin; k < k_end; ++k )
+        {
+            mint j = js(k);
+            mreal b = B[j];
+            mreal v1 = Y1[j] - x1;
+            mreal v2 = Y2[j] - x2;
+            mreal v3 = Y3[j] - x3;
+
+            mreal rinv = 1. / sqrt( v1 * v1 + v2 * v2 + v3 * v3 );
+            sum += b * rinv;
+
+            if( derivatives )
+            {
+                mreal brinv3 = b * rinv * rinv * rinv;
+                dx1 += brinv3 * v1;
+                dx2 += brinv3 * v2;
+                dx3 += brinv3 * v3;
+            }
+        }
+
+        if( derivatives )
+        {
+            U[ 4 * i + 0 ] += sum - ( dx1 * x1 + dx2 * x2 + dx3 * x3 );
+            U[ 4 * i + 1 ] += dx1;
+            U[ 4 * i + 2 ] += dx2;
+            U[ 4 * i + 3 ] += dx3;
+        }
+
+        return a * sum;
+    }
+
     CoulombEnergy::CoulombEnergy(TPEKernel *kernel_, double theta_)
     {
         kernel = kernel_;
         theta = theta_;
-        root = 0;
+        Update();
     }
 
     CoulombEnergy::~CoulombEnergy()
     {
+        ClearTrees();
+    }
+
+    void CoulombEnergy::ClearTrees()
+    {
+        if (vertex_bct)
+        {
+            delete vertex_bct;
+            vertex_bct = nullptr;
+        }
+        if (vertex_bvh)
+        {
+            delete vertex_bvh;
+            vertex_bvh = nullptr;
+        }
         if (root)
         {
             delete root;
+            root = nullptr;
         }
     }
 
     void CoulombEnergy::Update()
     {
-        if (root)
+        ptic("CoulombEnergy::Update");
+
+        // The face tree is repaired from the previous one when possible, so keep it out of ClearTrees.
+        OptimizedClusterTree *previous = root;
+        root = nullptr;
+        ClearTrees();
+
+        MeshPtr mesh = kernel->mesh;
+        GeomPtr geom = kernel->geom;
+
+        const mint *origins = faceOrigins.Match(previous, mesh->nFaces());
+        if (origins)
         {
-            delete root;
+            root = RepairOptimizedBVH(mesh, geom, previous, origins);
+        }
+        else
+        {
+            root = CreateOptimizedBVH(mesh, geom);
+        }
+        faceOrigins.Built(origins != nullptr);
+
+        if (previous)
+        {
+            delete previous;
         }
+
+        vertex_bvh = CreateOptimizedBVH_Vertices(mesh, geom);
+
+        BCTSettings settings;
+        settings.require_metrics = false;
+        vertex_bct = new OptimizedBlockClusterTree(vertex_bvh, vertex_bvh, kernel->alpha, kernel->beta, theta, 1., settings);
+
+        ptoc("CoulombEnergy::Update");
+    }
+
+    void CoulombEnergy::NotifyRemeshed(const std::vector<mint> &origins)
+    {
+        faceOrigins.Remeshed(origins);
+    }
+
+    void CoulombEnergy::RefreshCharges()
+    {
+        MeshPtr mesh = kernel->mesh;
+        GeomPtr geom = kernel->geom;
+        UpdateOptimizedBVH_Vertices(vertex_bvh, mesh, geom);
     }
 
     MeshPtr CoulombEnergy::GetMesh()
@@ -50,76 +161,147 @@ namespace rsurfaces
         return theta;
     }
 
-    double CoulombEnergy::Value()
+    template <bool derivatives>
+    mreal CoulombEnergy::NearField()
     {
-        double sum = 0;
-        #pragma omp parallel for reduction(+ : sum) shared(root)
-        for (size_t i = 0; i < kernel->mesh->nVertices(); i++)
+        ptic("CoulombEnergy::NearField");
+
+        auto S = vertex_bct->S;
+        auto T = vertex_bct->T;
+        mint b_m = vertex_bct->near->b_m;
+        mint nthreads = std::min( S->thread_count, T->thread_count);
+
+        mint const *restrict const b_row_ptr = S->leaf_cluster_ptr;
+        mint const *restrict const b_col_ptr = T->leaf_cluster_ptr;
+        mint const *restrict const b_outer = vertex_bct->near->b_outer;
+        mint const *restrict const b_inner = vertex_bct->near->b_inner;
+
+        mreal const *const *X = &S->P_near[0];
+        mreal const *const *Y = &T->P_near[0];
+
+        TPContiguousTargets js;
+        mreal sum = 0.;
+
+        // Each row only writes the derivatives of its own vertices, into the buffer of its thread.
+        #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
+        for( mint b_i = 0; b_i < b_m; ++b_i )
         {
-            GCVertex v = kernel->mesh->vertex(i);
-            double e_v = energyAtVertex(root, v);
-            sum += e_v;
+            mint thread = omp_get_thread_num();
+            mreal *restrict U = derivatives ? &S->P_D_near[thread][0] : nullptr;
+
+            mint i_begin = b_row_ptr[b_i];
+            mint i_end = b_row_ptr[b_i+1];
+
+            for( mint k = b_outer[b_i]; k < b_outer[b_i+1]; ++k )
+            {
+                mint b_j = b_inner[k];
+                mint j_begin = b_col_ptr[b_j];
+                mint j_end = b_col_ptr[b_j+1];
+
+                for( mint i = i_begin; i < i_end; ++i )
+                {
+                    if( b_i == b_j )
+                    {
+                        // Skip the self-interaction of vertex i.
+                        sum += CoulombRow<derivatives>( i, js, j_begin, i, X, Y, U );
+                        sum += CoulombRow<derivatives>( i, js, i + 1, j_end, X, Y, U );
+                    }
+                    else
+                    {
+                        sum += CoulombRow<derivatives>( i, js, j_begin, j_end, X, Y, U );
+                    }
+                }
+            }
         }
+
+        ptoc("CoulombEnergy::NearField");
+
         return sum;
     }
 
-    double CoulombEnergy::energyAtVertex(OptimizedClusterTree* node, GCVertex v)
+    template <bool derivatives>
+    mreal CoulombEnergy::FarField()
     {
-        Vector3 vPos = kernel->geom->inputVertexPositions[v];
-        
-        double sum = 0;
-        for (GCVertex v2 : kernel->mesh->vertices())
+        ptic("CoulombEnergy::FarField");
+
+        auto S = vertex_bct->S;
+        auto T = vertex_bct->T;
+        mint b_m = vertex_bct->far->b_m;
+        mint nthreads = std::min( S->thread_count, T->thread_count);
+
+        mint const *restrict const b_outer = vertex_bct->far->b_outer;
+        TPIndexedTargets js{ vertex_bct->far->b_inner };
+
+        mreal const *const *X = &S->C_far[0];
+        mreal const *const *Y = &T->C_far[0];
+
+        mreal sum = 0.;
+
+        #pragma omp parallel for num_threads( nthreads ) reduction( + : sum ) RAGGED_SCHEDULE
+        for( mint i = 0; i < b_m; ++i )
         {
-            if (v == v2) continue;
-            Vector3 vPos2 = kernel->geom->inputVertexPositions[v2];
-            double dist = (vPos - vPos2).norm();
-            sum += 1 / dist;
+            mint thread = omp_get_thread_num();
+            mreal *restrict U = derivatives ? &S->C_D_far[thread][0] : nullptr;
+
+            sum += CoulombRow<derivatives>( i, js, b_outer[i], b_outer[i+1], X, Y, U );
         }
+
+        ptoc("CoulombEnergy::FarField");
+
         return sum;
     }
 
-    void CoulombEnergy::Differential(Eigen::MatrixXd &output)
+    double CoulombEnergy::Value()
     {
-        VertexIndices indices = kernel->mesh->getVertexIndices();
-        output.setZero();
-        Eigen::MatrixXd partialOutput = output;
-        #pragma omp parallel firstprivate(partialOutput) shared(root, output)
-        {
-            #pragma omp for
-            for (size_t i = 0; i < kernel->mesh->nVertices(); i++)
-            {
-                GCVertex v = kernel->mesh->vertex(i);
-                Vector3 grad_v = gradientAtVertex(root, v);
-                MatrixUtils::addToRow(partialOutput, indices[v], grad_v);
-            }
+        ptic("CoulombEnergy::Value");
 
-            #pragma omp critical
-            {
-                output += partialOutput;
-            }
-        }
+        RefreshCharges();
+        mreal value = NearField<false>() + FarField<false>();
+
+        ptoc("CoulombEnergy::Value");
+
+        return weight * value;
     }
 
-    Vector3 CoulombEnergy::gradientAtVertex(OptimizedClusterTree *node, GCVertex v)
+    double CoulombEnergy::ValueAndDifferential(Eigen::MatrixXd &output)
     {
-        Vector3 vPos = kernel->geom->inputVertexPositions[v];
-        Vector3 sum{0, 0, 0};
+        ptic("CoulombEnergy::ValueAndDifferential");
+
+        RefreshCharges();
+
+        auto S = vertex_bct->S;
+        S->CleanseD();
+
+        mreal value = NearField<true>() + FarField<true>();
 
-        for (GCVertex v2 : kernel->mesh->vertices())
+        EigenMatrixRM P_D_near( S->primitive_count, S->near_dim );
+        EigenMatrixRM P_D_far ( S->primitive_count, S->far_dim );
+
+        S->CollectDerivatives( P_D_near.data(), P_D_far.data() );
+
+        // The block cluster tree holds both orders of every pair, and the rows only
+        // differentiate with respect to their own vertices, so the other half of the
+        // derivative is the same by symmetry. With unit charges, the derivative with
+        // respect to a vertex is the one with respect to its charge-weighted position.
+        mreal factor = 2. * weight;
+        mint vertex_count = S->primitive_count;
+
+        #pragma omp parallel for
+        for( mint i = 0; i < vertex_count; ++i )
         {
-            if (v == v2) continue;
-            Vector3 vPos2 = kernel->geom->inputVertexPositions[v2];
-            Vector3 towardsOther = vPos2 - vPos;
-            double dist = towardsOther.norm();
-            // Normalize the direction
-            towardsOther /= dist;
-            // Then divide by r^2 to get the right magnitude
-            towardsOther /= dist;
-            towardsOther /= dist;
-
-            sum += towardsOther;
+            output(i, 0) += factor * ( P_D_near(i, 1) + P_D_far(i, 1) );
+            output(i, 1) += factor * ( P_D_near(i, 2) + P_D_far(i, 2) );
+            output(i, 2) += factor * ( P_D_near(i, 3) + P_D_far(i, 3) );
         }
-        return sum;
+
+        ptoc("CoulombEnergy::ValueAndDifferential");
+
+        return weight * value;
+    }
+
+    void CoulombEnergy::Differential(Eigen::MatrixXd &output)
+    {
+        ValueAndDifferential(output);
     }
 
-} // namespace rsurfaces
\ No newline at end of file
+} // namespace rsurfaces
@@ -23,15 +23,49 @@ namespace rsurfaces
         }
     }
 
+    void ImplicitAttractor::evaluateSurface(bool withGradients)
+    {
+        size_t nV = mesh->nVertices();
+        positions.resize(3 * nV);
+        distances.resize(nV);
+        gradients.resize(withGradients ? 3 * nV : 0);
+
+        // Without UVs every vertex is attracted, so the mask only needs rebuilding
+        // when the vertex count changes
+        if (uvs || attracted.size() != nV)
+        {
+            attracted.resize(nV);
+            size_t i = 0;
+            for (GCVertex v : mesh->vertices())
+            {
+                attracted[i++] = shouldAttract(v);
+            }
+        }
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < nV; i++)
+        {
+            Vector3 p = geom->inputVertexPositions[i];
+            positions[3 * i + 0] = p.x;
+            positions[3 * i + 1] = p.y;
+            positions[3 * i + 2] = p.z;
+        }
+
+        surface->Evaluate(positions.data(), nV, distances.data(), withGradients ? gradients.data() : 0);
+    }
+
     double ImplicitAttractor::Value()
     {
+        evaluateSurface(false);
+
+        size_t nV = distances.size();
         double sum = 0;
-        for (GCVertex v : mesh->vertices())
+        #pragma omp parallel for reduction(+ : sum)
+        for (size_t i = 0; i < nV; i++)
         {
-            if (shouldAttract(v))
+            if (attracted[i])
             {
-                double signDist = surface->SignedDistance(geom->inputVertexPositions[v]);
-                sum += pow(signDist, power);
+                sum += pow(distances[i], power);
             }
         }
         return weight * sum;
@@ -39,18 +73,19 @@ namespace rsurfaces
 
     void ImplicitAttractor::Differential(Eigen::MatrixXd &output)
     {
-        VertexIndices inds = mesh->getVertexIndices();
+        evaluateSurface(true);
 
-        for (GCVertex v : mesh->vertices())
+        size_t nV = distances.size();
+        #pragma omp parallel for
+        for (size_t i = 0; i < nV; i++)
         {
-            if (shouldAttract(v))
+            if (attracted[i])
             {
-                Vector3 gradDist = surface->GradientOfDistance(geom->inputVertexPositions[v]);
-                double signDist = surface->SignedDistance(geom->inputVertexPositions[v]);
-
                 // d/dx D^2 = 2 * D * (d/dx D)
-                Vector3 gradE = power * pow(signDist, power - 1) * gradDist;
-                MatrixUtils::addToRow(output, inds[v], weight * gradE);
+                double coeff = weight * power * pow(distances[i], power - 1);
+                output(i, 0) += coeff * gradients[3 * i + 0];
+                output(i, 1) += coeff * gradients[3 * i + 1];
+                output(i, 2) += coeff * gradients[3 * i + 2];
             }
         }
     }
@@ -69,4 +104,4 @@ namespace rsurfaces
     {
         return 0;
     }
-} // namespace rsurfaces
\ No newline at end of file
+} // namespace rsurfaces
@@ -13,30 +13,52 @@ namespace rsurfaces
         geom = geom_;
     }
 
+    void ImplicitObstacle::evaluateSurface(bool withGradients)
+    {
+        size_t nV = mesh->nVertices();
+        positions.resize(3 * nV);
+        distances.resize(nV);
+        gradients.resize(withGradients ? 3 * nV : 0);
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < nV; i++)
+        {
+            Vector3 p = geom->inputVertexPositions[i];
+            positions[3 * i + 0] = p.x;
+            positions[3 * i + 1] = p.y;
+            positions[3 * i + 2] = p.z;
+        }
+
+        surface->Evaluate(positions.data(), nV, distances.data(), withGradients ? gradients.data() : 0);
+    }
+
     double ImplicitObstacle::Value()
     {
+        evaluateSurface(false);
+
+        size_t nV = distances.size();
         double sum = 0;
-        for (GCVertex v : mesh->vertices())
+        #pragma omp parallel for reduction(+ : sum)
+        for (size_t i = 0; i < nV; i++)
         {
-            double signDist = surface->SignedDistance(geom->inputVertexPositions[v]);
-            sum += 1.0 / pow(signDist, power);
+            sum += 1.0 / pow(distances[i], power);
         }
         return weight * sum;
     }
 
     void ImplicitObstacle::Differential(Eigen::MatrixXd &output)
     {
-        VertexIndices inds = mesh->getVertexIndices();
+        evaluateSurface(true);
 
-        for (GCVertex v : mesh->vertices())
+        size_t nV = distances.size();
+        #pragma omp parallel for
+        for (size_t i = 0; i < nV; i++)
         {
-            Vector3 gradDist = surface->GradientOfDistance(geom->inputVertexPositions[v]);
-            double signDist = surface->SignedDistance(geom->inputVertexPositions[v]);
-
             // d/dx (1 / D^x) = -x * (1 / D^(x+1)) * (d/dx D)
-            double coeff = -power * (1.0 / pow(signDist, power + 1));
-            Vector3 gradE = coeff * gradDist;
-            MatrixUtils::addToRow(output, inds[v], weight * gradE);
+            double coeff = -weight * power * (1.0 / pow(distances[i], power + 1));
+            output(i, 0) += coeff * gradients[3 * i + 0];
+            output(i, 1) += coeff * gradients[3 * i + 1];
+            output(i, 2) += coeff * gradients[3 * i + 2];
         }
     }
 
@@ -54,4 +76,4 @@ namespace rsurfaces
     {
         return 0;
     }
-} // namespace rsurfaces
\ No newline at end of file
+} // namespace rsurfaces
@@ -56,6 +56,14 @@ namespace rsurfaces
     {
         originalPositions[v] = newPos;
     }
+
+    void SquaredError::ResetTargetsInRegion(const DragRegion &region)
+    {
+        for (mint i : region.vertices)
+        {
+            originalPositions.data[i] = geom->inputVertexPositions[i];
+        }
+    }
     
     // Get the exponents of this energy; only applies to tangent-point energies.
     Vector2 SquaredError::GetExponents()
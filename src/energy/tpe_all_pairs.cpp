@@ -297,16 +297,31 @@ namespace rsurfaces
     void TPEnergyAllPairs::Update()
     {
         ptic("TPEnergyAllPairs::Update");
-        if (bvh)
+        OptimizedClusterTree *previous = bvh;
+        const mint *origins = faceOrigins.Match(previous, mesh->nFaces());
+        if (origins)
         {
-            delete bvh;
+            bvh = RepairOptimizedBVH(mesh, geom, previous, origins);
+        }
+        else
+        {
+            bvh = CreateOptimizedBVH(mesh, geom);
+        }
+        faceOrigins.Built(origins != nullptr);
+
+        if (previous)
+        {
+            delete previous;
         }
-        
-        bvh = CreateOptimizedBVH(mesh, geom);
         
         ptoc("TPEnergyAllPairs::Update");
     }
 
+    void TPEnergyAllPairs::NotifyRemeshed(const std::vector<mint> &origins)
+    {
+        faceOrigins.Remeshed(origins);
+    }
+
     // Get the exponents of this energy; only applies to tangent-point energies.
     Vector2 TPEnergyAllPairs::GetExponents()
     {
@@ -320,15 +320,30 @@ namespace rsurfaces
     // involve building a new BVH for Barnes-Hut energies, for instance.
     void TPEnergyAllPairs_Projectors::Update()
     {
-        if (bvh)
+        OptimizedClusterTree *previous = bvh;
+        const mint *origins = faceOrigins.Match(previous, mesh->nFaces());
+        if (origins)
         {
-            delete bvh;
+            bvh = RepairOptimizedBVH_Projectors(mesh, geom, previous, origins);
         }
+        else
+        {
+            bvh = CreateOptimizedBVH_Projectors(mesh, geom);
+        }
+        faceOrigins.Built(origins != nullptr);
 
-        bvh = CreateOptimizedBVH_Projectors(mesh, geom);
+        if (previous)
+        {
+            delete previous;
+        }
         
     }
 
+    void TPEnergyAllPairs_Projectors::NotifyRemeshed(const std::vector<mint> &origins)
+    {
+        faceOrigins.Remeshed(origins);
+    }
+
     // Get the mesh associated with this energy.
     MeshPtr TPEnergyAllPairs_Projectors::GetMesh()
     {
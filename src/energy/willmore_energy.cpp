@@ -4,97 +4,98 @@ namespace rsurfaces
 {
     void WillmoreEnergy::requireMeanCurvatureVectors()
     {
-        mint vertex_count = mesh->nVertices();
-        VertexIndices vInds = mesh->getVertexIndices();
+        operators->Update(mesh, geom);
         
-        geom->requireVertexDualAreas();
-        geom->requireFaceAreas();
-        geom->requireCotanLaplacian();
-        geom->requireVertexPositions();
+        mint vertex_count = operators->VertexCount();
+        mreal const * restrict const A = operators->DualAreas();
+        char const * restrict const boundary = operators->Boundary();
         
-        auto x = Eigen::MatrixXd( vertex_count, 3 );
-                    
-        for( mint i = 0; i < vertex_count; ++i )
-        {
-            x( i, 0 ) = geom->inputVertexPositions[i][0];
-            x( i, 1 ) = geom->inputVertexPositions[i][1];
-            x( i, 2 ) = geom->inputVertexPositions[i][2];
-        }
+        H.assign( 3 * vertex_count, 0. );
+        H_squared.resize( vertex_count );
         
-        H = geom->cotanLaplacian * x;
+        operators->MultiplyAddLaplacian( operators->Positions(), H.data() );
         
-        H_squared = Eigen::VectorXd( vertex_count );
+        mreal * restrict const h = H.data();
+        mreal * restrict const h2 = H_squared.data();
         
-        for( auto vertex : mesh->vertices() )
+        #pragma omp parallel for simd
+        for( mint i = 0; i < vertex_count; ++i )
         {
-            mint i = vInds[vertex];
-            
-            mreal factor = ( vertex.isBoundary() ) ? 0. : -0.5/ geom->vertexDualArea(vertex);
-            H( i, 0 ) *= factor;
-            H( i, 1 ) *= factor;
-            H( i, 2 ) *= factor;
+            mreal factor = boundary[i] ? 0. : -0.5 / A[i];
+            h[3 * i + 0] *= factor;
+            h[3 * i + 1] *= factor;
+            h[3 * i + 2] *= factor;
             
-            H_squared(i) = H( i, 0 ) * H( i, 0 ) + H( i, 1 ) * H( i, 1 ) + H( i, 2 ) * H( i, 2 );
+            h2[i] = h[3 * i + 0] * h[3 * i + 0] + h[3 * i + 1] * h[3 * i + 1] + h[3 * i + 2] * h[3 * i + 2];
         }
     }
 
     double WillmoreEnergy::Value()
     {
         requireMeanCurvatureVectors();
-        geom->requireVertexDualAreas();
         
-        Eigen::VectorXd a = geom->vertexDualAreas.toVector();
+        mint vertex_count = operators->VertexCount();
+        mreal const * restrict const A = operators->DualAreas();
+        mreal const * restrict const h2 = H_squared.data();
+        
+        mreal sum = 0.;
+        #pragma omp parallel for simd reduction( + : sum )
+        for( mint i = 0; i < vertex_count; ++i )
+        {
+            sum += h2[i] * A[i];
+        }
 
-        return weight * H_squared.dot(a);
+        return weight * sum;
     } // Value
 
     void WillmoreEnergy::Differential( Eigen::MatrixXd &output )
     {
-        auto primitives = getPrimitiveIndices(mesh,geom);
-        auto x = getVertexPositions(mesh,geom);
-        
-        mint vertex_count = x.rows();
-        mint dim = x.cols();
-        mint primitive_count = primitives.rows();
-        mint primitive_length = primitives.cols();
         requireMeanCurvatureVectors();
+        
+        mint dim = 3;
+        mint primitive_count = operators->TriangleCount();
+        mint primitive_length = 3;
+        mint const * restrict const t = operators->Triangles();
+        mreal const * restrict const x = operators->Positions();
+        mreal const * restrict const h = H.data();
+        mreal const * restrict const h2 = H_squared.data();
 
         auto buffer = Eigen::MatrixXd( primitive_count * primitive_length, dim );
         
         mreal one_third = 1./3.;
         
-        #pragma omp parallel
+        #pragma omp parallel for
         for( mint i = 0 ; i < primitive_count; ++i )
         {
-            mint i0 = primitives(i,0);
-            mint i1 = primitives(i,1);
-            mint i2 = primitives(i,2);
+            mint i0 = t[3 * i + 0];
+            mint i1 = t[3 * i + 1];
+            mint i2 = t[3 * i + 2];
             
-            mreal x00 = x(i0,0);
-            mreal x01 = x(i0,1);
-            mreal x02 = x(i0,2);
+            mreal x00 = x[3 * i0 + 0];
+            mreal x01 = x[3 * i0 + 1];
+            mreal x02 = x[3 * i0 + 2];
             
-            mreal x10 = x(i1,0);
-            mreal x11 = x(i1,1);
-            mreal x12 = x(i1,2);
+            mreal x10 = x[3 * i1 + 0];
+            mreal x11 = x[3 * i1 + 1];
+            mreal x12 = x[3 * i1 + 2];
             
-            mreal x20 = x(i2,0);
-            mreal x21 = x(i2,1);
-            mreal x22 = x(i2,2);
+            mreal x20 = x[3 * i2 + 0];
+            mreal x21 = x[3 * i2 + 1];
+            mreal x22 = x[3 * i2 + 2];
             
-            mreal v00 = H( i0, 0 );
-            mreal v01 = H( i0, 1 );
-            mreal v02 = H( i0, 2 );
+            mreal v00 = h[3 * i0 + 0];
+            mreal v01 = h[3 * i0 + 1];
+            mreal v02 = h[3 * i0 + 2];
             
-            mreal v10 = H( i1, 0 );
-            mreal v11 = H( i1, 1 );
-            mreal v12 = H( i1, 2 );
+            mreal v10 = h[3 * i1 + 0];
+            mreal v11 = h[3 * i1 + 1];
+            mreal v12 = h[3 * i1 + 2];
             
-            mreal v20 = H( i2, 0 );
-            mreal v21 = H( i2, 1 );
-            mreal v22 = H( i2, 2 );
+            mreal v20 = h[3 * i2 + 0];
+            mreal v21 = h[3 * i2 + 1];
+            mreal v22 = h[3 * i2 + 2];
             
-            mreal weight = one_third * ( H_squared(i0) + H_squared(i1) + H_squared(i2) );
+            mreal weight = one_third * ( h2[i0] + h2[i1] + h2[i2] );
             
             mreal s0 = -(x01*x10);
             mreal s1 = x00*x11;
@@ -394,7 +395,7 @@ namespace rsurfaces
             buffer( 3 * i + 2, 2 ) = -(s276*v00) - s281*v01 - s266*v02 - s271*v10 - s286*v11 - s260*v12 - s254*v20 - s251*v21 - (((2*s247 + 2*s248)*s26)/4. - (s246*s35)/8.)*v22 - (s26*s89*weight)/4.;
         }
         
-        output += weight * DerivativeAssembler( mesh, geom ) * buffer;
+        AssembleDerivative( t, primitive_count, buffer, output, weight );
     } // Differential
     
     // Get the exponents of this energy; only applies to tangent-point energies.
@@ -406,7 +407,7 @@ namespace rsurfaces
     void WillmoreEnergy::AddMetricTerm(std::vector<MetricTerm*> &terms)
     {
         std::cout << "  * Adding bi-Laplacian to metric for Willmore energy" << std::endl;
-        BiLaplacianMetricTerm* term = new BiLaplacianMetricTerm(mesh, geom);
+        BiLaplacianMetricTerm* term = new BiLaplacianMetricTerm(mesh, geom, operators);
         terms.push_back(term);
     }
 
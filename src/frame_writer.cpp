@@ -0,0 +1,303 @@
+#include "frame_writer.h"
+#include "binary_mesh.h"
+#include "trajectory.h"
+#include "scene_file.h"
+#include "profiler.h"
+
+#include <fstream>
+#include <sstream>
+
+#ifdef RSURFACES_USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace rsurfaces
+{
+    bool frameCompressionAvailable()
+    {
+#ifdef RSURFACES_USE_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    AsyncFrameWriter::AsyncFrameWriter(size_t maxQueued_)
+    {
+        maxQueued = std::max(maxQueued_, size_t(1));
+        stopping = false;
+        busy = false;
+        format = FrameFormat::OBJ;
+        compress = false;
+        trajectoryFile = "trajectory.rst";
+        trajectoryQuantum = 1e-6;
+        trajectoryKeepFrames = -1;
+        currentFaces = 0;
+        currentFacesEpoch = 0;
+        warnedTrajectoryAreaRatios = false;
+        worker = std::thread(&AsyncFrameWriter::run, this);
+    }
+
+    AsyncFrameWriter::~AsyncFrameWriter()
+    {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueNotEmpty.notify_all();
+        worker.join();
+    }
+
+    void AsyncFrameWriter::InvalidateConnectivity()
+    {
+        currentFaces = 0;
+    }
+
+    void AsyncFrameWriter::Enqueue(MeshPtr mesh, GeomPtr geom, GeomPtr geomOrig, bool writeAreaRatios, std::string output,
+                                   size_t connectivityEpoch)
+    {
+        ptic("AsyncFrameWriter::Enqueue");
+
+        FrameSnapshot frame;
+        frame.format = format;
+        frame.compress = compress && frameCompressionAvailable();
+
+        std::string base = output;
+        if (endsWith(base, ".obj"))
+        {
+            base = base.substr(0, base.size() - 4);
+        }
+        if (format == FrameFormat::Trajectory)
+        {
+            frame.filename = trajectoryFile;
+        }
+        else
+        {
+            frame.filename = base + ((format == FrameFormat::Binary) ? ".rsm" : ".obj") + (frame.compress ? ".gz" : "");
+        }
+
+        // The count check also catches a mesh replaced behind the remesher's back, e.g. on resume
+        if (currentFaces && (currentFacesEpoch != connectivityEpoch || currentFaces->size() != 3 * mesh->nFaces()))
+        {
+            currentFaces = 0;
+        }
+        if (!currentFaces)
+        {
+            std::vector<uint32_t> *faces = new std::vector<uint32_t>(3 * mesh->nFaces());
+            VertexIndices inds = mesh->getVertexIndices();
+            size_t i = 0;
+            for (GCFace f : mesh->faces())
+            {
+                for (GCVertex v : f.adjacentVertices())
+                {
+                    (*faces)[i++] = inds[v];
+                }
+            }
+            currentFaces = std::shared_ptr<const std::vector<uint32_t>>(faces);
+            currentFacesEpoch = connectivityEpoch;
+        }
+        frame.faces = currentFaces;
+
+        size_t nVerts = mesh->nVertices();
+        frame.positions.resize(nVerts, 3);
+        #pragma omp parallel for
+        for (size_t i = 0; i < nVerts; i++)
+        {
+            Vector3 p = geom->inputVertexPositions[i];
+            frame.positions(i, 0) = p.x;
+            frame.positions(i, 1) = p.y;
+            frame.positions(i, 2) = p.z;
+        }
+
+        if (writeAreaRatios && format == FrameFormat::Trajectory)
+        {
+            if (!warnedTrajectoryAreaRatios)
+            {
+                std::cout << "Warning: the trajectory format cannot store area ratios; they are not written." << std::endl;
+                warnedTrajectoryAreaRatios = true;
+            }
+            writeAreaRatios = false;
+        }
+
+        if (writeAreaRatios)
+        {
+            frame.areaRatios.setZero(nVerts);
+            for (size_t i = 0; i < nVerts; i++)
+            {
+                GCVertex vert = mesh->vertex(i);
+                frame.areaRatios(i) = geomOrig->vertexDualArea(vert) / geom->vertexDualArea(vert);
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (queue.size() >= maxQueued)
+            {
+                std::cout << "Frame writer is behind (" << queue.size() << " frames queued); waiting for disk..." << std::endl;
+                queueNotFull.wait(lock, [this] { return queue.size() < maxQueued; });
+            }
+            queue.push_back(std::move(frame));
+        }
+        queueNotEmpty.notify_one();
+
+        ptoc("AsyncFrameWriter::Enqueue");
+    }
+
+    void AsyncFrameWriter::Flush()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueNotFull.wait(lock, [this] { return queue.empty() && !busy; });
+    }
+
+    void AsyncFrameWriter::run()
+    {
+        while (true)
+        {
+            FrameSnapshot frame;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueNotEmpty.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    // Only reached when stopping, after everything has been written
+                    return;
+                }
+                frame = std::move(queue.front());
+                queue.pop_front();
+                busy = true;
+            }
+
+            writeFrame(frame);
+
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                busy = false;
+            }
+            queueNotFull.notify_all();
+        }
+    }
+
+    void serializeOBJ(FrameSnapshot &frame, std::ostream &out)
+    {
+        bool writeAreaRatios = (frame.areaRatios.size() > 0);
+        size_t nVerts = frame.positions.rows();
+        const std::vector<uint32_t> &faces = *frame.faces;
+
+        for (size_t i = 0; i < nVerts; i++)
+        {
+            out << "v " << frame.positions(i, 0) << " " << frame.positions(i, 1) << " " << frame.positions(i, 2) << "\n";
+        }
+
+        if (writeAreaRatios)
+        {
+            for (size_t i = 0; i < nVerts; i++)
+            {
+                out << "vt " << frame.areaRatios(i) << " " << 0 << "\n";
+            }
+        }
+
+        for (size_t i = 0; i < faces.size(); i += 3)
+        {
+            out << "f ";
+            for (size_t j = 0; j < 3; j++)
+            {
+                // OBJ is 1-indexed
+                size_t vertInd = faces[i + j] + 1;
+                out << vertInd;
+                if (writeAreaRatios)
+                {
+                    out << "/" << vertInd;
+                }
+                out << " ";
+            }
+            out << "\n";
+        }
+        out << "\n";
+    }
+
+    void AsyncFrameWriter::writeFrame(FrameSnapshot &frame)
+    {
+        if (frame.format == FrameFormat::Trajectory)
+        {
+            if (!trajectory || trajectory->Filename() != frame.filename)
+            {
+                try
+                {
+                    trajectory.reset(new TrajectoryWriter(frame.filename, trajectoryQuantum, frame.compress, trajectoryKeepFrames));
+                    trajectoryKeepFrames = -1;
+                }
+                catch (std::runtime_error &e)
+                {
+                    std::cerr << e.what() << std::endl;
+                    return;
+                }
+                std::cout << "Writing trajectory to " << frame.filename << std::endl;
+            }
+            try
+            {
+                trajectory->WriteFrame(frame.positions.data(), frame.positions.rows(), frame.faces);
+            }
+            catch (std::runtime_error &e)
+            {
+                std::cerr << e.what() << " Skipping the frame." << std::endl;
+            }
+            return;
+        }
+
+        std::ostringstream buffer;
+        if (frame.format == FrameFormat::Binary)
+        {
+            const std::vector<uint32_t> &faces = *frame.faces;
+            std::vector<double> cornerRatios;
+            if (frame.areaRatios.size() > 0)
+            {
+                // Per-face data with one value per corner, like the vt indices in the OBJ output
+                cornerRatios.resize(faces.size());
+                for (size_t i = 0; i < faces.size(); i++)
+                {
+                    cornerRatios[i] = frame.areaRatios(faces[i]);
+                }
+            }
+            writeBinaryMesh(buffer, frame.positions.data(), frame.positions.rows(), faces.data(), faces.size() / 3,
+                            cornerRatios.empty() ? 0 : cornerRatios.data(), cornerRatios.empty() ? 0 : 3);
+        }
+        else
+        {
+            serializeOBJ(frame, buffer);
+        }
+        std::string data = buffer.str();
+
+        if (frame.compress)
+        {
+#ifdef RSURFACES_USE_ZLIB
+            // Level 1: the point is to shrink the data faster than the disk could write it
+            gzFile gz = gzopen(frame.filename.c_str(), "wb1");
+            if (!gz)
+            {
+                std::cerr << "Could not open " << frame.filename << " for writing." << std::endl;
+                return;
+            }
+            size_t written = 0;
+            while (written < data.size())
+            {
+                unsigned int chunk = (unsigned int)std::min(data.size() - written, size_t(1) << 30);
+                gzwrite(gz, data.data() + written, chunk);
+                written += chunk;
+            }
+            gzclose(gz);
+#endif
+        }
+        else
+        {
+            std::ofstream outfile(frame.filename, std::ios::binary);
+            if (!outfile)
+            {
+                std::cerr << "Could not open " << frame.filename << " for writing." << std::endl;
+                return;
+            }
+            outfile.write(data.data(), data.size());
+            outfile.close();
+        }
+        std::cout << "Saved frame to " << frame.filename << std::endl;
+    }
+} // namespace rsurfaces
@@ -0,0 +1,172 @@
+#include "geometry_cache.h"
+#include "vertex_positions.h"
+
+namespace rsurfaces
+{
+    void GeometryCache::Require(int quantities)
+    {
+        // Dual areas are summed from the face areas
+        if (quantities & VertexDualAreas)
+        {
+            quantities |= FaceAreas;
+        }
+        missing |= quantities & ~required;
+        required |= quantities;
+        Resize();
+    }
+
+    void GeometryCache::Resize()
+    {
+        faceArea.resize((required & FaceAreas) ? faceCount : 0);
+        for (auto *a : {&nx, &ny, &nz})
+        {
+            a->resize((required & FaceNormals) ? faceCount : 0);
+        }
+        for (auto *a : {&bx, &by, &bz})
+        {
+            a->resize((required & FaceBarycenters) ? faceCount : 0);
+        }
+        dualArea.resize((required & VertexDualAreas) ? vertexCount : 0);
+    }
+
+    void GeometryCache::Rebuild(MeshPtr const &mesh, GeomPtr const &geom)
+    {
+        ptic("GeometryCache::Rebuild");
+
+        vertexCount = mesh->nVertices();
+        faceCount = mesh->nFaces();
+        VertexIndices vInds = mesh->getVertexIndices();
+        positions = mapVertexPositions(mesh, geom).data();
+
+        triangles.resize(3 * faceCount);
+        FaceIndices fInds = mesh->getFaceIndices();
+        for (GCFace face : mesh->faces())
+        {
+            mint f = fInds[face];
+            GCHalfedge he = face.halfedge();
+            triangles[3 * f + 0] = vInds[he.vertex()];
+            triangles[3 * f + 1] = vInds[he.next().vertex()];
+            triangles[3 * f + 2] = vInds[he.next().next().vertex()];
+        }
+
+        vf_outer.assign(vertexCount + 1, 0);
+        for (mint k = 0; k < 3 * faceCount; ++k)
+        {
+            ++vf_outer[triangles[k] + 1];
+        }
+        for (mint i = 0; i < vertexCount; ++i)
+        {
+            vf_outer[i + 1] += vf_outer[i];
+        }
+        vf_inner.resize(3 * faceCount);
+        std::vector<mint> fill(vf_outer.begin(), vf_outer.end() - 1);
+        for (mint k = 0; k < 3 * faceCount; ++k)
+        {
+            vf_inner[fill[triangles[k]]++] = k / 3;
+        }
+
+        vertexMoving.assign(vertexCount, true);
+        faceChanged.resize(faceCount);
+        Resize();
+
+        missing = required;
+        Update();
+
+        ptoc("GeometryCache::Rebuild");
+    }
+
+    void GeometryCache::SetMoving(const Eigen::MatrixXd &direction)
+    {
+        if (direction.rows() != vertexCount)
+        {
+            throw std::runtime_error("GeometryCache: direction has " + std::to_string(direction.rows()) +
+                                     " rows, but the mesh has " + std::to_string(vertexCount) + " vertices.");
+        }
+
+        #pragma omp parallel for
+        for (mint i = 0; i < vertexCount; ++i)
+        {
+            vertexMoving[i] = (direction(i, 0) != 0.) || (direction(i, 1) != 0.) || (direction(i, 2) != 0.);
+        }
+    }
+
+    void GeometryCache::Update()
+    {
+        ptic("GeometryCache::Update");
+
+        // Quantities required since the last update have to be computed everywhere
+        bool all = (missing != 0);
+        int todo = required;
+
+        #pragma omp parallel for
+        for (mint f = 0; f < faceCount; ++f)
+        {
+            mint i0 = triangles[3 * f + 0];
+            mint i1 = triangles[3 * f + 1];
+            mint i2 = triangles[3 * f + 2];
+
+            faceChanged[f] = all || vertexMoving[i0] || vertexMoving[i1] || vertexMoving[i2];
+            if (!faceChanged[f])
+            {
+                continue;
+            }
+
+            mreal const *p0 = positions + 3 * i0;
+            mreal const *p1 = positions + 3 * i1;
+            mreal const *p2 = positions + 3 * i2;
+
+            if (todo & FaceBarycenters)
+            {
+                bx[f] = (p0[0] + p1[0] + p2[0]) / 3.;
+                by[f] = (p0[1] + p1[1] + p2[1]) / 3.;
+                bz[f] = (p0[2] + p1[2] + p2[2]) / 3.;
+            }
+
+            if (todo & (FaceAreas | FaceNormals))
+            {
+                mreal u0 = p1[0] - p0[0], u1 = p1[1] - p0[1], u2 = p1[2] - p0[2];
+                mreal v0 = p2[0] - p0[0], v1 = p2[1] - p0[1], v2 = p2[2] - p0[2];
+                mreal c0 = u1 * v2 - u2 * v1;
+                mreal c1 = u2 * v0 - u0 * v2;
+                mreal c2 = u0 * v1 - u1 * v0;
+                mreal norm = sqrt(c0 * c0 + c1 * c1 + c2 * c2);
+
+                if (todo & FaceAreas)
+                {
+                    faceArea[f] = 0.5 * norm;
+                }
+                if (todo & FaceNormals)
+                {
+                    mreal ninv = 1. / norm;
+                    nx[f] = c0 * ninv;
+                    ny[f] = c1 * ninv;
+                    nz[f] = c2 * ninv;
+                }
+            }
+        }
+
+        if (todo & VertexDualAreas)
+        {
+            #pragma omp parallel for
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                bool changed = false;
+                mreal sum = 0.;
+                for (mint k = vf_outer[i]; k < vf_outer[i + 1]; ++k)
+                {
+                    changed = changed || faceChanged[vf_inner[k]];
+                    sum += faceArea[vf_inner[k]];
+                }
+                if (changed)
+                {
+                    dualArea[i] = sum / 3.;
+                }
+            }
+        }
+
+        missing = 0;
+
+        ptoc("GeometryCache::Update");
+    }
+
+} // namespace rsurfaces
@@ -0,0 +1,111 @@
+#include "implicit/csg_surfaces.h"
+
+#include <algorithm>
+
+namespace rsurfaces
+{
+    ImplicitCSG::ImplicitCSG(CSGOperation op, std::unique_ptr<ImplicitSurface> first_, std::unique_ptr<ImplicitSurface> second_)
+        : first(std::move(first_)), second(std::move(second_))
+    {
+        operation = op;
+    }
+
+    double ImplicitCSG::SignedDistance(Vector3 point)
+    {
+        double d1 = first->SignedDistance(point);
+        double d2 = second->SignedDistance(point);
+        if (operation == CSGOperation::Difference)
+        {
+            d2 = -d2;
+        }
+        return takeSecond(d1, d2) ? d2 : d1;
+    }
+
+    Vector3 ImplicitCSG::GradientOfDistance(Vector3 point)
+    {
+        double d1 = first->SignedDistance(point);
+        double d2 = second->SignedDistance(point);
+        double sign2 = 1;
+        if (operation == CSGOperation::Difference)
+        {
+            d2 = -d2;
+            sign2 = -1;
+        }
+        return takeSecond(d1, d2) ? sign2 * second->GradientOfDistance(point) : first->GradientOfDistance(point);
+    }
+
+    double ImplicitCSG::BoundingDiameter()
+    {
+        if (operation == CSGOperation::Union)
+        {
+            // Smallest sphere containing both bounding spheres
+            double r1 = first->BoundingDiameter() / 2;
+            double r2 = second->BoundingDiameter() / 2;
+            double dist = norm(second->BoundingCenter() - first->BoundingCenter());
+            return std::max(std::max(2 * r1, 2 * r2), dist + r1 + r2);
+        }
+        else if (operation == CSGOperation::Intersection)
+        {
+            return std::min(first->BoundingDiameter(), second->BoundingDiameter());
+        }
+        return first->BoundingDiameter();
+    }
+
+    Vector3 ImplicitCSG::BoundingCenter()
+    {
+        if (operation == CSGOperation::Union)
+        {
+            Vector3 c1 = first->BoundingCenter();
+            Vector3 c2 = second->BoundingCenter();
+            double r1 = first->BoundingDiameter() / 2;
+            double r2 = second->BoundingDiameter() / 2;
+            double dist = norm(c2 - c1);
+            if (dist + r2 <= r1)
+            {
+                return c1;
+            }
+            if (dist + r1 <= r2)
+            {
+                return c2;
+            }
+            double R = (dist + r1 + r2) / 2;
+            return c1 + ((R - r1) / dist) * (c2 - c1);
+        }
+        else if (operation == CSGOperation::Intersection && second->BoundingDiameter() < first->BoundingDiameter())
+        {
+            return second->BoundingCenter();
+        }
+        return first->BoundingCenter();
+    }
+
+    void ImplicitCSG::Evaluate(const double *points, size_t n, double *distances, double *gradients)
+    {
+        // Evaluate both operands in batch, then select per point
+        std::vector<double> d2(n);
+        std::vector<double> g2(gradients ? 3 * n : 0);
+        first->Evaluate(points, n, distances, gradients);
+        second->Evaluate(points, n, d2.data(), gradients ? g2.data() : 0);
+
+        const double sign2 = (operation == CSGOperation::Difference) ? -1 : 1;
+        const bool isUnion = (operation == CSGOperation::Union);
+        const double *D2 = d2.data();
+        const double *G2 = g2.data();
+
+        #pragma omp parallel for simd
+        for (size_t i = 0; i < n; i++)
+        {
+            double d = sign2 * D2[i];
+            bool useSecond = isUnion ? (d < distances[i]) : (d > distances[i]);
+            if (useSecond)
+            {
+                distances[i] = d;
+                if (gradients)
+                {
+                    gradients[3 * i + 0] = sign2 * G2[3 * i + 0];
+                    gradients[3 * i + 1] = sign2 * G2[3 * i + 1];
+                    gradients[3 * i + 2] = sign2 * G2[3 * i + 2];
+                }
+            }
+        }
+    }
+}
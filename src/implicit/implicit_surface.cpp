@@ -3,4 +3,21 @@
 namespace rsurfaces
 {
     ImplicitSurface::~ImplicitSurface() {}
-}
\ No newline at end of file
+
+    void ImplicitSurface::Evaluate(const double *points, size_t n, double *distances, double *gradients)
+    {
+        #pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector3 p{points[3 * i + 0], points[3 * i + 1], points[3 * i + 2]};
+            distances[i] = SignedDistance(p);
+            if (gradients)
+            {
+                Vector3 g = GradientOfDistance(p);
+                gradients[3 * i + 0] = g.x;
+                gradients[3 * i + 1] = g.y;
+                gradients[3 * i + 2] = g.z;
+            }
+        }
+    }
+}
@@ -0,0 +1,591 @@
+#include "implicit/mesh_sdf.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <omp.h>
+
+namespace rsurfaces
+{
+    namespace
+    {
+        struct SDFTriangle
+        {
+            Vector3 p[3];
+            Vector3 faceNormal;
+            Vector3 vertexNormals[3];
+            // Edges p0-p1, p1-p2, p2-p0
+            Vector3 edgeNormals[3];
+        };
+
+        inline uint64_t packBlock(int64_t i, int64_t j, int64_t k)
+        {
+            const int64_t offset = int64_t(1) << 20;
+            return (uint64_t(i + offset) << 42) | (uint64_t(j + offset) << 21) | uint64_t(k + offset);
+        }
+
+        inline void unpackBlock(uint64_t key, int64_t &i, int64_t &j, int64_t &k)
+        {
+            const int64_t offset = int64_t(1) << 20;
+            const uint64_t mask = (uint64_t(1) << 21) - 1;
+            i = int64_t((key >> 42) & mask) - offset;
+            j = int64_t((key >> 21) & mask) - offset;
+            k = int64_t(key & mask) - offset;
+        }
+
+        inline int64_t floorDiv(int64_t a, int64_t b)
+        {
+            return (a >= 0) ? a / b : -((-a + b - 1) / b);
+        }
+
+        // Closest point on a triangle (Ericson, Real-Time Collision Detection, 5.1.5),
+        // also returning the pseudonormal of the feature the closest point lies on.
+        inline Vector3 closestPoint(const SDFTriangle &t, Vector3 p, Vector3 &pseudoNormal)
+        {
+            Vector3 a = t.p[0], b = t.p[1], c = t.p[2];
+            Vector3 ab = b - a, ac = c - a, ap = p - a;
+            double d1 = dot(ab, ap), d2 = dot(ac, ap);
+            if (d1 <= 0 && d2 <= 0)
+            {
+                pseudoNormal = t.vertexNormals[0];
+                return a;
+            }
+
+            Vector3 bp = p - b;
+            double d3 = dot(ab, bp), d4 = dot(ac, bp);
+            if (d3 >= 0 && d4 <= d3)
+            {
+                pseudoNormal = t.vertexNormals[1];
+                return b;
+            }
+
+            double vc = d1 * d4 - d3 * d2;
+            if (vc <= 0 && d1 >= 0 && d3 <= 0)
+            {
+                pseudoNormal = t.edgeNormals[0];
+                return a + (d1 / (d1 - d3)) * ab;
+            }
+
+            Vector3 cp = p - c;
+            double d5 = dot(ab, cp), d6 = dot(ac, cp);
+            if (d6 >= 0 && d5 <= d6)
+            {
+                pseudoNormal = t.vertexNormals[2];
+                return c;
+            }
+
+            double vb = d5 * d2 - d1 * d6;
+            if (vb <= 0 && d2 >= 0 && d6 <= 0)
+            {
+                pseudoNormal = t.edgeNormals[2];
+                return a + (d2 / (d2 - d6)) * ac;
+            }
+
+            double va = d3 * d6 - d5 * d4;
+            if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+            {
+                pseudoNormal = t.edgeNormals[1];
+                return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+            }
+
+            double denom = 1. / (va + vb + vc);
+            pseudoNormal = t.faceNormal;
+            return a + (vb * denom) * ab + (vc * denom) * ac;
+        }
+    } // namespace
+
+    MeshSDF::MeshSDF(surface::SurfaceMesh &mesh, surface::VertexPositionGeometry &geom, double cellSize_, int bandCells_)
+    {
+        ptic("MeshSDF::MeshSDF");
+
+        cellSize = cellSize_;
+        bandWidth = bandCells_ * cellSize;
+        if (cellSize <= 0 || bandCells_ < 1)
+        {
+            throw std::runtime_error("Signed distance grid needs a positive cell size and band width.");
+        }
+
+        // Gather the triangles together with the pseudonormals of their vertices and edges
+        size_t nV = mesh.nVertices();
+        surface::VertexData<size_t> vInds = mesh.getVertexIndices();
+        std::vector<Vector3> vertexNormals(nV, Vector3{0, 0, 0});
+        std::unordered_map<uint64_t, Vector3> edgeNormals;
+        std::vector<std::array<size_t, 3>> triIndices;
+
+        boxMin = Vector3{INFINITY, INFINITY, INFINITY};
+        boxMax = -boxMin;
+        for (size_t i = 0; i < nV; i++)
+        {
+            Vector3 p = geom.inputVertexPositions[i];
+            boxMin = Vector3{std::min(boxMin.x, p.x), std::min(boxMin.y, p.y), std::min(boxMin.z, p.z)};
+            boxMax = Vector3{std::max(boxMax.x, p.x), std::max(boxMax.y, p.y), std::max(boxMax.z, p.z)};
+        }
+
+        for (surface::Face f : mesh.faces())
+        {
+            if (f.degree() != 3)
+            {
+                throw std::runtime_error("Signed distance grid only supports triangle meshes.");
+            }
+            std::array<size_t, 3> tri;
+            size_t c = 0;
+            for (surface::Vertex v : f.adjacentVertices())
+            {
+                tri[c++] = vInds[v];
+            }
+
+            Vector3 p[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = geom.inputVertexPositions[tri[k]];
+            }
+            // Degenerate triangles have no normal and no angles; their points all lie on
+            // the edges of their neighbours, so they are left out entirely
+            Vector3 n = cross(p[1] - p[0], p[2] - p[0]);
+            double longestEdge2 = std::max(norm2(p[1] - p[0]), std::max(norm2(p[2] - p[1]), norm2(p[0] - p[2])));
+            if (!(norm(n) > 1e-12 * longestEdge2))
+            {
+                continue;
+            }
+            n = n.normalize();
+            triIndices.push_back(tri);
+
+            for (int k = 0; k < 3; k++)
+            {
+                Vector3 e1 = (p[(k + 1) % 3] - p[k]).normalize();
+                Vector3 e2 = (p[(k + 2) % 3] - p[k]).normalize();
+                double angle = std::acos(std::max(-1., std::min(1., dot(e1, e2))));
+                vertexNormals[tri[k]] += angle * n;
+
+                size_t v0 = std::min(tri[k], tri[(k + 1) % 3]);
+                size_t v1 = std::max(tri[k], tri[(k + 1) % 3]);
+                edgeNormals[(uint64_t(v0) << 32) | uint64_t(v1)] += n;
+            }
+        }
+
+        size_t nT = triIndices.size();
+        std::vector<SDFTriangle> triangles(nT);
+        #pragma omp parallel for
+        for (size_t t = 0; t < nT; t++)
+        {
+            SDFTriangle &T = triangles[t];
+            for (int k = 0; k < 3; k++)
+            {
+                T.p[k] = geom.inputVertexPositions[triIndices[t][k]];
+                T.vertexNormals[k] = vertexNormals[triIndices[t][k]];
+                size_t v0 = std::min(triIndices[t][k], triIndices[t][(k + 1) % 3]);
+                size_t v1 = std::max(triIndices[t][k], triIndices[t][(k + 1) % 3]);
+                T.edgeNormals[k] = edgeNormals.at((uint64_t(v0) << 32) | uint64_t(v1));
+            }
+            T.faceNormal = cross(T.p[1] - T.p[0], T.p[2] - T.p[0]).normalize();
+        }
+
+        // Find the blocks touched by the band around each triangle
+        origin = boxMin - Vector3{bandWidth, bandWidth, bandWidth};
+        double blockSize = B * cellSize;
+        int nThreads = omp_get_max_threads();
+        std::vector<std::vector<std::pair<uint64_t, size_t>>> threadPairs(nThreads);
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (size_t t = 0; t < nT; t++)
+        {
+            std::vector<std::pair<uint64_t, size_t>> &pairs = threadPairs[omp_get_thread_num()];
+            const SDFTriangle &T = triangles[t];
+            int64_t lo[3], hi[3];
+            for (int d = 0; d < 3; d++)
+            {
+                double tMin = std::min(T.p[0][d], std::min(T.p[1][d], T.p[2][d])) - bandWidth - origin[d];
+                double tMax = std::max(T.p[0][d], std::max(T.p[1][d], T.p[2][d])) + bandWidth - origin[d];
+                lo[d] = (int64_t)std::floor(tMin / blockSize);
+                hi[d] = (int64_t)std::floor(tMax / blockSize);
+            }
+            for (int64_t i = lo[0]; i <= hi[0]; i++)
+            {
+                for (int64_t j = lo[1]; j <= hi[1]; j++)
+                {
+                    for (int64_t k = lo[2]; k <= hi[2]; k++)
+                    {
+                        pairs.push_back(std::make_pair(packBlock(i, j, k), t));
+                    }
+                }
+            }
+        }
+
+        std::vector<std::pair<uint64_t, size_t>> pairs;
+        for (auto &tp : threadPairs)
+        {
+            pairs.insert(pairs.end(), tp.begin(), tp.end());
+            std::vector<std::pair<uint64_t, size_t>>().swap(tp);
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        std::vector<size_t> blockStart;
+        for (size_t p = 0; p < pairs.size(); p++)
+        {
+            if (p == 0 || pairs[p].first != pairs[p - 1].first)
+            {
+                blockStart.push_back(p);
+                blockKeys.push_back(pairs[p].first);
+            }
+        }
+        blockStart.push_back(pairs.size());
+
+        // Sample the signed distance at the nodes of every block, clamped to the band
+        size_t nBlocks = blockKeys.size();
+        const size_t nodesPerBlock = NODES * NODES * NODES;
+        blockValues.resize(nBlocks * nodesPerBlock);
+        // +1 / -1 where the sign is known, 0 for nodes beyond the band
+        std::vector<signed char> nodeSigns(nBlocks * nodesPerBlock, 0);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t b = 0; b < nBlocks; b++)
+        {
+            int64_t bi, bj, bk;
+            unpackBlock(blockKeys[b], bi, bj, bk);
+            float *values = &blockValues[b * nodesPerBlock];
+            signed char *signs = &nodeSigns[b * nodesPerBlock];
+
+            for (int li = 0; li < NODES; li++)
+            {
+                for (int lj = 0; lj < NODES; lj++)
+                {
+                    for (int lk = 0; lk < NODES; lk++)
+                    {
+                        Vector3 node = origin + cellSize * Vector3{double(B * bi + li), double(B * bj + lj), double(B * bk + lk)};
+                        // Within the band the candidates include the nearest triangle, so its
+                        // pseudonormal gives the sign; beyond it the sign is found further below
+                        double best = INFINITY;
+                        double bestSign = 1;
+                        for (size_t p = blockStart[b]; p < blockStart[b + 1]; p++)
+                        {
+                            Vector3 pseudoNormal;
+                            Vector3 q = closestPoint(triangles[pairs[p].second], node, pseudoNormal);
+                            double dist = norm(node - q);
+                            if (dist < best)
+                            {
+                                best = dist;
+                                bestSign = (dot(node - q, pseudoNormal) < 0) ? -1 : 1;
+                            }
+                        }
+                        values[(li * NODES + lj) * NODES + lk] = float(bestSign * std::min(best, bandWidth));
+                        signs[(li * NODES + lj) * NODES + lk] = (best <= bandWidth) ? (signed char)bestSign : 0;
+                    }
+                }
+            }
+        }
+
+        blockIndex.reserve(nBlocks);
+        for (size_t b = 0; b < nBlocks; b++)
+        {
+            blockIndex[blockKeys[b]] = b;
+        }
+
+        // The stored blocks cover the band, which separates the inside of a closed mesh from
+        // its outside. Flood the missing blocks from a layer of blocks around all stored ones;
+        // whatever is not reached lies inside.
+        for (int d = 0; d < 3; d++)
+        {
+            blockLo[d] = std::numeric_limits<int64_t>::max();
+            blockHi[d] = std::numeric_limits<int64_t>::min();
+        }
+        if (nBlocks == 0)
+        {
+            throw std::runtime_error("Signed distance grid needs a mesh with at least one triangle.");
+        }
+        for (size_t b = 0; b < nBlocks; b++)
+        {
+            int64_t ijk[3];
+            unpackBlock(blockKeys[b], ijk[0], ijk[1], ijk[2]);
+            for (int d = 0; d < 3; d++)
+            {
+                blockLo[d] = std::min(blockLo[d], ijk[d] - 1);
+                blockHi[d] = std::max(blockHi[d], ijk[d] + 1);
+            }
+        }
+
+        int64_t dims[3] = {blockHi[0] - blockLo[0] + 1, blockHi[1] - blockLo[1] + 1, blockHi[2] - blockLo[2] + 1};
+        // 0 = unknown, 1 = stored, 2 = outside
+        std::vector<char> state(dims[0] * dims[1] * dims[2], 0);
+        for (size_t b = 0; b < nBlocks; b++)
+        {
+            int64_t i, j, k;
+            unpackBlock(blockKeys[b], i, j, k);
+            state[((i - blockLo[0]) * dims[1] + (j - blockLo[1])) * dims[2] + (k - blockLo[2])] = 1;
+        }
+
+        std::vector<int64_t> queue;
+        state[0] = 2;
+        queue.push_back(0);
+        while (!queue.empty())
+        {
+            int64_t cur = queue.back();
+            queue.pop_back();
+            int64_t ijk[3] = {cur / (dims[1] * dims[2]), (cur / dims[2]) % dims[1], cur % dims[2]};
+            for (int d = 0; d < 3; d++)
+            {
+                for (int s = -1; s <= 1; s += 2)
+                {
+                    int64_t next[3] = {ijk[0], ijk[1], ijk[2]};
+                    next[d] += s;
+                    if (next[d] < 0 || next[d] >= dims[d])
+                    {
+                        continue;
+                    }
+                    int64_t idx = (next[0] * dims[1] + next[1]) * dims[2] + next[2];
+                    if (state[idx] == 0)
+                    {
+                        state[idx] = 2;
+                        queue.push_back(idx);
+                    }
+                }
+            }
+        }
+
+        blockInside.resize(state.size());
+        #pragma omp parallel for
+        for (int64_t idx = 0; idx < (int64_t)state.size(); idx++)
+        {
+            blockInside[idx] = (state[idx] == 0);
+        }
+
+        // A node beyond the band cannot be separated by the surface from any neighbouring node,
+        // as the band is at least one cell wide, and neither from a missing block it touches,
+        // which lies beyond the band entirely. So the known signs of the nodes within the band
+        // and of the flooded missing blocks spread through the nodes beyond the band. Blocks
+        // fill in their own nodes and see the other blocks as of the previous sweep.
+        auto sharedNodeSign = [&](const std::vector<signed char> &signs, int64_t x, int64_t y, int64_t z) -> signed char
+        {
+            int64_t g[3] = {x, y, z};
+            int64_t lo[3], hi[3];
+            for (int d = 0; d < 3; d++)
+            {
+                hi[d] = floorDiv(g[d], B);
+                lo[d] = (g[d] == B * hi[d]) ? hi[d] - 1 : hi[d];
+            }
+            signed char missingSign = 0;
+            for (int64_t i = lo[0]; i <= hi[0]; i++)
+            {
+                for (int64_t j = lo[1]; j <= hi[1]; j++)
+                {
+                    for (int64_t k = lo[2]; k <= hi[2]; k++)
+                    {
+                        auto found = blockIndex.find(packBlock(i, j, k));
+                        if (found == blockIndex.end())
+                        {
+                            missingSign = missingBlockInside(i, j, k) ? -1 : 1;
+                            continue;
+                        }
+                        signed char s = signs[found->second * nodesPerBlock + ((x - B * i) * NODES + (y - B * j)) * NODES + (z - B * k)];
+                        if (s != 0)
+                        {
+                            return s;
+                        }
+                    }
+                }
+            }
+            return missingSign;
+        };
+
+        const int neighbours[7][3] = {{0, 0, 0}, {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+        std::vector<signed char> previousSigns;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            previousSigns = nodeSigns;
+
+            #pragma omp parallel for schedule(dynamic, 1) reduction(|| : changed)
+            for (size_t b = 0; b < nBlocks; b++)
+            {
+                int64_t bi, bj, bk;
+                unpackBlock(blockKeys[b], bi, bj, bk);
+                signed char *signs = &nodeSigns[b * nodesPerBlock];
+
+                bool blockChanged = true;
+                while (blockChanged)
+                {
+                    blockChanged = false;
+                    for (int li = 0; li < NODES; li++)
+                    {
+                        for (int lj = 0; lj < NODES; lj++)
+                        {
+                            for (int lk = 0; lk < NODES; lk++)
+                            {
+                                signed char &s = signs[(li * NODES + lj) * NODES + lk];
+                                // Only nodes on the faces of the block have copies in other blocks
+                                bool onFace = (li == 0 || li == B || lj == 0 || lj == B || lk == 0 || lk == B);
+                                for (int m = onFace ? 0 : 1; m < 7 && s == 0; m++)
+                                {
+                                    int ni = li + neighbours[m][0];
+                                    int nj = lj + neighbours[m][1];
+                                    int nk = lk + neighbours[m][2];
+                                    bool local = (ni >= 0 && ni < NODES && nj >= 0 && nj < NODES && nk >= 0 && nk < NODES);
+                                    if (m == 0 || !local)
+                                    {
+                                        s = sharedNodeSign(previousSigns, B * bi + ni, B * bj + nj, B * bk + nk);
+                                    }
+                                    else
+                                    {
+                                        s = signs[(ni * NODES + nj) * NODES + nk];
+                                    }
+                                    if (s != 0)
+                                    {
+                                        blockChanged = true;
+                                        changed = true;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Nodes that could not be reached keep the sign of their nearest candidate
+        #pragma omp parallel for
+        for (size_t n = 0; n < blockValues.size(); n++)
+        {
+            if (nodeSigns[n] != 0)
+            {
+                blockValues[n] = nodeSigns[n] * std::abs(blockValues[n]);
+            }
+        }
+
+        std::cout << "Built signed distance grid with " << nBlocks << " blocks of " << B << "^3 cells (cell size " << cellSize
+                  << ", band " << bandWidth << ") for " << nT << " triangles" << std::endl;
+
+        ptoc("MeshSDF::MeshSDF");
+    }
+
+    bool MeshSDF::missingBlockInside(int64_t i, int64_t j, int64_t k) const
+    {
+        int64_t block[3] = {i, j, k};
+        for (int d = 0; d < 3; d++)
+        {
+            if (block[d] < blockLo[d] || block[d] > blockHi[d])
+            {
+                return false;
+            }
+        }
+        int64_t dy = blockHi[1] - blockLo[1] + 1;
+        int64_t dz = blockHi[2] - blockLo[2] + 1;
+        return blockInside[((i - blockLo[0]) * dy + (j - blockLo[1])) * dz + (k - blockLo[2])];
+    }
+
+    double MeshSDF::evaluate(const double *p, double *gradient) const
+    {
+        double g[3];
+        int64_t cell[3];
+        int64_t block[3];
+        int local[3];
+        double t[3];
+        for (int d = 0; d < 3; d++)
+        {
+            g[d] = (p[d] - origin[d]) / cellSize;
+            cell[d] = (int64_t)std::floor(g[d]);
+            block[d] = floorDiv(cell[d], B);
+            local[d] = int(cell[d] - B * block[d]);
+            t[d] = g[d] - cell[d];
+        }
+
+        auto found = blockIndex.find(packBlock(block[0], block[1], block[2]));
+        if (found == blockIndex.end())
+        {
+            if (gradient)
+            {
+                gradient[0] = gradient[1] = gradient[2] = 0;
+            }
+            return missingBlockInside(block[0], block[1], block[2]) ? -bandWidth : bandWidth;
+        }
+
+        const float *values = &blockValues[found->second * NODES * NODES * NODES];
+        double c[2][2][2];
+        for (int i = 0; i < 2; i++)
+        {
+            for (int j = 0; j < 2; j++)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    c[i][j][k] = values[((local[0] + i) * NODES + (local[1] + j)) * NODES + (local[2] + k)];
+                }
+            }
+        }
+
+        // Trilinear interpolation, one axis at a time
+        double cx[2][2], cxy[2];
+        for (int j = 0; j < 2; j++)
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                cx[j][k] = c[0][j][k] + t[0] * (c[1][j][k] - c[0][j][k]);
+            }
+        }
+        for (int k = 0; k < 2; k++)
+        {
+            cxy[k] = cx[0][k] + t[1] * (cx[1][k] - cx[0][k]);
+        }
+        double value = cxy[0] + t[2] * (cxy[1] - cxy[0]);
+
+        if (gradient)
+        {
+            double dx = 0, dy = 0;
+            for (int j = 0; j < 2; j++)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    double wyz = (j ? t[1] : 1 - t[1]) * (k ? t[2] : 1 - t[2]);
+                    dx += wyz * (c[1][j][k] - c[0][j][k]);
+                }
+            }
+            for (int i = 0; i < 2; i++)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    double wxz = (i ? t[0] : 1 - t[0]) * (k ? t[2] : 1 - t[2]);
+                    dy += wxz * (c[i][1][k] - c[i][0][k]);
+                }
+            }
+            gradient[0] = dx / cellSize;
+            gradient[1] = dy / cellSize;
+            gradient[2] = (cxy[1] - cxy[0]) / cellSize;
+        }
+        return value;
+    }
+
+    void MeshSDF::Evaluate(const double *points, size_t n, double *distances, double *gradients)
+    {
+        ptic("MeshSDF::Evaluate");
+        #pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+        {
+            distances[i] = evaluate(points + 3 * i, gradients ? gradients + 3 * i : 0);
+        }
+        ptoc("MeshSDF::Evaluate");
+    }
+
+    double MeshSDF::SignedDistance(Vector3 point)
+    {
+        double p[3] = {point.x, point.y, point.z};
+        return evaluate(p, 0);
+    }
+
+    Vector3 MeshSDF::GradientOfDistance(Vector3 point)
+    {
+        double p[3] = {point.x, point.y, point.z};
+        double gradient[3];
+        evaluate(p, gradient);
+        return Vector3{gradient[0], gradient[1], gradient[2]};
+    }
+
+    double MeshSDF::BoundingDiameter()
+    {
+        return norm(boxMax - boxMin) + 2 * bandWidth;
+    }
+
+    Vector3 MeshSDF::BoundingCenter()
+    {
+        return (boxMin + boxMax) / 2;
+    }
+} // namespace rsurfaces
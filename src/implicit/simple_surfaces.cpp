@@ -1,5 +1,7 @@
 #include "implicit/simple_surfaces.h"
 
+#include <cmath>
+
 namespace rsurfaces
 {
     // ========== Implicit sphere of variable radius ==========
@@ -24,6 +26,25 @@ namespace rsurfaces
     Vector3 ImplicitSphere::BoundingCenter() {
         return center;
     }
+
+    void ImplicitSphere::Evaluate(const double *points, size_t n, double *distances, double *gradients) {
+        const double cx = center.x, cy = center.y, cz = center.z;
+        const double r = radius;
+        #pragma omp parallel for simd
+        for (size_t i = 0; i < n; i++) {
+            double dx = points[3 * i + 0] - cx;
+            double dy = points[3 * i + 1] - cy;
+            double dz = points[3 * i + 2] - cz;
+            double len = sqrt(dx * dx + dy * dy + dz * dz);
+            distances[i] = len - r;
+            if (gradients) {
+                double invLen = 1. / len;
+                gradients[3 * i + 0] = dx * invLen;
+                gradients[3 * i + 1] = dy * invLen;
+                gradients[3 * i + 2] = dz * invLen;
+            }
+        }
+    }
     // ============================================================
 
     // ========== Infinite implicit cylinder of radius r centered at c along axis u ==========
@@ -56,6 +77,30 @@ namespace rsurfaces
     Vector3 ImplicitCylinder::BoundingCenter() {
         return center;
     }
+
+    void ImplicitCylinder::Evaluate(const double *points, size_t n, double *distances, double *gradients) {
+        const double cx = center.x, cy = center.y, cz = center.z;
+        const double ux = axis.x, uy = axis.y, uz = axis.z;
+        const double r = radius;
+        #pragma omp parallel for simd
+        for (size_t i = 0; i < n; i++) {
+            double px = points[3 * i + 0] - cx;
+            double py = points[3 * i + 1] - cy;
+            double pz = points[3 * i + 2] - cz;
+            double along = px * ux + py * uy + pz * uz;
+            px -= along * ux;
+            py -= along * uy;
+            pz -= along * uz;
+            double len = sqrt(px * px + py * py + pz * pz);
+            distances[i] = len - r;
+            if (gradients) {
+                double invLen = 1. / len;
+                gradients[3 * i + 0] = px * invLen;
+                gradients[3 * i + 1] = py * invLen;
+                gradients[3 * i + 2] = pz * invLen;
+            }
+        }
+    }
     // ============================================================
 
     // ========== Implicit torus of variable radii ==========
@@ -98,6 +143,27 @@ namespace rsurfaces
     Vector3 ImplicitTorus::BoundingCenter() {
         return center;
     }
+
+    void ImplicitTorus::Evaluate(const double *points, size_t n, double *distances, double *gradients) {
+        const double cx = center.x, cy = center.y, cz = center.z;
+        const double R = majorRadius, r = minorRadius;
+        #pragma omp parallel for simd
+        for (size_t i = 0; i < n; i++) {
+            double px = points[3 * i + 0] - cx;
+            double py = points[3 * i + 1] - cy;
+            double pz = points[3 * i + 2] - cz;
+            double normXZ = sqrt(px * px + pz * pz);
+            double sqTerm = sqrt(px * px + py * py + pz * pz - 2 * R * normXZ + R * R);
+            distances[i] = sqTerm - r;
+            if (gradients) {
+                double invSq = 1. / sqTerm;
+                double radial = 1. - R / normXZ;
+                gradients[3 * i + 0] = px * radial * invSq;
+                gradients[3 * i + 1] = py * invSq;
+                gradients[3 * i + 2] = pz * radial * invSq;
+            }
+        }
+    }
     // ============================================================
 
     // ========== Infinite flat plane with given normal ==========
@@ -124,5 +190,19 @@ namespace rsurfaces
     Vector3 FlatPlane::BoundingCenter() {
         return point;
     }
+
+    void FlatPlane::Evaluate(const double *points, size_t n, double *distances, double *gradients) {
+        const double px = point.x, py = point.y, pz = point.z;
+        const double nx = normal.x, ny = normal.y, nz = normal.z;
+        #pragma omp parallel for simd
+        for (size_t i = 0; i < n; i++) {
+            distances[i] = nx * (points[3 * i + 0] - px) + ny * (points[3 * i + 1] - py) + nz * (points[3 * i + 2] - pz);
+            if (gradients) {
+                gradients[3 * i + 0] = nx;
+                gradients[3 * i + 1] = ny;
+                gradients[3 * i + 2] = nz;
+            }
+        }
+    }
     // ============================================================
 }
@@ -5,8 +5,8 @@
 
 namespace rsurfaces
 {
-    LineSearch::LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_)
-    : energies(energies_), maxStep(maxStep_)
+    LineSearch::LineSearch(MeshPtr mesh_, GeomPtr geom_, std::vector<SurfaceEnergy*> energies_, double maxStep_, double initialEnergy_, GeometryCache *cache_)
+    : energies(energies_), maxStep(maxStep_), knownInitialEnergy(initialEnergy_), cache(cache_)
     {
         mesh = mesh_;
         geom = geom_;
@@ -14,64 +14,44 @@ namespace rsurfaces
 
     void LineSearch::SaveCurrentPositions()
     {
-        surface::VertexData<size_t> indices = mesh->getVertexIndices();
-        origPositions.setZero(mesh->nVertices(), 3);
-        for (GCVertex v : mesh->vertices())
-        {
-            // Copy the vertex positions of each vertex into
-            // the corresponding row
-            Vector3 pos_v = geom->inputVertexPositions[v];
-            size_t ind_v = indices[v];
-            origPositions(ind_v, 0) = pos_v.x;
-            origPositions(ind_v, 1) = pos_v.y;
-            origPositions(ind_v, 2) = pos_v.z;
-        }
+        origPositions = mapVertexPositions(mesh, geom);
     }
 
-    void LineSearch::RestorePositions()
+    void LineSearch::RefreshGeometry()
     {
-        surface::VertexData<size_t> indices = mesh->getVertexIndices();
-        for (GCVertex v : mesh->vertices())
+        OptimizedClusterTree *bvh = energies[0]->GetBVH();
+
+        if (cache)
         {
-            // Copy the positions in each row of origPositions
-            // back to each vertex
-            size_t ind_v = indices[v];
-            Vector3 pos_v = GetRow(origPositions, ind_v);
-            geom->inputVertexPositions[v] = pos_v;
+            cache->Update();
+            if (bvh)
+            {
+                UpdateOptimizedBVH(bvh, *cache);
+            }
+            return;
         }
 
         geom->refreshQuantities();
 
-        if (energies[0]->GetBVH())
+        if (bvh)
         {
 //            energies[0]->GetBVH()->UpdateWithNewPositions(mesh, geom);
             // Henrik changed this line to make OptimizedClusterTree again agnostic of MeshPtr and GeomPtr, so that it can be used also in other projects.
-            UpdateOptimizedBVH(energies[0]->GetBVH(), mesh, geom );
+            UpdateOptimizedBVH(bvh, mesh, geom );
         }
     }
 
-    void LineSearch::SetGradientStep(Eigen::MatrixXd &gradient, double delta)
+    void LineSearch::RestorePositions()
     {
-        surface::VertexData<size_t> indices = mesh->getVertexIndices();
-        for (GCVertex v : mesh->vertices())
-        {
-            // Set the position of each vertex to be the sum of
-            // origPositions + delta * gradient
-            size_t ind_v = indices[v];
-            Vector3 pos_v = GetRow(origPositions, ind_v);
-            Vector3 grad_v = GetRow(gradient, ind_v);
-            geom->inputVertexPositions[v] = pos_v + delta * grad_v;
-        }
-
-        geom->refreshQuantities();
-
-        if (energies[0]->GetBVH())
-        {
-//            energies[0]->GetBVH()->UpdateWithNewPositions(mesh, geom);
+        mapVertexPositions(mesh, geom) = origPositions;
+        RefreshGeometry();
+    }
 
-            // Henrik changed this line to make OptimizedClusterTree again agnostic of MeshPtr and GeomPtr, so that it can be used also in other projects.
-            UpdateOptimizedBVH(energies[0]->GetBVH(), mesh, geom );
-        }
+    void LineSearch::SetGradientStep(Eigen::MatrixXd &gradient, double delta)
+    {
+        // origPositions + delta * gradient, written straight into the geometry
+        mapVertexPositions(mesh, geom).noalias() = origPositions + delta * gradient;
+        RefreshGeometry();
     }
 
     double LineSearch::BacktrackingLineSearch(Eigen::MatrixXd &gradient, double initGuess, double gradDot, bool negativeIsForward)
@@ -79,8 +59,16 @@ namespace rsurfaces
         double delta = initGuess;
         SaveCurrentPositions();
 
+        if (cache)
+        {
+            // The connectivity may have changed since the last line search
+            cache->Require(GeometryCache::FaceAreas | GeometryCache::FaceNormals | GeometryCache::FaceBarycenters);
+            cache->Rebuild(mesh, geom);
+            cache->SetMoving(gradient);
+        }
+
         // Gather some initial data
-        double initialEnergy = GetEnergyValue(energies);
+        double initialEnergy = std::isnan(knownInitialEnergy) ? GetEnergyValue(energies) : knownInitialEnergy;
         double gradNorm = gradient.norm();
         int numBacktracks = 0;
         double sigma = 0.01;
@@ -129,6 +117,16 @@ namespace rsurfaces
             std::cout << "  * Failed to find a non-trivial step after " << numBacktracks << " backtracks" << std::endl;
             // Restore initial positions if step size goes to 0
             RestorePositions();
+        }
+
+        if (cache)
+        {
+            // Trial steps have only updated the cache
+            geom->refreshQuantities();
+        }
+
+        if (delta <= LS_STEP_THRESHOLD)
+        {
             return 0;
         }
         else
@@ -14,6 +14,9 @@
 #include "energy/all_energies.h"
 #include "helpers.h"
 #include <memory>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
 
 #include <Eigen/Sparse>
 #include <omp.h>
@@ -26,6 +29,10 @@
 #include "spatial/convolution_kernel.h"
 #include "surface_derivatives.h"
 #include "obj_writer.h"
+#include "binary_mesh.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "point_cloud_stream.h"
 #include "dropdown_strings.h"
 #include "energy/coulomb.h"
 #include "energy/willmore_energy.h"
@@ -33,6 +40,7 @@
 #include "bct_constructors.h"
 
 #include "remeshing/remeshing.h"
+#include "vertex_positions.h"
 
 using namespace geometrycentral;
 using namespace geometrycentral::surface;
@@ -63,6 +71,12 @@ namespace rsurfaces
         referenceEnergy = 0;
         exitWhenDone = false;
         totalObstacleVolume = 0;
+        checkpointInterval = 0;
+    }
+
+    MainApp::~MainApp()
+    {
+        frameWriter.Flush();
     }
 
     void MainApp::logPerformanceLine()
@@ -149,7 +163,16 @@ namespace rsurfaces
             flow->verticesMutated = remesher.Remesh(5, doCollapse);
             if (flow->verticesMutated)
             {
-                std::cout << "Vertices were mutated this step -- memory vectors are now invalid." << std::endl;
+                flow->NotifyRemeshed(remesher.FaceOrigins());
+                if (flow->TransferVertexData(remesher.LastTransfer()))
+                {
+                    std::cout << "Vertices were mutated this step -- memory vectors were transferred." << std::endl;
+                    flow->verticesMutated = false;
+                }
+                else
+                {
+                    std::cout << "Vertices were mutated this step -- memory vectors are now invalid." << std::endl;
+                }
             }
             else
             {
@@ -158,6 +181,8 @@ namespace rsurfaces
             ptic("mesh->compress()");
             mesh->compress();
             ptoc("mesh->compress()");
+            frameWriter.InvalidateConnectivity();
+            dragEditor.Invalidate();
             ptic("MainApp::instance->reregisterMesh();");
             MainApp::instance->reregisterMesh();
             ptoc("MainApp::instance->reregisterMesh();");
@@ -179,6 +204,11 @@ namespace rsurfaces
             logPerformanceLine();
         }
 
+        if (checkpointInterval > 0 && numSteps % checkpointInterval == 0)
+        {
+            SaveCheckpoint(checkpointPrefix);
+        }
+
         if (showAreaRatios)
         {
             VertexData<double> areaRatio(*mesh);
@@ -192,6 +222,125 @@ namespace rsurfaces
         ptoc("MainApp::TakeOptimizationStep");
     }
 
+    void MainApp::SaveCheckpoint(std::string prefix)
+    {
+        ptic("MainApp::SaveCheckpoint");
+        long timeStart = currentTimeMilliseconds();
+
+        std::string meshFile = prefix + ".rsm";
+        std::string stateFile = prefix + ".state";
+
+        // Write both files under temporary names first, so that a job killed
+        // in the middle of writing still leaves the previous checkpoint intact
+        try
+        {
+            writeMeshToBinary(*mesh, *geom, meshFile + ".tmp");
+            // Ties the state to exactly this mesh file, in case only one of the two gets replaced
+            uint64_t fingerprint = checkpoint::meshFingerprint(MappedBinaryMesh(meshFile + ".tmp"));
+
+            std::ofstream out(stateFile + ".tmp", std::ios::binary);
+            out.write(checkpoint::STATE_MAGIC, sizeof(checkpoint::STATE_MAGIC));
+            checkpoint::writeValue<uint32_t>(out, checkpoint::STATE_VERSION);
+            checkpoint::writeValue<uint64_t>(out, mesh->nVertices());
+            checkpoint::writeValue<uint64_t>(out, fingerprint);
+            checkpoint::writeValue<int64_t>(out, numSteps);
+            checkpoint::writeValue<int64_t>(out, timeSpentSoFar);
+            checkpoint::writeValue<uint64_t>(out, frameIndex);
+            checkpoint::writePositions(out, mesh, geomOrig);
+            remesher.SaveState(out);
+            flow->SaveState(out);
+            out.close();
+            if (!out)
+            {
+                throw std::runtime_error("Failed to write " + stateFile + ".tmp.");
+            }
+        }
+        catch (std::runtime_error &e)
+        {
+            // Keep the previous checkpoint rather than replacing it with a truncated one
+            std::remove((meshFile + ".tmp").c_str());
+            std::remove((stateFile + ".tmp").c_str());
+            std::cerr << "Could not write checkpoint " << prefix << ": " << e.what() << std::endl;
+            ptoc("MainApp::SaveCheckpoint");
+            return;
+        }
+
+        if (std::rename((meshFile + ".tmp").c_str(), meshFile.c_str()) != 0)
+        {
+            std::remove((meshFile + ".tmp").c_str());
+            std::remove((stateFile + ".tmp").c_str());
+            std::cerr << "Could not replace " << meshFile << "; keeping the previous checkpoint " << prefix << "." << std::endl;
+            ptoc("MainApp::SaveCheckpoint");
+            return;
+        }
+        if (std::rename((stateFile + ".tmp").c_str(), stateFile.c_str()) != 0)
+        {
+            std::remove((stateFile + ".tmp").c_str());
+            std::cerr << "Could not replace " << stateFile << "; checkpoint " << prefix
+                      << " no longer matches its mesh and cannot be resumed until the next checkpoint is written." << std::endl;
+            ptoc("MainApp::SaveCheckpoint");
+            return;
+        }
+
+        long timeEnd = currentTimeMilliseconds();
+        std::cout << "Wrote checkpoint " << prefix << " at iteration " << numSteps << " (" << (timeEnd - timeStart) << " ms)" << std::endl;
+        ptoc("MainApp::SaveCheckpoint");
+    }
+
+    void MainApp::LoadCheckpoint(std::string prefix)
+    {
+        std::string stateFile = prefix + ".state";
+        std::ifstream in(stateFile, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open checkpoint state " + stateFile + ".");
+        }
+
+        char magic[sizeof(checkpoint::STATE_MAGIC)];
+        in.read(magic, sizeof(magic));
+        if (!in || std::memcmp(magic, checkpoint::STATE_MAGIC, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error(stateFile + " is not a checkpoint state file.");
+        }
+        uint32_t version = checkpoint::readValue<uint32_t>(in);
+        // Version 1 did not record the frame index yet, version 2 not the mesh fingerprint
+        if (version < 1 || version > checkpoint::STATE_VERSION)
+        {
+            throw std::runtime_error("Unsupported checkpoint version " + std::to_string(version) + ".");
+        }
+        uint64_t nVerts = checkpoint::readValue<uint64_t>(in);
+        if (nVerts != mesh->nVertices())
+        {
+            throw std::runtime_error("Checkpoint state does not match the checkpoint mesh (" + std::to_string(nVerts) +
+                                     " vs. " + std::to_string(mesh->nVertices()) + " vertices).");
+        }
+        if (version >= 3)
+        {
+            // The loaded mesh has been recentered since, so the file itself is checked
+            uint64_t fingerprint = checkpoint::readValue<uint64_t>(in);
+            if (fingerprint != checkpoint::meshFingerprint(MappedBinaryMesh(prefix + ".rsm")))
+            {
+                throw std::runtime_error("Checkpoint state " + stateFile + " was not written together with " + prefix + ".rsm.");
+            }
+        }
+
+        numSteps = checkpoint::readValue<int64_t>(in);
+        timeSpentSoFar = checkpoint::readValue<int64_t>(in);
+        if (version >= 2)
+        {
+            // Frames written after the checkpoint are written again from here on
+            frameIndex = checkpoint::readValue<uint64_t>(in);
+            frameWriter.trajectoryKeepFrames = frameIndex;
+        }
+        checkpoint::readPositions(in, mesh, geomOrig);
+        remesher.LoadState(in);
+        flow->LoadState(in);
+        dragEditor.Invalidate();
+
+        std::cout << "Resumed from checkpoint " << prefix << " at iteration " << numSteps
+                  << " (" << timeSpentSoFar << " ms spent so far, " << frameIndex << " frames written)" << std::endl;
+    }
+
     void MainApp::updateMeshPositions()
     {
         if (normalizeView)
@@ -317,70 +466,6 @@ namespace rsurfaces
         }
     }
 
-    class PVCompare
-    {
-    public:
-        bool operator()(PriorityVertex v1, PriorityVertex v2)
-        {
-            return (v1.priority > v2.priority);
-        }
-    };
-
-    double gaussian(double radius, double dist)
-    {
-        double radterm = dist / radius;
-        double epow = exp(-0.5 * radterm * radterm);
-        return epow;
-    }
-
-    void MainApp::GetFalloffWindow(GCVertex v, double radius, std::vector<PriorityVertex> &verts)
-    {
-        // Do a simple Dijkstra search on edges
-        VertexData<bool> seen(*mesh, false);
-        std::priority_queue<PriorityVertex, std::vector<PriorityVertex>, PVCompare> queue;
-        queue.push(PriorityVertex{v, 0, geom->inputVertexPositions[v]});
-
-        while (!queue.empty())
-        {
-            PriorityVertex next = queue.top();
-            queue.pop();
-
-            if (next.priority > radius)
-            {
-                break;
-            }
-            else if (seen[next.vertex])
-            {
-                continue;
-            }
-            else
-            {
-                // Mark the next vertex as seen
-                seen[next.vertex] = true;
-                // Compute the weight
-                double weight = gaussian(radius / 3, next.priority);
-                verts.push_back(PriorityVertex{next.vertex, weight, geom->inputVertexPositions[next.vertex]});
-
-                // Enqueue all neighbors
-                for (GCVertex neighbor : next.vertex.adjacentVertices())
-                {
-                    if (seen[neighbor])
-                    {
-                        continue;
-                    }
-                    // Add the next edge distance
-                    Vector3 p1 = geom->inputVertexPositions[next.vertex];
-                    Vector3 p2 = geom->inputVertexPositions[neighbor];
-                    double neighborDist = next.priority + norm(p1 - p2);
-
-                    queue.push(PriorityVertex{neighbor, neighborDist, geom->inputVertexPositions[neighbor]});
-                }
-            }
-        }
-
-        std::cout << "Got " << verts.size() << " vertices" << std::endl;
-    }
-
     void MainApp::HandlePicking()
     {
         using namespace polyscope;
@@ -396,8 +481,7 @@ namespace rsurfaces
             {
                 if (pickNearbyVertex(pickedVertex))
                 {
-                    hasPickedVertex = true;
-                    GetFalloffWindow(pickedVertex, 0.5, dragVertices);
+                    hasPickedVertex = dragEditor.Begin(mesh, geom, pickedVertex.getIndex(), 0.5, numSteps);
 
                     Vector3 screen = projectToScreenCoords3(geom->inputVertexPositions[pickedVertex], viewProj);
                     pickDepth = screen.z;
@@ -415,22 +499,8 @@ namespace rsurfaces
                     Vector3 unprojected = unprojectFromScreenCoords3(mousePos, pickDepth, viewProj);
                     Vector3 displacement = unprojected - initialPickedPosition;
 
-                    for (PriorityVertex &v : dragVertices)
-                    {
-                        Vector3 newPos = v.position + v.priority * displacement;
-                        geom->inputVertexPositions[v.vertex] = newPos;
-                    }
-
-                    flow->ResetAllConstraints();
-                    flow->ResetAllPotentials();
-
-                    if (vertexPotential)
-                    {
-                        for (PriorityVertex &v : dragVertices)
-                        {
-                            vertexPotential->ChangeVertexTarget(v.vertex, geom->inputVertexPositions[v.vertex]);
-                        }
-                    }
+                    dragEditor.Apply(geom, displacement, numSteps);
+                    flow->ResetRegion(dragEditor.Region());
 
                     updateMeshPositions();
                 }
@@ -442,7 +512,7 @@ namespace rsurfaces
             {
                 ctrlMouseDown = false;
                 hasPickedVertex = false;
-                dragVertices.clear();
+                dragEditor.End();
                 // geom->inputVertexPositions[pickedVertex] = initialPickedPosition;
                 updateMeshPositions();
             }
@@ -1649,12 +1719,103 @@ namespace rsurfaces
         }
     };
 
+    void MainApp::AddMappedPointCloudObstacle(std::string filename, double weight)
+    {
+        // Point clouds only need the positions, so the tree is built straight
+        // from the mapped pages without constructing a mesh at all
+        MappedBinaryMesh mapped(filename);
+        size_t nVerts = mapped.nVertices();
+        const double *pos = mapped.positions();
+
+        std::vector<glm::vec3> points(nVerts);
+        #pragma omp parallel for
+        for (size_t i = 0; i < nVerts; i++)
+        {
+            points[i] = glm::vec3{pos[3 * i], pos[3 * i + 1], pos[3 * i + 2]};
+        }
+        polyscope::registerPointCloud(polyscope::guessNiceNameFromPath(filename), points);
+
+        obstacleTree.AddPointCloud(pos, 0, nVerts, weight);
+        std::cout << "Added " << filename << " as memory-mapped point cloud obstacle with weight " << weight << std::endl;
+
+        // Like any point cloud obstacle, counts the volume of the triangles stored with it
+        totalObstacleVolume += mapped.TotalVolume();
+    }
+
+    void MainApp::AddStreamedPointCloudObstacle(std::string filename, double weight, double cellSize)
+    {
+        // The full cloud is never held in memory; only one chunk of it is
+        // resident at a time, and only the reduced cloud goes into the tree
+        StreamingPointCloudReducer reducer(cellSize);
+        reducer.AddBinaryFile(filename);
+
+        std::vector<double> pos, wts;
+        reducer.Extract(pos, wts);
+        size_t nPoints = reducer.PointCount();
+
+        std::vector<glm::vec3> points(nPoints);
+        #pragma omp parallel for
+        for (size_t i = 0; i < nPoints; i++)
+        {
+            points[i] = glm::vec3{pos[3 * i], pos[3 * i + 1], pos[3 * i + 2]};
+        }
+        polyscope::registerPointCloud(polyscope::guessNiceNameFromPath(filename), points);
+
+        obstacleTree.AddPointCloud(pos.data(), wts.data(), nPoints, weight);
+        std::cout << "Added " << filename << " as streamed point cloud obstacle with weight " << weight << " ("
+                  << reducer.InputCount() << " points reduced to " << nPoints << ")" << std::endl;
+
+        MappedBinaryMesh mapped(filename);
+        if (mapped.nFaces() > 0)
+        {
+            totalObstacleVolume += mapped.TotalVolume();
+        }
+    }
+
     void MainApp::AddObstacle(std::string filename, double weight, bool recenter, bool asPointCloud)
     {
+        if (isBinaryMeshFile(filename) && asPointCloud && !recenter)
+        {
+            AddMappedPointCloudObstacle(filename, weight);
+            return;
+        }
+
+        std::string cacheFile = "";
+        std::string mesh_name = polyscope::guessNiceNameFromPath(filename);
+        if (obstacleCacheDir != "")
+        {
+            cacheFile = obstacleCacheFile(obstacleCacheDir, filename, recenter, asPointCloud);
+            double volume = 0;
+            if (obstacleTree.LoadObstacle(cacheFile, weight, volume))
+            {
+                std::vector<Vector3> points;
+                std::vector<std::vector<size_t>> triangles;
+                obstacleTree.LastObstacleGeometry(points, triangles);
+                if (asPointCloud)
+                {
+                    polyscope::registerPointCloud(mesh_name, points);
+                }
+                else
+                {
+                    polyscope::registerSurfaceMesh(mesh_name, points, triangles);
+                }
+                std::cout << "Added " << filename << " as obstacle with weight " << weight << " (cached in " << cacheFile << ")" << std::endl;
+                totalObstacleVolume += volume;
+                return;
+            }
+        }
+
         std::unique_ptr<surface::SurfaceMesh> obstacleMesh;
         GeomUPtr obstacleGeometry;
         // Load mesh
-        std::tie(obstacleMesh, obstacleGeometry) = readNonManifoldMesh(filename);
+        if (isBinaryMeshFile(filename))
+        {
+            std::tie(obstacleMesh, obstacleGeometry) = readBinaryNonManifoldMesh(filename);
+        }
+        else
+        {
+            std::tie(obstacleMesh, obstacleGeometry) = readNonManifoldMesh(filename);
+        }
 
         obstacleGeometry->requireVertexDualAreas();
         obstacleGeometry->requireVertexNormals();
@@ -1669,8 +1830,6 @@ namespace rsurfaces
             }
         }
 
-        std::string mesh_name = polyscope::guessNiceNameFromPath(filename);
-
         if (asPointCloud)
         {
             polyscope::PointCloud *pointCloud = polyscope::registerPointCloud(mesh_name, obstacleGeometry->inputVertexPositions);
@@ -1682,47 +1841,73 @@ namespace rsurfaces
                                                                             obstacleMesh->getFaceVertexList(), polyscopePermutations(*obstacleMesh));
         }
 
-        std::unique_ptr<surface::SurfaceMesh> sharedObsMesh = std::move(obstacleMesh);
-        GeomPtr sharedObsGeom = std::move(obstacleGeometry);
-
-        SurfaceEnergy *obstacleEnergy = 0;
-
         if (asPointCloud)
         {
-            size_t nVerts = sharedObsMesh->nVertices();
-
-            Eigen::VectorXd wts;
-            wts.setOnes(nVerts);
-
-            Eigen::MatrixXd pos;
-            pos.setZero(nVerts, 3);
-
+            size_t nVerts = obstacleMesh->nVertices();
+            std::vector<mreal> pos(3 * nVerts);
             for (size_t i = 0; i < nVerts; i++)
             {
-                Vector3 v = sharedObsGeom->inputVertexPositions[i];
-                MatrixUtils::SetRowFromVector3(pos, i, v);
+                Vector3 v = obstacleGeometry->inputVertexPositions[i];
+                pos[3 * i + 0] = v.x;
+                pos[3 * i + 1] = v.y;
+                pos[3 * i + 2] = v.z;
             }
-
-            obstacleEnergy = new TPPointCloudObstacleBarnesHut0(mesh, geom, flow->BaseEnergy(), wts, pos,
-                                                                kernel->alpha, kernel->beta, bh_theta, weight);
+            obstacleTree.AddPointCloud(pos.data(), 0, nVerts, weight);
         }
 
         else
         {
-            obstacleEnergy = new TPObstacleBarnesHut0(mesh, geom, flow->BaseEnergy(), sharedObsMesh, sharedObsGeom,
-                                                      kernel->alpha, kernel->beta, bh_theta, weight);
+            obstacleTree.AddMesh(*obstacleMesh, *obstacleGeometry, weight);
         }
 
-        flow->AddObstacleEnergy(obstacleEnergy);
         std::cout << "Added " << filename << " as obstacle with weight " << weight << std::endl;
 
-        totalObstacleVolume += totalVolume(sharedObsGeom, sharedObsMesh);
+        // Point clouds read from a triangulated file count that file's volume too
+        GeomPtr sharedObsGeom = std::move(obstacleGeometry);
+        double volume = totalVolume(sharedObsGeom, obstacleMesh);
+        totalObstacleVolume += volume;
+
+        if (cacheFile != "")
+        {
+            obstacleTree.SaveLastObstacle(cacheFile, volume);
+            std::cout << "Cached obstacle " << filename << " in " << cacheFile << std::endl;
+        }
     }
 
-    void MainApp::AddImplicitBarrier(scene::ImplicitBarrierData &barrierData)
+    void MainApp::FinishObstacles()
+    {
+        if (obstacleTree.ObstacleCount() == 0)
+        {
+            return;
+        }
+
+        // All obstacles of one kind share one tree and one traversal; their weights are already
+        // folded into the primitive areas, so the combined energies have weight 1.
+        // Triangles and points go into separate trees, so that points keep hulls of length 1.
+        OptimizedClusterTree *baseBVH = flow->BaseEnergy()->GetBVH();
+        OptimizedClusterTree *triangleBVH = obstacleTree.Build(baseBVH->near_dim, baseBVH->far_dim, false);
+        if (triangleBVH)
+        {
+            flow->AddObstacleEnergy(new TPObstacleBarnesHut0(mesh, geom, flow->BaseEnergy(), triangleBVH,
+                                                             kernel->alpha, kernel->beta, bh_theta, 1.));
+        }
+        // Points have no normals, so only the mesh-to-points direction of the energy exists
+        OptimizedClusterTree *pointBVH = obstacleTree.Build(baseBVH->near_dim, baseBVH->far_dim, true);
+        if (pointBVH)
+        {
+            flow->AddObstacleEnergy(new TPPointCloudObstacleBarnesHut0(mesh, geom, flow->BaseEnergy(), pointBVH,
+                                                                       kernel->alpha, kernel->beta, bh_theta, 1.));
+        }
+        std::cout << "Merged " << obstacleTree.ObstacleCount() << " obstacles (" << obstacleTree.PrimitiveCount()
+                  << " primitives) into the obstacle trees" << std::endl;
+
+        // The primitive data now lives in the tree
+        obstacleTree.Clear();
+    }
+
+    ImplicitSurface *MainApp::CreateImplicitSurface(scene::ImplicitBarrierData &barrierData)
     {
         ImplicitSurface *implSurface;
-        // Create the requested implicit surface
         switch (barrierData.type)
         {
         case scene::ImplicitType::Plane:
@@ -1759,12 +1944,51 @@ namespace rsurfaces
             implSurface = new ImplicitCylinder(radius, center, axis);
         }
         break;
+        case scene::ImplicitType::Mesh:
+        {
+            double cellSize = barrierData.parameters[0];
+            int bandCells = (barrierData.parameters.size() >= 2) ? int(barrierData.parameters[1]) : 4;
+            std::cout << "Constructing signed distance grid for " << barrierData.meshFile << " with cell size " << cellSize << ", band of " << bandCells << " cells" << std::endl;
+
+            std::unique_ptr<surface::SurfaceMesh> sdfMesh;
+            GeomUPtr sdfGeometry;
+            if (isBinaryMeshFile(barrierData.meshFile))
+            {
+                std::tie(sdfMesh, sdfGeometry) = readBinaryNonManifoldMesh(barrierData.meshFile);
+            }
+            else
+            {
+                std::tie(sdfMesh, sdfGeometry) = readNonManifoldMesh(barrierData.meshFile);
+            }
+            implSurface = new MeshSDF(*sdfMesh, *sdfGeometry, cellSize, bandCells);
+        }
+        break;
+        case scene::ImplicitType::Union:
+        case scene::ImplicitType::Intersection:
+        case scene::ImplicitType::Difference:
+        {
+            CSGOperation op = (barrierData.type == scene::ImplicitType::Union)
+                                  ? CSGOperation::Union
+                                  : (barrierData.type == scene::ImplicitType::Intersection) ? CSGOperation::Intersection : CSGOperation::Difference;
+            std::unique_ptr<ImplicitSurface> first(CreateImplicitSurface(barrierData.operands[0]));
+            std::unique_ptr<ImplicitSurface> second(CreateImplicitSurface(barrierData.operands[1]));
+            std::cout << "Combining the last two implicit surfaces" << std::endl;
+            implSurface = new ImplicitCSG(op, std::move(first), std::move(second));
+        }
+        break;
         default:
         {
             throw std::runtime_error("Unimplemented implicit surface type.");
         }
         break;
         }
+        return implSurface;
+    }
+
+    void MainApp::AddImplicitBarrier(scene::ImplicitBarrierData &barrierData)
+    {
+        // Create the requested implicit surface
+        ImplicitSurface *implSurface = CreateImplicitSurface(barrierData);
 
         // Mesh the 0 isosurface so we can see the implicit surface
         MainApp::instance->MeshImplicitSurface(implSurface);
@@ -1849,8 +2073,6 @@ namespace rsurfaces
 
     void MainApp::MeshImplicitSurface(ImplicitSurface *surface)
     {
-        CIsoSurface<double> *iso = new CIsoSurface<double>();
-
         std::cout << "Meshing the supplied implicit surface using marching cubes..." << std::endl;
 
         const int numCells = 50;
@@ -1859,59 +2081,34 @@ namespace rsurfaces
         double cellSize = diameter / numCells;
         double radius = diameter / 2;
 
-        Vector3 lowerCorner = center - Vector3{radius, radius, radius};
-
-        int numCorners = numCells + 1;
+        SampleGrid grid;
+        grid.origin = center - Vector3{radius, radius, radius};
+        grid.cellLengths = Vector3{cellSize, cellSize, cellSize};
+        grid.nx = grid.ny = grid.nz = numCells;
 
-        double field[numCorners * numCorners * numCorners];
+        std::vector<double> field;
+        SampleImplicitSurface(surface, grid, field);
 
-        int nSlice = numCorners * numCorners;
-        int nRow = numCorners;
+        std::vector<double> positions;
+        std::vector<mint> indices;
+        ExtractIsoSurface(field.data(), 0, grid, positions, indices);
 
-        for (int x = 0; x < numCorners; x++)
+        size_t nVerts = positions.size() / 3;
+        std::vector<glm::vec3> nodes(nVerts);
+        for (size_t i = 0; i < nVerts; i++)
         {
-            for (int y = 0; y < numCorners; y++)
-            {
-                for (int z = 0; z < numCorners; z++)
-                {
-                    Vector3 samplePt = lowerCorner + Vector3{(double)x, (double)y, (double)z} * cellSize;
-                    double value = surface->SignedDistance(samplePt);
-                    field[nSlice * z + nRow * y + x] = value;
-                }
-            }
+            nodes[i] = glm::vec3{positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]};
         }
 
-        iso->GenerateSurface(field, 0, numCells, numCells, numCells, cellSize, cellSize, cellSize);
-
-        std::vector<glm::vec3> nodes;
-        std::vector<std::array<size_t, 3>> triangles;
-
-        int nVerts = iso->m_nVertices;
-
-        for (int i = 0; i < nVerts; i++)
-        {
-            double x = iso->m_ppt3dVertices[i][0];
-            double y = iso->m_ppt3dVertices[i][1];
-            double z = iso->m_ppt3dVertices[i][2];
-
-            Vector3 p = lowerCorner + Vector3{x, y, z};
-            nodes.push_back(glm::vec3{p.x, p.y, p.z});
-        }
-
-        int nTris = iso->m_nTriangles;
-
-        for (int i = 0; i < nTris; i++)
+        size_t nTris = indices.size() / 3;
+        std::vector<std::array<size_t, 3>> triangles(nTris);
+        for (size_t i = 0; i < nTris; i++)
         {
-            int i1 = iso->m_piTriangleIndices[3 * i];
-            int i2 = iso->m_piTriangleIndices[3 * i + 1];
-            int i3 = iso->m_piTriangleIndices[3 * i + 2];
-
-            triangles.push_back({(size_t)i1, (size_t)i2, (size_t)i3});
+            triangles[i] = {(size_t)indices[3 * i], (size_t)indices[3 * i + 1], (size_t)indices[3 * i + 2]};
         }
 
         implicitCount++;
         polyscope::registerSurfaceMesh("implicitSurface" + std::to_string(implicitCount), nodes, triangles);
-        delete iso;
     }
 } // namespace rsurfaces
 
@@ -1921,7 +2118,8 @@ bool takeScreenshots = false;
 bool saveOBJs = false;
 bool skipEveryOther = false;
 uint screenshotNum = 0;
-uint objNum = 0;
+// Set once the frame of the starting state (or the resumed state) has been written
+bool wroteFirstFrame = false;
 bool uiNormalizeView = false;
 bool remesh = true;
 bool changeTopo = false;
@@ -1946,8 +2144,9 @@ void saveOBJ(rsurfaces::MeshPtr mesh, rsurfaces::GeomPtr geom, rsurfaces::GeomPt
     char buffer[5];
     std::snprintf(buffer, sizeof(buffer), "%04d", i);
     std::string fname = "objs/frame" + std::string(buffer) + ".obj";
-    rsurfaces::writeMeshToOBJ(mesh, geom, geomOrig, areaRatios, fname);
-    std::cout << "Saved OBJ frame to " << fname << std::endl;
+    // Only snapshots the positions; the file is written in the background
+    rsurfaces::MainApp::instance->frameWriter.Enqueue(mesh, geom, geomOrig, areaRatios, fname,
+                                                      rsurfaces::MainApp::instance->remesher.ConnectivityEpoch());
 }
 
 template <typename ItemType>
@@ -1997,9 +2196,22 @@ void customCallback()
 
     ImGui::Checkbox("Write OBJs", &saveOBJs);
     ImGui::SameLine(ITEM_WIDTH, 2 * INDENT);
-    if ((saveOBJs && objNum == 0) || ImGui::Button("Write OBJ", ImVec2{ITEM_WIDTH, 0}))
+    if ((saveOBJs && !wroteFirstFrame) || ImGui::Button("Write OBJ", ImVec2{ITEM_WIDTH, 0}))
     {
-        saveOBJ(MainApp::instance->mesh, MainApp::instance->geom, MainApp::instance->geomOrig, objNum++);
+        saveOBJ(MainApp::instance->mesh, MainApp::instance->geom, MainApp::instance->geomOrig, MainApp::instance->frameIndex++);
+        wroteFirstFrame = true;
+    }
+    int frameFormat = (int)MainApp::instance->frameWriter.format;
+    ImGui::RadioButton("OBJ", &frameFormat, (int)FrameFormat::OBJ);
+    ImGui::SameLine();
+    ImGui::RadioButton("Binary", &frameFormat, (int)FrameFormat::Binary);
+    ImGui::SameLine();
+    ImGui::RadioButton("Trajectory", &frameFormat, (int)FrameFormat::Trajectory);
+    MainApp::instance->frameWriter.format = (FrameFormat)frameFormat;
+    if (frameCompressionAvailable())
+    {
+        ImGui::SameLine(ITEM_WIDTH, 2 * INDENT);
+        ImGui::Checkbox("Compress frames", &MainApp::instance->frameWriter.compress);
     }
     ImGui::Checkbox("Log performance", &MainApp::instance->logPerformance);
     ImGui::Checkbox("Skip odd frames", &skipEveryOther);
@@ -2068,7 +2280,7 @@ void customCallback()
         }
         if (saveOBJs)
         {
-            saveOBJ(MainApp::instance->mesh, MainApp::instance->geom, MainApp::instance->geomOrig, objNum++);
+            saveOBJ(MainApp::instance->mesh, MainApp::instance->geom, MainApp::instance->geomOrig, MainApp::instance->frameIndex++);
         }
         if ((MainApp::instance->stepLimit > 0 && MainApp::instance->numSteps >= MainApp::instance->stepLimit) ||
             (MainApp::instance->realTimeLimit > 0 && MainApp::instance->timeSpentSoFar >= MainApp::instance->realTimeLimit))
@@ -2076,6 +2288,7 @@ void customCallback()
             run = false;
             if (MainApp::instance->exitWhenDone)
             {
+                MainApp::instance->frameWriter.Flush();
                 std::exit(0);
             }
         }
@@ -2135,6 +2348,8 @@ void customCallback()
     {
         MainApp::instance->remesher.Remesh(5, true);
         MainApp::instance->mesh->compress();
+        MainApp::instance->frameWriter.InvalidateConnectivity();
+        MainApp::instance->dragEditor.Invalidate();
         MainApp::instance->reregisterMesh();
     }
     ImGui::EndGroup();
@@ -2150,6 +2365,36 @@ struct MeshAndEnergy
     std::string meshName;
 };
 
+// Registers the mesh with polyscope and sets up the tangent-point kernel on it.
+MeshAndEnergy initTPE(rsurfaces::MeshPtr meshShared, rsurfaces::GeomPtr geomShared, rsurfaces::UVDataPtr uvShared,
+                      bool hasUVs, std::string mesh_name, double alpha, double beta)
+{
+    using namespace rsurfaces;
+
+    // Register the mesh with polyscope
+    polyscope::SurfaceMesh *psMesh = polyscope::registerSurfaceMesh(mesh_name,
+                                                                    geomShared->inputVertexPositions, meshShared->getFaceVertexList(),
+                                                                    polyscopePermutations(*meshShared));
+
+    psMesh->setSurfaceColor( glm::vec3( 222/255., 192/255., 130/255. ) );
+    psMesh->setEdgeColor( glm::vec3( 156/255., 133/255., 84/255. ) );
+    psMesh->setEdgeWidth( 1.5 );
+    psMesh->setSmoothShade( true );
+
+    geomShared->requireFaceNormals();
+    geomShared->requireFaceAreas();
+    geomShared->requireVertexNormals();
+    geomShared->requireVertexDualAreas();
+    geomShared->requireVertexGaussianCurvatures();
+
+    TPEKernel *tpe = new rsurfaces::TPEKernel(meshShared, geomShared, alpha, beta);
+
+    std::cout << "Initial mesh area = " << totalArea(geomShared, meshShared) << std::endl;
+    std::cout << "Initial mesh volume = " << totalVolume(geomShared, meshShared) << std::endl;
+
+    return MeshAndEnergy{tpe, psMesh, meshShared, geomShared, (hasUVs) ? uvShared : 0, mesh_name};
+}
+
 MeshAndEnergy initTPEOnMesh(std::string meshFile, double alpha, double beta)
 {
     using namespace rsurfaces;
@@ -2160,7 +2405,16 @@ MeshAndEnergy initTPEOnMesh(std::string meshFile, double alpha, double beta)
     std::unique_ptr<CornerData<Vector2>> uvs;
 
     // Load mesh
-    std::tie(u_mesh, u_geometry, uvs) = readParameterizedMesh(meshFile);
+    if (isBinaryMeshFile(meshFile))
+    {
+        // The binary format carries no UVs
+        std::tie(u_mesh, u_geometry) = readBinaryMesh(meshFile);
+        uvs = std::unique_ptr<CornerData<Vector2>>(new CornerData<Vector2>(*u_mesh, Vector2{0, 0}));
+    }
+    else
+    {
+        std::tie(u_mesh, u_geometry, uvs) = readParameterizedMesh(meshFile);
+    }
     std::string mesh_name = polyscope::guessNiceNameFromPath(meshFile);
 
     std::cout << "Read " << uvs->size() << " UV coordinates" << std::endl;
@@ -2187,31 +2441,67 @@ MeshAndEnergy initTPEOnMesh(std::string meshFile, double alpha, double beta)
         std::cout << "Mesh has no UVs or all UVs are 0; not using as flags" << std::endl;
     }
 
-    // Register the mesh with polyscope
-    polyscope::SurfaceMesh *psMesh = polyscope::registerSurfaceMesh(mesh_name,
-                                                                    u_geometry->inputVertexPositions, u_mesh->getFaceVertexList(),
-                                                                    polyscopePermutations(*u_mesh));
-
-    psMesh->setSurfaceColor( glm::vec3( 222/255., 192/255., 130/255. ) );
-    psMesh->setEdgeColor( glm::vec3( 156/255., 133/255., 84/255. ) );
-    psMesh->setEdgeWidth( 1.5 );
-    psMesh->setSmoothShade( true );
     MeshPtr meshShared = std::move(u_mesh);
     GeomPtr geomShared = std::move(u_geometry);
     UVDataPtr uvShared = std::move(uvs);
 
-    geomShared->requireFaceNormals();
-    geomShared->requireFaceAreas();
-    geomShared->requireVertexNormals();
-    geomShared->requireVertexDualAreas();
-    geomShared->requireVertexGaussianCurvatures();
+    return initTPE(meshShared, geomShared, uvShared, hasUVs, mesh_name, alpha, beta);
+}
 
-    TPEKernel *tpe = new rsurfaces::TPEKernel(meshShared, geomShared, alpha, beta);
+// Moves every vertex to the nearest point on the zero level set, to first order.
+// Vertices where the gradient vanishes have no well-defined direction and stay put.
+void projectOntoImplicitSurface(rsurfaces::MeshPtr const &mesh, rsurfaces::GeomPtr const &geom, rsurfaces::ImplicitSurface *surface)
+{
+    using namespace rsurfaces;
+    VertexPositionMap positions = mapVertexPositions(mesh, geom);
+    mint n = positions.rows();
+    Eigen::VectorXd distances(n);
+    EigenMatrixRM gradients(n, 3);
 
-    std::cout << "Initial mesh area = " << totalArea(geomShared, meshShared) << std::endl;
-    std::cout << "Initial mesh volume = " << totalVolume(geomShared, meshShared) << std::endl;
+    surface->Evaluate(positions.data(), n, distances.data(), gradients.data());
 
-    return MeshAndEnergy{tpe, psMesh, meshShared, geomShared, (hasUVs) ? uvShared : 0, mesh_name};
+    #pragma omp parallel for
+    for (mint i = 0; i < n; i++)
+    {
+        double gradientSquared = gradients.row(i).squaredNorm();
+        if (gradientSquared > 1e-12)
+        {
+            positions.row(i) -= (distances(i) / gradientSquared) * gradients.row(i);
+        }
+    }
+}
+
+MeshAndEnergy initTPEOnImplicit(rsurfaces::ImplicitSurface *surface, double edgeLength, std::string meshName, double alpha, double beta)
+{
+    using namespace rsurfaces;
+    std::cout << "Initializing tangent-point energy with (" << alpha << ", " << beta << ")" << std::endl;
+
+    MeshUPtr u_mesh;
+    GeomUPtr u_geometry;
+    std::tie(u_mesh, u_geometry) = ImplicitSurfaceToMesh(surface, edgeLength);
+    MeshPtr meshShared = std::move(u_mesh);
+    GeomPtr geomShared = std::move(u_geometry);
+
+    // Marching cubes leaves slivers, and edges of any length up to the cell diagonal.
+    // Remesh towards the requested length, so that the average length the DynamicRemesher
+    // measures on the initial mesh, and keeps from then on, is the one asked for.
+    geomShared->requireFaceAreas();
+    geomShared->requireVertexDualAreas();
+    GeomPtr geomOrig = geomShared->copy();
+    for (int i = 0; i < 5; i++)
+    {
+        remeshing::adjustEdgeLengths(meshShared, geomShared, geomOrig, edgeLength, 0.1, edgeLength * 0.5, false);
+        geomShared->refreshQuantities();
+        remeshing::fixDelaunayParallel(meshShared, geomShared);
+        geomShared->refreshQuantities();
+        remeshing::smoothByCircumcenter(meshShared, geomShared);
+        projectOntoImplicitSurface(meshShared, geomShared, surface);
+        geomShared->refreshQuantities();
+    }
+    std::cout << "Generated mesh with " << meshShared->nVertices() << " vertices and " << meshShared->nFaces() << " faces" << std::endl;
+
+    UVDataPtr uvShared(new CornerData<Vector2>(*meshShared, Vector2{0, 0}));
+    return initTPE(meshShared, geomShared, uvShared, false, polyscope::guessNiceNameFromPath(meshName), alpha, beta);
 }
 
 enum class EnergyOverride
@@ -2399,6 +2689,12 @@ int main(int argc, char **argv)
     args::Flag autologFlag(parser, "autolog", "Automatically start the flow, log performance, and exit when done.", {"autolog"});
     args::Flag coulombFlag(parser, "coulomb", "Use a coulomb energy instead of the tangent-point energy.", {"coulomb"});
     args::ValueFlag<int> threadFlag(parser, "threads", "How many threads to use in parallel.", {"threads"});
+    args::ValueFlag<std::string> logFlag(parser, "file", "Write the performance log to this file instead of the one given in the scene.", {"log"});
+    args::ValueFlag<std::string> obstacleCacheFlag(parser, "dir", "Cache loaded obstacles in this directory, so that later runs can skip loading them.", {"obstacle-cache"});
+    args::ValueFlag<std::string> resumeFlag(parser, "prefix", "Resume a run from the checkpoint files <prefix>.rsm and <prefix>.state.", {"resume"});
+    args::ValueFlag<int> checkpointFlag(parser, "interval", "Write a checkpoint every given number of iterations.", {"checkpoint"});
+    args::ValueFlag<std::string> extractFlag(parser, "outdir", "Extract all frames of the input trajectory (.rst) as OBJs into the given directory, and exit.", {"extract"});
+    args::ValueFlag<std::string> convertFlag(parser, "output", "Convert the input mesh to the binary .rsm format, write it to the given file, and exit.", {"convert"});
 
     polyscope::options::programName = "Repulsive Surfaces";
     polyscope::options::groundPlaneEnabled = false;
@@ -2433,7 +2729,21 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    MainApp::defaultNumThreads = omp_get_max_threads() / 2 + 2;
+    if (extractFlag)
+    {
+        extractTrajectory(args::get(inputFilename), args::get(extractFlag));
+        return EXIT_SUCCESS;
+    }
+
+    if (convertFlag)
+    {
+        convertMeshToBinary(args::get(inputFilename), args::get(convertFlag));
+        return EXIT_SUCCESS;
+    }
+
+    // omp_get_num_procs only counts the cores in our affinity mask, so a job
+    // pinned to a core set by the batch runner stays within it
+    MainApp::defaultNumThreads = std::min(omp_get_max_threads() / 2 + 2, omp_get_num_procs());
 
     if (threadFlag)
     {
@@ -2506,11 +2816,38 @@ int main(int argc, char **argv)
         data = defaultScene(inFile);
     }
 
+    else if (isBinaryMeshFile(inFile))
+    {
+        std::cout << "Reading " << inFile << " as binary mesh file." << std::endl;
+        data = defaultScene(inFile);
+    }
+
     else
     {
         throw std::runtime_error("Unknown file extension for " + inFile + ".");
     }
 
+    if (resumeFlag)
+    {
+        // The mesh comes from the checkpoint instead of the scene; everything
+        // else in the scene is set up as usual, then overwritten by the saved state
+        data.meshName = args::get(resumeFlag) + ".rsm";
+        std::cout << "Resuming from checkpoint mesh " << data.meshName << std::endl;
+    }
+    if (checkpointFlag)
+    {
+        data.checkpointInterval = args::get(checkpointFlag);
+    }
+    if (obstacleCacheFlag)
+    {
+        data.obstacleCacheDir = args::get(obstacleCacheFlag);
+    }
+    if (logFlag)
+    {
+        data.performanceLogFile = args::get(logFlag);
+        std::cout << "Logging to " << data.performanceLogFile << std::endl;
+    }
+
     bool useCoulomb = false;
     if (coulombFlag)
     {
@@ -2518,7 +2855,16 @@ int main(int argc, char **argv)
         std::cout << "Using Coulomb energy. (Note: Not expected to work well.)" << std::endl;
     }
 
-    MeshAndEnergy m = initTPEOnMesh(data.meshName, data.alpha, data.beta);
+    MeshAndEnergy m;
+    if (data.meshFromImplicit && !resumeFlag)
+    {
+        std::unique_ptr<ImplicitSurface> surface(MainApp::CreateImplicitSurface(data.meshImplicit));
+        m = initTPEOnImplicit(surface.get(), data.meshEdgeLength, data.meshName, data.alpha, data.beta);
+    }
+    else
+    {
+        m = initTPEOnMesh(data.meshName, data.alpha, data.beta);
+    }
 
     EnergyOverride eo = EnergyOverride::TangentPoint;
     if (useCoulomb)
@@ -2541,6 +2887,17 @@ int main(int argc, char **argv)
     MainApp::instance->methodChoice = data.defaultMethod;
     MainApp::instance->sceneData = data;
     MainApp::instance->uvs = m.uvs;
+    MainApp::instance->checkpointInterval = data.checkpointInterval;
+    MainApp::instance->checkpointPrefix = data.checkpointPrefix;
+    MainApp::instance->obstacleCacheDir = data.obstacleCacheDir;
+    if (data.trajectoryFile != "")
+    {
+        MainApp::instance->frameWriter.format = FrameFormat::Trajectory;
+        MainApp::instance->frameWriter.trajectoryFile = data.trajectoryFile;
+        MainApp::instance->frameWriter.trajectoryQuantum = data.trajectoryQuantum;
+        MainApp::instance->frameWriter.compress = true;
+        saveOBJs = true;
+    }
 
     if (autologFlag)
     {
@@ -2548,9 +2905,12 @@ int main(int argc, char **argv)
         MainApp::instance->exitWhenDone = true;
         MainApp::instance->logPerformance = true;
         run = true;
-        std::ofstream outfile;
-        outfile.open(data.performanceLogFile, std::ios_base::out);
-        outfile.close();
+        if (!resumeFlag)
+        {
+            std::ofstream outfile;
+            outfile.open(data.performanceLogFile, std::ios_base::out);
+            outfile.close();
+        }
     }
 
     for (scene::PotentialData &p : data.potentials)
@@ -2559,8 +2919,14 @@ int main(int argc, char **argv)
     }
     for (scene::ObstacleData &obs : data.obstacles)
     {
+        if (obs.cellSize > 0)
+        {
+            MainApp::instance->AddStreamedPointCloudObstacle(obs.obstacleName, obs.weight, obs.cellSize);
+            continue;
+        }
         MainApp::instance->AddObstacle(obs.obstacleName, obs.weight, obs.recenter, obs.asPointCloud);
     }
+    MainApp::instance->FinishObstacles();
     for (scene::ImplicitBarrierData &barrierData : data.implicitBarriers)
     {
         MainApp::instance->AddImplicitBarrier(barrierData);
@@ -2573,10 +2939,19 @@ int main(int argc, char **argv)
         MainApp::instance->flow->retargetSchurConstraintOfType<Constraints::TotalVolumeConstraint>(targetVol);
     }
 
+    if (resumeFlag)
+    {
+        MainApp::instance->LoadCheckpoint(args::get(resumeFlag));
+    }
+
     MainApp::instance->updateMeshPositions();
 
     // Give control to the polyscope gui
     polyscope::show();
 
+    // Closing the window must not lose the frames that are still being written
+    delete MainApp::instance;
+    MainApp::instance = nullptr;
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,264 @@
+#include "marchingcubes/parallel_marching_cubes.h"
+#include "marchingcubes/CIsoSurface.h"
+
+#include <cmath>
+
+namespace rsurfaces
+{
+    // For each of the 12 cube edges in CIsoSurface numbering: offset of the grid point the
+    // edge starts at, and its direction (0 = x, 1 = y, 2 = z).
+    static const int cubeEdges[12][4] = {
+        {0, 0, 0, 1}, {0, 1, 0, 0}, {1, 0, 0, 1}, {0, 0, 0, 0},
+        {0, 0, 1, 1}, {0, 1, 1, 0}, {1, 0, 1, 1}, {0, 0, 1, 0},
+        {0, 0, 0, 2}, {0, 1, 0, 2}, {1, 1, 0, 2}, {1, 0, 0, 2}};
+
+    // Offsets of the 8 cube corners, in the order of the bits of the table index.
+    static const int cubeCorners[8][3] = {
+        {0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0},
+        {0, 0, 1}, {0, 1, 1}, {1, 1, 1}, {1, 0, 1}};
+
+    void SampleImplicitSurface(ImplicitSurface *surface, const SampleGrid &grid, std::vector<double> &field)
+    {
+        ptic("SampleImplicitSurface");
+
+        mint nRow = grid.nx + 1;
+        mint nSlice = nRow * (grid.ny + 1);
+        field.resize(grid.PointCount());
+        std::vector<double> points(3 * nSlice);
+
+        for (mint z = 0; z <= grid.nz; ++z)
+        {
+            #pragma omp parallel for
+            for (mint k = 0; k < nSlice; ++k)
+            {
+                mint x = k % nRow;
+                mint y = k / nRow;
+                points[3 * k + 0] = grid.origin.x + x * grid.cellLengths.x;
+                points[3 * k + 1] = grid.origin.y + y * grid.cellLengths.y;
+                points[3 * k + 2] = grid.origin.z + z * grid.cellLengths.z;
+            }
+            surface->Evaluate(points.data(), nSlice, &field[z * nSlice], nullptr);
+        }
+
+        ptoc("SampleImplicitSurface");
+    }
+
+    void ExtractIsoSurface(const double *field, double isoLevel, const SampleGrid &grid,
+                           std::vector<double> &positions, std::vector<mint> &triangles)
+    {
+        ptic("ExtractIsoSurface");
+
+        mint nx = grid.nx;
+        mint ny = grid.ny;
+        mint nz = grid.nz;
+        mint nRow = nx + 1;
+        mint nSlice = nRow * (ny + 1);
+        mint step[3] = {1, nRow, nSlice};
+        double lengths[3] = {grid.cellLengths.x, grid.cellLengths.y, grid.cellLengths.z};
+
+        // 1. Each z-plane of grid points numbers the crossings on the edges that start at its
+        // points, three slots per point, and interpolates their positions.
+        std::vector<std::vector<mint>> edgeIds(nz + 1);
+        std::vector<std::vector<double>> planePositions(nz + 1);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (mint z = 0; z <= nz; ++z)
+        {
+            std::vector<mint> &ids = edgeIds[z];
+            std::vector<double> &pos = planePositions[z];
+            ids.assign(3 * nSlice, -1);
+            pos.clear();
+
+            for (mint y = 0; y <= ny; ++y)
+            {
+                for (mint x = 0; x <= nx; ++x)
+                {
+                    mint a = z * nSlice + y * nRow + x;
+                    double fa = field[a];
+                    bool inside = fa < isoLevel;
+                    bool hasNext[3] = {x < nx, y < ny, z < nz};
+
+                    for (int d = 0; d < 3; ++d)
+                    {
+                        if (!hasNext[d] || (field[a + step[d]] < isoLevel) == inside)
+                        {
+                            continue;
+                        }
+                        double t = (isoLevel - fa) / (field[a + step[d]] - fa);
+                        double p[3] = {grid.origin.x + x * lengths[0], grid.origin.y + y * lengths[1], grid.origin.z + z * lengths[2]};
+                        p[d] += t * lengths[d];
+
+                        ids[3 * (y * nRow + x) + d] = pos.size() / 3;
+                        pos.insert(pos.end(), p, p + 3);
+                    }
+                }
+            }
+        }
+
+        std::vector<mint> vertexOffsets(nz + 2, 0);
+        for (mint z = 0; z <= nz; ++z)
+        {
+            vertexOffsets[z + 1] = vertexOffsets[z] + planePositions[z].size() / 3;
+        }
+        positions.resize(3 * vertexOffsets[nz + 1]);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (mint z = 0; z <= nz; ++z)
+        {
+            std::copy(planePositions[z].begin(), planePositions[z].end(), positions.begin() + 3 * vertexOffsets[z]);
+            for (mint &id : edgeIds[z])
+            {
+                if (id >= 0)
+                {
+                    id += vertexOffsets[z];
+                }
+            }
+            std::vector<double>().swap(planePositions[z]);
+        }
+
+        // 2. Each slab of cells between two z-planes emits its triangles, which only read the
+        // edge ids of its two planes.
+        std::vector<std::vector<mint>> slabTriangles(nz);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (mint z = 0; z < nz; ++z)
+        {
+            std::vector<mint> &tris = slabTriangles[z];
+            tris.clear();
+
+            for (mint y = 0; y < ny; ++y)
+            {
+                for (mint x = 0; x < nx; ++x)
+                {
+                    unsigned int tableIndex = 0;
+                    for (int c = 0; c < 8; ++c)
+                    {
+                        mint i = (z + cubeCorners[c][2]) * nSlice + (y + cubeCorners[c][1]) * nRow + (x + cubeCorners[c][0]);
+                        if (field[i] < isoLevel)
+                        {
+                            tableIndex |= (1u << c);
+                        }
+                    }
+
+                    const int *cubeTriangles = CIsoSurface<double>::m_triTable[tableIndex];
+                    for (int k = 0; cubeTriangles[k] != -1; ++k)
+                    {
+                        const int *e = cubeEdges[cubeTriangles[k]];
+                        tris.push_back(edgeIds[z + e[2]][3 * ((y + e[1]) * nRow + (x + e[0])) + e[3]]);
+                    }
+                }
+            }
+        }
+
+        std::vector<mint> triangleOffsets(nz + 1, 0);
+        for (mint z = 0; z < nz; ++z)
+        {
+            triangleOffsets[z + 1] = triangleOffsets[z] + slabTriangles[z].size();
+        }
+        triangles.resize(triangleOffsets[nz]);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (mint z = 0; z < nz; ++z)
+        {
+            std::copy(slabTriangles[z].begin(), slabTriangles[z].end(), triangles.begin() + triangleOffsets[z]);
+        }
+
+        ptoc("ExtractIsoSurface");
+    }
+
+    std::tuple<MeshUPtr, GeomUPtr> IsoSurfaceToMesh(const std::vector<double> &positions, const std::vector<mint> &triangles)
+    {
+        ptic("IsoSurfaceToMesh");
+
+        mint nV = positions.size() / 3;
+        mint nF = triangles.size() / 3;
+        const double *p = positions.data();
+        const mint *t = triangles.data();
+
+        double volume = 0;
+        #pragma omp parallel for reduction(+ : volume)
+        for (mint i = 0; i < nF; i++)
+        {
+            const double *a = p + 3 * t[3 * i];
+            const double *b = p + 3 * t[3 * i + 1];
+            const double *c = p + 3 * t[3 * i + 2];
+            Vector3 v1{a[0], a[1], a[2]};
+            Vector3 v2{b[0], b[1], b[2]};
+            Vector3 v3{c[0], c[1], c[2]};
+            volume += dot(cross(v1, v2), v3) / 6;
+        }
+        bool flip = (volume < 0);
+
+        std::vector<std::vector<size_t>> polygons(nF);
+        #pragma omp parallel for
+        for (mint i = 0; i < nF; i++)
+        {
+            if (flip)
+            {
+                polygons[i] = {(size_t)t[3 * i], (size_t)t[3 * i + 2], (size_t)t[3 * i + 1]};
+            }
+            else
+            {
+                polygons[i] = {(size_t)t[3 * i], (size_t)t[3 * i + 1], (size_t)t[3 * i + 2]};
+            }
+        }
+
+        MeshUPtr mesh(new surface::HalfedgeMesh(polygons));
+        GeomUPtr geom(new surface::VertexPositionGeometry(*mesh));
+
+        #pragma omp parallel for
+        for (mint i = 0; i < nV; i++)
+        {
+            geom->inputVertexPositions[i] = Vector3{p[3 * i], p[3 * i + 1], p[3 * i + 2]};
+        }
+
+        ptoc("IsoSurfaceToMesh");
+
+        return std::make_tuple(std::move(mesh), std::move(geom));
+    }
+
+    std::tuple<MeshUPtr, GeomUPtr> ImplicitSurfaceToMesh(ImplicitSurface *surface, double cellSize)
+    {
+        double diameter = surface->BoundingDiameter();
+        double cells = std::ceil(diameter / cellSize) + 2;
+        if (!(cellSize > 0) || !std::isfinite(cells))
+        {
+            throw std::runtime_error("Cannot mesh an implicit surface of diameter " + std::to_string(diameter) +
+                                     " with cells of size " + std::to_string(cellSize) + ".");
+        }
+        // The sampled field alone takes 8 bytes per grid point, so about 2 GB at this limit
+        const double maxGridPoints = 256.0 * 1024 * 1024;
+        double gridPoints = (cells + 1) * (cells + 1) * (cells + 1);
+        if (gridPoints > maxGridPoints)
+        {
+            double minCellSize = diameter / (std::cbrt(maxGridPoints) - 4);
+            throw std::runtime_error("Meshing an implicit surface of diameter " + std::to_string(diameter) +
+                                     " with cells of size " + std::to_string(cellSize) + " needs " +
+                                     std::to_string(gridPoints) + " grid points, more than the limit of " +
+                                     std::to_string(maxGridPoints) + "; use a cell size of at least " +
+                                     std::to_string(minCellSize) + ".");
+        }
+
+        SampleGrid grid;
+        grid.nx = grid.ny = grid.nz = mint(cells);
+        double halfWidth = cells * cellSize / 2;
+        grid.origin = surface->BoundingCenter() - Vector3{halfWidth, halfWidth, halfWidth};
+        grid.cellLengths = Vector3{cellSize, cellSize, cellSize};
+
+        std::vector<double> field;
+        SampleImplicitSurface(surface, grid, field);
+
+        std::vector<double> positions;
+        std::vector<mint> triangles;
+        ExtractIsoSurface(field.data(), 0, grid, positions, triangles);
+        std::vector<double>().swap(field);
+
+        if (triangles.empty())
+        {
+            throw std::runtime_error("The implicit surface has no zero level set inside its bounding region.");
+        }
+        std::cout << "Marching cubes on a " << grid.nx << "^3 grid gave " << positions.size() / 3 << " vertices and " << triangles.size() / 3 << " triangles" << std::endl;
+
+        return IsoSurfaceToMesh(positions, triangles);
+    }
+} // namespace rsurfaces
@@ -0,0 +1,405 @@
+#include "merged_obstacle_tree.h"
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unistd.h>
+
+namespace rsurfaces
+{
+    static const char OBSTACLE_CACHE_MAGIC[8] = {'R', 'S', 'U', 'R', 'F', 'O', 'B', 'S'};
+    // Version 3: point cloud entries store the volume of their triangles again
+    static const uint32_t OBSTACLE_CACHE_VERSION = 3;
+
+    void MergedObstacleTreeBuilder::PrimitivePool::resize(mint count, bool isPointCloud)
+    {
+        areas.resize(count);
+        centers.resize(3 * count);
+        if (!isPointCloud)
+        {
+            normals.resize(3 * count);
+            hulls.resize(9 * count);
+        }
+    }
+
+    void MergedObstacleTreeBuilder::beginObstacle(mreal weight, bool isPointCloud)
+    {
+        obstacleBegin.push_back(isPointCloud ? points.areas.size() : triangles.areas.size());
+        obstacleWeights.push_back(weight);
+        obstacleIsPointCloud.push_back(isPointCloud);
+    }
+
+    void MergedObstacleTreeBuilder::AddMesh(surface::SurfaceMesh &mesh, surface::VertexPositionGeometry &geom, mreal weight)
+    {
+        beginObstacle(weight, false);
+
+        geom.requireFaceAreas();
+        geom.requireFaceNormals();
+
+        for (surface::Face face : mesh.faces())
+        {
+            if (face.degree() != 3)
+            {
+                throw std::runtime_error("Merged obstacle tree only supports triangle meshes.");
+            }
+
+            Vector3 center{0, 0, 0};
+            for (surface::Vertex v : face.adjacentVertices())
+            {
+                Vector3 p = geom.inputVertexPositions[v];
+                triangles.hulls.push_back(p.x);
+                triangles.hulls.push_back(p.y);
+                triangles.hulls.push_back(p.z);
+                center += p / 3.;
+            }
+
+            Vector3 n = geom.faceNormals[face];
+            triangles.areas.push_back(weight * geom.faceAreas[face]);
+            triangles.centers.push_back(center.x);
+            triangles.centers.push_back(center.y);
+            triangles.centers.push_back(center.z);
+            triangles.normals.push_back(n.x);
+            triangles.normals.push_back(n.y);
+            triangles.normals.push_back(n.z);
+        }
+    }
+
+    void MergedObstacleTreeBuilder::AddPointCloud(const mreal *pt_positions, const mreal *pt_weights, mint pt_count, mreal weight)
+    {
+        beginObstacle(weight, true);
+
+        mint begin = points.areas.size();
+        points.resize(begin + pt_count, true);
+
+        #pragma omp parallel for
+        for (mint i = 0; i < pt_count; ++i)
+        {
+            points.areas[begin + i] = weight * (pt_weights ? pt_weights[i] : 1.);
+            points.centers[3 * (begin + i) + 0] = pt_positions[3 * i + 0];
+            points.centers[3 * (begin + i) + 1] = pt_positions[3 * i + 1];
+            points.centers[3 * (begin + i) + 2] = pt_positions[3 * i + 2];
+        }
+    }
+
+    void MergedObstacleTreeBuilder::Clear()
+    {
+        triangles = PrimitivePool();
+        points = PrimitivePool();
+        obstacleBegin.clear();
+        obstacleWeights.clear();
+        obstacleIsPointCloud.clear();
+    }
+
+    void MergedObstacleTreeBuilder::SaveLastObstacle(std::string cacheFile, double volume) const
+    {
+        if (obstacleBegin.empty() || obstacleWeights.back() == 0)
+        {
+            // Nothing to save, or the unweighted areas cannot be recovered
+            return;
+        }
+
+        bool isPointCloud = obstacleIsPointCloud.back();
+        const PrimitivePool &pool = isPointCloud ? points : triangles;
+        mint begin = obstacleBegin.back();
+        mint count = pool.areas.size() - begin;
+        mreal weight = obstacleWeights.back();
+
+        std::vector<mreal> unweighted(pool.areas.begin() + begin, pool.areas.end());
+        for (mreal &a : unweighted)
+        {
+            a /= weight;
+        }
+
+        // Write to a temporary name first, so that concurrent runs never see a partial file
+        std::string tmpFile = cacheFile + ".tmp" + std::to_string(getpid());
+        std::ofstream out(tmpFile, std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "Could not write obstacle cache " << cacheFile << std::endl;
+            return;
+        }
+        out.write(OBSTACLE_CACHE_MAGIC, sizeof(OBSTACLE_CACHE_MAGIC));
+        checkpoint::writeValue<uint32_t>(out, OBSTACLE_CACHE_VERSION);
+        checkpoint::writeValue<uint32_t>(out, isPointCloud ? 1 : 0);
+        checkpoint::writeValue<uint64_t>(out, count);
+        checkpoint::writeValue<double>(out, volume);
+        out.write(reinterpret_cast<const char *>(unweighted.data()), sizeof(mreal) * count);
+        out.write(reinterpret_cast<const char *>(&pool.centers[3 * begin]), sizeof(mreal) * 3 * count);
+        if (!isPointCloud)
+        {
+            out.write(reinterpret_cast<const char *>(&pool.normals[3 * begin]), sizeof(mreal) * 3 * count);
+            out.write(reinterpret_cast<const char *>(&pool.hulls[9 * begin]), sizeof(mreal) * 9 * count);
+        }
+        out.close();
+        if (!out)
+        {
+            std::cerr << "Could not write obstacle cache " << cacheFile << std::endl;
+            std::remove(tmpFile.c_str());
+            return;
+        }
+        std::rename(tmpFile.c_str(), cacheFile.c_str());
+    }
+
+    bool MergedObstacleTreeBuilder::LoadObstacle(std::string cacheFile, mreal weight, double &volume)
+    {
+        std::ifstream in(cacheFile, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+
+        char magic[sizeof(OBSTACLE_CACHE_MAGIC)];
+        in.read(magic, sizeof(magic));
+        if (!in || std::memcmp(magic, OBSTACLE_CACHE_MAGIC, sizeof(magic)) != 0)
+        {
+            return false;
+        }
+
+        // Kept outside the try block, so that a failed allocation can be undone
+        PrimitivePool *grownPool = nullptr;
+        mint begin = 0;
+        bool isPointCloud = false;
+        try
+        {
+            if (checkpoint::readValue<uint32_t>(in) != OBSTACLE_CACHE_VERSION)
+            {
+                return false;
+            }
+            isPointCloud = (checkpoint::readValue<uint32_t>(in) != 0);
+            uint64_t count = checkpoint::readValue<uint64_t>(in);
+            volume = checkpoint::readValue<double>(in);
+
+            // Areas and centers, plus normals and hulls for triangles
+            uint64_t bytesPerPrimitive = sizeof(mreal) * (isPointCloud ? 4 : 16);
+            int64_t left = checkpoint::bytesLeft(in);
+            if (left < 0 || count > uint64_t(left) / bytesPerPrimitive)
+            {
+                return false;
+            }
+
+            PrimitivePool &pool = isPointCloud ? points : triangles;
+            begin = pool.areas.size();
+            grownPool = &pool;
+            pool.resize(begin + count, isPointCloud);
+
+            // An empty obstacle has nothing to read, and begin would index past the pool
+            if (count > 0)
+            {
+                in.read(reinterpret_cast<char *>(&pool.areas[begin]), sizeof(mreal) * count);
+                in.read(reinterpret_cast<char *>(&pool.centers[3 * begin]), sizeof(mreal) * 3 * count);
+                if (!isPointCloud)
+                {
+                    in.read(reinterpret_cast<char *>(&pool.normals[3 * begin]), sizeof(mreal) * 3 * count);
+                    in.read(reinterpret_cast<char *>(&pool.hulls[9 * begin]), sizeof(mreal) * 9 * count);
+                }
+            }
+            if (!in)
+            {
+                // Truncated file; drop whatever was read
+                pool.resize(begin, isPointCloud);
+                return false;
+            }
+
+            for (mint i = begin; i < begin + (mint)count; ++i)
+            {
+                pool.areas[i] *= weight;
+            }
+
+            obstacleBegin.push_back(begin);
+            obstacleWeights.push_back(weight);
+            obstacleIsPointCloud.push_back(isPointCloud);
+        }
+        catch (std::exception &e)
+        {
+            // Also covers a failed allocation, which may have grown only some of the arrays
+            if (grownPool)
+            {
+                grownPool->resize(begin, isPointCloud);
+            }
+            return false;
+        }
+        return true;
+    }
+
+    void MergedObstacleTreeBuilder::LastObstacleGeometry(std::vector<Vector3> &points, std::vector<std::vector<size_t>> &triangles) const
+    {
+        points.clear();
+        triangles.clear();
+        if (obstacleBegin.empty())
+        {
+            return;
+        }
+
+        bool isPointCloud = obstacleIsPointCloud.back();
+        const PrimitivePool &pool = isPointCloud ? this->points : this->triangles;
+        mint begin = obstacleBegin.back();
+        for (mint i = begin; i < (mint)pool.areas.size(); ++i)
+        {
+            if (isPointCloud)
+            {
+                points.push_back(Vector3{pool.centers[3 * i], pool.centers[3 * i + 1], pool.centers[3 * i + 2]});
+            }
+            else
+            {
+                size_t first = points.size();
+                for (mint corner = 0; corner < 3; ++corner)
+                {
+                    const mreal *p = &pool.hulls[9 * i + 3 * corner];
+                    points.push_back(Vector3{p[0], p[1], p[2]});
+                }
+                triangles.push_back({first, first + 1, first + 2});
+            }
+        }
+    }
+
+    std::string obstacleCacheFile(std::string cacheDir, std::string filename, bool recenter, bool asPointCloud)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open obstacle " + filename + ".");
+        }
+
+        // 64-bit FNV-1a over the file contents and the options
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const char *data, size_t size) {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= uint8_t(data[i]);
+                hash *= 1099511628211ull;
+            }
+        };
+
+        std::vector<char> buffer(1 << 20);
+        while (in)
+        {
+            in.read(buffer.data(), buffer.size());
+            mix(buffer.data(), in.gcount());
+        }
+        char options[2] = {char(recenter), char(asPointCloud)};
+        mix(options, sizeof(options));
+
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+
+        std::string sep = "";
+        if (cacheDir.size() > 0 && cacheDir[cacheDir.size() - 1] != '/')
+        {
+            sep = "/";
+        }
+        return cacheDir + sep + std::string(name) + ".rso";
+    }
+
+    // Writes either the normal (3 entries) or the projector onto the normal (6 entries)
+    // after the area and barycenter, depending on how many entries the layout has.
+    inline void setOrientationData(mreal *dest, mint dataDim, mreal n1, mreal n2, mreal n3)
+    {
+        if (dataDim - 4 == 6)
+        {
+            dest[4] = n1 * n1;
+            dest[5] = n1 * n2;
+            dest[6] = n1 * n3;
+            dest[7] = n2 * n2;
+            dest[8] = n2 * n3;
+            dest[9] = n3 * n3;
+        }
+        else if (dataDim - 4 == 3)
+        {
+            dest[4] = n1;
+            dest[5] = n2;
+            dest[6] = n3;
+        }
+    }
+
+    OptimizedClusterTree *MergedObstacleTreeBuilder::Build(mint near_dim, mint far_dim, bool pointClouds) const
+    {
+        ptic("MergedObstacleTreeBuilder::Build");
+
+        const PrimitivePool &pool = pointClouds ? points : triangles;
+        mint dim = 3;
+        // A point is its own hull
+        mint primitive_length = pointClouds ? 1 : 3;
+        mint primitive_count = pool.areas.size();
+
+        if (primitive_count == 0)
+        {
+            ptoc("MergedObstacleTreeBuilder::Build");
+            return 0;
+        }
+
+        mreal *P_near = nullptr;
+        mreal *P_far = nullptr;
+        safe_alloc(P_near, primitive_count * near_dim, 0.);
+        safe_alloc(P_far, primitive_count * far_dim, 0.);
+
+        #pragma omp parallel for
+        for (mint i = 0; i < primitive_count; ++i)
+        {
+            P_far[far_dim * i + 0] = P_near[near_dim * i + 0] = pool.areas[i];
+            P_far[far_dim * i + 1] = P_near[near_dim * i + 1] = pool.centers[dim * i + 0];
+            P_far[far_dim * i + 2] = P_near[near_dim * i + 2] = pool.centers[dim * i + 1];
+            P_far[far_dim * i + 3] = P_near[near_dim * i + 3] = pool.centers[dim * i + 2];
+
+            // Points have no orientation; the obstacle side of the energy only uses areas and positions
+            if (!pointClouds)
+            {
+                mreal n1 = pool.normals[dim * i + 0];
+                mreal n2 = pool.normals[dim * i + 1];
+                mreal n3 = pool.normals[dim * i + 2];
+                setOrientationData(&P_near[near_dim * i], near_dim, n1, n2, n3);
+                setOrientationData(&P_far[far_dim * i], far_dim, n1, n2, n3);
+            }
+        }
+
+        mint *idx = nullptr;
+        mint *idxdim = nullptr;
+        mreal *ones = nullptr;
+        mreal *zeroes = nullptr;
+
+        safe_iota(idx, dim * primitive_count + 1);
+        safe_alloc(idxdim, dim * primitive_count);
+        safe_alloc(ones, primitive_count + 1, 1.);
+        safe_alloc(zeroes, dim * primitive_count, 0.);
+
+        #pragma omp parallel for
+        for (mint i = 0; i < primitive_count; ++i)
+        {
+            for (mint k = 0; k < dim; ++k)
+            {
+                idxdim[dim * i + k] = i;
+            }
+        }
+
+        // The obstacles never move, so only their primitive data enters the
+        // metric; the operators are placeholders like for point clouds.
+        MKLSparseMatrix AvOp = MKLSparseMatrix(primitive_count, primitive_count, idx, idx, ones);                // identity matrix
+        MKLSparseMatrix DiffOp = MKLSparseMatrix(dim * primitive_count, primitive_count, idx, idxdim, zeroes); // zero matrix
+
+        OptimizedClusterTree *o_bvh = new OptimizedClusterTree(
+            &pool.centers[0], // coordinates used for clustering
+            primitive_count,  // number of primitives
+            dim,              // dimension of ambient space
+            pointClouds ? &pool.centers[0] : &pool.hulls[0], // coordinates of the convex hull of each primitive
+            primitive_length, // number of points in the convex hull of each primitive
+            &P_near[0],       // weighted area, barycenter, and normal of each primitive
+            near_dim,         // number of dofs of P_near per primitive
+            &P_far[0],        // weighted area, barycenter, and projector of each primitive
+            far_dim,          // number of dofs of P_far per primitive
+            idx,              // some ordering of primitives
+            DiffOp,           // the first-order differential operator belonging to the hi order term of the metric
+            AvOp              // the zeroth-order differential operator belonging to the lo order term of the metric
+        );
+        o_bvh->Freeze();
+
+        safe_free(P_near);
+        safe_free(P_far);
+        safe_free(idx);
+        safe_free(idxdim);
+        safe_free(ones);
+        safe_free(zeroes);
+
+        ptoc("MergedObstacleTreeBuilder::Build");
+        return o_bvh;
+    }
+} // namespace rsurfaces
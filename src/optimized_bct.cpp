@@ -44,7 +44,10 @@ namespace rsurfaces
 
         // TODO: The following line should be moved to InternalMultiply in order to delay matrix creation to a time when it is actually needed. Otherwise, using the BCT for line search (evaluating only the energy), the time for creating the matrices would be wasted.
         
-        RequireMetrics();
+        if( settings.require_metrics )
+        {
+            RequireMetrics();
+        }
 
         ptoc("OptimizedBlockClusterTree::OptimizedBlockClusterTree");
     }; // Constructor
@@ -945,29 +948,38 @@ namespace rsurfaces
 
             //Sloppily: hi_diag = hi_ker * P_near[0], where hi_ker is the kernel implemented in ApplyKernel
             
-            // Initialize the "diag" vector (weighted by the primitive weights)
+            mreal * T_P_weights = T->P_frozen_weights;
+            mreal * T_C_weights = T->C_frozen_weights;
+
+            if( !T->frozen )
             {
-                mreal * a = T->P_near[0];
-                mreal * diag = T->P_in;
-                mint m = T->primitive_count;
-                #pragma omp parallel for simd aligned( a, diag : ALIGN )
-                for( mint i = 0; i < m; ++i )
+                // Initialize the "diag" vector (weighted by the primitive weights)
                 {
-                    diag[i] = a[i];
+                    mreal * a = T->P_near[0];
+                    mreal * diag = T->P_in;
+                    mint m = T->primitive_count;
+                    #pragma omp parallel for simd aligned( a, diag : ALIGN )
+                    for( mint i = 0; i < m; ++i )
+                    {
+                        diag[i] = a[i];
+                    }
                 }
+
+                T->P_to_C.Multiply( T->P_in, T->C_in, cols);
+
+                T->PercolateUp();
+
+                T_P_weights = T->P_in;
+                T_C_weights = T->C_in;
             }
-            
-            T->P_to_C.Multiply( T->P_in, T->C_in, cols);
-            
-            T->PercolateUp();
 
             safe_alloc( fr_diag, S->primitive_count );
             safe_alloc( hi_diag, S->primitive_count );
             safe_alloc( lo_diag, S->primitive_count );
 
             // The factor of 2. in the last argument stems from the symmetry of the kernel
-             far->ApplyKernel( BCTKernelType::FractionalOnly, T->C_in, S->C_out, cols, 2., settings.mult_alg);
-            near->ApplyKernel( BCTKernelType::FractionalOnly, T->P_in, S->P_out, cols, 2., settings.mult_alg);
+             far->ApplyKernel( BCTKernelType::FractionalOnly, T_C_weights, S->C_out, cols, 2., settings.mult_alg);
+            near->ApplyKernel( BCTKernelType::FractionalOnly, T_P_weights, S->P_out, cols, 2., settings.mult_alg);
             
             S->PercolateDown();
             S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
@@ -989,8 +1001,8 @@ namespace rsurfaces
             }
 
             
-             far->ApplyKernel( BCTKernelType::HighOrder, T->C_in, S->C_out, cols, 2., settings.mult_alg);
-            near->ApplyKernel( BCTKernelType::HighOrder, T->P_in, S->P_out, cols, 2., settings.mult_alg);
+             far->ApplyKernel( BCTKernelType::HighOrder, T_C_weights, S->C_out, cols, 2., settings.mult_alg);
+            near->ApplyKernel( BCTKernelType::HighOrder, T_P_weights, S->P_out, cols, 2., settings.mult_alg);
             
             S->PercolateDown();
             S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
@@ -1001,8 +1013,8 @@ namespace rsurfaces
                 hi_diag[i] =  ainv[i] * data[i];
             }
              
-             far->ApplyKernel( BCTKernelType::LowOrder, T->C_in, S->C_out, cols, 2., settings.mult_alg);
-            near->ApplyKernel( BCTKernelType::LowOrder, T->P_in, S->P_out, cols, 2., settings.mult_alg);
+             far->ApplyKernel( BCTKernelType::LowOrder, T_C_weights, S->C_out, cols, 2., settings.mult_alg);
+            near->ApplyKernel( BCTKernelType::LowOrder, T_P_weights, S->P_out, cols, 2., settings.mult_alg);
             
             S->PercolateDown();
             S->C_to_P.Multiply( S->C_out, S->P_out, cols, true);
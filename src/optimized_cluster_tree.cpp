@@ -38,6 +38,249 @@ namespace rsurfaces
     {
         ptic("OptimizedClusterTree::OptimizedClusterTree");
         
+        Initialize( P_coords_, primitive_count_, dim_, hull_count_, near_dim_, far_dim_, ordering_, settings_ );
+
+        ptic("SplitCluster");
+
+        Cluster2 * root = new Cluster2 ( 0, primitive_count, 0 );
+
+        #pragma omp parallel num_threads(tree_thread_count)  shared( root, P_coords, P_ext_pos, tree_thread_count)
+        {
+            #pragma omp single nowait
+            {
+                SplitCluster( root, tree_thread_count );
+            }
+        }
+        ptoc("SplitCluster");
+
+        Finish( root, P_hull_coords_, P_near_, P_far_, DiffOp, AvOp );
+        
+        ptoc("OptimizedClusterTree::OptimizedClusterTree");
+    }; //Constructor
+
+
+    OptimizedClusterTree::OptimizedClusterTree(
+       const OptimizedClusterTree &previous,
+       const mint * restrict const previous_primitive,
+       const mreal * restrict const P_coords_,
+       const mint primitive_count_,
+       const mint dim_,
+       const mreal * restrict const P_hull_coords_,
+       const mint hull_count_,
+       const mreal * restrict const P_near_,
+       const mint near_dim_,
+       const mreal * restrict const P_far_,
+       const mint far_dim_,
+       MKLSparseMatrix &DiffOp,
+       MKLSparseMatrix &AvOp,
+       BVHSettings settings_
+    )
+    {
+        ptic("OptimizedClusterTree::OptimizedClusterTree (repair)");
+
+        // Sort the primitives by the leaf of the previous tree they belong to. Since leaves are
+        // numbered in depth-first order, every cluster of the previous tree stays contiguous.
+        std::vector<mint> leaf ( primitive_count_ );
+        previous.FindLeaves( P_coords_, primitive_count_, previous_primitive, &leaf[0] );
+
+        mint previous_leaf_count = previous.leaf_cluster_count;
+        std::vector<mint> leaf_ptr ( previous_leaf_count + 1, 0 );
+        for( mint i = 0; i < primitive_count_; ++i )
+        {
+            ++leaf_ptr[ leaf[i] + 1 ];
+        }
+        for( mint l = 0; l < previous_leaf_count; ++l )
+        {
+            leaf_ptr[l + 1] += leaf_ptr[l];
+        }
+        std::vector<mint> ordering ( primitive_count_ );
+        std::vector<mint> fill ( leaf_ptr.begin(), leaf_ptr.end() - 1 );
+        for( mint i = 0; i < primitive_count_; ++i )
+        {
+            ordering[ fill[ leaf[i] ]++ ] = i;
+        }
+
+        Initialize( P_coords_, primitive_count_, dim_, hull_count_, near_dim_, far_dim_, &ordering[0], settings_ );
+
+        ptic("RepairCluster");
+        
+        Cluster2 * root = nullptr;
+        #pragma omp parallel num_threads(tree_thread_count)
+        {
+            #pragma omp single nowait
+            {
+                root = RepairCluster( previous, 0, &leaf_ptr[0], tree_thread_count );
+            }
+        }
+        if( root == nullptr )
+        {
+            root = new Cluster2 ( 0, primitive_count, 0 );
+        }
+        CountDescendants( root, 0 );
+        
+        ptoc("RepairCluster");
+
+        Finish( root, P_hull_coords_, P_near_, P_far_, DiffOp, AvOp );
+
+        ptoc("OptimizedClusterTree::OptimizedClusterTree (repair)");
+    }; //Constructor (repair)
+
+
+    void OptimizedClusterTree::FindLeaves( const mreal * restrict const P_coords_, const mint count, const mint * restrict const previous_primitive, mint * restrict const leaf ) const
+    {
+        // leaf of each primitive position in this tree
+        std::vector<mint> position_leaf ( primitive_count );
+        #pragma omp parallel for
+        for( mint l = 0; l < leaf_cluster_count; ++l )
+        {
+            mint C = leaf_clusters[l];
+            for( mint i = C_begin[C]; i < C_end[C]; ++i )
+            {
+                position_leaf[i] = l;
+            }
+        }
+
+        #pragma omp parallel for
+        for( mint i = 0; i < count; ++i )
+        {
+            mint j = previous_primitive[i];
+            if( j >= 0 && j < primitive_count )
+            {
+                leaf[i] = position_leaf[ inverse_ordering[j] ];
+                continue;
+            }
+
+            // A new primitive descends into the child whose bounding box is closer to it.
+            const mreal * restrict const x = P_coords_ + dim * i;
+            mint C = 0;
+            while( C_left[C] >= 0 )
+            {
+                mint L = C_left[C];
+                mint R = C_right[C];
+                mreal dL = 0.;
+                mreal dR = 0.;
+                for( mint k = 0; k < dim; ++k )
+                {
+                    mreal gL = std::max( static_cast<mreal>(0.), std::max( C_min[k][L] - x[k], x[k] - C_max[k][L] ) );
+                    mreal gR = std::max( static_cast<mreal>(0.), std::max( C_min[k][R] - x[k], x[k] - C_max[k][R] ) );
+                    dL += gL * gL;
+                    dR += gR * gR;
+                }
+                if( dL < dR || ( dL == dR && C_end[L] - C_begin[L] <= C_end[R] - C_begin[R] ) )
+                {
+                    C = L;
+                }
+                else
+                {
+                    C = R;
+                }
+            }
+            leaf[i] = leaf_cluster_lookup[C];
+        }
+    }; //FindLeaves
+
+
+    Cluster2 * OptimizedClusterTree::RepairCluster( const OptimizedClusterTree &previous, const mint C, const mint * restrict const leaf_ptr, const mint free_thread_count )
+    {
+        mint L = previous.C_left [C];
+        mint R = previous.C_right[C];
+
+        if( L < 0 )
+        {
+            mint l = previous.leaf_cluster_lookup[C];
+            if( leaf_ptr[l] == leaf_ptr[l+1] )
+            {
+                // all primitives of the leaf were removed
+                return nullptr;
+            }
+            // splits the leaf further if it became larger than split_threshold
+            Cluster2 * leaf = new Cluster2 ( leaf_ptr[l], leaf_ptr[l+1], 0 );
+            SplitCluster( leaf, free_thread_count );
+            return leaf;
+        }
+
+        Cluster2 * left = nullptr;
+        Cluster2 * right = nullptr;
+        #pragma omp task final(free_thread_count<1)  shared( left, previous, leaf_ptr )
+        {
+            left = RepairCluster( previous, L, leaf_ptr, free_thread_count/2 );
+        }
+        #pragma omp task final(free_thread_count<1)  shared( right, previous, leaf_ptr )
+        {
+            right = RepairCluster( previous, R, leaf_ptr, free_thread_count - free_thread_count/2 );
+        }
+        #pragma omp taskwait
+
+        if( left == nullptr )
+        {
+            return right;
+        }
+        if( right == nullptr )
+        {
+            return left;
+        }
+
+        Cluster2 * cluster = new Cluster2 ( left->begin, right->end, 0 );
+        if( cluster->end - cluster->begin <= settings.split_threshold )
+        {
+            // small enough to be a single leaf again
+            DeleteCluster( left );
+            DeleteCluster( right );
+        }
+        else
+        {
+            cluster->left = left;
+            cluster->right = right;
+        }
+        return cluster;
+    }; //RepairCluster
+
+
+    void OptimizedClusterTree::CountDescendants( Cluster2 * const C, const mint depth )
+    {
+        C->depth = depth;
+        if( ( C->left != nullptr ) && ( C->right != nullptr ) )
+        {
+            CountDescendants( C->left, depth + 1 );
+            CountDescendants( C->right, depth + 1 );
+            C->descendant_count = 1 + C->left->descendant_count + C->right->descendant_count;
+            C->descendant_leaf_count = C->left->descendant_leaf_count + C->right->descendant_leaf_count;
+            C->max_depth = std::max( C->left->max_depth, C->right->max_depth );
+        }
+        else
+        {
+            C->descendant_count = 1;
+            C->descendant_leaf_count = 1;
+            C->max_depth = depth;
+        }
+    }; //CountDescendants
+
+
+    void OptimizedClusterTree::DeleteCluster( Cluster2 * const C )
+    {
+        if( C->left != nullptr )
+        {
+            DeleteCluster( C->left );
+        }
+        if( C->right != nullptr )
+        {
+            DeleteCluster( C->right );
+        }
+        delete C;
+    }; //DeleteCluster
+
+
+    void OptimizedClusterTree::Initialize(
+        const mreal * restrict const P_coords_,
+        const mint primitive_count_,
+        const mint dim_,
+        const mint hull_count_,
+        const mint near_dim_,
+        const mint far_dim_,
+        const mint * restrict const ordering_,
+        BVHSettings settings_
+    )
+    {
         primitive_count = primitive_count_;
         hull_count = hull_count_;
         dim = dim_;
@@ -79,20 +322,18 @@ namespace rsurfaces
                 P_coords[k][i] = P_coords_[ dim * j + k ];
             }
         }
+    }; //Initialize
 
-        ptic("SplitCluster");
-
-        Cluster2 * root = new Cluster2 ( 0, primitive_count, 0 );
-
-        #pragma omp parallel num_threads(tree_thread_count)  shared( root, P_coords, P_ext_pos, tree_thread_count)
-        {
-            #pragma omp single nowait
-            {
-                SplitCluster( root, tree_thread_count );
-            }
-        }
-        ptoc("SplitCluster");
 
+    void OptimizedClusterTree::Finish(
+        Cluster2 * root,
+        const mreal * restrict const P_hull_coords_,
+        const mreal * restrict const P_near_,
+        const mreal * restrict const P_far_,
+        MKLSparseMatrix &DiffOp,
+        MKLSparseMatrix &AvOp
+    )
+    {
         ptic("Bunch of allocations");
 
         cluster_count = root->descendant_count;
@@ -173,10 +414,7 @@ namespace rsurfaces
         ComputeClusterData();
 
         ComputePrePost( DiffOp, AvOp );
-
-        
-        ptoc("OptimizedClusterTree::OptimizedClusterTree");
-    }; //Constructor
+    }; //Finish
 
 
     void OptimizedClusterTree::SplitCluster( Cluster2 * const C, const mint free_thread_count )
@@ -646,6 +884,29 @@ namespace rsurfaces
         
     }; // RequireBuffers
 
+    void OptimizedClusterTree::Freeze()
+    {
+        ptic("OptimizedClusterTree::Freeze");
+        RequireBuffers(1);
+
+        mreal * a = P_near[0];
+        #pragma omp parallel for simd aligned( a, P_in : ALIGN )
+        for( mint i = 0; i < primitive_count; ++i )
+        {
+            P_in[i] = a[i];
+        }
+        P_to_C.Multiply( P_in, C_in, 1 );
+        PercolateUp();
+
+        safe_alloc( P_frozen_weights, primitive_count );
+        safe_alloc( C_frozen_weights, cluster_count );
+        std::copy( P_in, P_in + primitive_count, P_frozen_weights );
+        std::copy( C_in, C_in + cluster_count, C_frozen_weights );
+
+        frozen = true;
+        ptoc("OptimizedClusterTree::Freeze");
+    }; // Freeze
+
     void OptimizedClusterTree::CleanseBuffers()
     {
         ptic("CleanseBuffers");
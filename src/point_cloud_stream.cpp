@@ -0,0 +1,84 @@
+#include "point_cloud_stream.h"
+#include "binary_mesh.h"
+#include "profiler.h"
+
+#include <cmath>
+
+namespace rsurfaces
+{
+    StreamingPointCloudReducer::StreamingPointCloudReducer(double cellSize_)
+    {
+        cellSize = cellSize_;
+        inputCount = 0;
+
+        if (cellSize <= 0)
+        {
+            throw std::runtime_error("Point cloud cell size must be positive.");
+        }
+    }
+
+    void StreamingPointCloudReducer::AddChunk(const double *positions, size_t count)
+    {
+        ptic("StreamingPointCloudReducer::AddChunk");
+
+        // Computing the cells is the part that touches every point, so do it in
+        // parallel; the accumulation into the (much smaller) map stays sequential
+        std::vector<CellKey> keys(count);
+        double invCellSize = 1. / cellSize;
+
+        #pragma omp parallel for
+        for (size_t p = 0; p < count; p++)
+        {
+            keys[p].i = (int64_t)std::floor(positions[3 * p + 0] * invCellSize);
+            keys[p].j = (int64_t)std::floor(positions[3 * p + 1] * invCellSize);
+            keys[p].k = (int64_t)std::floor(positions[3 * p + 2] * invCellSize);
+        }
+
+        for (size_t p = 0; p < count; p++)
+        {
+            CellSum &cell = cells[keys[p]];
+            cell.count += 1;
+            cell.x += positions[3 * p + 0];
+            cell.y += positions[3 * p + 1];
+            cell.z += positions[3 * p + 2];
+        }
+        inputCount += count;
+
+        ptoc("StreamingPointCloudReducer::AddChunk");
+    }
+
+    void StreamingPointCloudReducer::AddBinaryFile(std::string filename, size_t chunkSize)
+    {
+        MappedBinaryMesh mapped(filename);
+        size_t nVerts = mapped.nVertices();
+        const double *pos = mapped.positions();
+
+        for (size_t begin = 0; begin < nVerts; begin += chunkSize)
+        {
+            size_t end = std::min(begin + chunkSize, nVerts);
+            AddChunk(pos + 3 * begin, end - begin);
+            // Each point is read exactly once, so there is no point in keeping it resident
+            mapped.ReleasePositions(begin, end);
+        }
+
+        std::cout << "Streamed " << nVerts << " points from " << filename << " into " << cells.size()
+                  << " cells of size " << cellSize << std::endl;
+    }
+
+    void StreamingPointCloudReducer::Extract(std::vector<double> &positions, std::vector<double> &weights) const
+    {
+        positions.resize(3 * cells.size());
+        weights.resize(cells.size());
+
+        size_t i = 0;
+        for (auto &entry : cells)
+        {
+            const CellSum &cell = entry.second;
+            positions[3 * i + 0] = cell.x / cell.count;
+            positions[3 * i + 1] = cell.y / cell.count;
+            positions[3 * i + 2] = cell.z / cell.count;
+            weights[i] = cell.count;
+            i++;
+        }
+    }
+} // namespace rsurfaces
@@ -1,4 +1,5 @@
 #include "remeshing/dynamic_remesher.h"
+#include "checkpoint.h"
 
 namespace rsurfaces
 {
@@ -57,11 +58,28 @@ namespace rsurfaces
             vectorData.push_back(data);
         }
 
+        void DynamicRemesher::SaveState(std::ostream &out)
+        {
+            checkpoint::writeValue<double>(out, initialAverageLength);
+            checkpoint::writeValue<double>(out, initialHWeightedLength);
+            checkpoint::writeValue<double>(out, epsilon);
+        }
+
+        void DynamicRemesher::LoadState(std::istream &in)
+        {
+            initialAverageLength = checkpoint::readValue<double>(in);
+            initialHWeightedLength = checkpoint::readValue<double>(in);
+            epsilon = checkpoint::readValue<double>(in);
+        }
+
         bool DynamicRemesher::Remesh(int numIters, bool changeTopology)
         {
             ptic("DynamicRemesher::Remesh");
             
             bool didSplitOrCollapse = false;
+            // The flow has moved the vertices since the last call
+            positionsLoaded = false;
+
             switch (remeshingMode)
             {
             case RemeshingMode::FlipOnly:
@@ -91,7 +109,52 @@ namespace rsurfaces
                     double l = (curvatureAdaptive) ? initialHWeightedLength : initialAverageLength;
                     double l_min = (curvatureAdaptive) ? initialAverageLength * 0.9 : initialAverageLength * 0.5;
 
-                    didSplitOrCollapse = adjustEdgeLengths(mesh, geom, geomOrig, l, epsilon, l_min, curvatureAdaptive);
+                    // Faces created by splits take the default value
+                    FaceData<mint> origin(*mesh, -1);
+                    FaceIndices fInds = mesh->getFaceIndices();
+                    for (Face f : mesh->faces())
+                    {
+                        origin[f] = fInds[f];
+                    }
+
+                    // Registered vertex data is read by the old indices before the mesh changes
+                    std::vector<Eigen::MatrixXd> oldData(vectorData.size());
+                    VertexIndices vInds = mesh->getVertexIndices();
+                    for (size_t k = 0; k < vectorData.size(); k++)
+                    {
+                        oldData[k].setZero(mesh->nVertices(), 3);
+                        for (GCVertex v : mesh->vertices())
+                        {
+                            oldData[k].row(vInds[v]) = Eigen::RowVector3d(vectorData[k]->data[v].x, vectorData[k]->data[v].y, vectorData[k]->data[v].z);
+                        }
+                    }
+
+                    transfer.Begin(mesh);
+                    didSplitOrCollapse = adjustEdgeLengths(mesh, geom, geomOrig, l, epsilon, l_min, curvatureAdaptive, &transfer);
+                    transfer.End(mesh);
+                    topologyChanged = topologyChanged || didSplitOrCollapse;
+                    if (didSplitOrCollapse)
+                    {
+                        connectivityEpoch++;
+                    }
+
+                    vInds = mesh->getVertexIndices();
+                    for (size_t k = 0; k < vectorData.size(); k++)
+                    {
+                        transfer.Apply(oldData[k]);
+                        for (GCVertex v : mesh->vertices())
+                        {
+                            size_t i = vInds[v];
+                            vectorData[k]->data[v] = Vector3{oldData[k](i, 0), oldData[k](i, 1), oldData[k](i, 2)};
+                        }
+                    }
+
+                    fInds = mesh->getFaceIndices();
+                    faceOrigins.assign(mesh->nFaces(), -1);
+                    for (Face f : mesh->faces())
+                    {
+                        faceOrigins[fInds[f]] = origin[f];
+                    }
                 }
                 geom->refreshQuantities();
 
@@ -118,10 +181,16 @@ namespace rsurfaces
             switch (flippingMode)
             {
             case FlippingMode::Delaunay:
-                fixDelaunay(mesh, geom);
+                if (fixDelaunayParallel(mesh, geom) > 0)
+                {
+                    topologyChanged = true;
+                    connectivityEpoch++;
+                }
                 break;
             case FlippingMode::Degree:
                 adjustVertexDegrees(mesh, geom);
+                topologyChanged = true;
+                connectivityEpoch++;
                 break;
             default:
                 throw std::runtime_error("Unknown flipping mode.");
@@ -131,18 +200,32 @@ namespace rsurfaces
 
         void DynamicRemesher::smoothVertices()
         {
+            if (topologyChanged || !smoother.Matches(mesh))
+            {
+                smoother.Rebuild(mesh);
+                topologyChanged = false;
+                positionsLoaded = false;
+            }
+            if (!positionsLoaded)
+            {
+                smoother.Load(geom);
+                positionsLoaded = true;
+            }
+
             switch (smoothingMode)
             {
             case SmoothingMode::Laplacian:
-                smoothByLaplacian(mesh, geom);
+                smoother.SmoothByLaplacian();
                 break;
             case SmoothingMode::Circumcenter:
-                smoothByCircumcenter(mesh, geom);
+                smoother.SmoothByCircumcenter();
                 break;
             default:
                 throw std::runtime_error("Unknown smoothing mode.");
                 break;
             }
+            // Flipping reads the positions from the geometry
+            smoother.Store(geom);
         }
 
     } // namespace remeshing
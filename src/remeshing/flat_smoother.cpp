@@ -0,0 +1,294 @@
+#include "remeshing/flat_smoother.h"
+
+namespace rsurfaces
+{
+    namespace remeshing
+    {
+        bool FlatSmoother::Matches(MeshPtr const &mesh) const
+        {
+            return (vertexCount == (mint)mesh->nVertices()) && (faceCount == (mint)mesh->nFaces());
+        }
+
+        void FlatSmoother::Rebuild(MeshPtr const &mesh)
+        {
+            ptic("FlatSmoother::Rebuild");
+
+            vertexCount = mesh->nVertices();
+            faceCount = mesh->nFaces();
+            VertexData<size_t> vIdx = mesh->getVertexIndices();
+
+            vertices.clear();
+            vertices.reserve(vertexCount);
+            vertexOnBoundary.resize(vertexCount);
+            for (GCVertex v : mesh->vertices())
+            {
+                vertexOnBoundary[vertices.size()] = v.isBoundary();
+                vertices.push_back(v);
+            }
+
+            triangles.resize(3 * faceCount);
+            faceOnBoundary.resize(faceCount);
+            mint f = 0;
+            for (GCFace face : mesh->faces())
+            {
+                GCHalfedge he = face.halfedge();
+                bool boundary = false;
+                for (mint c = 0; c < 3; ++c)
+                {
+                    triangles[3 * f + c] = vIdx[he.vertex()];
+                    boundary = boundary || !he.twin().isInterior();
+                    he = he.next();
+                }
+                faceOnBoundary[f] = boundary;
+                ++f;
+            }
+
+            // Vertex-face incidences, by counting sort over the corners
+            vf_outer.assign(vertexCount + 1, 0);
+            for (mint k = 0; k < 3 * faceCount; ++k)
+            {
+                ++vf_outer[triangles[k] + 1];
+            }
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                vf_outer[i + 1] += vf_outer[i];
+            }
+            vf_face.resize(3 * faceCount);
+            vf_corner.resize(3 * faceCount);
+            std::vector<mint> fill(vf_outer.begin(), vf_outer.end() - 1);
+            for (mint k = 0; k < 3 * faceCount; ++k)
+            {
+                mint slot = fill[triangles[k]]++;
+                vf_face[slot] = k / 3;
+                vf_corner[slot] = k;
+            }
+
+            vv_outer.assign(vertexCount + 1, 0);
+            vv_inner.clear();
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                for (GCVertex j : vertices[i].adjacentVertices())
+                {
+                    vv_inner.push_back(vIdx[j]);
+                }
+                vv_outer[i + 1] = vv_inner.size();
+            }
+
+            for (auto *a : {&x, &y, &z, &x_new, &y_new, &z_new})
+            {
+                a->resize(vertexCount);
+            }
+            for (auto *a : {&faceArea, &nx, &ny, &nz, &cx, &cy, &cz})
+            {
+                a->resize(faceCount);
+            }
+            cornerAngle.resize(3 * faceCount);
+
+            ptoc("FlatSmoother::Rebuild");
+        }
+
+        void FlatSmoother::Load(GeomPtr const &geom)
+        {
+            #pragma omp parallel for
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                Vector3 p = geom->inputVertexPositions[vertices[i]];
+                x[i] = p.x;
+                y[i] = p.y;
+                z[i] = p.z;
+            }
+        }
+
+        void FlatSmoother::Store(GeomPtr const &geom) const
+        {
+            #pragma omp parallel for
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                geom->inputVertexPositions[vertices[i]] = Vector3{x[i], y[i], z[i]};
+            }
+        }
+
+        void FlatSmoother::ComputeFaceData(bool centers)
+        {
+            mint const *restrict const t = triangles.data();
+            char const *restrict const onBoundary = faceOnBoundary.data();
+            mreal const *restrict const X = x.data();
+            mreal const *restrict const Y = y.data();
+            mreal const *restrict const Z = z.data();
+            mreal *restrict const A = faceArea.data();
+            mreal *restrict const NX = nx.data();
+            mreal *restrict const NY = ny.data();
+            mreal *restrict const NZ = nz.data();
+            mreal *restrict const CX = cx.data();
+            mreal *restrict const CY = cy.data();
+            mreal *restrict const CZ = cz.data();
+            mreal *restrict const angle = cornerAngle.data();
+
+            #pragma omp parallel for simd
+            for (mint f = 0; f < faceCount; ++f)
+            {
+                mint i0 = t[3 * f + 0];
+                mint i1 = t[3 * f + 1];
+                mint i2 = t[3 * f + 2];
+
+                // edge vectors opposite of each corner
+                mreal e00 = X[i2] - X[i1], e01 = Y[i2] - Y[i1], e02 = Z[i2] - Z[i1];
+                mreal e10 = X[i0] - X[i2], e11 = Y[i0] - Y[i2], e12 = Z[i0] - Z[i2];
+                mreal e20 = X[i1] - X[i0], e21 = Y[i1] - Y[i0], e22 = Z[i1] - Z[i0];
+
+                mreal n0 = e21 * (-e12) - e22 * (-e11);
+                mreal n1 = e22 * (-e10) - e20 * (-e12);
+                mreal n2 = e20 * (-e11) - e21 * (-e10);
+                mreal nn = sqrt(n0 * n0 + n1 * n1 + n2 * n2);
+
+                A[f] = 0.5 * nn;
+                NX[f] = n0 / nn;
+                NY[f] = n1 / nn;
+                NZ[f] = n2 / nn;
+
+                // the angle at a corner lies between the two edges that meet there
+                angle[3 * f + 0] = atan2(nn, -(e10 * e20 + e11 * e21 + e12 * e22));
+                angle[3 * f + 1] = atan2(nn, -(e20 * e00 + e21 * e01 + e22 * e02));
+                angle[3 * f + 2] = atan2(nn, -(e00 * e10 + e01 * e11 + e02 * e12));
+
+                if (centers)
+                {
+                    mreal w0 = 1. / 3.;
+                    mreal w1 = 1. / 3.;
+                    mreal w2 = 1. / 3.;
+                    if (!onBoundary[f])
+                    {
+                        // barycentric coordinates of the circumcenter
+                        mreal a2 = e00 * e00 + e01 * e01 + e02 * e02;
+                        mreal b2 = e10 * e10 + e11 * e11 + e12 * e12;
+                        mreal c2 = e20 * e20 + e21 * e21 + e22 * e22;
+                        w0 = a2 * (b2 + c2 - a2);
+                        w1 = b2 * (c2 + a2 - b2);
+                        w2 = c2 * (a2 + b2 - c2);
+                        mreal s = w0 + w1 + w2;
+                        w0 /= s;
+                        w1 /= s;
+                        w2 /= s;
+                    }
+                    CX[f] = w0 * X[i0] + w1 * X[i1] + w2 * X[i2];
+                    CY[f] = w0 * Y[i0] + w1 * Y[i1] + w2 * Y[i2];
+                    CZ[f] = w0 * Z[i0] + w1 * Z[i1] + w2 * Z[i2];
+                }
+            }
+        }
+
+        inline void FlatSmoother::TangentialStep(mint i, mreal u0, mreal u1, mreal u2, mreal stepSize)
+        {
+            mreal N0 = 0.;
+            mreal N1 = 0.;
+            mreal N2 = 0.;
+
+            #pragma omp simd reduction( + : N0, N1, N2 )
+            for (mint k = vf_outer[i]; k < vf_outer[i + 1]; ++k)
+            {
+                mint f = vf_face[k];
+                mreal a = cornerAngle[vf_corner[k]];
+                N0 += a * nx[f];
+                N1 += a * ny[f];
+                N2 += a * nz[f];
+            }
+
+            mreal nn = sqrt(N0 * N0 + N1 * N1 + N2 * N2);
+            N0 /= nn;
+            N1 /= nn;
+            N2 /= nn;
+
+            mreal d = N0 * u0 + N1 * u1 + N2 * u2;
+            x_new[i] = x[i] + stepSize * (u0 - d * N0);
+            y_new[i] = y[i] + stepSize * (u1 - d * N1);
+            z_new[i] = z[i] + stepSize * (u2 - d * N2);
+        }
+
+        void FlatSmoother::SmoothByCircumcenter()
+        {
+            ptic("FlatSmoother::SmoothByCircumcenter");
+
+            ComputeFaceData(true);
+
+            #pragma omp parallel for
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                if (vertexOnBoundary[i])
+                {
+                    x_new[i] = x[i];
+                    y_new[i] = y[i];
+                    z_new[i] = z[i];
+                    continue;
+                }
+
+                // area-weighted mean of the face centers; the barycentric dual area is a
+                // third of the area of the faces around the vertex
+                mreal area = 0.;
+                mreal s0 = 0.;
+                mreal s1 = 0.;
+                mreal s2 = 0.;
+
+                #pragma omp simd reduction( + : area, s0, s1, s2 )
+                for (mint k = vf_outer[i]; k < vf_outer[i + 1]; ++k)
+                {
+                    mint f = vf_face[k];
+                    area += faceArea[f];
+                    s0 += faceArea[f] * cx[f];
+                    s1 += faceArea[f] * cy[f];
+                    s2 += faceArea[f] * cz[f];
+                }
+
+                TangentialStep(i, s0 / area - x[i], s1 / area - y[i], s2 / area - z[i], 0.5);
+            }
+
+            x.swap(x_new);
+            y.swap(y_new);
+            z.swap(z_new);
+
+            ptoc("FlatSmoother::SmoothByCircumcenter");
+        }
+
+        void FlatSmoother::SmoothByLaplacian()
+        {
+            ptic("FlatSmoother::SmoothByLaplacian");
+
+            ComputeFaceData(false);
+
+            #pragma omp parallel for
+            for (mint i = 0; i < vertexCount; ++i)
+            {
+                if (vertexOnBoundary[i])
+                {
+                    x_new[i] = x[i];
+                    y_new[i] = y[i];
+                    z_new[i] = z[i];
+                    continue;
+                }
+
+                // average of the surrounding vertices
+                mreal s0 = 0.;
+                mreal s1 = 0.;
+                mreal s2 = 0.;
+
+                #pragma omp simd reduction( + : s0, s1, s2 )
+                for (mint k = vv_outer[i]; k < vv_outer[i + 1]; ++k)
+                {
+                    mint j = vv_inner[k];
+                    s0 += x[j];
+                    s1 += y[j];
+                    s2 += z[j];
+                }
+
+                mreal degree = vv_outer[i + 1] - vv_outer[i];
+                TangentialStep(i, s0 / degree - x[i], s1 / degree - y[i], s2 / degree - z[i], 1.);
+            }
+
+            x.swap(x_new);
+            y.swap(y_new);
+            z.swap(z_new);
+
+            ptoc("FlatSmoother::SmoothByLaplacian");
+        }
+
+    } // namespace remeshing
+} // namespace rsurfaces
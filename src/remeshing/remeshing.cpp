@@ -1,4 +1,8 @@
 #include "remeshing/remeshing.h"
+#include "optimized_bct_types.h"
+
+#include <algorithm>
+#include <limits>
 
 namespace rsurfaces
 {
@@ -466,6 +470,125 @@ namespace rsurfaces
             }
         }
 
+        // Returns by how much the opposite angles of e exceed pi, or -1 if e is Delaunay.
+        inline double delaunayExcess(GeomPtr const &geometry, Edge e)
+        {
+            if (e.isBoundary())
+            {
+                return -1;
+            }
+            float angle1 = geometry->cornerAngle(e.halfedge().next().next().corner());
+            float angle2 = geometry->cornerAngle(e.halfedge().twin().next().next().corner());
+            return (angle1 + angle2 <= PI) ? -1 : angle1 + angle2 - PI;
+        }
+
+        // Orders flip candidates by excess, ties broken by index.
+        inline bool flipsBefore(EdgeData<double> const &excess, Edge e1, Edge e2)
+        {
+            return (excess[e1] > excess[e2]) || (excess[e1] == excess[e2] && e1.getIndex() > e2.getIndex());
+        }
+
+        size_t fixDelaunayParallel(MeshPtr const &mesh, GeomPtr const &geometry)
+        {
+            ptic("fixDelaunayParallel");
+
+            // -1 for Delaunay edges; always up to date for edges outside of active
+            EdgeData<double> excess(*mesh, -1);
+            // true if edge is currently in active
+            EdgeData<char> inActive(*mesh, false);
+            // edges to re-test: unflipped candidates, and the diamonds of flipped edges
+            std::vector<Edge> active;
+            std::vector<Edge> candidates;
+            std::vector<char> selected;
+
+            for (Edge e : mesh->edges())
+            {
+                active.push_back(e);
+                inActive[e] = true;
+            }
+
+            // counter and limit for number of flips
+            size_t flipMax = 100 * mesh->nVertices();
+            size_t flipCnt = 0;
+
+            while (!active.empty() && flipCnt < flipMax)
+            {
+                mint activeCount = active.size();
+
+                #pragma omp parallel for
+                for (mint i = 0; i < activeCount; ++i)
+                {
+                    excess[active[i]] = delaunayExcess(geometry, active[i]);
+                }
+
+                candidates.clear();
+                for (Edge e : active)
+                {
+                    inActive[e] = false;
+                    if (excess[e] > 0)
+                    {
+                        candidates.push_back(e);
+                    }
+                }
+                active.clear();
+
+                // A candidate is flipped in this round if it comes first among the candidates
+                // of its diamond, so that no two flipped edges share a face.
+                mint candidateCount = candidates.size();
+                selected.assign(candidateCount, false);
+
+                #pragma omp parallel for
+                for (mint i = 0; i < candidateCount; ++i)
+                {
+                    Edge e = candidates[i];
+                    Halfedge he = e.halfedge();
+                    Edge neighbors[4] = {he.next().edge(), he.next().next().edge(),
+                                         he.twin().next().edge(), he.twin().next().next().edge()};
+                    bool first = true;
+                    for (Edge n : neighbors)
+                    {
+                        if (flipsBefore(excess, n, e))
+                        {
+                            first = false;
+                        }
+                    }
+                    selected[i] = first;
+                }
+
+                // Connectivity updates stay serial; the flips of one round are independent.
+                for (mint i = 0; i < candidateCount && flipCnt < flipMax; ++i)
+                {
+                    Edge e = candidates[i];
+                    if (!selected[i])
+                    {
+                        // Still a candidate; its excess is re-tested with the next round.
+                        active.push_back(e);
+                        inActive[e] = true;
+                        continue;
+                    }
+
+                    flipCnt++;
+                    Halfedge he = e.halfedge();
+                    Edge diamond[4] = {he.next().edge(), he.next().next().edge(),
+                                       he.twin().next().edge(), he.twin().next().next().edge()};
+                    for (Edge d : diamond)
+                    {
+                        if (!inActive[d])
+                        {
+                            active.push_back(d);
+                            inActive[d] = true;
+                        }
+                    }
+                    mesh->flip(e);
+                    excess[e] = -1;
+                }
+            }
+
+            ptoc("fixDelaunayParallel");
+
+            return flipCnt;
+        }
+
         void smoothByLaplacian(MeshPtr const &mesh, GeomPtr const &geometry)
         {
             // smoothed vertex positions
@@ -631,72 +754,208 @@ namespace rsurfaces
             // return flatLength;
         }
         
-        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive)
+        // Picks a batch of collapses that do not affect each other: a candidate is taken if it
+        // has the smallest rank among all candidates with an endpoint within two edges of its
+        // own endpoints. (The foldover test of a collapse looks one ring further out than the
+        // faces it removes.) rank has to hold INT_MAX for all vertices, and is left that way.
+        static void selectIndependentCollapses(std::vector<Edge> const &candidates, VertexData<mint> &rank, VertexData<mint> &ringRank, std::vector<char> &selected)
+        {
+            mint n = candidates.size();
+            std::vector<Vertex> endpoints(2 * n);
+            std::vector<Vertex> touched;
+
+            for (mint i = 0; i < n; ++i)
+            {
+                endpoints[2 * i + 0] = candidates[i].halfedge().vertex();
+                endpoints[2 * i + 1] = candidates[i].halfedge().twin().vertex();
+                rank[endpoints[2 * i + 0]] = std::min(rank[endpoints[2 * i + 0]], i);
+                rank[endpoints[2 * i + 1]] = std::min(rank[endpoints[2 * i + 1]], i);
+            }
+
+            // smallest rank of the candidates touching each vertex or its neighbors
+            for (Vertex a : endpoints)
+            {
+                touched.push_back(a);
+                ringRank[a] = std::min(ringRank[a], rank[a]);
+                for (Vertex w : a.adjacentVertices())
+                {
+                    touched.push_back(w);
+                    ringRank[w] = std::min(ringRank[w], rank[a]);
+                }
+            }
+
+            std::vector<mint> nearRank(2 * n);
+
+            #pragma omp parallel for
+            for (mint k = 0; k < 2 * n; ++k)
+            {
+                Vertex a = endpoints[k];
+                mint best = ringRank[a];
+                for (Vertex w : a.adjacentVertices())
+                {
+                    best = std::min(best, ringRank[w]);
+                }
+                nearRank[k] = best;
+            }
+
+            selected.assign(n, false);
+
+            #pragma omp parallel for
+            for (mint i = 0; i < n; ++i)
+            {
+                selected[i] = (nearRank[2 * i + 0] == i) && (nearRank[2 * i + 1] == i);
+            }
+
+            for (Vertex v : touched)
+            {
+                rank[v] = std::numeric_limits<mint>::max();
+                ringRank[v] = std::numeric_limits<mint>::max();
+            }
+        }
+
+        bool adjustEdgeLengths(MeshPtr const &mesh, GeomPtr const &geometry, GeomPtr const &geometryOriginal, double flatLength, double epsilon, double minLength, bool curvatureAdaptive, VertexTransfer *transfer)
         {
+            ptic("adjustEdgeLengths");
+
             bool didSplitOrCollapse = false;
-            // queues of edges to CHECK to change
-            std::vector<Edge> toSplit;
+            std::vector<Edge> edges;
             std::vector<Edge> toCollapse;
-            
+
             for(Edge e : mesh->edges())
             {
-                toSplit.push_back(e);
+                edges.push_back(e);
             }
-            
-            // actually do it
-            std::cerr<<"Spliting..."<<std::endl;
-            while(!toSplit.empty())
+
+            // Splitting an edge at its midpoint leaves all other edge lengths as they are,
+            // so every edge can be classified up front.
+            mint edgeCount = edges.size();
+            std::vector<char> split(edgeCount);
+
+            #pragma omp parallel for
+            for (mint i = 0; i < edgeCount; ++i)
             {
-                Edge e = toSplit.back();
-                toSplit.pop_back();
+                Edge e = edges[i];
                 double length_e = geometry->edgeLength(e);
                 double threshold = (curvatureAdaptive) ? findMeanTargetL(mesh, geometry, e, flatLength, epsilon) : flatLength;
-                if(length_e > minLength && length_e > threshold * 1.5)
+                split[i] = (length_e > minLength && length_e > threshold * 1.5);
+            }
+
+            std::cerr<<"Spliting..."<<std::endl;
+            for (mint i = edgeCount - 1; i >= 0; --i)
+            {
+                Edge e = edges[i];
+                if (split[i])
                 {
                     Vector3 newPos = edgeMidpoint(mesh, geometry, e);
                     Vector3 newPosOrig = edgeMidpoint(mesh, geometryOriginal, e);
+                    Vertex a = e.halfedge().vertex();
+                    Vertex b = e.halfedge().twin().vertex();
                     Halfedge he = mesh->splitEdgeTriangular(e);
                     didSplitOrCollapse = true;
                     Vertex newV = he.vertex();
+                    if (transfer)
+                    {
+                        transfer->RecordSplit(newV, a, b);
+                    }
                     geometry->inputVertexPositions[newV] = newPos;
                     geometryOriginal->inputVertexPositions[newV] = newPosOrig;
                 }
                 else
                 {
                     toCollapse.push_back(e);
-                }                
-                
+                }
             }
+
+            // Collapses change the lengths around them, so they happen in rounds: all remaining
+            // candidates are tested in parallel, and then a batch of them with disjoint one-rings
+            // is collapsed, shortest edges first. The shortest candidate is always in the batch.
             std::cerr<<"Collapsing..."<<std::endl;
-            while(!toCollapse.empty())
+            VertexData<mint> rank(*mesh, std::numeric_limits<mint>::max());
+            VertexData<mint> ringRank(*mesh, std::numeric_limits<mint>::max());
+            std::vector<Edge> candidates;
+            std::vector<double> lengths;
+            std::vector<char> collapse;
+            std::vector<char> selected;
+            std::vector<mint> order;
+
+            while (!toCollapse.empty())
             {
-                Edge e = toCollapse.back();
-                toCollapse.pop_back();
-                if(e.halfedge().next().getIndex() != INVALID_IND) // make sure it exists
+                mint count = toCollapse.size();
+                lengths.assign(count, 0);
+                collapse.assign(count, false);
+
+                #pragma omp parallel for
+                for (mint i = 0; i < count; ++i)
+                {
+                    Edge e = toCollapse[i];
+                    if(e.halfedge().next().getIndex() != INVALID_IND) // make sure it exists
+                    {
+                        double threshold = (curvatureAdaptive) ? findMeanTargetL(mesh, geometry, e, flatLength, epsilon) : flatLength;
+                        lengths[i] = geometry->edgeLength(e);
+                        collapse[i] = (lengths[i] < threshold * 0.5) && shouldCollapse(mesh, geometry, e);
+                    }
+                }
+
+                order.clear();
+                for (mint i = 0; i < count; ++i)
+                {
+                    if (collapse[i])
+                    {
+                        order.push_back(i);
+                    }
+                }
+                std::sort(order.begin(), order.end(), [&](mint a, mint b) { return lengths[a] < lengths[b] || (lengths[a] == lengths[b] && a < b); });
+
+                candidates.clear();
+                for (mint i : order)
+                {
+                    candidates.push_back(toCollapse[i]);
+                }
+
+                selectIndependentCollapses(candidates, rank, ringRank, selected);
+
+                // Connectivity updates stay serial; the collapses of one batch do not interact.
+                toCollapse.clear();
+                for (size_t i = 0; i < candidates.size(); ++i)
                 {
-                    double threshold = (curvatureAdaptive) ? findMeanTargetL(mesh, geometry, e, flatLength, epsilon) : flatLength;
-                    if(geometry->edgeLength(e) < threshold * 0.5)
+                    Edge e = candidates[i];
+                    if (!selected[i])
                     {
-                        Vector3 newPos = edgeMidpoint(mesh, geometry, e);
-                        Vector3 newPosOrig = edgeMidpoint(mesh, geometryOriginal, e);
-                        if(shouldCollapse(mesh, geometry, e)) {
-                            Vertex v = mesh->collapseEdgeTriangular(e);
-                            didSplitOrCollapse = true;
-                            if (v != Vertex()) {
-                                if(!v.isBoundary()) {
-                                    geometry->inputVertexPositions[v] = newPos;
-                                    geometryOriginal->inputVertexPositions[v] = newPosOrig;
-                                }
-                            }
+                        toCollapse.push_back(e);
+                        continue;
+                    }
+
+                    Vector3 newPos = edgeMidpoint(mesh, geometry, e);
+                    Vector3 newPosOrig = edgeMidpoint(mesh, geometryOriginal, e);
+                    if (transfer)
+                    {
+                        transfer->StageCollapse(e.halfedge().vertex(), e.halfedge().twin().vertex());
+                    }
+                    Vertex v = mesh->collapseEdgeTriangular(e);
+                    didSplitOrCollapse = true;
+                    if (v != Vertex()) {
+                        if (transfer)
+                        {
+                            transfer->CommitCollapse(v, !v.isBoundary());
+                        }
+                        if(!v.isBoundary()) {
+                            geometry->inputVertexPositions[v] = newPos;
+                            geometryOriginal->inputVertexPositions[v] = newPosOrig;
                         }
                     }
                 }
             }
-            
+
+#ifndef NDEBUG
             mesh->validateConnectivity();
-            //std::cerr<<"hereeee"<<std::endl;
-            mesh->compress();
+#endif
+            if (didSplitOrCollapse)
+            {
+                mesh->compress();
+            }
             geometry->refreshQuantities();
+
+            ptoc("adjustEdgeLengths");
             return didSplitOrCollapse;
         }
 
@@ -0,0 +1,186 @@
+#include "remeshing/vertex_transfer.h"
+
+#include <algorithm>
+
+namespace rsurfaces
+{
+    namespace remeshing
+    {
+        void VertexTransfer::Begin(MeshPtr const &mesh)
+        {
+            oldCount = mesh->nVertices();
+            // Vertices created later take the default values
+            origin = surface::VertexData<mint>(*mesh, -1);
+            stencilIndex = surface::VertexData<mint>(*mesh, -1);
+            stencils.clear();
+
+            VertexIndices vInds = mesh->getVertexIndices();
+            for (GCVertex v : mesh->vertices())
+            {
+                origin[v] = vInds[v];
+            }
+        }
+
+        VertexTransfer::Stencil VertexTransfer::GetStencil(GCVertex v) const
+        {
+            if (stencilIndex[v] >= 0)
+            {
+                return stencils[stencilIndex[v]];
+            }
+            return Stencil{{origin[v], 1.}};
+        }
+
+        void VertexTransfer::SetStencil(GCVertex v, Stencil s)
+        {
+            if (stencilIndex[v] < 0)
+            {
+                stencilIndex[v] = stencils.size();
+                stencils.push_back(std::move(s));
+            }
+            else
+            {
+                stencils[stencilIndex[v]] = std::move(s);
+            }
+        }
+
+        VertexTransfer::Stencil VertexTransfer::Average(const Stencil &s1, const Stencil &s2)
+        {
+            Stencil s;
+            s.reserve(s1.size() + s2.size());
+            for (auto &e : s1)
+            {
+                s.push_back({e.first, 0.5 * e.second});
+            }
+            for (auto &e : s2)
+            {
+                s.push_back({e.first, 0.5 * e.second});
+            }
+            // merge entries of the same old vertex
+            std::sort(s.begin(), s.end());
+            size_t k = 0;
+            for (size_t i = 0; i < s.size(); ++i)
+            {
+                if (k > 0 && s[k - 1].first == s[i].first)
+                {
+                    s[k - 1].second += s[i].second;
+                }
+                else
+                {
+                    s[k++] = s[i];
+                }
+            }
+            s.resize(k);
+            return s;
+        }
+
+        void VertexTransfer::RecordSplit(GCVertex newVertex, GCVertex a, GCVertex b)
+        {
+            SetStencil(newVertex, Average(GetStencil(a), GetStencil(b)));
+        }
+
+        void VertexTransfer::StageCollapse(GCVertex a, GCVertex b)
+        {
+            staged_va = a;
+            staged_vb = b;
+            staged_a = GetStencil(a);
+            staged_b = GetStencil(b);
+        }
+
+        void VertexTransfer::CommitCollapse(GCVertex survivor, bool averaged)
+        {
+            if (averaged)
+            {
+                SetStencil(survivor, Average(staged_a, staged_b));
+            }
+            else
+            {
+                SetStencil(survivor, (survivor == staged_va) ? staged_a : staged_b);
+            }
+        }
+
+        void VertexTransfer::End(MeshPtr const &mesh)
+        {
+            ptic("VertexTransfer::End");
+
+            VertexIndices vInds = mesh->getVertexIndices();
+            mint n = mesh->nVertices();
+
+            outer.assign(n + 1, 0);
+            std::vector<GCVertex> verts(n);
+            for (GCVertex v : mesh->vertices())
+            {
+                mint i = vInds[v];
+                verts[i] = v;
+                outer[i + 1] = (stencilIndex[v] >= 0) ? stencils[stencilIndex[v]].size() : 1;
+            }
+            for (mint i = 0; i < n; ++i)
+            {
+                outer[i + 1] += outer[i];
+            }
+
+            inner.resize(outer[n]);
+            weights.resize(outer[n]);
+            for (mint i = 0; i < n; ++i)
+            {
+                Stencil s = GetStencil(verts[i]);
+                for (size_t k = 0; k < s.size(); ++k)
+                {
+                    inner[outer[i] + k] = s[k].first;
+                    weights[outer[i] + k] = s[k].second;
+                }
+            }
+
+            // Stop tracking the mesh
+            origin = surface::VertexData<mint>();
+            stencilIndex = surface::VertexData<mint>();
+            stencils.clear();
+
+            ptoc("VertexTransfer::End");
+        }
+
+        void VertexTransfer::Apply(const mreal *oldData, mreal *newData, mint blockSize) const
+        {
+            mint n = NewCount();
+
+            #pragma omp parallel for
+            for (mint i = 0; i < n; ++i)
+            {
+                for (mint c = 0; c < blockSize; ++c)
+                {
+                    mreal sum = 0.;
+                    for (mint k = outer[i]; k < outer[i + 1]; ++k)
+                    {
+                        sum += weights[k] * oldData[blockSize * inner[k] + c];
+                    }
+                    newData[blockSize * i + c] = sum;
+                }
+            }
+        }
+
+        void VertexTransfer::Apply(Eigen::MatrixXd &data) const
+        {
+            if (data.rows() != oldCount)
+            {
+                throw std::runtime_error("VertexTransfer: matrix has " + std::to_string(data.rows()) +
+                                         " rows, but the mesh had " + std::to_string(oldCount) + " vertices.");
+            }
+            EigenMatrixRM oldData = data;
+            EigenMatrixRM newData(NewCount(), data.cols());
+            Apply(oldData.data(), newData.data(), data.cols());
+            data = newData;
+        }
+
+        void VertexTransfer::Apply(Eigen::VectorXd &data, mint blockSize) const
+        {
+            if (data.rows() != blockSize * oldCount)
+            {
+                throw std::runtime_error("VertexTransfer: vector has " + std::to_string(data.rows()) +
+                                         " entries, but the mesh had " + std::to_string(oldCount) + " vertices.");
+            }
+            Eigen::VectorXd newData(blockSize * NewCount());
+            Apply(data.data(), newData.data(), blockSize);
+            data = newData;
+        }
+
+    } // namespace remeshing
+} // namespace rsurfaces
@@ -1,4 +1,5 @@
 #include "scene_file.h"
+#include "binary_mesh.h"
 
 #include <fstream>
 
@@ -149,7 +150,36 @@ namespace rsurfaces
             if (parts[0] == "repel_mesh")
             {
                 data.meshName = dir_root + parts[1];
-                cout << "  * Using mesh at " << data.meshName << endl;
+                cout << "  * Using mesh at " << data.meshName << (isBinaryMeshFile(data.meshName) ? " (binary)" : "") << endl;
+                if (parts.size() == 4)
+                {
+                    data.alpha = stod(parts[2]);
+                    data.beta = stod(parts[3]);
+                    cout << "  * Using exponents (" << data.alpha << ", " << data.beta << ")" << endl;
+                }
+            }
+            else if (parts[0] == "repel_implicit")
+            {
+                if (parts.size() != 2 && parts.size() != 4)
+                {
+                    throw std::runtime_error("repel_implicit expects <edge length> [<alpha> <beta>].");
+                }
+                if (data.implicitBarriers.empty())
+                {
+                    throw std::runtime_error("repel_implicit needs a preceding implicit surface.");
+                }
+
+                // The last implicit surface becomes the starting shape instead of a barrier
+                data.meshFromImplicit = true;
+                data.meshImplicit = data.implicitBarriers.back();
+                data.implicitBarriers.pop_back();
+                data.meshEdgeLength = stod(parts[1]);
+                if (!(data.meshEdgeLength > 0))
+                {
+                    throw std::runtime_error("repel_implicit needs a positive edge length.");
+                }
+                data.meshName = dir_root + "implicit_mesh";
+                cout << "  * Generating the mesh from an implicit surface with edge length " << data.meshEdgeLength << endl;
                 if (parts.size() == 4)
                 {
                     data.alpha = stod(parts[2]);
@@ -319,6 +349,30 @@ namespace rsurfaces
                     obsData.weight = 1;
                 }
                 obsData.asPointCloud = (parts[0] == "point_cloud_obstacle");
+                if (isBinaryMeshFile(obsData.obstacleName))
+                {
+                    cout << "  * Obstacle " << obsData.obstacleName << " will be memory-mapped" << endl;
+                }
+
+                data.obstacles.push_back(obsData);
+            }
+
+            else if (parts[0] == "streamed_point_cloud_obstacle")
+            {
+                if (parts.size() != 4)
+                {
+                    throw std::runtime_error("streamed_point_cloud_obstacle expects <points .rsm> <weight> <cell size>.");
+                }
+                ObstacleData obsData;
+                obsData.obstacleName = dir_root + parts[1];
+                obsData.weight = stod(parts[2]);
+                obsData.cellSize = stod(parts[3]);
+                obsData.asPointCloud = true;
+                if (!isBinaryMeshFile(obsData.obstacleName))
+                {
+                    throw std::runtime_error("Streamed point cloud obstacles must be binary (.rsm) files; use --convert first.");
+                }
+                cout << "  * Obstacle " << obsData.obstacleName << " will be streamed into cells of size " << obsData.cellSize << endl;
 
                 data.obstacles.push_back(obsData);
             }
@@ -343,6 +397,10 @@ namespace rsurfaces
                 {
                     implData.type = ImplicitType::Plane;
                 }
+                else if (parts[1] == "mesh")
+                {
+                    implData.type = ImplicitType::Mesh;
+                }
                 else
                 {
                     throw std::runtime_error("Unrecognized implicit type " + parts[1]);
@@ -364,13 +422,60 @@ namespace rsurfaces
                 implData.power = stod(parts[3]);
                 implData.weight = stod(parts[4]);
 
-                for (size_t i = 5; i < parts.size(); i++)
+                size_t firstParam = 5;
+                if (implData.type == ImplicitType::Mesh)
+                {
+                    std::string sep = "";
+                    if (dir_root[dir_root.size() - 1] != '/')
+                    {
+                        sep = "/";
+                    }
+                    implData.meshFile = dir_root + sep + parts[5];
+                    firstParam = 6;
+                }
+
+                for (size_t i = firstParam; i < parts.size(); i++)
                 {
                     implData.parameters.push_back(stod(parts[i]));
                 }
 
                 data.implicitBarriers.push_back(implData);
             }
+            else if (parts[0] == "implicit_combine")
+            {
+                if (data.implicitBarriers.size() < 2)
+                {
+                    throw std::runtime_error("implicit_combine needs two preceding implicit surfaces.");
+                }
+
+                ImplicitBarrierData combined;
+                if (parts[1] == "union")
+                {
+                    combined.type = ImplicitType::Union;
+                }
+                else if (parts[1] == "intersection")
+                {
+                    combined.type = ImplicitType::Intersection;
+                }
+                else if (parts[1] == "difference")
+                {
+                    combined.type = ImplicitType::Difference;
+                }
+                else
+                {
+                    throw std::runtime_error("Unrecognized implicit combination " + parts[1]);
+                }
+
+                // The combination replaces its operands, and acts like the first one
+                size_t n = data.implicitBarriers.size();
+                combined.operands.push_back(data.implicitBarriers[n - 2]);
+                combined.operands.push_back(data.implicitBarriers[n - 1]);
+                combined.repel = combined.operands[0].repel;
+                combined.power = combined.operands[0].power;
+                combined.weight = combined.operands[0].weight;
+                data.implicitBarriers.resize(n - 2);
+                data.implicitBarriers.push_back(combined);
+            }
 
             else if (parts[0] == "autotarget_volume")
             {
@@ -394,6 +499,44 @@ namespace rsurfaces
                 data.performanceLogFile = dir_root + sep + parts[1];
                 std::cout << "Logging to " << data.performanceLogFile << std::endl;
             }
+            else if (parts[0] == "checkpoint")
+            {
+                data.checkpointInterval = stoi(parts[1]);
+                if (parts.size() >= 3)
+                {
+                    std::string sep = "";
+                    if (dir_root[dir_root.size() - 1] != '/')
+                    {
+                        sep = "/";
+                    }
+                    data.checkpointPrefix = dir_root + sep + parts[2];
+                }
+                std::cout << "Writing checkpoint " << data.checkpointPrefix << " every " << data.checkpointInterval << " iterations" << std::endl;
+            }
+            else if (parts[0] == "trajectory")
+            {
+                std::string sep = "";
+                if (dir_root[dir_root.size() - 1] != '/')
+                {
+                    sep = "/";
+                }
+                data.trajectoryFile = dir_root + sep + parts[1];
+                if (parts.size() >= 3)
+                {
+                    data.trajectoryQuantum = stod(parts[2]);
+                }
+                std::cout << "Writing trajectory to " << data.trajectoryFile << " (quantization step " << data.trajectoryQuantum << ")" << std::endl;
+            }
+            else if (parts[0] == "obstacle_cache")
+            {
+                std::string sep = "";
+                if (dir_root[dir_root.size() - 1] != '/')
+                {
+                    sep = "/";
+                }
+                data.obstacleCacheDir = dir_root + sep + parts[1];
+                std::cout << "Caching obstacles in " << data.obstacleCacheDir << std::endl;
+            }
             else
             {
                 cout << "  * Unrecognized statement: " << parts[0] << endl;
@@ -1,5 +1,6 @@
 #include "sobolev/h1.h"
 #include "sobolev/bqn_lbfgs.h"
+#include "checkpoint.h"
 
 namespace rsurfaces
 {
@@ -9,6 +10,19 @@ namespace rsurfaces
         bqn_B = bqn_B_;
     }
 
+    void BQN_LBFGS::SaveState(std::ostream &out)
+    {
+        // B depends on the area at the start of the run, so it can't be recomputed on resume
+        checkpoint::writeValue<double>(out, bqn_B);
+        H1_LBFGS::SaveState(out);
+    }
+
+    void BQN_LBFGS::LoadState(std::istream &in)
+    {
+        bqn_B = checkpoint::readValue<double>(in);
+        H1_LBFGS::LoadState(in);
+    }
+
     void BQN_LBFGS::UpdateHistory(Eigen::VectorXd &currentPosition, Eigen::VectorXd &currentGradient)
     {
         // Update memory vectors based on current position and gradient
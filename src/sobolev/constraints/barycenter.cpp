@@ -33,6 +33,11 @@ namespace rsurfaces
             initValue = meshBarycenter(geom, mesh);
         }
 
+        void BarycenterConstraint3X::ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region)
+        {
+            initValue = region.barycenter;
+        }
+
         void BarycenterConstraint3X::addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             // Take the same weights from the non-3X version of this constraint,
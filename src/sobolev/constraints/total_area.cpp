@@ -16,6 +16,11 @@ namespace rsurfaces
             initValue = totalArea(geom, mesh);
         }
 
+        void TotalAreaConstraint::ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region)
+        {
+            initValue = region.totalArea;
+        }
+
         size_t TotalAreaConstraint::nRows()
         {
             return 1;
@@ -16,6 +16,11 @@ namespace rsurfaces
             initValue = totalVolume(geom, mesh);
         }
 
+        void TotalVolumeConstraint::ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region)
+        {
+            initValue = region.totalVolume;
+        }
+
         size_t TotalVolumeConstraint::nRows()
         {
             return 1;
@@ -25,6 +25,19 @@ namespace rsurfaces
             }
         }
 
+        void VertexNormalConstraint::ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region)
+        {
+            // A normal changes whenever one of its incident faces does, which is exactly
+            // when its vertex belongs to a face of the region
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                if (region.Touches(indices[i]))
+                {
+                    initNormals[i] = vertexAreaNormal(geom, mesh->vertex(indices[i]));
+                }
+            }
+        }
+
         void VertexNormalConstraint::addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             VertexIndices allInds = mesh->getVertexIndices();
@@ -43,6 +43,18 @@ namespace rsurfaces
             }
         }
 
+        void VertexPinConstraint::ResetRegion(const MeshPtr &mesh, const GeomPtr &geom, const DragRegion &region)
+        {
+            // Only pins that were dragged along have moved
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                if (region.Contains(indices[i]))
+                {
+                    initPositions[i] = geom->inputVertexPositions[mesh->vertex(indices[i])];
+                }
+            }
+        }
+
         void VertexPinConstraint::addTriplets(std::vector<Triplet> &triplets, const MeshPtr &mesh, const GeomPtr &geom, int baseRow)
         {
             // All we do is put a 1 in the index for all pinned vertices
@@ -0,0 +1,338 @@
+#include "sobolev/flat_bilaplacian.h"
+#include "derivative_assembler.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace rsurfaces
+{
+    void FlatBiLaplacian::Update(MeshPtr const &mesh, GeomPtr const &geom)
+    {
+        ptic("FlatBiLaplacian::Update");
+
+        auto prims = getPrimitiveIndices(mesh, geom);
+        mint n = mesh->nVertices();
+        mint m = prims.rows();
+
+        bool same_topology = (n == vertex_count) && (m == triangle_count) &&
+                             (std::memcmp(prims.data(), triangles.data(), 3 * m * sizeof(mint)) == 0);
+
+        if (!same_topology)
+        {
+            vertex_count = n;
+            triangle_count = m;
+            triangles.assign(prims.data(), prims.data() + 3 * m);
+            BuildPatterns();
+        }
+
+        geom->requireVertexPositions();
+        positions.resize(3 * n);
+        mreal *restrict const x = positions.data();
+
+        #pragma omp parallel for
+        for (mint i = 0; i < n; ++i)
+        {
+            auto p = geom->inputVertexPositions[i];
+            x[3 * i + 0] = p[0];
+            x[3 * i + 1] = p[1];
+            x[3 * i + 2] = p[2];
+        }
+
+        mint const *restrict const t = triangles.data();
+        mreal *restrict const cot = corner_cotans.data();
+        mreal *restrict const area = triangle_areas.data();
+
+        #pragma omp parallel for
+        for (mint f = 0; f < m; ++f)
+        {
+            mint i0 = t[3 * f + 0];
+            mint i1 = t[3 * f + 1];
+            mint i2 = t[3 * f + 2];
+
+            mreal e00 = x[3 * i1 + 0] - x[3 * i0 + 0];
+            mreal e01 = x[3 * i1 + 1] - x[3 * i0 + 1];
+            mreal e02 = x[3 * i1 + 2] - x[3 * i0 + 2];
+            mreal e10 = x[3 * i2 + 0] - x[3 * i1 + 0];
+            mreal e11 = x[3 * i2 + 1] - x[3 * i1 + 1];
+            mreal e12 = x[3 * i2 + 2] - x[3 * i1 + 2];
+            mreal e20 = x[3 * i0 + 0] - x[3 * i2 + 0];
+            mreal e21 = x[3 * i0 + 1] - x[3 * i2 + 1];
+            mreal e22 = x[3 * i0 + 2] - x[3 * i2 + 2];
+
+            mreal n0 = e01 * e12 - e02 * e11;
+            mreal n1 = e02 * e10 - e00 * e12;
+            mreal n2 = e00 * e11 - e01 * e10;
+            mreal double_area = sqrt(n0 * n0 + n1 * n1 + n2 * n2);
+            mreal factor = 0.5 / double_area;
+
+            area[f] = 0.5 * double_area;
+            // The cotangent of a corner is the dot product of its two outgoing
+            // edges over the norm of their cross product.
+            cot[3 * f + 0] = -factor * (e00 * e20 + e01 * e21 + e02 * e22);
+            cot[3 * f + 1] = -factor * (e10 * e00 + e11 * e01 + e12 * e02);
+            cot[3 * f + 2] = -factor * (e20 * e10 + e21 * e11 + e22 * e12);
+        }
+
+        mint const *restrict const vt_o = vt_outer.data();
+        mint const *restrict const vt_i = vt_inner.data();
+        mreal *restrict const A = dual_areas.data();
+        mreal *restrict const A_inv = inv_dual_areas.data();
+
+        #pragma omp parallel for
+        for (mint i = 0; i < n; ++i)
+        {
+            mreal sum = 0.;
+            for (mint k = vt_o[i]; k < vt_o[i + 1]; ++k)
+            {
+                sum += area[vt_i[k]];
+            }
+            A[i] = sum / 3.;
+            A_inv[i] = 1. / A[i];
+        }
+
+        mint const *restrict const L_o = L_outer.data();
+        mint const *restrict const L_d = L_diag.data();
+        mint const *restrict const c_o = corner_outer.data();
+        mint const *restrict const c_i = corner_inner.data();
+        mreal *restrict const L = L_values.data();
+
+        #pragma omp parallel for
+        for (mint i = 0; i < n; ++i)
+        {
+            mreal row_sum = 0.;
+            for (mint k = L_o[i]; k < L_o[i + 1]; ++k)
+            {
+                mreal w = 0.;
+                for (mint c = c_o[k]; c < c_o[k + 1]; ++c)
+                {
+                    w += cot[c_i[c]];
+                }
+                L[k] = -w;
+                row_sum += w;
+            }
+            L[L_d[i]] = row_sum;
+        }
+
+        ptoc("FlatBiLaplacian::Update");
+    } // Update
+
+    void FlatBiLaplacian::BuildPatterns()
+    {
+        ptic("FlatBiLaplacian::BuildPatterns");
+
+        mint n = vertex_count;
+        mint m = triangle_count;
+        mint const *const t = triangles.data();
+
+        corner_cotans.assign(3 * m, 0.);
+        triangle_areas.assign(m, 0.);
+        dual_areas.assign(n, 0.);
+        inv_dual_areas.assign(n, 0.);
+        boundary.assign(n, 0);
+
+        // Vertex-triangle incidences
+        vt_outer.assign(n + 1, 0);
+        for (mint k = 0; k < 3 * m; ++k)
+        {
+            ++vt_outer[t[k] + 1];
+        }
+        for (mint i = 0; i < n; ++i)
+        {
+            vt_outer[i + 1] += vt_outer[i];
+        }
+        vt_inner.resize(3 * m);
+        {
+            std::vector<mint> fill(vt_outer.begin(), vt_outer.end() - 1);
+            for (mint k = 0; k < 3 * m; ++k)
+            {
+                vt_inner[fill[t[k]]++] = k / 3;
+            }
+        }
+
+        // Laplacian pattern: each vertex, its neighbors and itself, sorted
+        L_outer.assign(n + 1, 0);
+        L_inner.clear();
+        L_diag.assign(n, 0);
+        for (mint i = 0; i < n; ++i)
+        {
+            L_inner.push_back(i);
+            for (mint k = vt_outer[i]; k < vt_outer[i + 1]; ++k)
+            {
+                mint f = vt_inner[k];
+                L_inner.push_back(t[3 * f + 0]);
+                L_inner.push_back(t[3 * f + 1]);
+                L_inner.push_back(t[3 * f + 2]);
+            }
+            auto begin = L_inner.begin() + L_outer[i];
+            std::sort(begin, L_inner.end());
+            L_inner.erase(std::unique(begin, L_inner.end()), L_inner.end());
+            L_outer[i + 1] = L_inner.size();
+            L_diag[i] = std::lower_bound(begin, L_inner.end(), i) - L_inner.begin();
+        }
+        mint L_nnz = L_outer[n];
+        L_values.assign(L_nnz, 0.);
+
+        auto slot = [&](mint i, mint j) {
+            return std::lower_bound(L_inner.begin() + L_outer[i], L_inner.begin() + L_outer[i + 1], j) - L_inner.begin();
+        };
+
+        // Corners opposite of each edge slot; both slots (i,j) and (j,i) get the corner.
+        corner_outer.assign(L_nnz + 1, 0);
+        for (mint f = 0; f < m; ++f)
+        {
+            for (mint c = 0; c < 3; ++c)
+            {
+                mint a = t[3 * f + (c + 1) % 3];
+                mint b = t[3 * f + (c + 2) % 3];
+                ++corner_outer[slot(a, b) + 1];
+                ++corner_outer[slot(b, a) + 1];
+            }
+        }
+        for (mint k = 0; k < L_nnz; ++k)
+        {
+            corner_outer[k + 1] += corner_outer[k];
+        }
+        corner_inner.resize(corner_outer[L_nnz]);
+        {
+            std::vector<mint> fill(corner_outer.begin(), corner_outer.end() - 1);
+            for (mint f = 0; f < m; ++f)
+            {
+                for (mint c = 0; c < 3; ++c)
+                {
+                    mint a = t[3 * f + (c + 1) % 3];
+                    mint b = t[3 * f + (c + 2) % 3];
+                    corner_inner[fill[slot(a, b)]++] = 3 * f + c;
+                    corner_inner[fill[slot(b, a)]++] = 3 * f + c;
+                }
+            }
+        }
+
+        // An edge with a single incident triangle is a boundary edge.
+        for (mint i = 0; i < n; ++i)
+        {
+            for (mint k = L_outer[i]; k < L_outer[i + 1]; ++k)
+            {
+                if (k != L_diag[i] && corner_outer[k + 1] - corner_outer[k] == 1)
+                {
+                    boundary[i] = 1;
+                }
+            }
+        }
+
+        // Bi-Laplacian pattern: the union of the Laplacian rows of all neighbors
+        B_outer.assign(n + 1, 0);
+        B_inner.clear();
+        B_diag.assign(n, 0);
+        B_term_ptr.assign(n + 1, 0);
+        B_targets.clear();
+
+        std::vector<mint> position(n, -1);
+        for (mint i = 0; i < n; ++i)
+        {
+            mint row_begin = B_inner.size();
+            for (mint a = L_outer[i]; a < L_outer[i + 1]; ++a)
+            {
+                mint k = L_inner[a];
+                B_inner.insert(B_inner.end(), L_inner.begin() + L_outer[k], L_inner.begin() + L_outer[k + 1]);
+            }
+            std::sort(B_inner.begin() + row_begin, B_inner.end());
+            B_inner.erase(std::unique(B_inner.begin() + row_begin, B_inner.end()), B_inner.end());
+            B_outer[i + 1] = B_inner.size();
+
+            for (mint s = B_outer[i]; s < B_outer[i + 1]; ++s)
+            {
+                position[B_inner[s]] = s;
+            }
+            B_diag[i] = position[i];
+
+            for (mint a = L_outer[i]; a < L_outer[i + 1]; ++a)
+            {
+                mint k = L_inner[a];
+                for (mint b = L_outer[k]; b < L_outer[k + 1]; ++b)
+                {
+                    B_targets.push_back(position[L_inner[b]]);
+                }
+            }
+            B_term_ptr[i + 1] = B_targets.size();
+        }
+        B_values.assign(B_outer[n], 0.);
+
+        std::cout << "    * Built flat bi-Laplacian pattern (" << L_nnz << " Laplacian and " << B_outer[n] << " bi-Laplacian nonzeros)" << std::endl;
+
+        ptoc("FlatBiLaplacian::BuildPatterns");
+    } // BuildPatterns
+
+    void FlatBiLaplacian::AssembleBiLaplacian(mreal epsilon)
+    {
+        ptic("FlatBiLaplacian::AssembleBiLaplacian");
+
+        mint n = vertex_count;
+        mint const *restrict const L_o = L_outer.data();
+        mint const *restrict const L_i = L_inner.data();
+        mreal const *restrict const L = L_values.data();
+        mreal const *restrict const A_inv = inv_dual_areas.data();
+        mint const *restrict const B_o = B_outer.data();
+        mint const *restrict const B_d = B_diag.data();
+        mint const *restrict const ptr = B_term_ptr.data();
+        mint const *restrict const target = B_targets.data();
+        mreal *restrict const B = B_values.data();
+
+        #pragma omp parallel for
+        for (mint i = 0; i < n; ++i)
+        {
+            for (mint s = B_o[i]; s < B_o[i + 1]; ++s)
+            {
+                B[s] = 0.;
+            }
+            mint pos = ptr[i];
+            for (mint a = L_o[i]; a < L_o[i + 1]; ++a)
+            {
+                mint k = L_i[a];
+                mreal factor = L[a] * A_inv[k];
+                for (mint b = L_o[k]; b < L_o[k + 1]; ++b)
+                {
+                    B[target[pos++]] += factor * L[b];
+                }
+            }
+            B[B_d[i]] += epsilon;
+        }
+
+        ptoc("FlatBiLaplacian::AssembleBiLaplacian");
+    } // AssembleBiLaplacian
+
+    // Threaded row-wise SpMV of a scalar CSR matrix applied to the three coordinate columns.
+    static void MultiplyAddCSR3(mint n, mint const *restrict const outer, mint const *restrict const inner,
+                                mreal const *restrict const values, const mreal *restrict const x, mreal *restrict const y)
+    {
+        #pragma omp parallel for
+        for (mint i = 0; i < n; ++i)
+        {
+            mreal y0 = 0.;
+            mreal y1 = 0.;
+            mreal y2 = 0.;
+            #pragma omp simd reduction(+ : y0, y1, y2)
+            for (mint k = outer[i]; k < outer[i + 1]; ++k)
+            {
+                mint j = inner[k];
+                mreal v = values[k];
+                y0 += v * x[3 * j + 0];
+                y1 += v * x[3 * j + 1];
+                y2 += v * x[3 * j + 2];
+            }
+            y[3 * i + 0] += y0;
+            y[3 * i + 1] += y1;
+            y[3 * i + 2] += y2;
+        }
+    }
+
+    void FlatBiLaplacian::MultiplyAddLaplacian(const mreal *x, mreal *y) const
+    {
+        MultiplyAddCSR3(vertex_count, L_outer.data(), L_inner.data(), L_values.data(), x, y);
+    }
+
+    void FlatBiLaplacian::MultiplyAddBiLaplacian(const mreal *x, mreal *y) const
+    {
+        MultiplyAddCSR3(vertex_count, B_outer.data(), B_inner.data(), B_values.data(), x, y);
+    }
+
+} // namespace rsurfaces
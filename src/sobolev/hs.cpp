@@ -131,7 +131,7 @@ namespace rsurfaces
             return (beta - 2.0) / alpha;
         }
 
-        HsMetric::HsMetric(std::vector<SurfaceEnergy*> energies, SurfaceEnergy* obstacleEnergy_,
+        HsMetric::HsMetric(std::vector<SurfaceEnergy*> energies, std::vector<SurfaceEnergy*> obstacleEnergies_,
                            std::vector<SimpleProjectorConstraint *> &spcs,
                            std::vector<ConstraintPack> &schurs)
             : simpleConstraints(spcs), newtonConstraints(schurs)
@@ -144,7 +144,7 @@ namespace rsurfaces
                 extraEnergies.push_back(energies[i]);
             }
 
-            obstacleEnergy = obstacleEnergy_;
+            obstacleEnergies = obstacleEnergies_;
             usedDefaultConstraint = false;
             schurComplementComputed = false;
             precomputeSizes();
@@ -158,8 +158,8 @@ namespace rsurfaces
             bvh = energy_->GetBVH();
             bh_theta = energy_->GetTheta();
             optBCT = 0;
-            obstacleBCT = 0;
-            obstacleEnergy = 0;
+            obstacleBCTs.clear();
+            obstacleEnergies.clear();
         }
 
         void HsMetric::precomputeSizes()
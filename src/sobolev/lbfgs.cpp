@@ -1,4 +1,5 @@
 #include "sobolev/lbfgs.h"
+#include "checkpoint.h"
 
 namespace rsurfaces
 {
@@ -6,6 +7,7 @@ namespace rsurfaces
     {
         memSize = memSize_;
         firstStep = true;
+        historyTransferred = false;
     }
 
     Eigen::VectorXd &LBFGSOptimizer::direction()
@@ -18,6 +20,58 @@ namespace rsurfaces
         s_list.clear();
         y_list.clear();
         firstStep = true;
+        historyTransferred = false;
+    }
+
+    bool LBFGSOptimizer::TransferHistory(const remeshing::VertexTransfer &transfer)
+    {
+        if (firstStep)
+        {
+            return true;
+        }
+
+        mint expected = 3 * transfer.OldCount();
+        for (auto it_s = s_list.begin(), it_y = y_list.begin(); it_s != s_list.end(); ++it_s, ++it_y)
+        {
+            if (it_s->rows() != expected || it_y->rows() != expected)
+            {
+                ResetMemory();
+                return false;
+            }
+        }
+
+        for (auto it_s = s_list.begin(), it_y = y_list.begin(); it_s != s_list.end(); ++it_s, ++it_y)
+        {
+            transfer.Apply(*it_s, 3);
+            transfer.Apply(*it_y, 3);
+        }
+        // The remesher has also moved the vertices, so the last position and gradient are
+        // replaced at the next update instead of forming a new pair.
+        historyTransferred = true;
+        return true;
+    }
+
+    void LBFGSOptimizer::SaveState(std::ostream &out)
+    {
+        checkpoint::writeValue<uint64_t>(out, memSize);
+        checkpoint::writeValue<uint8_t>(out, firstStep);
+        checkpoint::writeVectorList(out, s_list);
+        checkpoint::writeVectorList(out, y_list);
+        checkpoint::writeVector(out, lastPosition);
+        checkpoint::writeVector(out, lastGradient);
+        checkpoint::writeVector(out, z);
+    }
+
+    void LBFGSOptimizer::LoadState(std::istream &in)
+    {
+        memSize = checkpoint::readValue<uint64_t>(in);
+        firstStep = checkpoint::readValue<uint8_t>(in);
+        historyTransferred = false;
+        checkpoint::readVectorList(in, s_list);
+        checkpoint::readVectorList(in, y_list);
+        checkpoint::readVector(in, lastPosition);
+        checkpoint::readVector(in, lastGradient);
+        checkpoint::readVector(in, z);
     }
 
     void LBFGSOptimizer::UpdateHistory(Eigen::VectorXd &currentPosition, Eigen::VectorXd &currentGradient)
@@ -40,11 +94,18 @@ namespace rsurfaces
 
     void LBFGSOptimizer::UpdateDirection(Eigen::VectorXd &currentPosition, Eigen::VectorXd &currentGradient)
     {
-        if (!firstStep)
+        if (!firstStep && historyTransferred)
+        {
+            historyTransferred = false;
+            lastGradient = currentGradient;
+            lastPosition = currentPosition;
+        }
+        else if (!firstStep)
         {
             UpdateHistory(currentPosition, currentGradient);
         }
-        else
+
+        if (firstStep || !hasHistory())
         {
             firstStep = false;
             lastGradient = currentGradient;
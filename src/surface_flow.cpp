@@ -12,6 +12,8 @@
 #include "sobolev/hs_iterative.h"
 #include "sobolev/constraints.h"
 #include "spatial/convolution.h"
+#include "checkpoint.h"
+#include "vertex_positions.h"
 
 #include <Eigen/SparseCholesky>
 
@@ -30,11 +32,11 @@ namespace rsurfaces
         std::cout << "Original barycenter = " << origBarycenter << std::endl;
         RecenterMesh();
         secretBarycenter = 0;
-        obstacleEnergy = 0;
 
         verticesMutated = false;
         lbfgs = 0;
         bqn_B = 0;
+        prevStep = 0;
     }
 
     void SurfaceFlow::AddAdditionalEnergy(SurfaceEnergy *extraEnergy)
@@ -44,8 +46,8 @@ namespace rsurfaces
 
     void SurfaceFlow::AddObstacleEnergy(SurfaceEnergy *obsEnergy)
     {
-        obstacleEnergy = obsEnergy;
-        AddAdditionalEnergy(obstacleEnergy);
+        obstacleEnergies.push_back(obsEnergy);
+        AddAdditionalEnergy(obsEnergy);
     }
 
 
@@ -75,7 +77,7 @@ namespace rsurfaces
         AssembleGradients(l2diff);
 
         double initGuess = guessStepSize(l2diff.norm());
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         search.BacktrackingLineSearch(l2diff, initGuess, 1);
     }
 
@@ -115,7 +117,7 @@ namespace rsurfaces
         MatrixUtils::ColumnIntoMatrix(l2col, l2diff);
 
         double initGuess = guessStepSize(l2diff.norm());
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         search.BacktrackingLineSearch(l2diff, initGuess, 1);
         
         // Constraint projection
@@ -155,12 +157,12 @@ namespace rsurfaces
 
     void SurfaceFlow::AssembleGradients(Eigen::MatrixXd &dest)
     {
-        AddGradientsToMatrix(energies, dest);
+        assembledEnergy = AddGradientsToMatrix(energies, dest);
     }
 
     std::unique_ptr<Hs::HsMetric> SurfaceFlow::GetHsMetric()
     {
-        std::unique_ptr<Hs::HsMetric> hs(new Hs::HsMetric(energies, obstacleEnergy, simpleConstraints, schurConstraints));
+        std::unique_ptr<Hs::HsMetric> hs(new Hs::HsMetric(energies, obstacleEnergies, simpleConstraints, schurConstraints));
         hs->disableNearField = disableNearField;
         return hs;
     }
@@ -209,7 +211,7 @@ namespace rsurfaces
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
 
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
         geom->refreshQuantities();
 
@@ -306,7 +308,7 @@ namespace rsurfaces
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
 
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         if (schurConstraints.size() > 0)
@@ -381,7 +383,7 @@ namespace rsurfaces
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
 
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Constraint projection
@@ -506,7 +508,7 @@ namespace rsurfaces
         double initGuess = guessStepSize(gProjNorm);
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Do corrective constraint projection by reusing the H1 metric
@@ -521,18 +523,7 @@ namespace rsurfaces
 
     void savePositions(MeshPtr &mesh, GeomPtr &geom, Eigen::MatrixXd &positions)
     {
-        positions.setZero(mesh->nVertices(), 3);
-
-        VertexIndices inds = mesh->getVertexIndices();
-
-        for (GCVertex v : mesh->vertices())
-        {
-            Vector3 pos = geom->inputVertexPositions[v];
-            size_t i = inds[v];
-            positions(i, 0) = pos.x;
-            positions(i, 1) = pos.y;
-            positions(i, 2) = pos.z;
-        }
+        positions = mapVertexPositions(mesh, geom);
     }
 
     void SurfaceFlow::StepAQP(double invKappa)
@@ -548,12 +539,7 @@ namespace rsurfaces
         {
             double theta = (1 - sqrt(invKappa)) / (1 + sqrt(invKappa));
             // 1. Nesterov step
-            Eigen::MatrixXd y_n = (1 + theta) * prevPositions1 - theta * prevPositions2;
-            for (GCVertex v : mesh->vertices())
-            {
-                Vector3 pos = MatrixUtils::GetRowAsVector3(y_n, v.getIndex());
-                geom->inputVertexPositions[v] = pos;
-            }
+            mapVertexPositions(mesh, geom).noalias() = (1 + theta) * prevPositions1 - theta * prevPositions2;
             geom->refreshQuantities();
         }
         stepCount++;
@@ -604,7 +590,7 @@ namespace rsurfaces
         double initGuess = guessStepSize(gProjNorm);
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
         // Take the step using line search
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Make sure pins don't drift
@@ -666,7 +652,7 @@ namespace rsurfaces
         double gradDot = (l2diffvec.dot(lbfgs->direction())) / (gNorm * gProjNorm);
         std::cout << "  * Dot product = " << gradDot << std::endl;
 
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         // Take the step using line search
         double initGuess = guessStepSize(gProjNorm);
         double delta = search.BacktrackingLineSearch(projected, initGuess, fmax(0, gradDot));
@@ -736,7 +722,7 @@ namespace rsurfaces
         double gradDot = (l2diffvec.dot(lbfgs->direction())) / (gNorm * gProjNorm);
         std::cout << "  * Dot product = " << gradDot << std::endl;
 
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         // Take the step using line search
         double initGuess = guessStepSize(gProjNorm);
         double delta = search.BacktrackingLineSearch(projected, initGuess, fmax(0, gradDot));
@@ -804,7 +790,7 @@ namespace rsurfaces
         double gradDot = (l2diff.transpose() * gradientProj).trace() / (gNorm * gProjNorm);
         double initGuess = guessStepSize(gProjNorm);
         std::cout << "  * Initial step size guess = " << initGuess << std::endl;
-        LineSearch search(mesh, geom, energies, maxStepSize);
+        LineSearch search(mesh, geom, energies, maxStepSize, assembledEnergy, &geometryCache);
         double delta = search.BacktrackingLineSearch(gradientProj, initGuess, gradDot);
 
         // Do corrective constraint projection by reusing the metric
@@ -818,6 +804,94 @@ namespace rsurfaces
     }
 
 
+    enum class LBFGSKind : uint8_t
+    {
+        None,
+        H1,
+        BQN
+    };
+
+    void SurfaceFlow::SaveState(std::ostream &out)
+    {
+        checkpoint::writeValue<uint32_t>(out, stepCount);
+        checkpoint::writeValue<Vector3>(out, origBarycenter);
+        checkpoint::writeValue<double>(out, bqn_B);
+        checkpoint::writeValue<double>(out, prevStep);
+        checkpoint::writeValue<uint8_t>(out, verticesMutated);
+        checkpoint::writeMatrix(out, prevPositions1);
+        checkpoint::writeMatrix(out, prevPositions2);
+
+        checkpoint::writeValue<uint64_t>(out, schurConstraints.size());
+        for (ConstraintPack &c : schurConstraints)
+        {
+            checkpoint::writeValue<double>(out, c.constraint->getTargetValue());
+            checkpoint::writeValue<double>(out, c.stepSize);
+            checkpoint::writeValue<int64_t>(out, c.iterationsLeft);
+        }
+
+        LBFGSKind kind = LBFGSKind::None;
+        if (dynamic_cast<BQN_LBFGS *>(lbfgs))
+        {
+            kind = LBFGSKind::BQN;
+        }
+        else if (lbfgs)
+        {
+            kind = LBFGSKind::H1;
+        }
+        checkpoint::writeValue<LBFGSKind>(out, kind);
+        if (lbfgs)
+        {
+            lbfgs->SaveState(out);
+        }
+    }
+
+    void SurfaceFlow::LoadState(std::istream &in)
+    {
+        stepCount = checkpoint::readValue<uint32_t>(in);
+        origBarycenter = checkpoint::readValue<Vector3>(in);
+        bqn_B = checkpoint::readValue<double>(in);
+        prevStep = checkpoint::readValue<double>(in);
+        verticesMutated = checkpoint::readValue<uint8_t>(in);
+        checkpoint::readMatrix(in, prevPositions1);
+        checkpoint::readMatrix(in, prevPositions2);
+
+        uint64_t nSchur = checkpoint::readValue<uint64_t>(in);
+        if (nSchur != schurConstraints.size())
+        {
+            throw std::runtime_error("Checkpoint has " + std::to_string(nSchur) + " Schur constraints, but the flow has " +
+                                     std::to_string(schurConstraints.size()) + ".");
+        }
+        for (ConstraintPack &c : schurConstraints)
+        {
+            double target = checkpoint::readValue<double>(in);
+            c.constraint->incrementTargetValue(target - c.constraint->getTargetValue());
+            c.stepSize = checkpoint::readValue<double>(in);
+            c.iterationsLeft = checkpoint::readValue<int64_t>(in);
+        }
+
+        LBFGSKind kind = checkpoint::readValue<LBFGSKind>(in);
+        if (lbfgs)
+        {
+            delete lbfgs;
+            lbfgs = 0;
+        }
+        if (kind == LBFGSKind::BQN)
+        {
+            // B gets overwritten by the saved value
+            lbfgs = new BQN_LBFGS(20, simpleConstraints, 1);
+        }
+        else if (kind == LBFGSKind::H1)
+        {
+            lbfgs = new H1_LBFGS(20, simpleConstraints);
+        }
+        if (lbfgs)
+        {
+            lbfgs->LoadState(in);
+        }
+
+        std::cout << "Restored flow state at iteration " << stepCount << std::endl;
+    }
+
     void SurfaceFlow::RecenterMesh()
     {
         Vector3 center = meshBarycenter(geom, mesh);
@@ -844,6 +918,58 @@ namespace rsurfaces
         }
     }
 
+    void SurfaceFlow::NotifyRemeshed(const std::vector<mint> &faceOrigins)
+    {
+        for (SurfaceEnergy *energy : energies)
+        {
+            energy->NotifyRemeshed(faceOrigins);
+        }
+    }
+
+    bool SurfaceFlow::TransferVertexData(const remeshing::VertexTransfer &transfer)
+    {
+        bool ok = true;
+
+        if (prevPositions1.rows() > 0)
+        {
+            if (prevPositions1.rows() == transfer.OldCount() && prevPositions2.rows() == transfer.OldCount())
+            {
+                // Only the momentum is interpolated; the remesher has moved the vertices since
+                Eigen::MatrixXd momentum = prevPositions1 - prevPositions2;
+                transfer.Apply(momentum);
+                savePositions(mesh, geom, prevPositions1);
+                prevPositions2 = prevPositions1 - momentum;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+
+        if (lbfgs)
+        {
+            ok = lbfgs->TransferHistory(transfer) && ok;
+        }
+
+        return ok;
+    }
+
+    void SurfaceFlow::ResetRegion(const DragRegion &region)
+    {
+        for (ConstraintPack &p : schurConstraints)
+        {
+            p.constraint->ResetRegion(mesh, geom, region);
+        }
+        for (Constraints::SimpleProjectorConstraint *c : simpleConstraints)
+        {
+            c->ResetRegion(mesh, geom, region);
+        }
+        for (SurfaceEnergy *energy : energies)
+        {
+            energy->ResetTargetsInRegion(region);
+        }
+    }
+
     SurfaceEnergy *SurfaceFlow::BaseEnergy()
     {
         return energies[0];
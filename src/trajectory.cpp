@@ -0,0 +1,411 @@
+#include "trajectory.h"
+#include "frame_writer.h"
+#include "scene_file.h"
+#include "profiler.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+
+#ifdef RSURFACES_USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace rsurfaces
+{
+    inline void putVarint(std::string &buffer, int64_t value)
+    {
+        // Zigzag, so that small negative deltas also get short codes
+        uint64_t u = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+        while (u >= 0x80)
+        {
+            buffer.push_back(char((u & 0x7f) | 0x80));
+            u >>= 7;
+        }
+        buffer.push_back(char(u));
+    }
+
+    inline int64_t getVarint(const std::string &buffer, size_t &pos)
+    {
+        uint64_t u = 0;
+        int shift = 0;
+        while (true)
+        {
+            if (pos >= buffer.size() || shift > 63)
+            {
+                throw std::runtime_error("Corrupt varint in trajectory record.");
+            }
+            uint8_t byte = uint8_t(buffer[pos++]);
+            u |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                break;
+            }
+            shift += 7;
+        }
+        return int64_t(u >> 1) ^ -int64_t(u & 1);
+    }
+
+    bool isTrajectoryFile(std::string const &filename)
+    {
+        return endsWith(filename, ".rst");
+    }
+
+    TrajectoryWriter::TrajectoryWriter(std::string filename_, double quantum_, bool compress_, long keepFrames)
+    {
+        filename = filename_;
+        quantum = quantum_;
+        compress = compress_ && frameCompressionAvailable();
+        nFrames = 0;
+        epochFaces = 0;
+
+        if (quantum <= 0)
+        {
+            throw std::runtime_error("Trajectory quantization step must be positive.");
+        }
+
+        if (keepFrames >= 0 && truncateForResume(keepFrames))
+        {
+            out.open(filename, std::ios::binary | std::ios::app);
+            if (!out)
+            {
+                throw std::runtime_error("Could not open " + filename + " for appending.");
+            }
+            return;
+        }
+
+        out.open(filename, std::ios::binary);
+        if (!out)
+        {
+            throw std::runtime_error("Could not open " + filename + " for writing.");
+        }
+
+        TrajectoryHeader header;
+        std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+        header.version = TRAJECTORY_VERSION;
+        header.compressed = compress ? 1 : 0;
+        header.quantum = quantum;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(TrajectoryHeader));
+    }
+
+    bool TrajectoryWriter::truncateForResume(long keepFrames)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+
+        TrajectoryHeader header;
+        in.read(reinterpret_cast<char *>(&header), sizeof(TrajectoryHeader));
+        if (!in || std::memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0)
+        {
+            return false;
+        }
+        if (header.version != TRAJECTORY_VERSION || header.quantum != quantum || (header.compressed != 0) != compress)
+        {
+            throw std::runtime_error("Cannot continue trajectory " + filename + ", it was written with different settings.");
+        }
+
+        // Records are skipped without decoding; the new frames start with a
+        // connectivity record of their own
+        in.seekg(0, std::ios::end);
+        uint64_t size = in.tellg();
+        uint64_t end = sizeof(TrajectoryHeader);
+        long frames = 0;
+        while (frames < keepFrames && end + sizeof(TrajectoryRecordHeader) <= size)
+        {
+            TrajectoryRecordHeader record;
+            in.seekg(end);
+            in.read(reinterpret_cast<char *>(&record), sizeof(TrajectoryRecordHeader));
+            uint64_t recordEnd = end + sizeof(TrajectoryRecordHeader) + record.storedSize;
+            if (!in || recordEnd > size)
+            {
+                // Cut off by a killed run
+                break;
+            }
+            end = recordEnd;
+            if (record.type != uint32_t(TrajectoryRecord::Connectivity))
+            {
+                frames++;
+            }
+        }
+        in.close();
+
+        if (::truncate(filename.c_str(), end) != 0)
+        {
+            throw std::runtime_error("Could not truncate trajectory " + filename + " for resuming.");
+        }
+        nFrames = frames;
+        std::cout << "Continuing trajectory " << filename << " after " << frames << " frames" << std::endl;
+        return true;
+    }
+
+    void TrajectoryWriter::writeRecord(TrajectoryRecord type, const std::string &payload)
+    {
+        TrajectoryRecordHeader record;
+        record.type = uint32_t(type);
+        record.reserved = 0;
+        record.rawSize = payload.size();
+
+        if (compress)
+        {
+#ifdef RSURFACES_USE_ZLIB
+            uLongf storedSize = compressBound(payload.size());
+            std::string stored(storedSize, '\0');
+            int result = compress2(reinterpret_cast<Bytef *>(&stored[0]), &storedSize,
+                                   reinterpret_cast<const Bytef *>(payload.data()), payload.size(), 1);
+            if (result != Z_OK)
+            {
+                throw std::runtime_error("Could not compress record for trajectory " + filename + ".");
+            }
+            record.storedSize = storedSize;
+            out.write(reinterpret_cast<const char *>(&record), sizeof(TrajectoryRecordHeader));
+            out.write(stored.data(), storedSize);
+#endif
+        }
+        else
+        {
+            record.storedSize = payload.size();
+            out.write(reinterpret_cast<const char *>(&record), sizeof(TrajectoryRecordHeader));
+            out.write(payload.data(), payload.size());
+        }
+    }
+
+    void TrajectoryWriter::WriteFrame(const double *positions, size_t nVertices, const std::shared_ptr<const std::vector<uint32_t>> &faces)
+    {
+        ptic("TrajectoryWriter::WriteFrame");
+
+        bool newEpoch = (faces != epochFaces) || (lastQuantized.size() != 3 * nVertices);
+        try
+        {
+            if (newEpoch)
+            {
+                std::string payload;
+                uint64_t nV = nVertices;
+                uint64_t nF = faces->size() / 3;
+                payload.append(reinterpret_cast<const char *>(&nV), sizeof(uint64_t));
+                payload.append(reinterpret_cast<const char *>(&nF), sizeof(uint64_t));
+                payload.append(reinterpret_cast<const char *>(faces->data()), sizeof(uint32_t) * faces->size());
+                writeRecord(TrajectoryRecord::Connectivity, payload);
+
+                epochFaces = faces;
+                lastQuantized.assign(3 * nVertices, 0);
+            }
+
+            // Deltas are taken against the previous quantized frame, not the previous
+            // exact one, so rounding errors do not accumulate over the epoch
+            std::string payload;
+            payload.reserve(2 * 3 * nVertices);
+            for (size_t i = 0; i < 3 * nVertices; i++)
+            {
+                int64_t q = std::llround(positions[i] / quantum);
+                putVarint(payload, q - lastQuantized[i]);
+                lastQuantized[i] = q;
+            }
+            writeRecord(newEpoch ? TrajectoryRecord::Keyframe : TrajectoryRecord::Delta, payload);
+        }
+        catch (std::runtime_error &e)
+        {
+            // The frame is dropped; lastQuantized may already hold it, so the next
+            // frame starts a new epoch instead of a delta against it
+            epochFaces.reset();
+            ptoc("TrajectoryWriter::WriteFrame");
+            throw;
+        }
+
+        // Keep the file readable up to the last frame if the run gets killed
+        out.flush();
+        nFrames++;
+
+        ptoc("TrajectoryWriter::WriteFrame");
+    }
+
+    TrajectoryReader::TrajectoryReader(std::string filename_)
+    {
+        filename = filename_;
+        nFrames = 0;
+        epochStarted = false;
+        keyframePending = false;
+
+        in.open(filename, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open trajectory " + filename + ".");
+        }
+
+        TrajectoryHeader header;
+        in.read(reinterpret_cast<char *>(&header), sizeof(TrajectoryHeader));
+        if (!in || std::memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0)
+        {
+            throw std::runtime_error(filename + " is not a trajectory file.");
+        }
+        if (header.version != TRAJECTORY_VERSION)
+        {
+            throw std::runtime_error("Unsupported trajectory version " + std::to_string(header.version) + " in " + filename + ".");
+        }
+        quantum = header.quantum;
+        compressed = (header.compressed != 0);
+
+        if (compressed && !frameCompressionAvailable())
+        {
+            throw std::runtime_error("Trajectory " + filename + " is compressed, but this build has no zlib support.");
+        }
+    }
+
+    bool TrajectoryReader::readRecord(TrajectoryRecord &type, std::string &payload)
+    {
+        TrajectoryRecordHeader record;
+        in.read(reinterpret_cast<char *>(&record), sizeof(TrajectoryRecordHeader));
+        if (!in)
+        {
+            return false;
+        }
+
+        std::string stored(record.storedSize, '\0');
+        in.read(&stored[0], record.storedSize);
+        if (!in)
+        {
+            std::cout << "Trajectory " << filename << " ends in an incomplete record; stopping after " << nFrames << " frames." << std::endl;
+            return false;
+        }
+
+        if (record.type > uint32_t(TrajectoryRecord::Delta))
+        {
+            throw std::runtime_error("Unknown record type " + std::to_string(record.type) + " in trajectory " + filename + ".");
+        }
+        type = TrajectoryRecord(record.type);
+        if (compressed)
+        {
+#ifdef RSURFACES_USE_ZLIB
+            payload.assign(record.rawSize, '\0');
+            uLongf rawSize = record.rawSize;
+            int result = uncompress(reinterpret_cast<Bytef *>(&payload[0]), &rawSize,
+                                    reinterpret_cast<const Bytef *>(stored.data()), stored.size());
+            if (result != Z_OK || rawSize != record.rawSize)
+            {
+                throw std::runtime_error("Could not decompress record in trajectory " + filename + ".");
+            }
+#endif
+        }
+        else
+        {
+            payload = std::move(stored);
+        }
+        return true;
+    }
+
+    bool TrajectoryReader::NextFrame(std::vector<double> &positions, std::vector<uint32_t> &faces)
+    {
+        TrajectoryRecord type;
+        std::string payload;
+
+        while (true)
+        {
+            if (!readRecord(type, payload))
+            {
+                return false;
+            }
+            if (type != TrajectoryRecord::Connectivity)
+            {
+                break;
+            }
+
+            uint64_t nV, nF;
+            if (payload.size() < 2 * sizeof(uint64_t))
+            {
+                throw std::runtime_error("Truncated connectivity record in trajectory " + filename + ".");
+            }
+            std::memcpy(&nV, payload.data(), sizeof(uint64_t));
+            std::memcpy(&nF, payload.data() + sizeof(uint64_t), sizeof(uint64_t));
+            // Divide instead of multiplying, so a corrupt face count cannot overflow the check
+            if ((payload.size() - 2 * sizeof(uint64_t)) / (sizeof(uint32_t) * 3) != nF ||
+                (payload.size() - 2 * sizeof(uint64_t)) % (sizeof(uint32_t) * 3) != 0)
+            {
+                throw std::runtime_error("Connectivity record in trajectory " + filename + " does not match its face count.");
+            }
+            epochFaces.resize(3 * nF);
+            std::memcpy(epochFaces.data(), payload.data() + 2 * sizeof(uint64_t), sizeof(uint32_t) * 3 * nF);
+            for (uint32_t v : epochFaces)
+            {
+                if (v >= nV)
+                {
+                    throw std::runtime_error("Face index out of range in trajectory " + filename + ".");
+                }
+            }
+            lastQuantized.assign(3 * nV, 0);
+            epochStarted = true;
+            keyframePending = true;
+        }
+
+        if (!epochStarted)
+        {
+            throw std::runtime_error("Trajectory " + filename + " does not start with a connectivity record.");
+        }
+
+        if (type == TrajectoryRecord::Delta && keyframePending)
+        {
+            throw std::runtime_error("Epoch in trajectory " + filename + " does not start with a keyframe.");
+        }
+        keyframePending = false;
+
+        // Keyframes are coded as deltas against zero, so both decode the same way
+        size_t pos = 0;
+        positions.resize(lastQuantized.size());
+        for (size_t i = 0; i < lastQuantized.size(); i++)
+        {
+            lastQuantized[i] += getVarint(payload, pos);
+            positions[i] = lastQuantized[i] * quantum;
+        }
+        faces = epochFaces;
+
+        nFrames++;
+        return true;
+    }
+
+    void extractTrajectory(std::string input, std::string outputDir)
+    {
+        TrajectoryReader reader(input);
+        std::vector<double> positions;
+        std::vector<uint32_t> faces;
+
+        std::string sep = "";
+        if (outputDir.size() > 0 && outputDir[outputDir.size() - 1] != '/')
+        {
+            sep = "/";
+        }
+
+        while (true)
+        {
+            size_t i = reader.FrameIndex();
+            if (!reader.NextFrame(positions, faces))
+            {
+                break;
+            }
+
+            char buffer[16];
+            std::snprintf(buffer, sizeof(buffer), "%04zu", i);
+            std::string fname = outputDir + sep + "frame" + std::string(buffer) + ".obj";
+
+            std::ofstream outfile(fname);
+            if (!outfile)
+            {
+                throw std::runtime_error("Could not open " + fname + " for writing.");
+            }
+            for (size_t v = 0; v < positions.size(); v += 3)
+            {
+                outfile << "v " << positions[v] << " " << positions[v + 1] << " " << positions[v + 2] << "\n";
+            }
+            for (size_t f = 0; f < faces.size(); f += 3)
+            {
+                // OBJ is 1-indexed
+                outfile << "f " << (faces[f] + 1) << " " << (faces[f + 1] + 1) << " " << (faces[f + 2] + 1) << "\n";
+            }
+            outfile.close();
+        }
+
+        std::cout << "Extracted " << reader.FrameIndex() << " frames from " << input << " to " << outputDir << std::endl;
+    }
+} // namespace rsurfaces